@@ -160,7 +160,7 @@ int main() {
 				continue;
 			} else {
 				// Start P2P connection
-				int peer_sock = connect_to_server(peer_ip, selected_peer_port);
+				int peer_sock = connect_to_peer(peer_ip, selected_peer_port);
 				if (peer_sock < 0) {
 					safe_print("Could not connect to peer. The peer may no longer be connected.\n");
 					// Inform the server that the peer is no longer connected
@@ -313,7 +313,7 @@ int main() {
 				peer_port_input = atoi(buffer);
 
 				// Attempt to connect
-				int peer_sock = connect_to_server(peer_ip_input, peer_port_input);
+				int peer_sock = connect_to_peer(peer_ip_input, peer_port_input);
 				if (peer_sock < 0) {
 					safe_print("Could not connect to peer at %s:%d. Waiting for incoming connections...\n", peer_ip_input, peer_port_input);
 					// Continue to wait for incoming connections
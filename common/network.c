@@ -8,6 +8,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 // Function to create a socket
@@ -21,29 +25,7 @@ int create_socket() {
 
 // Function to connect to the routing server
 int connect_to_server(const char *ip, int port) {
-	int sock = create_socket();
-	if (sock < 0) return -1;
-
-	struct sockaddr_in server_addr;
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(port);
-
-	// Convert IP address from string to binary form
-	if (inet_pton(AF_INET, ip, &server_addr.sin_addr) <= 0) {
-		perror("inet_pton");
-		close(sock);
-		return -1;
-	}
-
-	// Connect to the server
-	if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-		perror("connect");
-		close(sock);
-		return -1;
-	}
-
-	return sock;
+	return connect_with_timeout(ip, port, CONNECT_TIMEOUT_MS);
 }
 
 // Function to bind and listen on a given port
@@ -82,27 +64,157 @@ int bind_and_listen(int port) {
 
 // Function to connect to a peer
 int connect_to_peer(const char *ip, int port) {
+	return connect_with_timeout(ip, port, CONNECT_TIMEOUT_MS);
+}
+
+// Milliseconds left until the given CLOCK_MONOTONIC deadline
+static int remaining_ms(const struct timespec *deadline) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+	return ms > 0 ? (int)ms : 0;
+}
+
+// Start a non-blocking connect, returns the socket or -1 if it failed straight away
+static int start_connect(const char *ip, int port) {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+
+	// Convert IP address from string to binary form
+	if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0) {
+		fprintf(stderr, "inet_pton: invalid address '%s'\n", ip);
+		errno = EINVAL;
+		return -1;
+	}
+
 	int sock = create_socket();
 	if (sock < 0) return -1;
 
-	struct sockaddr_in peer_addr;
-	memset(&peer_addr, 0, sizeof(peer_addr));
-	peer_addr.sin_family = AF_INET;
-	peer_addr.sin_port = htons(port);
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		close(sock);
+		return -1;
+	}
 
-	// Convert IP address from string to binary form
-	if (inet_pton(AF_INET, ip, &peer_addr.sin_addr) <= 0) {
-		perror("inet_pton");
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		int err = errno;
+		fprintf(stderr, "connect %s:%d: %s\n", ip, port, strerror(err));
 		close(sock);
+		errno = err;
 		return -1;
 	}
 
-	// Connect to the peer
-	if (connect(sock, (struct sockaddr *)&peer_addr, sizeof(peer_addr)) < 0) {
-		perror("connect");
+	return sock;
+}
+
+// Connect to one of several candidates, racing all attempts and keeping the first to complete.
+// Attempts that fail are dropped as soon as the failure is known, and -1 is returned as soon as
+// every candidate has failed or timeout_ms has passed (errno is ETIMEDOUT in the latter case).
+int connect_first(const Peer *candidates, int count, int timeout_ms, int *winner) {
+	struct pollfd fds[count > 0 ? count : 1];
+	int index[count > 0 ? count : 1];
+	int pending = 0;
+	int last_err = ECONNREFUSED;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int sock = start_connect(candidates[i].ip, candidates[i].port);
+		if (sock < 0) {
+			last_err = errno;
+			continue;
+		}
+		fds[pending].fd = sock;
+		fds[pending].events = POLLOUT;
+		index[pending] = i;
+		pending++;
+	}
+
+	int sock = -1;
+	while (pending > 0 && sock < 0) {
+		int ready = poll(fds, pending, remaining_ms(&deadline));
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			last_err = errno;
+			break;
+		}
+		if (ready == 0) {
+			last_err = ETIMEDOUT;
+			break;
+		}
+
+		for (int i = 0; i < pending; i++) {
+			if (fds[i].revents == 0) continue;
+
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+				err = errno;
+			}
+
+			if (err == 0 && sock < 0) {
+				// First completed attempt wins
+				sock = fds[i].fd;
+				if (winner != NULL) *winner = index[i];
+			} else {
+				if (err != 0) {
+					last_err = err;
+					fprintf(stderr, "connect %s:%d: %s\n", candidates[index[i]].ip,
+							candidates[index[i]].port, strerror(err));
+				}
+				close(fds[i].fd);
+			}
+
+			// Remove this attempt from the pending set
+			pending--;
+			fds[i] = fds[pending];
+			index[i] = index[pending];
+			i--;
+		}
+	}
+
+	// Abandon the attempts that lost the race
+	for (int i = 0; i < pending; i++) {
+		close(fds[i].fd);
+	}
+
+	if (sock < 0) {
+		errno = last_err;
+		return -1;
+	}
+
+	// Hand back an ordinary blocking socket
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+		perror("fcntl");
 		close(sock);
 		return -1;
 	}
 
 	return sock;
 }
+
+// Connect to a single address, giving up after timeout_ms
+int connect_with_timeout(const char *ip, int port, int timeout_ms) {
+	Peer candidate;
+	memset(&candidate, 0, sizeof(candidate));
+	strncpy(candidate.ip, ip, sizeof(candidate.ip) - 1);
+	candidate.port = port;
+
+	int sock = connect_first(&candidate, 1, timeout_ms, NULL);
+	if (sock < 0 && errno == ETIMEDOUT) {
+		fprintf(stderr, "connect %s:%d: timed out after %d ms\n", ip, port, timeout_ms);
+	}
+	return sock;
+}
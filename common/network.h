@@ -20,4 +20,8 @@ int connect_to_server(const char *ip, int port);
 int bind_and_listen(int port);
 int connect_to_peer(const char *ip, int port);
 
+// Non-blocking connects bounded by a deadline
+int connect_with_timeout(const char *ip, int port, int timeout_ms);
+int connect_first(const Peer *candidates, int count, int timeout_ms, int *winner);
+
 #endif // NETWORK_H
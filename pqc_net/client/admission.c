@@ -0,0 +1,525 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "admission.h"
+#include "utils.h"
+#include "puzzle.h"
+#include "network.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+enum { STAGE_READ, STAGE_DECIDE, STAGE_ACCEPT, STAGE_DENY };
+enum { OUTCOME_ACCEPTED, OUTCOME_DENIED, OUTCOME_FAILED, OUTCOME_PUZZLED };
+
+typedef struct {
+	int sock;
+	int stage;
+	int puzzle_bits;            // difficulty asked of the dialer, from the queue depth it found
+	handshake_request_t request;
+	struct timespec queued;     // when it entered its current queue
+	double waited_us;           // total queue time so far
+	double crypto_us;
+} incoming_t;
+
+// Fixed size FIFO of connections. At most ADMISSION_QUEUE_SIZE are live at once, so neither queue
+// can overflow and nothing has to wait for room.
+typedef struct {
+	incoming_t *items[ADMISSION_QUEUE_SIZE];
+	size_t head, count;
+} fifo_t;
+
+static struct {
+	int running;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;   // signalled for the workers
+	pthread_cond_t decide_ready; // signalled for the admission thread
+	fifo_t work;                 // STAGE_READ, STAGE_ACCEPT and STAGE_DENY
+	fifo_t decide;               // STAGE_DECIDE
+	incoming_t *waiting[ADMISSION_QUEUE_SIZE]; // STAGE_READ until the dialer sends something
+	size_t waiting_count;
+	int wake[2];                 // pipe that tells the reader thread a connection is waiting
+	size_t live;
+
+	pthread_t workers[ADMISSION_MAX_WORKERS];
+	int worker_count;
+	pthread_t admission_thread;
+	pthread_t reader_thread;
+	admission_policy_t policy;
+	const char *username;
+	void *(*session)(void *chat);
+
+	int read_timeout;            // seconds, from the environment at start
+	unsigned long admitted, dropped, accepted, denied, failed, timed_out, puzzled, reads, decided, keyed;
+	double read_wait_us, decide_wait_us, accept_wait_us, max_wait_us, crypto_us;
+} queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_ready = PTHREAD_COND_INITIALIZER,
+	.decide_ready = PTHREAD_COND_INITIALIZER,
+	.wake = { -1, -1 },
+};
+
+static double since_us(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void fifo_push(fifo_t *fifo, incoming_t *item) {
+	fifo->items[(fifo->head + fifo->count) % ADMISSION_QUEUE_SIZE] = item;
+	fifo->count++;
+}
+
+static incoming_t *fifo_pop(fifo_t *fifo) {
+	incoming_t *item = fifo->items[fifo->head];
+	fifo->head = (fifo->head + 1) % ADMISSION_QUEUE_SIZE;
+	fifo->count--;
+	return item;
+}
+
+// Caller holds the lock. Records how long item sat in the queue it is leaving.
+static double take_wait(incoming_t *item, double *total) {
+	double us = since_us(&item->queued);
+	item->waited_us += us;
+	*total += us;
+	return us;
+}
+
+// Caller holds the lock
+static void requeue(incoming_t *item, int stage) {
+	item->stage = stage;
+	clock_gettime(CLOCK_MONOTONIC, &item->queued);
+	if (stage == STAGE_DECIDE) {
+		fifo_push(&queue.decide, item);
+		pthread_cond_signal(&queue.decide_ready);
+	} else {
+		fifo_push(&queue.work, item);
+		pthread_cond_signal(&queue.work_ready);
+	}
+}
+
+// The connection leaves the pipeline, either to a chat session or closed
+static void finish(incoming_t *item, int outcome) {
+	handshake_request_free(&item->request);
+	pthread_mutex_lock(&queue.lock);
+	queue.live--;
+	if (outcome == OUTCOME_ACCEPTED) {
+		queue.accepted++;
+	} else if (outcome == OUTCOME_DENIED) {
+		queue.denied++;
+	} else if (outcome == OUTCOME_PUZZLED) {
+		queue.puzzled++;
+	} else {
+		queue.failed++;
+	}
+	queue.crypto_us += item->crypto_us;
+	if (item->waited_us > queue.max_wait_us) queue.max_wait_us = item->waited_us;
+	pthread_mutex_unlock(&queue.lock);
+	free(item);
+}
+
+// Bound every read on sock, 0 lifts the bound
+static int set_read_timeout(int sock, int seconds) {
+	struct timeval timeout = { .tv_sec = seconds, .tv_usec = 0 };
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		perror("setsockopt SO_RCVTIMEO");
+		return -1;
+	}
+	return 0;
+}
+
+// Read the request, for an early request that includes decapsulating its secret
+static void worker_read(incoming_t *item) {
+	// The dialer has started sending, but may stall halfway and hold this worker
+	if (set_read_timeout(item->sock, queue.read_timeout) != 0) {
+		close(item->sock);
+		finish(item, OUTCOME_FAILED);
+		return;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int rc = handshake_read_request(item->sock, item->puzzle_bits, &item->request);
+	int timed_out = rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	item->crypto_us += since_us(&start);
+
+	if (rc != 0) {
+		// Counted in the stats rather than printed, under a flood it would be one line per connection
+		close(item->sock);
+		if (timed_out) {
+			pthread_mutex_lock(&queue.lock);
+			queue.timed_out++;
+			pthread_mutex_unlock(&queue.lock);
+		}
+		finish(item, rc == HANDSHAKE_PUZZLED ? OUTCOME_PUZZLED : OUTCOME_FAILED);
+		return;
+	}
+	pthread_mutex_lock(&queue.lock);
+	requeue(item, STAGE_DECIDE);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+static void worker_accept(incoming_t *item) {
+	struct chat_info *chat = malloc(sizeof(struct chat_info));
+	if (chat == NULL) {
+		perror("malloc");
+		close(item->sock);
+		finish(item, OUTCOME_FAILED);
+		return;
+	}
+	chat->sock = item->sock;
+	strcpy(chat->peer_username, item->request.username);
+	snprintf(chat->your_username, sizeof(chat->your_username), "%s", queue.username);
+
+	// Answer with the session's cipher and KEM, the encapsulation and the first encrypted record
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int rc = handshake_accept(item->sock, &item->request, chat);
+	item->crypto_us += since_us(&start);
+
+	pthread_t thread;
+	if (rc != 0) {
+		safe_print("Handshake with '%s' failed.\n", item->request.username);
+	} else if (set_read_timeout(item->sock, 0) != 0) {
+		// The session waits on the peer for as long as it likes
+		pqcrypto_context_free(&chat->enc_ctx);
+	} else if (pthread_create(&thread, NULL, queue.session, chat) != 0) {
+		perror("pthread_create");
+		pqcrypto_context_free(&chat->enc_ctx);
+	} else {
+		pthread_detach(thread);
+		finish(item, OUTCOME_ACCEPTED);
+		return;
+	}
+	close(item->sock);
+	free(chat);
+	finish(item, OUTCOME_FAILED);
+}
+
+static void *worker_thread(void *arg) {
+	(void)arg;
+
+	pthread_mutex_lock(&queue.lock);
+	while (1) {
+		while (queue.running && queue.work.count == 0) {
+			pthread_cond_wait(&queue.work_ready, &queue.lock);
+		}
+		if (!queue.running) break;
+
+		incoming_t *item = fifo_pop(&queue.work);
+		if (item->stage == STAGE_READ) {
+			take_wait(item, &queue.read_wait_us);
+			queue.reads++;
+			item->puzzle_bits = puzzle_bits(queue.live);
+		} else {
+			take_wait(item, &queue.accept_wait_us);
+			queue.keyed++;
+		}
+		pthread_mutex_unlock(&queue.lock);
+
+		if (item->stage == STAGE_READ) {
+			worker_read(item);
+		} else if (item->stage == STAGE_ACCEPT) {
+			worker_accept(item);
+		} else {
+			handshake_deny(item->sock);
+			close(item->sock);
+			finish(item, OUTCOME_DENIED);
+		}
+		pthread_mutex_lock(&queue.lock);
+	}
+	pthread_mutex_unlock(&queue.lock);
+	return NULL;
+}
+
+// Connections wait here for the dialer's first bytes, so one that sends nothing holds a queue slot
+// until its deadline but never a worker
+static void *reader_thread(void *arg) {
+	(void)arg;
+	struct pollfd fds[ADMISSION_QUEUE_SIZE + 1];
+	incoming_t *polled[ADMISSION_QUEUE_SIZE];
+
+	while (1) {
+		incoming_t *expired[ADMISSION_QUEUE_SIZE];
+		int expired_count = 0, count = 0, timeout_ms = -1;
+
+		pthread_mutex_lock(&queue.lock);
+		if (!queue.running) {
+			pthread_mutex_unlock(&queue.lock);
+			break;
+		}
+		for (size_t i = 0; i < queue.waiting_count;) {
+			incoming_t *item = queue.waiting[i];
+			int left_ms = queue.read_timeout * 1000 - (int)(since_us(&item->queued) / 1000);
+			if (left_ms <= 0) {
+				expired[expired_count++] = item;
+				queue.waiting[i] = queue.waiting[--queue.waiting_count];
+				queue.timed_out++;
+				continue;
+			}
+			if (timeout_ms < 0 || left_ms < timeout_ms) timeout_ms = left_ms;
+			polled[count] = item;
+			fds[count + 1] = (struct pollfd){ .fd = item->sock, .events = POLLIN };
+			count++;
+			i++;
+		}
+		pthread_mutex_unlock(&queue.lock);
+
+		for (int i = 0; i < expired_count; i++) {
+			close(expired[i]->sock);
+			finish(expired[i], OUTCOME_FAILED);
+		}
+
+		fds[0] = (struct pollfd){ .fd = queue.wake[0], .events = POLLIN };
+		if (poll(fds, count + 1, timeout_ms) < 0) {
+			if (errno != EINTR) perror("poll");
+			continue;
+		}
+		if (fds[0].revents & POLLIN) {
+			char drain[64];
+			if (read(queue.wake[0], drain, sizeof(drain)) < 0) perror("read");
+		}
+
+		// Only this thread takes connections out of waiting, so polled is still accurate
+		pthread_mutex_lock(&queue.lock);
+		for (int i = 0; i < count; i++) {
+			if (fds[i + 1].revents == 0) continue;
+			for (size_t j = 0; j < queue.waiting_count; j++) {
+				if (queue.waiting[j] == polled[i]) {
+					queue.waiting[j] = queue.waiting[--queue.waiting_count];
+					break;
+				}
+			}
+			requeue(polled[i], STAGE_READ);
+		}
+		pthread_mutex_unlock(&queue.lock);
+	}
+	return NULL;
+}
+
+static void wake_reader() {
+	if (write(queue.wake[1], "", 1) < 0 && errno != EAGAIN) perror("write");
+}
+
+// The admission thread can be cancelled while the policy waits on stdin, refuse its request then
+static void refuse_on_cancel(void *arg) {
+	incoming_t *item = arg;
+	handshake_deny(item->sock);
+	close(item->sock);
+	finish(item, OUTCOME_DENIED);
+}
+
+static void *admission_thread(void *arg) {
+	(void)arg;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	pthread_mutex_lock(&queue.lock);
+	while (1) {
+		while (queue.running && queue.decide.count == 0) {
+			pthread_cond_wait(&queue.decide_ready, &queue.lock);
+		}
+		if (!queue.running) break;
+
+		incoming_t *item = fifo_pop(&queue.decide);
+		take_wait(item, &queue.decide_wait_us);
+		queue.decided++;
+		pthread_mutex_unlock(&queue.lock);
+
+		// The policy may block on the user for as long as it likes, the workers carry on
+		int accepted;
+		pthread_cleanup_push(refuse_on_cancel, item);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		accepted = queue.policy(&item->request);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_cleanup_pop(0);
+
+		pthread_mutex_lock(&queue.lock);
+		requeue(item, accepted ? STAGE_ACCEPT : STAGE_DENY);
+	}
+	pthread_mutex_unlock(&queue.lock);
+	return NULL;
+}
+
+int admission_prompt(const handshake_request_t *request) {
+	char buffer[BUFFER_SIZE];
+
+	// Not cancelled in the middle of safe_print(), which would leave its mutex held
+	int state;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	safe_print("Received connection request from '%s'. Accept? (yes/no): ", request->username);
+	pthread_setcancelstate(state, NULL);
+
+	if (fgets(buffer, sizeof(buffer), stdin) == NULL) buffer[0] = '\0';
+	trim_newline(buffer);
+	return strcmp(buffer, "yes") == 0;
+}
+
+int admission_accept_all(const handshake_request_t *request) {
+	safe_print("Accepting connection request from '%s'.\n", request->username);
+	return 1;
+}
+
+admission_policy_t admission_policy_from_env() {
+	const char *name = getenv("PQC_ACCEPT_POLICY");
+	if (name == NULL || strcmp(name, "prompt") == 0) return admission_prompt;
+	if (strcmp(name, "auto") == 0) return admission_accept_all;
+	fprintf(stderr, "Unknown accept policy '%s', prompting\n", name);
+	return admission_prompt;
+}
+
+static int default_read_timeout() {
+	const char *value = getenv("PQC_HANDSHAKE_TIMEOUT");
+	int seconds = value != NULL ? atoi(value) : ADMISSION_READ_TIMEOUT;
+	return seconds > 0 ? seconds : ADMISSION_READ_TIMEOUT;
+}
+
+static int default_workers() {
+	const char *value = getenv("PQC_HANDSHAKE_WORKERS");
+	long workers = value != NULL ? atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 1) workers = 1;
+	if (workers > ADMISSION_MAX_WORKERS) workers = ADMISSION_MAX_WORKERS;
+	return (int)workers;
+}
+
+int admission_start(int workers, admission_policy_t policy, const char *username, void *(*session)(void *chat)) {
+	if (workers <= 0) workers = default_workers();
+	if (workers > ADMISSION_MAX_WORKERS) workers = ADMISSION_MAX_WORKERS;
+
+	pthread_mutex_lock(&queue.lock);
+	queue.running = 1;
+	queue.policy = policy;
+	queue.username = username;
+	queue.session = session;
+	queue.read_timeout = default_read_timeout();
+	queue.worker_count = 0;
+	pthread_mutex_unlock(&queue.lock);
+
+	// Non-blocking so a burst of submits never waits on the reader thread
+	if (pipe(queue.wake) != 0) {
+		perror("pipe");
+		queue.running = 0;
+		return -1;
+	}
+	if (set_nonblocking(queue.wake[0]) != 0 || set_nonblocking(queue.wake[1]) != 0 ||
+		pthread_create(&queue.reader_thread, NULL, reader_thread, NULL) != 0) {
+		queue.running = 0;
+		close(queue.wake[0]);
+		close(queue.wake[1]);
+		return -1;
+	}
+	if (pthread_create(&queue.admission_thread, NULL, admission_thread, NULL) != 0) {
+		perror("pthread_create");
+		pthread_mutex_lock(&queue.lock);
+		queue.running = 0;
+		pthread_mutex_unlock(&queue.lock);
+		wake_reader();
+		pthread_join(queue.reader_thread, NULL);
+		close(queue.wake[0]);
+		close(queue.wake[1]);
+		return -1;
+	}
+	for (int i = 0; i < workers; i++) {
+		if (pthread_create(&queue.workers[i], NULL, worker_thread, NULL) != 0) {
+			perror("pthread_create");
+			break;
+		}
+		queue.worker_count++;
+	}
+	if (queue.worker_count == 0) {
+		admission_stop();
+		return -1;
+	}
+	return 0;
+}
+
+void admission_stop() {
+	pthread_mutex_lock(&queue.lock);
+	if (!queue.running) {
+		pthread_mutex_unlock(&queue.lock);
+		return;
+	}
+	queue.running = 0;
+	pthread_cond_broadcast(&queue.work_ready);
+	pthread_cond_broadcast(&queue.decide_ready);
+	pthread_mutex_unlock(&queue.lock);
+	wake_reader();
+	pthread_join(queue.reader_thread, NULL);
+
+	// The admission thread may be sitting in a prompt
+	pthread_cancel(queue.admission_thread);
+	pthread_join(queue.admission_thread, NULL);
+	for (int i = 0; i < queue.worker_count; i++) {
+		pthread_join(queue.workers[i], NULL);
+	}
+	queue.worker_count = 0;
+
+	fifo_t *fifos[] = { &queue.work, &queue.decide };
+	for (int i = 0; i < 2; i++) {
+		while (fifos[i]->count > 0) {
+			incoming_t *item = fifo_pop(fifos[i]);
+			handshake_deny(item->sock);
+			close(item->sock);
+			finish(item, OUTCOME_DENIED);
+		}
+	}
+	while (queue.waiting_count > 0) {
+		incoming_t *item = queue.waiting[--queue.waiting_count];
+		handshake_deny(item->sock);
+		close(item->sock);
+		finish(item, OUTCOME_DENIED);
+	}
+	close(queue.wake[0]);
+	close(queue.wake[1]);
+	queue.wake[0] = queue.wake[1] = -1;
+}
+
+int admission_submit(int sock) {
+	incoming_t *item = calloc(1, sizeof(incoming_t));
+
+	pthread_mutex_lock(&queue.lock);
+	if (item == NULL || !queue.running || queue.live == ADMISSION_QUEUE_SIZE) {
+		queue.dropped++;
+		pthread_mutex_unlock(&queue.lock);
+		// Tell the dialer rather than leave it waiting, it can try again later
+		handshake_deny(sock);
+		close(sock);
+		free(item);
+		return -1;
+	}
+	item->sock = sock;
+	item->stage = STAGE_READ;
+	clock_gettime(CLOCK_MONOTONIC, &item->queued);
+	queue.live++;
+	queue.admitted++;
+	queue.waiting[queue.waiting_count++] = item;
+	pthread_mutex_unlock(&queue.lock);
+	wake_reader();
+	return 0;
+}
+
+void admission_get_stats(admission_stats_t *stats) {
+	pthread_mutex_lock(&queue.lock);
+	unsigned long done = queue.accepted + queue.denied + queue.failed + queue.puzzled;
+	stats->workers = queue.worker_count;
+	stats->queued = queue.live;
+	stats->admitted = queue.admitted;
+	stats->dropped = queue.dropped;
+	stats->accepted = queue.accepted;
+	stats->denied = queue.denied;
+	stats->failed = queue.failed;
+	stats->timed_out = queue.timed_out;
+	stats->puzzled = queue.puzzled;
+	stats->read_wait_us = queue.reads > 0 ? queue.read_wait_us / queue.reads : 0;
+	stats->decide_wait_us = queue.decided > 0 ? queue.decide_wait_us / queue.decided : 0;
+	stats->accept_wait_us = queue.keyed > 0 ? queue.accept_wait_us / queue.keyed : 0;
+	stats->max_wait_us = queue.max_wait_us;
+	stats->crypto_us = done > 0 ? queue.crypto_us / done : 0;
+	pthread_mutex_unlock(&queue.lock);
+}
@@ -0,0 +1,64 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "handshake.h"
+
+#define ADMISSION_QUEUE_SIZE 16  // inbound connections between accept() and their chat session
+#define ADMISSION_MAX_WORKERS 16
+#define ADMISSION_READ_TIMEOUT 5  // seconds a dialer gets to start its request and for each read after, $PQC_HANDSHAKE_TIMEOUT
+
+// Inbound connections go through three stages, after waiting on a reader thread for their first
+// bytes so a connection that sends nothing never holds a worker:
+//
+//   crypto workers   read the request, decapsulating an early request's secret. Once the queue
+//                    is deep enough the dialer has to solve a puzzle first, see puzzle.h
+//   admission thread asks the policy, one request at a time in arrival order
+//   crypto workers   accept (the KEM encapsulation) or deny, then start the chat session
+//
+// The admission thread is the only one that prompts, so concurrent requests don't race for stdin,
+// and the KEM work of a burst runs in parallel on the workers instead of behind the user's answer.
+
+// Returns 1 to accept the request. Runs on the admission thread.
+typedef int (*admission_policy_t)(const handshake_request_t *request);
+
+// Ask on stdin, the interactive default
+int admission_prompt(const handshake_request_t *request);
+// Accept everything, for headless peers
+int admission_accept_all(const handshake_request_t *request);
+
+// Policy named by $PQC_ACCEPT_POLICY, "prompt" (default) or "auto"
+admission_policy_t admission_policy_from_env();
+
+typedef struct {
+	int workers;
+	size_t queued;              // connections in the pipeline right now
+	unsigned long admitted;     // connections queued
+	unsigned long dropped;      // refused because the queue was full
+	unsigned long accepted, denied, failed;
+	unsigned long timed_out;    // closed after ADMISSION_READ_TIMEOUT without the request, also counted as failed
+	unsigned long puzzled;      // sent away with a puzzle to solve
+	double read_wait_us;        // average wait for a worker to read the request
+	double decide_wait_us;      // average wait for the policy's answer
+	double accept_wait_us;      // average wait for a worker to key an accepted session
+	double max_wait_us;         // longest total wait, accept() to keyed session
+	double crypto_us;           // average worker time per connection, reading plus accepting
+} admission_stats_t;
+
+// Start the admission thread and the crypto workers, workers <= 0 takes $PQC_HANDSHAKE_WORKERS or
+// the number of CPUs. Accepted sessions are keyed as username and run in a detached thread started
+// as session(chat).
+int admission_start(int workers, admission_policy_t policy, const char *username, void *(*session)(void *chat));
+
+// Stop the threads and refuse whatever is still queued, safe to call if never started
+void admission_stop();
+
+// Queue a connection from accept(). Returns -1 after refusing it when the queue is full.
+int admission_submit(int sock);
+
+void admission_get_stats(admission_stats_t *stats);
+
+#endif // ADMISSION_H
@@ -5,103 +5,414 @@
 #include "chat.h"
 #include "utils.h"
 #include "network.h"
+#include "frame_reader.h"
 #include "pq_encryption.h"
+#include "ktls.h"
+#include "kem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
 
-// Declare external variables
-extern int server_sock;
-extern char username_global[50];
-extern int peer_port;
-extern volatile int in_chat;
+// Chat and control streams carry newline-terminated messages
+struct line_buffer {
+	char data[BUFFER_SIZE + 1];
+	size_t len;
+};
 
-void *send_messages(void *arg) {
-	struct chat_info *chat = (struct chat_info *)arg;
-	char message[BUFFER_SIZE];
-	unsigned char ciphertext[BUFFER_SIZE + AES_GCM_TAG_SIZE];
-	size_t ciphertext_len;
+// State of the file currently being received on MUX_STREAM_FILE
+struct incoming_file {
+	FILE *fp;
+	char name[BUFFER_SIZE];
+	unsigned long long remaining;
+};
 
-	while (1) {
-		printf("[%s]: ", chat->your_username);
-		fflush(stdout);
-		safe_fgets(message, sizeof(message), stdin);
-		trim_newline(message);
+struct chat_io {
+	frame_reader_t reader;
+	struct line_buffer chat_lines, control_lines;
+	struct incoming_file file;
 
-		if (strcmp(message, "/quit") == 0) {
-			break;
+	// The frame going out, built in place with room in front for the frame header and sequence
+	// number and room behind for the tag. out points at what the socket has not taken yet.
+	unsigned char frame[FRAME_HEADER_SIZE + PQCRYPTO_RECORD_OVERHEAD + MUX_MAX_RECORD];
+	unsigned char *out;
+	size_t out_len;
+	mux_file_chunk_t body; // with kTLS, file data sent from the page cache after the frame's header
+	int more;              // the frame's body follows from body, keep the header in its TLS record
+};
+
+int chat_start(struct chat_info *chat) {
+	chat->closed = 0;
+	chat->io = NULL;
+	memset(&chat->stats, 0, sizeof(chat->stats));
+	chat->stats.cipher = pqcrypto_cipher_name(chat->cipher);
+	chat->stats.kem = kem_name(chat->kem);
+	chat->stats.started = time(NULL);
+	mux_init(&chat->mux); // first, chat_end() frees it whatever happens below
+
+	// Benchmark builds can negotiate records without encryption, a chat never runs over them
+	if (chat->cipher == PQCRYPTO_CIPHER_NULL) {
+		safe_print("Peer negotiated an unencrypted session, refusing it.\n");
+		return -1;
+	}
+
+	chat->io = calloc(1, sizeof(struct chat_io));
+	if (chat->io == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	if (frame_reader_init(&chat->io->reader, chat->sock, MAX_FRAME_SIZE) != 0) {
+		free(chat->io);
+		chat->io = NULL;
+		return -1;
+	}
+
+	// The handshake keyed the session and moved it into the kernel when both ends could
+	if (chat->ktls) {
+		safe_print("Record encryption (%s) offloaded to kernel TLS.\n", chat->stats.cipher);
+	} else {
+		safe_print("Records encrypted with %s.\n", chat->stats.cipher);
+	}
+
+	mux_open(&chat->mux, MUX_STREAM_CONTROL, MUX_PRIORITY_HIGH);
+	mux_open(&chat->mux, MUX_STREAM_CHAT, MUX_PRIORITY_HIGH);
+	mux_open(&chat->mux, MUX_STREAM_FILE, MUX_PRIORITY_BULK);
+
+	// Chat messages are small and latency-sensitive, don't let Nagle hold them back, and keep
+	// the kernel queue short so they never sit behind a pile of file data. The socket only
+	// reports writable again once the queue is that short.
+	set_socket_mode(chat->sock, SOCKET_MODE_INTERACTIVE);
+	limit_unsent_bytes(chat->sock, 2 * MUX_MAX_RECORD);
+	return set_nonblocking(chat->sock);
+}
+
+void chat_end(struct chat_info *chat) {
+	struct chat_io *io = chat->io;
+
+	print_session_stats(chat);
+	if (io != NULL) {
+		if (io->file.fp != NULL) {
+			fclose(io->file.fp);
+			safe_print("Transfer of '%s' was cut short.\n", io->file.name);
+		}
+		// Earlier chunks of a file are still owned by the mux, the last one is ours
+		if (io->body.len > 0 && io->body.last) {
+			close(io->body.fd);
 		}
+		frame_reader_free(&io->reader);
+		free(io);
+	}
+	mux_free(&chat->mux);
+	pqcrypto_context_free(&chat->enc_ctx);
+	close(chat->sock);
+	free(chat);
+}
 
-		size_t plaintext_len = strlen(message);
+void print_session_stats(const struct chat_info *chat) {
+	const struct session_stats *st = &chat->stats;
+	safe_print("Session with '%s': %s%s over %s%s, %ld s, sent %llu records (%llu bytes), received %llu records (%llu bytes)\n",
+			   chat->peer_username, st->cipher, chat->ktls || chat->ktls_rx > 0 ? " (kTLS)" : "", st->kem, chat->resumed ? " (resumed)" : "",
+			   (long)(time(NULL) - st->started),
+			   st->records_sent, st->bytes_sent, st->records_received, st->bytes_received);
+	// Records sealed in user space ratchet to fresh keys as they go, kTLS keeps its keys
+	if (!chat->ktls || chat->ktls_rx <= 0) {
+		safe_print("Key epochs: sending %u, receiving %u\n", chat->enc_ctx.send.epoch, chat->enc_ctx.recv.epoch);
+	}
+}
 
-		// Encrypt the message
-		if (pqcrypto_encrypt(&chat->enc_ctx, (unsigned char *)message, plaintext_len,
-							 ciphertext, &ciphertext_len) != 0) {
-			printf("Encryption failed.\n");
-			break;
-							 }
+// Announce a file on the control stream and queue its contents on the file stream
+static void start_file_transfer(struct chat_info *chat, char *path) {
+	char announcement[BUFFER_SIZE];
+	struct stat st;
 
-		// Send the ciphertext length
-		uint32_t net_ciphertext_len = htonl(ciphertext_len);
-		if (write(chat->sock, &net_ciphertext_len, sizeof(net_ciphertext_len)) <= 0) {
-			printf("Failed to send message length. Connection may have been lost.\n");
-			break;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		safe_print("Could not open '%s'.\n", path);
+		if (fd >= 0) close(fd);
+		return;
+	}
+
+	snprintf(announcement, sizeof(announcement), "FILE %s %llu\n", basename(path),
+			 (unsigned long long)st.st_size);
+	if (mux_try_write(&chat->mux, MUX_STREAM_CONTROL, announcement, strlen(announcement)) != 0) {
+		safe_print(errno == EAGAIN ? "The peer is not keeping up, transfer not started.\n"
+								   : "Could not start the transfer. Connection may have been lost.\n");
+		close(fd);
+		return;
+	}
+	if (mux_write_file(&chat->mux, MUX_STREAM_FILE, fd, st.st_size) != 0) {
+		safe_print("Could not start the transfer, is another one still running?\n");
+		close(fd);
+		return;
+	}
+	safe_print("Sending '%s' (%llu bytes).\n", path, (unsigned long long)st.st_size);
+}
+
+int chat_on_input(struct chat_info *chat, char *line) {
+	trim_newline(line);
+	if (strcmp(line, "/quit") == 0) {
+		// chat_flush() sends what is queued, then reports the session over
+		mux_close(&chat->mux);
+		return -1;
+	}
+	if (strcmp(line, "/stats") == 0) {
+		print_session_stats(chat);
+		return 0;
+	}
+	if (strncmp(line, "/send ", 6) == 0) {
+		start_file_transfer(chat, line + 6);
+		return 0;
+	}
+
+	// Messages are newline-delimited on the chat stream
+	char message[BUFFER_SIZE + 1];
+	size_t len = strlen(line);
+	if (len > BUFFER_SIZE - 1) len = BUFFER_SIZE - 1;
+	memcpy(message, line, len);
+	message[len++] = '\n';
+	if (mux_try_write(&chat->mux, MUX_STREAM_CHAT, message, len) != 0) {
+		safe_print(errno == EAGAIN ? "The peer is not keeping up, message not sent.\n"
+								   : "Failed to send message. Connection may have been lost.\n");
+	}
+	return 0;
+}
+
+// Build the next frame from the mux into io->out. Returns 1 with a frame, 0 if the mux has nothing
+// to send, -1 once it is closed and drained or on failure.
+static int next_frame(struct chat_info *chat) {
+	struct chat_io *io = chat->io;
+	unsigned char *sealed = io->frame + FRAME_HEADER_SIZE;
+	unsigned char *record = sealed + PQCRYPTO_SEQ_SIZE;
+	size_t record_len, sealed_len;
+	mux_file_chunk_t file;
+
+	int rc = mux_poll_record(&chat->mux, record, &record_len, &file);
+	if (rc <= 0) return rc;
+
+	if (chat->ktls && file.len > 0) {
+		// The kernel encrypts, so file data can go from the page cache straight to the socket
+		uint32_t net_len = htonl(record_len + file.len);
+		io->out = record - FRAME_HEADER_SIZE;
+		memcpy(io->out, &net_len, sizeof(net_len));
+		io->out_len = FRAME_HEADER_SIZE + MUX_HEADER_SIZE;
+		io->body = file;
+		io->more = 1;
+	} else {
+		if (file.len > 0) {
+			if (pread(file.fd, record + record_len, file.len, file.offset) != (ssize_t)file.len) {
+				safe_print("Failed to read file being sent.\n");
+				if (file.last) close(file.fd);
+				return -1;
+			}
+			record_len += file.len;
+			if (file.last) {
+				close(file.fd);
+				safe_print("File sent.\n");
+			}
 		}
 
-		// Send the ciphertext
-		if (write(chat->sock, ciphertext, ciphertext_len) <= 0) {
-			printf("Failed to send message. Connection may have been lost.\n");
-			break;
+		if (chat->ktls) {
+			io->out = record - FRAME_HEADER_SIZE;
+			io->out_len = FRAME_HEADER_SIZE + record_len;
+		} else if (pqcrypto_encrypt_inplace(&chat->enc_ctx, sealed, record_len, &sealed_len) != 0) {
+			safe_print("Encryption failed.\n");
+			return -1;
+		} else {
+			io->out = io->frame;
+			io->out_len = FRAME_HEADER_SIZE + sealed_len;
 		}
+		uint32_t net_len = htonl(io->out_len - FRAME_HEADER_SIZE);
+		memcpy(io->out, &net_len, sizeof(net_len));
+		io->more = 0;
 	}
 
-	close(chat->sock);
-	free(chat);
-	in_chat = 0;
-	pthread_exit(NULL);
+	chat->stats.records_sent++;
+	chat->stats.bytes_sent += record_len + (chat->ktls ? file.len : 0);
+	return 1;
 }
 
-void *receive_messages(void *arg) {
-	struct chat_info *chat = (struct chat_info *)arg;
-	unsigned char buffer[BUFFER_SIZE + AES_GCM_TAG_SIZE];
-	unsigned char plaintext[BUFFER_SIZE];
-	ssize_t bytes_read;
+int chat_flush(struct chat_info *chat) {
+	struct chat_io *io = chat->io;
 
 	while (1) {
-		// Read the ciphertext length
-		uint32_t net_ciphertext_len;
-		bytes_read = read(chat->sock, &net_ciphertext_len, sizeof(net_ciphertext_len));
-		if (bytes_read <= 0) {
-			break;
+		ssize_t sent;
+
+		if (io->out_len > 0) {
+			// MSG_MORE keeps a header in the same TLS record as the file data behind it
+			sent = send(chat->sock, io->out, io->out_len, MSG_NOSIGNAL | (io->more ? MSG_MORE : 0));
+			if (sent > 0) {
+				io->out += sent;
+				io->out_len -= sent;
+				continue;
+			}
+		} else if (io->body.len > 0) {
+			sent = sendfile(chat->sock, io->body.fd, &io->body.offset, io->body.len);
+			if (sent == 0) {
+				safe_print("File shrank during transfer.\n");
+				return -1;
+			}
+			if (sent > 0) {
+				io->body.len -= sent;
+				if (io->body.len == 0 && io->body.last) {
+					close(io->body.fd);
+					safe_print("File sent.\n");
+				}
+				continue;
+			}
+		} else {
+			int rc = next_frame(chat);
+			if (rc <= 0) return rc;
+			continue;
 		}
-		size_t ciphertext_len = ntohl(net_ciphertext_len);
 
-		// Read the ciphertext
-		bytes_read = read(chat->sock, buffer, ciphertext_len);
-		if (bytes_read <= 0) {
-			break;
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+		safe_print("Failed to send message. Connection may have been lost.\n");
+		return -1;
+	}
+}
+
+// Collect stream bytes into lines, returns the next complete line or NULL
+static char *next_line(struct line_buffer *lb, const unsigned char **data, size_t *len) {
+	while (*len > 0) {
+		char c = (char)**data;
+		(*data)++;
+		(*len)--;
+
+		if (c != '\n') {
+			lb->data[lb->len++] = c;
 		}
+		if (c == '\n' || lb->len == sizeof(lb->data) - 1) {
+			lb->data[lb->len] = '\0';
+			lb->len = 0;
+			return lb->data;
+		}
+	}
+	return NULL;
+}
 
-		// Decrypt the message
-		size_t plaintext_len;
-		if (pqcrypto_decrypt(&chat->enc_ctx, buffer, ciphertext_len,
-							 plaintext, &plaintext_len) != 0) {
-			printf("Decryption failed.\n");
-			break;
-							 }
-		plaintext[plaintext_len] = '\0';
+static void handle_control_line(const char *line, struct incoming_file *file) {
+	char name[256];
+	unsigned long long size;
+
+	if (sscanf(line, "FILE %255s %llu", name, &size) != 2 || strchr(name, '/') != NULL) {
+		safe_print("Ignoring unknown control message from peer.\n");
+		return;
+	}
+	if (file->fp != NULL) {
+		fclose(file->fp);
+	}
 
-		safe_print("[%s]: %s\n", chat->peer_username, plaintext);
+	snprintf(file->name, sizeof(file->name), "received_%s", name);
+	file->fp = fopen(file->name, "wb");
+	file->remaining = size;
+	if (file->fp == NULL) {
+		perror("fopen");
+		return;
 	}
+	safe_print("Receiving '%s' (%llu bytes) as '%s'.\n", name, size, file->name);
 
-	// Connection closed or error
-	safe_print("Connection with '%s' closed.\n", chat->peer_username);
-	close(chat->sock);
-	free(chat);
-	in_chat = 0;
-	pthread_exit(NULL);
+	if (size == 0) {
+		fclose(file->fp);
+		file->fp = NULL;
+		safe_print("Finished receiving '%s'.\n", file->name);
+	}
 }
 
+static void handle_file_data(const unsigned char *data, size_t len, struct incoming_file *file) {
+	if (file->fp == NULL || len > file->remaining) {
+		safe_print("Discarding unexpected file data from peer.\n");
+		return;
+	}
 
+	fwrite(data, 1, len, file->fp);
+	file->remaining -= len;
+	if (file->remaining == 0) {
+		fclose(file->fp);
+		file->fp = NULL;
+		safe_print("Finished receiving '%s'.\n", file->name);
+	}
+}
+
+// Open one record and hand its mux frame to the stream it belongs to
+static int handle_record(struct chat_info *chat, unsigned char *frame, size_t frame_len) {
+	struct chat_io *io = chat->io;
+
+	// Decrypt the record in place, behind its sequence number. With kTLS the kernel has
+	// already done it.
+	unsigned char *plaintext = frame;
+	size_t plaintext_len = frame_len;
+	if (chat->ktls_rx <= 0) {
+		if (pqcrypto_decrypt_inplace(&chat->enc_ctx, frame, frame_len, &plaintext, &plaintext_len) != 0) {
+			safe_print("Decryption failed.\n");
+			return -1;
+		}
+	}
+
+	chat->stats.records_received++;
+	chat->stats.bytes_received += plaintext_len;
+
+	mux_event_t event;
+	if (mux_on_record(&chat->mux, plaintext, plaintext_len, &event) != 0) {
+		return -1;
+	}
+	if (event.type != MUX_FRAME_DATA) {
+		return 0;
+	}
+
+	const unsigned char *data = event.data;
+	size_t len = event.len;
+	char *line;
+	if (event.stream_id == MUX_STREAM_CHAT) {
+		while ((line = next_line(&io->chat_lines, &data, &len)) != NULL) {
+			safe_print("[%s]: %s\n", chat->peer_username, line);
+		}
+	} else if (event.stream_id == MUX_STREAM_CONTROL) {
+		while ((line = next_line(&io->control_lines, &data, &len)) != NULL) {
+			handle_control_line(line, &io->file);
+		}
+	} else if (event.stream_id == MUX_STREAM_FILE) {
+		handle_file_data(data, len, &io->file);
+	}
+	mux_consumed(&chat->mux, event.stream_id, event.len);
+	return 0;
+}
+
+int chat_on_readable(struct chat_info *chat) {
+	struct chat_io *io = chat->io;
+	unsigned char *frame;
+	size_t frame_len;
+
+	// The peer's first record shows whether its kernel seals them, see ktls_start_receiving()
+	if (chat->ktls_rx < 0) chat->ktls_rx = ktls_start_receiving(chat->sock, &chat->enc_ctx, chat->initiator);
+	ssize_t bytes_read = chat->ktls_rx < 0 ? -1 : frame_reader_fill(&io->reader);
+
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+
+	// Whatever arrived before a hang-up is still shown
+	int rc;
+	while ((rc = frame_reader_take(&io->reader, &frame, &frame_len)) > 0) {
+		if (handle_record(chat, frame, frame_len) != 0) {
+			rc = -1;
+			break;
+		}
+	}
+	if (rc < 0 || bytes_read <= 0) {
+		if (!chat->closed) {
+			safe_print("Connection with '%s' closed.\n", chat->peer_username);
+		}
+		chat->closed = 1;
+		mux_close(&chat->mux);
+		return -1;
+	}
+	return 0;
+}
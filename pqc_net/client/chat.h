@@ -5,18 +5,60 @@
 #ifndef CHAT_H
 #define CHAT_H
 
+#include <pthread.h>
+#include <time.h>
 #include "constants.h"
+#include "mux.h"
 #include "pq_encryption.h"
 
+// Per-session counters, shown by /stats and when the chat ends
+struct session_stats {
+	const char *cipher;       // record cipher agreed in the handshake
+	const char *kem;          // KEM the session secret came from
+	time_t started;
+	unsigned long long records_sent, bytes_sent;
+	unsigned long long records_received, bytes_received;
+};
+
+// Receive buffer, the frame going out and the streams' line buffers, private to chat.c
+struct chat_io;
+
 struct chat_info {
 	int sock;
 	encryption_context_t enc_ctx; // encryption context
+	mux_t mux;                    // chat, file and control streams sharing sock
+	volatile int closed;
+	int initiator;                // we dialed the peer
+	int ktls;                     // records we send are sealed by the kernel
+	int ktls_rx;                  // records we receive are opened by the kernel, -1 until the first shows
+	int cipher;                   // record cipher chosen by the responder
+	int kem;                      // KEM chosen by the responder, see kem.h
+	int resumed;                  // keyed from a resumption ticket, the KEM is the earlier session's
+	struct session_stats stats;
+	struct chat_io *io;
 	char peer_username[USERNAME_MAX_LENGTH];
 	char your_username[USERNAME_MAX_LENGTH];
 };
 
-void *send_messages(void *arg);
-void *receive_messages(void *arg);
+// A keyed session driven by the client's event loop, see event_loop.h. Nothing here blocks:
+//
+//   chat_start()        socket made non-blocking, streams opened
+//   chat_on_readable()  every complete record the socket has is opened and handled
+//   chat_on_input()     a line the user typed: a message, /stats or /send <path>
+//   chat_flush()        records the mux has ready are sealed and written until the socket is full
+//   chat_end()          statistics printed, socket closed, chat freed
+//
+// /quit closes the mux, chat_flush() then drains it and reports the session over.
+int chat_start(struct chat_info *chat);
+// -1 once the peer hung up or sent something we could not open
+int chat_on_readable(struct chat_info *chat);
+// -1 after /quit
+int chat_on_input(struct chat_info *chat, char *line);
+// 1 while a record waits for the socket to take it (wait for EPOLLOUT), 0 when everything ready went
+// out, -1 when the session is over
+int chat_flush(struct chat_info *chat);
+void chat_end(struct chat_info *chat);
 
-#endif // CHAT_H
+void print_session_stats(const struct chat_info *chat);
 
+#endif // CHAT_H
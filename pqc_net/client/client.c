@@ -4,24 +4,26 @@
 
 #include "client.h"
 #include "network.h"
-#include "chat.h"
 #include "peer_list.h"
 #include "utils.h"
 #include "constants.h"
 #include "pq_encryption.h"
+#include "admission.h"
+#include "directory.h"
+#include "keypool.h"
+#include "secure_arena.h"
+#include "puzzle.h"
+#include "ticket.h"
+#include "kem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <arpa/inet.h>
-#include <pthread.h>
-#include <openssl/rand.h>
 
 // Define global variables
 int server_sock;
 char username_global[USERNAME_MAX_LENGTH];
 int peer_port;
-volatile int in_chat = 0;
 
 // Implement request_peer_list
 void request_peer_list(int sock) {
@@ -31,277 +33,55 @@ void request_peer_list(int sock) {
 	}
 }
 
-void *server_listener(void *arg) {
-	int sock = *(int *)arg;
-	char buffer[BUFFER_SIZE];
-	ssize_t bytes_read;
-
-	while ((bytes_read = read(sock, buffer, sizeof(buffer) - 1)) > 0) {
-		buffer[bytes_read] = '\0';
-
-		// Check if the message is a notification about a new peer
-		if (strncmp(buffer, "New peer connected", 18) == 0) {
-			safe_print("Server notification: %s", buffer);
-
-			// Send GET_PEER_LIST request to the server
-			request_peer_list(sock);
-		}
-		// Check if the message is the updated peer list
-		else if (strncmp(buffer, "PEER_LIST\n", 10) == 0) {
-			char *peer_list_str = buffer + 10;
-			update_peer_list(peer_list_str);
-			safe_print("Peer list updated.\n");
-		}
-		else {
-			safe_print("Server message: %s", buffer);
-		}
+int register_with_server(int sock) {
+	char line[DIRECTORY_LINE_MAX];
+	directory_register_line(line, sizeof(line), username_global, peer_port);
+	if (write(sock, line, strlen(line)) < 0) {
+		perror("write");
+		return -1;
 	}
-
-	// Connection closed
-	safe_print("Disconnected from server.\n");
-	close(sock);
-	pthread_exit(NULL);
+	return 0;
 }
 
-void *handle_incoming_peer(void *arg) {
-	int peer_sock = *(int *)arg;
-	free(arg);
-
-	char buffer[BUFFER_SIZE];
-	ssize_t bytes_read;
-
-	// Receive connection request from peer
-	bytes_read = read(peer_sock, buffer, sizeof(buffer) - 1);
-	if (bytes_read <= 0) {
-		perror("read");
-		close(peer_sock);
-		pthread_exit(NULL);
-	}
-	buffer[bytes_read] = '\0';
-	trim_newline(buffer);
-
-	// Check if it's a CONNECT_REQUEST
-	if (strncmp(buffer, "CONNECT_REQUEST", 15) == 0) {
-		char peer_username[USERNAME_MAX_LENGTH];
-		sscanf(buffer + 16, "%s", peer_username);
-
-		// Prompt user to accept or deny the connection
-		safe_print("Received connection request from '%s'. Accept? (yes/no): ", peer_username);
-		fgets(buffer, sizeof(buffer), stdin);
-		trim_newline(buffer);
-
-		if (strcmp(buffer, "yes") == 0) {
-			// Send ACCEPT response
-			snprintf(buffer, sizeof(buffer), "ACCEPT\n");
-			write(peer_sock, buffer, strlen(buffer));
-
-			// Remove from discoverable list
-			snprintf(buffer, sizeof(buffer), "REMOVE %s\n", username_global);
-			write(server_sock, buffer, strlen(buffer));
-
-			safe_print("Connection accepted with '%s'.\n", peer_username);
-
-			in_chat = 1; // Set in_chat flag
-
-			// Start chat session
-			struct chat_info *chat = malloc(sizeof(struct chat_info));
-			if (chat == NULL) {
-				perror("malloc");
-				close(peer_sock);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-			chat->sock = peer_sock;
-			strcpy(chat->peer_username, peer_username);
-			strcpy(chat->your_username, username_global);
-
-			// Generate Kyber key pair
-			unsigned char *public_key = NULL, *secret_key = NULL;
-			size_t public_key_len = 0, secret_key_len = 0;
-			if (pqcrypto_generate_keypair(&public_key, &public_key_len, &secret_key, &secret_key_len) != 0) {
-				fprintf(stderr, "Failed to generate Kyber key pair\n");
-				close(peer_sock);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			// Receive peer's public key length and public key
-			uint32_t peer_public_key_len;
-			if (read(peer_sock, &peer_public_key_len, sizeof(peer_public_key_len)) <= 0) {
-				perror("read");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-			peer_public_key_len = ntohl(peer_public_key_len);
-
-			unsigned char *peer_public_key = malloc(peer_public_key_len);
-			if (peer_public_key == NULL) {
-				perror("malloc");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			if (read(peer_sock, peer_public_key, peer_public_key_len) <= 0) {
-				perror("read");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(peer_public_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			// Derive shared secret and initialize encryption context
-			if (pqcrypto_derive_shared_secret(&chat->enc_ctx, peer_public_key, peer_public_key_len,
-											 secret_key, secret_key_len) != 0) {
-				fprintf(stderr, "Failed to derive shared secret\n");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(peer_public_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			// Send own public key length and public key to peer
-			uint32_t net_public_key_len = htonl(public_key_len);
-			if (write(peer_sock, &net_public_key_len, sizeof(net_public_key_len)) <= 0) {
-				perror("write");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(peer_public_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-			if (write(peer_sock, public_key, public_key_len) <= 0) {
-				perror("write");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(peer_public_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			// Send AES IV to peer
-			if (write(peer_sock, chat->enc_ctx.iv, AES_GCM_IV_SIZE) <= 0) {
-				perror("write");
-				close(peer_sock);
-				free(public_key);
-				free(secret_key);
-				free(peer_public_key);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			// Clean up keys
-			free(public_key);
-			free(secret_key);
-			free(peer_public_key);
-
-			// Start chat threads
-			pthread_t send_thread, receive_thread;
-			if (pthread_create(&send_thread, NULL, send_messages, (void *)chat) != 0) {
-				perror("pthread_create");
-				close(peer_sock);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-			if (pthread_create(&receive_thread, NULL, receive_messages, (void *)chat) != 0) {
-				perror("pthread_create");
-				close(peer_sock);
-				free(chat);
-				in_chat = 0;
-				pthread_exit(NULL);
-			}
-
-			// Wait for chat to end
-			pthread_join(send_thread, NULL);
-			pthread_join(receive_thread, NULL);
-
-			safe_print("Chat with '%s' ended.\n", peer_username);
-			close(peer_sock);
-			in_chat = 0;
-
-			// Re-register with the server
-			snprintf(buffer, sizeof(buffer), "REGISTER %s %d\n", username_global, peer_port);
-			write(server_sock, buffer, strlen(buffer));
-
-			// Request updated peer list
-			request_peer_list(server_sock);
-
-			pthread_exit(NULL);
-
-		} else {
-			// Send DENY response
-			snprintf(buffer, sizeof(buffer), "DENY\n");
-			write(peer_sock, buffer, strlen(buffer));
-
-			close(peer_sock);
-			pthread_exit(NULL);
-		}
-	} else {
-		// Unknown command
-		safe_print("Received unknown command from peer.\n");
-		close(peer_sock);
-		pthread_exit(NULL);
-	}
-}
-
-void *peer_listener(void *arg) {
-	int port = *(int *)arg;
-
-	int listen_sock = bind_and_listen(port);
-	if (listen_sock < 0) {
-		fprintf(stderr, "Failed to bind and listen on port %d.\n", port);
-		pthread_exit(NULL);
-	}
-
-	printf("Listening for incoming peer connections on port %d...\n", port);
-
-	while (1) {
-		int *peer_sock = malloc(sizeof(int));
-		if (peer_sock == NULL) {
-			perror("malloc");
-			continue;
-		}
-
-		struct sockaddr_in peer_addr;
-		socklen_t addr_size = sizeof(peer_addr);
-		*peer_sock = accept(listen_sock, (struct sockaddr *)&peer_addr, &addr_size);
-		if (*peer_sock < 0) {
-			perror("accept");
-			free(peer_sock);
-			continue;
-		}
-
-		// Handle the incoming peer connection in a new thread
-		pthread_t thread_id;
-		if (pthread_create(&thread_id, NULL, handle_incoming_peer, (void *)peer_sock) != 0) {
-			perror("pthread_create");
-			close(*peer_sock);
-			free(peer_sock);
-			continue;
-		}
-		pthread_detach(thread_id);
-	}
-
-	close(listen_sock);
-	pthread_exit(NULL);
+void print_handshake_stats() {
+	keypool_stats_t stats;
+	keypool_get_stats(&stats);
+	safe_print("Key pool: %zu %s key pairs ready, %lu hits, %lu misses, %lu refilled at %.0f key pairs/s\n",
+			   stats.ready, stats.kem, stats.hits, stats.misses, stats.refilled, stats.refill_rate);
+	safe_print("KEM policy: %s\n", kem_policy_name(kem_get_policy()));
+
+	secure_arena_stats_t arena;
+	secure_arena_get_stats(&arena);
+	safe_print("Secure memory: %zu of %zu bytes in use (%zu at most, %s), %lu allocations, %lu from the heap\n",
+			   arena.in_use, arena.size, arena.high_water, arena.locked ? "locked" : "not locked",
+			   arena.allocations, arena.fallbacks);
+
+	ticket_stats_t tickets;
+	ticket_get_stats(&tickets);
+	safe_print("Tickets: %zu/%d cached, %lu of %lu dials resumed (%.0f%%), %lu refused, %lu issued, %lu redeemed, "
+			   "%lu replays refused\n",
+			   tickets.cached, TICKET_CACHE_SIZE, tickets.resumed, tickets.lookups,
+			   tickets.lookups > 0 ? 100.0 * tickets.resumed / tickets.lookups : 0.0, tickets.rejected,
+			   tickets.issued, tickets.accepted, tickets.replayed);
+	safe_print("Dial handshake: %.0f us resumed, %.0f us with a KEM exchange (lifetime %d s)\n",
+			   tickets.resume_us, tickets.full_us, ticket_lifetime());
+
+	admission_stats_t admission;
+	admission_get_stats(&admission);
+	safe_print("Incoming: %lu queued, %lu accepted, %lu denied, %lu failed (%lu timed out), %lu given a puzzle, "
+			   "%lu refused as the queue was full (%zu/%d now)\n",
+			   admission.admitted, admission.accepted, admission.denied, admission.failed, admission.timed_out,
+			   admission.puzzled,
+			   admission.dropped, admission.queued, ADMISSION_QUEUE_SIZE);
+	safe_print("Incoming waits: %.0f us for a worker, %.0f us for a decision, %.0f us to be keyed, %.0f us worst; "
+			   "%.0f us of crypto each on %d workers\n",
+			   admission.read_wait_us, admission.decide_wait_us, admission.accept_wait_us, admission.max_wait_us,
+			   admission.crypto_us, admission.workers);
+
+	puzzle_stats_t puzzles;
+	puzzle_get_stats(&puzzles);
+	safe_print("Puzzles: %lu handed out from %d queued, %lu solved by dialers, %lu refused; "
+			   "we solved %lu in %.0f us each\n",
+			   puzzles.issued, puzzle_get_threshold(), puzzles.verified, puzzles.refused,
+			   puzzles.solved, puzzles.solve_us);
 }
@@ -5,17 +5,19 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
-#include <pthread.h>
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 5453
 
-extern int server_sock;
+extern int server_sock; // -1 once the routing server hung up
 extern char username_global[50];
 extern int peer_port;
-extern volatile int in_chat;
 
-void *server_listener(void *arg);
-void *peer_listener(void *arg);
-void *handle_incoming_peer(void *arg);
+// Send REGISTER with our published key, see directory_register_line()
+int register_with_server(int sock);
 
 void request_peer_list(int server_sock);
 
+// Show how well the key pair pool and the resumption tickets are keeping handshakes short
+void print_handshake_stats();
+
 #endif // CLIENT_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "directory.h"
+#include "network.h"
+#include "utils.h"
+#include "kem.h"
+#include "secure_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+
+typedef struct {
+	int kem;
+	unsigned char *public_key;
+	unsigned char *secret_key;
+	size_t public_key_len;
+	size_t secret_key_len;
+	unsigned char id[DIRECTORY_KEY_ID_SIZE];
+	time_t created;
+} published_key_t;
+
+// The current key and the one it replaced, accept threads decapsulate while main rotates
+static struct {
+	pthread_mutex_t lock;
+	published_key_t current;
+	published_key_t previous;
+} keys = { .lock = PTHREAD_MUTEX_INITIALIZER, .current = { .kem = -1 }, .previous = { .kem = -1 } };
+
+static void key_free(published_key_t *key) {
+	if (key->secret_key != NULL) secure_free(key->secret_key, key->secret_key_len);
+	free(key->public_key);
+	memset(key, 0, sizeof(*key));
+	key->kem = -1;
+}
+
+static int key_generate(published_key_t *key) {
+	int kem = kem_preferred();
+	const OQS_KEM *handle = kem_handle(kem);
+
+	if (handle == NULL || handle->length_public_key > DIRECTORY_KEY_MAX) {
+		// Too big for the directory, dialers will send a key share instead
+		return -1;
+	}
+	if (pqcrypto_generate_keypair(kem, &key->public_key, &key->public_key_len,
+								  &key->secret_key, &key->secret_key_len) != 0) {
+		return -1;
+	}
+	key->kem = kem;
+	key->created = time(NULL);
+	directory_key_id(key->public_key, key->public_key_len, key->id);
+	return 0;
+}
+
+int directory_key_start() {
+	pthread_mutex_lock(&keys.lock);
+	int rc = key_generate(&keys.current);
+	pthread_mutex_unlock(&keys.lock);
+	return rc;
+}
+
+void directory_key_stop() {
+	pthread_mutex_lock(&keys.lock);
+	key_free(&keys.current);
+	key_free(&keys.previous);
+	pthread_mutex_unlock(&keys.lock);
+}
+
+void directory_key_id(const unsigned char *public_key, size_t public_key_len, unsigned char *id) {
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len;
+
+	EVP_Digest(public_key, public_key_len, digest, &digest_len, EVP_sha256(), NULL);
+	memcpy(id, digest, DIRECTORY_KEY_ID_SIZE);
+}
+
+int directory_key_due() {
+	pthread_mutex_lock(&keys.lock);
+	int due = keys.current.kem >= 0 && time(NULL) - keys.current.created >= DIRECTORY_KEY_LIFETIME;
+	pthread_mutex_unlock(&keys.lock);
+	return due;
+}
+
+void directory_register_line(char *line, size_t size, const char *username, int port) {
+	static char hex[2 * DIRECTORY_KEY_MAX + 1];
+
+	pthread_mutex_lock(&keys.lock);
+	if (keys.current.kem >= 0 && time(NULL) - keys.current.created >= DIRECTORY_KEY_LIFETIME) {
+		published_key_t next = { .kem = -1 };
+		if (key_generate(&next) == 0) {
+			key_free(&keys.previous);
+			keys.previous = keys.current;
+			keys.current = next;
+		}
+	}
+	if (keys.current.kem < 0) {
+		snprintf(line, size, "REGISTER %s %d\n", username, port);
+	} else {
+		hex_encode(keys.current.public_key, keys.current.public_key_len, hex);
+		snprintf(line, size, "REGISTER %s %d %s %s\n", username, port, kem_name(keys.current.kem), hex);
+	}
+	pthread_mutex_unlock(&keys.lock);
+}
+
+int directory_resolve(const char *server_ip, int server_port, const char *username, directory_entry_t *entry) {
+	char line[DIRECTORY_LINE_MAX];
+	char kem_choice[32];
+	int offset = 0;
+
+	int sock = connect_to_server(server_ip, server_port);
+	if (sock < 0) return -1;
+
+	snprintf(line, sizeof(line), "RESOLVE %s\n", username);
+	if (write(sock, line, strlen(line)) < 0 || read_line(sock, line, sizeof(line)) <= 0) {
+		close(sock);
+		return -1;
+	}
+	close(sock);
+
+	memset(entry, 0, sizeof(*entry));
+	entry->kem = -1;
+	if (sscanf(line, "RESOLVED %*s %15s %d%n", entry->ip, &entry->port, &offset) != 2) {
+		return -1;
+	}
+
+	// The key is optional, peers that didn't publish one get the key share handshake
+	char *fields = line + offset;
+	if (sscanf(fields, "%31s %n", kem_choice, &offset) == 1 && offset > 0) {
+		size_t hex_len = strcspn(fields + offset, " \r\n");
+		int kem = kem_from_name(kem_choice);
+		int len = hex_decode(fields + offset, hex_len, entry->public_key, sizeof(entry->public_key));
+		if (kem_handle(kem) != NULL && len > 0 && (size_t)len == kem_handle(kem)->length_public_key) {
+			entry->kem = kem;
+			entry->public_key_len = len;
+		}
+	}
+	return 0;
+}
+
+int directory_decapsulate(encryption_context_t *enc_ctx, int kem, const unsigned char *key_id,
+						  const unsigned char *ciphertext, size_t ciphertext_len) {
+	int rc = -1;
+
+	pthread_mutex_lock(&keys.lock);
+	published_key_t *candidates[] = { &keys.current, &keys.previous };
+	for (int i = 0; i < 2; i++) {
+		published_key_t *key = candidates[i];
+		if (key->kem >= 0 && key->kem == kem && memcmp(key->id, key_id, DIRECTORY_KEY_ID_SIZE) == 0) {
+			rc = pqcrypto_derive_shared_secret(enc_ctx, kem, ciphertext, ciphertext_len, key->secret_key);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&keys.lock);
+	return rc;
+}
@@ -0,0 +1,50 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include "constants.h"
+#include "pq_encryption.h"
+#include <stddef.h>
+
+#define DIRECTORY_KEY_LIFETIME 3600 // seconds before the published key pair is replaced
+#define DIRECTORY_KEY_CHECK_INTERVAL 60 // seconds between checks whether the published key is due
+#define DIRECTORY_KEY_ID_SIZE 8     // leading bytes of the key's SHA-256, names it on the wire
+
+// A peer's entry as the routing server returned it
+typedef struct {
+	char ip[IP_STR_LEN];
+	int port;
+	int kem;                  // -1 when the peer published no key we can use
+	unsigned char public_key[DIRECTORY_KEY_MAX];
+	size_t public_key_len;
+} directory_entry_t;
+
+// Generate the key pair we publish with REGISTER, for the locally preferred KEM. Dialers that
+// resolve us encapsulate to it and skip waiting for a key share.
+int directory_key_start();
+void directory_key_stop();
+
+// REGISTER line for the routing server carrying our published key. The key pair is replaced first
+// once it is older than DIRECTORY_KEY_LIFETIME, the one before stays usable for dialers that
+// resolved it earlier.
+void directory_register_line(char *line, size_t size, const char *username, int port);
+
+// 1 once the published key is older than DIRECTORY_KEY_LIFETIME, the next REGISTER line rotates it
+int directory_key_due();
+
+// Ask the routing server where username listens and for its published key, on a connection of its
+// own so the answer doesn't have to be picked out of the server listener's stream. Returns 0 or -1
+// if the server doesn't know the peer.
+int directory_resolve(const char *server_ip, int server_port, const char *username, directory_entry_t *entry);
+
+void directory_key_id(const unsigned char *public_key, size_t public_key_len, unsigned char *id);
+
+// Decapsulate a secret a dialer sent to our published key key_id into enc_ctx. Returns -1 if we no
+// longer hold that key.
+int directory_decapsulate(encryption_context_t *enc_ctx, int kem, const unsigned char *key_id,
+						  const unsigned char *ciphertext, size_t ciphertext_len);
+
+#endif // DIRECTORY_H
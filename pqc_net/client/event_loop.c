@@ -0,0 +1,762 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "event_loop.h"
+#include "client.h"
+#include "chat.h"
+#include "network.h"
+#include "peer_list.h"
+#include "directory.h"
+#include "ticket.h"
+#include "admission.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// What an epoll event is for, sessions are TAG_SESSION + slot
+#define TAG_WAKE 0
+#define TAG_STDIN 1
+#define TAG_SERVER 2
+#define TAG_LISTEN 3
+#define TAG_ROTATE 4
+#define TAG_SESSION 5
+
+#define MAX_EVENTS 16
+
+typedef enum { SESSION_FREE, SESSION_DIALING, SESSION_OPEN, SESSION_CLOSING } session_state_t;
+
+typedef struct {
+	session_state_t state;
+	struct chat_info *chat;          // set once OPEN
+	char peer[USERNAME_MAX_LENGTH];
+	int writing;                     // watching for EPOLLOUT, a record is waiting for the socket
+} session_t;
+
+// Why a dial ended without a session
+#define DIAL_OK 0
+#define DIAL_UNREACHABLE 1
+#define DIAL_DENIED 2
+#define DIAL_FAILED 3
+
+#define DIAL_MAX_CANDIDATES 4 // addresses raced for one peer, the first to connect is used
+
+typedef struct {
+	int slot;
+	Peer candidates[DIAL_MAX_CANDIDATES];
+	int candidate_count;
+	char peer[USERNAME_MAX_LENGTH];
+	char username[USERNAME_MAX_LENGTH];
+	int discoverable; // look up the peer's published key
+} dial_t;
+
+// Sessions finished by other threads, picked up by the loop when the wake fd fires
+typedef struct handoff {
+	struct chat_info *chat; // NULL when the dial failed
+	int slot;               // the DIALING session, -1 for an inbound one
+	int result;             // DIAL_*
+	struct handoff *next;
+} handoff_t;
+
+static struct {
+	int epoll_fd;
+	int listen_sock;
+	int discoverable;
+	int rotate_fd;        // timerfd checking whether the published key is due, -1 when not registered
+	int foreground;       // session typed lines go to, -1 for the menu
+	int running;
+	session_t sessions[EVENT_LOOP_MAX_SESSIONS];
+	char input[BUFFER_SIZE];
+	size_t input_len;
+} loop = { .epoll_fd = -1, .listen_sock = -1, .rotate_fd = -1, .foreground = -1 };
+
+static struct {
+	pthread_mutex_t lock;
+	int wake_fd;
+	int stopped;
+	handoff_t *head, *tail;
+} handoffs = { PTHREAD_MUTEX_INITIALIZER, -1, 0, NULL, NULL };
+
+// The admission thread's question, shown and answered on the loop
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t answered;
+	char username[USERNAME_MAX_LENGTH];
+	int waiting;  // a question is waiting for the loop
+	int shown;    // the next typed line is its answer
+	int answer;   // -1 until answered
+} prompt = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, "", 0, 0, -1 };
+
+// Caller holds handoffs.lock
+static int wake_fd_locked() {
+	if (handoffs.wake_fd < 0) {
+		handoffs.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (handoffs.wake_fd < 0) perror("eventfd");
+	}
+	return handoffs.wake_fd;
+}
+
+static void wake_loop() {
+	uint64_t one = 1;
+	pthread_mutex_lock(&handoffs.lock);
+	int fd = wake_fd_locked();
+	pthread_mutex_unlock(&handoffs.lock);
+	if (fd >= 0 && write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("write eventfd");
+}
+
+// Hand a session (or a failed dial) to the loop. After the loop has stopped the session is closed.
+static void post(struct chat_info *chat, int slot, int result) {
+	handoff_t *h = malloc(sizeof(handoff_t));
+
+	pthread_mutex_lock(&handoffs.lock);
+	if (h == NULL || handoffs.stopped) {
+		pthread_mutex_unlock(&handoffs.lock);
+		if (h == NULL) perror("malloc");
+		free(h);
+		if (chat != NULL) {
+			pqcrypto_context_free(&chat->enc_ctx);
+			close(chat->sock);
+			free(chat);
+		}
+		return;
+	}
+	*h = (handoff_t){ chat, slot, result, NULL };
+	if (handoffs.tail != NULL) handoffs.tail->next = h;
+	else handoffs.head = h;
+	handoffs.tail = h;
+	pthread_mutex_unlock(&handoffs.lock);
+	wake_loop();
+}
+
+void *event_loop_adopt(void *chat) {
+	post(chat, -1, DIAL_OK);
+	return NULL;
+}
+
+static void unlock_prompt(void *arg) {
+	(void)arg;
+	pthread_mutex_unlock(&prompt.lock);
+}
+
+int event_loop_prompt(const handshake_request_t *request) {
+	int answer;
+
+	pthread_mutex_lock(&prompt.lock);
+	// admission_stop() cancels the admission thread, possibly while it waits here
+	pthread_cleanup_push(unlock_prompt, NULL);
+	strncpy(prompt.username, request->username, sizeof(prompt.username) - 1);
+	prompt.username[sizeof(prompt.username) - 1] = '\0';
+	prompt.answer = -1;
+	prompt.waiting = 1;
+	wake_loop();
+	while (prompt.answer < 0) {
+		pthread_cond_wait(&prompt.answered, &prompt.lock);
+	}
+	answer = prompt.answer;
+	prompt.waiting = 0;
+	pthread_cleanup_pop(1);
+	return answer;
+}
+
+// Settle a waiting question, with the user's answer or a refusal when the loop stops
+static void answer_prompt(int answer) {
+	pthread_mutex_lock(&prompt.lock);
+	if (prompt.waiting) {
+		prompt.answer = answer;
+		prompt.shown = 0;
+		pthread_cond_broadcast(&prompt.answered);
+	}
+	pthread_mutex_unlock(&prompt.lock);
+}
+
+// What the user is typing into next
+static void show_prompt() {
+	pthread_mutex_lock(&prompt.lock);
+	int asking = prompt.waiting && prompt.answer < 0;
+	if (asking) {
+		prompt.shown = 1;
+		safe_print("Received connection request from '%s'. Accept? (yes/no): ", prompt.username);
+	}
+	pthread_mutex_unlock(&prompt.lock);
+	if (asking) return;
+
+	if (loop.foreground >= 0) {
+		safe_print("[%s]: ", loop.sessions[loop.foreground].chat->your_username);
+	} else if (loop.discoverable) {
+		display_peer_list();
+		safe_print("Enter the username of the peer to connect to (or 'stats', 'exit' to quit): ");
+	} else {
+		safe_print("Enter the IP and port of the peer to connect to, more pairs are tried at once (or 'stats', 'exit' to quit): ");
+	}
+	fflush(stdout);
+}
+
+static void server_write(const char *line) {
+	if (server_sock >= 0 && write(server_sock, line, strlen(line)) < 0) {
+		perror("write");
+	}
+}
+
+static int watch(int fd, uint32_t events, uint32_t tag) {
+	struct epoll_event ev = { .events = events, .data.u32 = tag };
+	if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+static int open_sessions() {
+	int open = 0;
+	for (int i = 0; i < EVENT_LOOP_MAX_SESSIONS; i++) {
+		if (loop.sessions[i].state == SESSION_OPEN || loop.sessions[i].state == SESSION_CLOSING) open++;
+	}
+	return open;
+}
+
+static int free_slot() {
+	for (int i = 0; i < EVENT_LOOP_MAX_SESSIONS; i++) {
+		if (loop.sessions[i].state == SESSION_FREE) return i;
+	}
+	return -1;
+}
+
+static void session_close(int slot) {
+	session_t *s = &loop.sessions[slot];
+	char peer[USERNAME_MAX_LENGTH];
+
+	strcpy(peer, s->peer);
+	chat_end(s->chat); // also drops the socket from the epoll set
+	s->chat = NULL;
+	s->state = SESSION_FREE;
+	s->writing = 0;
+	safe_print("Chat with '%s' ended.\n", peer);
+
+	if (loop.foreground == slot) {
+		loop.foreground = -1;
+		for (int i = 0; i < EVENT_LOOP_MAX_SESSIONS; i++) {
+			if (loop.sessions[i].state == SESSION_OPEN) {
+				loop.foreground = i;
+				safe_print("Back in the chat with '%s'.\n", loop.sessions[i].peer);
+				break;
+			}
+		}
+	}
+
+	// Discoverable again once the last chat is over, in case a dialer reported us gone
+	if (loop.running && loop.discoverable && open_sessions() == 0) {
+		if (server_sock >= 0) register_with_server(server_sock);
+		if (server_sock >= 0) request_peer_list(server_sock);
+	}
+}
+
+// Drive an OPEN or CLOSING session after its socket became readable or writable, or after it was
+// given something to send
+static void session_service(int slot, uint32_t events) {
+	session_t *s = &loop.sessions[slot];
+
+	if (s->state != SESSION_OPEN && s->state != SESSION_CLOSING) return;
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && chat_on_readable(s->chat) != 0) {
+		session_close(slot);
+		return;
+	}
+
+	// Reading may have freed the peer's window or owe it a window update, so flush after either
+	int rc = chat_flush(s->chat);
+	if (rc < 0) {
+		session_close(slot);
+		return;
+	}
+	if (rc != s->writing) {
+		struct epoll_event ev = { .events = EPOLLIN | (rc ? EPOLLOUT : 0), .data.u32 = TAG_SESSION + slot };
+		epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, s->chat->sock, &ev);
+		s->writing = rc;
+	}
+}
+
+// A keyed session from a dial or from admission becomes OPEN
+static void session_open(int slot, struct chat_info *chat) {
+	session_t *s = &loop.sessions[slot];
+
+	s->chat = chat;
+	s->writing = 0;
+	strcpy(s->peer, chat->peer_username);
+	if (chat_start(chat) != 0 || watch(chat->sock, EPOLLIN, TAG_SESSION + slot) != 0) {
+		chat_end(chat);
+		s->chat = NULL;
+		s->state = SESSION_FREE;
+		return;
+	}
+	s->state = SESSION_OPEN;
+
+	// Taken off the directory while chatting
+	if (loop.discoverable) {
+		char line[BUFFER_SIZE];
+		snprintf(line, sizeof(line), "REMOVE %s\n", username_global);
+		server_write(line);
+	}
+	if (loop.foreground < 0) {
+		loop.foreground = slot;
+		safe_print("Chatting with '%s'. /quit leaves, /menu goes back to the menu, /switch <user> changes chats.\n",
+				   s->peer);
+	} else {
+		safe_print("Chat with '%s' is open in the background, /switch %s to reply.\n", s->peer, s->peer);
+	}
+}
+
+static void *dial_thread(void *arg) {
+	dial_t *d = arg;
+	int result = DIAL_FAILED, winner = 0;
+
+	int sock = connect_first(d->candidates, d->candidate_count, CONNECT_TIMEOUT_MS, &winner);
+	if (sock < 0) {
+		post(NULL, d->slot, DIAL_UNREACHABLE);
+		free(d);
+		return NULL;
+	}
+	const Peer *address = &d->candidates[winner];
+	safe_print("Connected to peer at %s:%d\n", address->ip, address->port);
+
+	// Look up the peer's published key, unless a ticket will resume the session anyway
+	directory_entry_t entry;
+	char peer_addr[TICKET_PEER_SIZE];
+	int have_key = 0;
+	snprintf(peer_addr, sizeof(peer_addr), "%s:%d", address->ip, address->port);
+	if (d->discoverable && !ticket_held(peer_addr) &&
+		directory_resolve(SERVER_IP, SERVER_PORT, d->peer, &entry) == 0) {
+		have_key = entry.kem >= 0;
+	}
+
+	struct chat_info *chat = calloc(1, sizeof(struct chat_info));
+	if (chat == NULL) {
+		perror("calloc");
+	} else {
+		chat->sock = sock;
+		strcpy(chat->peer_username, d->peer);
+		strcpy(chat->your_username, d->username);
+
+		// Our username, offers and key share (or ciphertext for the published key) go out in the first flight
+		int rc = handshake_dial(sock, d->username, have_key ? &entry : NULL, chat);
+		if (rc == 0) {
+			post(chat, d->slot, DIAL_OK);
+			free(d);
+			return NULL;
+		}
+		result = rc == HANDSHAKE_DENIED ? DIAL_DENIED : DIAL_FAILED;
+		free(chat);
+	}
+	close(sock);
+	post(NULL, d->slot, result);
+	free(d);
+	return NULL;
+}
+
+// Start dialing the peer's addresses in the background, the loop carries on meanwhile
+static void start_dial(const Peer *candidates, int count, const char *peer) {
+	int slot = free_slot();
+	if (slot < 0) {
+		safe_print("Too many sessions open, leave one first.\n");
+		return;
+	}
+
+	dial_t *d = calloc(1, sizeof(dial_t));
+	pthread_t thread;
+	if (d == NULL) {
+		perror("calloc");
+		return;
+	}
+	d->slot = slot;
+	memcpy(d->candidates, candidates, count * sizeof(Peer));
+	d->candidate_count = count;
+	strncpy(d->peer, peer, USERNAME_MAX_LENGTH - 1);
+	strcpy(d->username, loop.discoverable ? username_global : "Anonymous");
+	d->discoverable = loop.discoverable;
+
+	loop.sessions[slot].state = SESSION_DIALING;
+	strcpy(loop.sessions[slot].peer, d->peer);
+	if (pthread_create(&thread, NULL, dial_thread, d) != 0) {
+		perror("pthread_create");
+		loop.sessions[slot].state = SESSION_FREE;
+		free(d);
+		return;
+	}
+	pthread_detach(thread);
+	safe_print("Dialing '%s'...\n", peer);
+}
+
+static void on_dial_failed(int slot, int result) {
+	session_t *s = &loop.sessions[slot];
+	char line[BUFFER_SIZE];
+
+	s->state = SESSION_FREE;
+	if (result == DIAL_DENIED) {
+		safe_print("Connection request denied.\n");
+	} else if (result == DIAL_FAILED) {
+		safe_print("Handshake with peer failed.\n");
+	} else if (loop.discoverable) {
+		safe_print("Could not connect to peer. The peer may no longer be connected.\n");
+		// Inform the server that the peer is no longer connected and fetch the new list
+		snprintf(line, sizeof(line), "PEER_DISCONNECTED %s\n", s->peer);
+		server_write(line);
+		if (server_sock >= 0) request_peer_list(server_sock);
+	} else {
+		safe_print("Could not connect to peer.\n");
+	}
+}
+
+// Sessions and failed dials handed over by the dial threads and the admission workers
+static void on_wake() {
+	uint64_t count;
+	if (read(handoffs.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read eventfd");
+
+	pthread_mutex_lock(&handoffs.lock);
+	handoff_t *h = handoffs.head;
+	handoffs.head = handoffs.tail = NULL;
+	pthread_mutex_unlock(&handoffs.lock);
+
+	while (h != NULL) {
+		handoff_t *next = h->next;
+		if (h->result != DIAL_OK) {
+			on_dial_failed(h->slot, h->result);
+		} else {
+			int slot = h->slot >= 0 ? h->slot : free_slot();
+			if (slot < 0) {
+				safe_print("Too many sessions open, hung up on '%s'.\n", h->chat->peer_username);
+				pqcrypto_context_free(&h->chat->enc_ctx);
+				close(h->chat->sock);
+				free(h->chat);
+			} else {
+				safe_print(h->slot >= 0 ? "Connection accepted by '%s'.\n" : "Connection accepted with '%s'.\n",
+						   h->chat->peer_username);
+				session_open(slot, h->chat);
+			}
+		}
+		free(h);
+		h = next;
+	}
+}
+
+static void on_server_readable() {
+	char buffer[BUFFER_SIZE];
+	ssize_t bytes_read = read(server_sock, buffer, sizeof(buffer) - 1);
+
+	if (bytes_read <= 0) {
+		if (bytes_read < 0 && errno == EINTR) return;
+		safe_print("Disconnected from server.\n");
+		close(server_sock); // leaves the epoll set with it
+		server_sock = -1;
+		return;
+	}
+	buffer[bytes_read] = '\0';
+
+	// A new peer registered, fetch the updated list
+	if (strncmp(buffer, "New peer connected", 18) == 0) {
+		safe_print("Server notification: %s", buffer);
+		request_peer_list(server_sock);
+	} else if (strncmp(buffer, "PEER_LIST\n", 10) == 0) {
+		update_peer_list(buffer + 10);
+		safe_print("Peer list updated.\n");
+	} else {
+		safe_print("Server message: %s", buffer);
+	}
+}
+
+// Publish a fresh key once ours is due, chats or not. Sessions keyed to the old one keep their keys
+// and the directory keeps the one before for dialers that resolved it earlier.
+static void on_rotate() {
+	uint64_t expirations;
+	if (read(loop.rotate_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("read timerfd");
+
+	if (server_sock >= 0 && directory_key_due()) register_with_server(server_sock);
+}
+
+// Check every DIRECTORY_KEY_CHECK_INTERVAL whether the published key is due, returns 0 or -1
+static int start_rotate_timer() {
+	struct itimerspec interval = {
+		.it_interval = { .tv_sec = DIRECTORY_KEY_CHECK_INTERVAL },
+		.it_value = { .tv_sec = DIRECTORY_KEY_CHECK_INTERVAL },
+	};
+
+	loop.rotate_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop.rotate_fd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+	if (timerfd_settime(loop.rotate_fd, 0, &interval, NULL) != 0) {
+		perror("timerfd_settime");
+		close(loop.rotate_fd);
+		loop.rotate_fd = -1;
+		return -1;
+	}
+	return watch(loop.rotate_fd, EPOLLIN, TAG_ROTATE);
+}
+
+static void on_listen_readable() {
+	while (1) {
+		int sock = accept(loop.listen_sock, NULL, NULL);
+		if (sock < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+			return;
+		}
+		// Queue it (blocking, accept() does not pass O_NONBLOCK on) for the handshake workers, a full queue refuses the dialer straight away
+		if (admission_submit(sock) != 0) {
+			safe_print("Too many pending connection requests, refused one.\n");
+		}
+	}
+}
+
+static int find_session(const char *peer) {
+	for (int i = 0; i < EVENT_LOOP_MAX_SESSIONS; i++) {
+		if (loop.sessions[i].state == SESSION_OPEN && strcmp(loop.sessions[i].peer, peer) == 0) return i;
+	}
+	return -1;
+}
+
+// A line typed at the menu. Returns -1 to exit.
+static int on_menu_line(char *line) {
+	if (strcmp(line, "stats") == 0) {
+		print_handshake_stats();
+		return 0;
+	}
+	if (strcmp(line, "exit") == 0) {
+		if (loop.discoverable) {
+			char remove[BUFFER_SIZE];
+			snprintf(remove, sizeof(remove), "REMOVE %s\n", username_global);
+			server_write(remove);
+		}
+		return -1;
+	}
+	if (line[0] == '\0') return 0;
+
+	Peer candidates[DIAL_MAX_CANDIDATES];
+	int count = 0;
+	memset(candidates, 0, sizeof(candidates));
+
+	if (!loop.discoverable) {
+		// "ip port" pairs, all of them are raced
+		int used;
+		char *rest = line;
+		while (count < DIAL_MAX_CANDIDATES &&
+			   sscanf(rest, "%15s %d%n", candidates[count].ip, &candidates[count].port, &used) == 2) {
+			rest += used;
+			count++;
+		}
+		if (count == 0) {
+			safe_print("Invalid input. Please enter IP and port.\n");
+			return 0;
+		}
+		start_dial(candidates, count, "Unknown");
+		return 0;
+	}
+
+	if (strcmp(line, username_global) == 0) {
+		safe_print("You cannot connect to yourself. Please select a different peer.\n");
+		return 0;
+	}
+	if (find_session(line) >= 0) {
+		loop.foreground = find_session(line);
+		return 0;
+	}
+
+	// Every address the peer list has for the peer is raced
+	pthread_mutex_lock(&peer_list_mutex);
+	for (int i = 0; i < peer_count && count < DIAL_MAX_CANDIDATES; i++) {
+		if (strcmp(peer_list[i].username, line) == 0) {
+			memcpy(candidates[count].ip, peer_list[i].ip, IP_STR_LEN);
+			candidates[count].port = peer_list[i].port;
+			count++;
+		}
+	}
+	pthread_mutex_unlock(&peer_list_mutex);
+
+	if (count == 0) {
+		safe_print("Peer not found. Please try again.\n");
+		return 0;
+	}
+	start_dial(candidates, count, line);
+	return 0;
+}
+
+// A line typed in the foreground session
+static void on_session_line(char *line) {
+	int slot = loop.foreground;
+
+	if (strcmp(line, "/menu") == 0) {
+		loop.foreground = -1;
+		return;
+	}
+	if (strncmp(line, "/switch ", 8) == 0) {
+		int other = find_session(line + 8);
+		if (other < 0) safe_print("No open chat with '%s'.\n", line + 8);
+		else loop.foreground = other;
+		return;
+	}
+
+	if (chat_on_input(loop.sessions[slot].chat, line) != 0) {
+		// Leaving: what is queued still goes out before the socket closes
+		loop.sessions[slot].state = SESSION_CLOSING;
+		loop.foreground = -1;
+	}
+	session_service(slot, 0);
+}
+
+// Split what stdin has into lines and route each one. Returns -1 to exit.
+static int on_stdin_readable() {
+	ssize_t bytes_read = read(STDIN_FILENO, loop.input + loop.input_len, sizeof(loop.input) - 1 - loop.input_len);
+	if (bytes_read < 0) return errno == EINTR || errno == EAGAIN ? 0 : -1;
+	if (bytes_read == 0) {
+		// Nothing more will be typed, the listener and open sessions carry on without it
+		epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+		return 0;
+	}
+	loop.input_len += bytes_read;
+
+	char *start = loop.input, *newline;
+	while ((newline = memchr(start, '\n', loop.input + loop.input_len - start)) != NULL ||
+		   loop.input_len == sizeof(loop.input) - 1) {
+		if (newline == NULL) newline = loop.input + loop.input_len - 1; // overlong, take what there is
+		*newline = '\0';
+		char *line = start;
+		start = newline + 1;
+		trim_newline(line);
+
+		pthread_mutex_lock(&prompt.lock);
+		int answering = prompt.shown;
+		pthread_mutex_unlock(&prompt.lock);
+		if (answering) {
+			answer_prompt(strcmp(line, "yes") == 0);
+		} else if (loop.foreground >= 0) {
+			on_session_line(line);
+		} else if (on_menu_line(line) != 0) {
+			return -1;
+		}
+		show_prompt();
+
+		size_t rest = loop.input + loop.input_len - start;
+		memmove(loop.input, start, rest);
+		loop.input_len = rest;
+		start = loop.input;
+	}
+	return 0;
+}
+
+int event_loop_run(int listen_sock) {
+	struct epoll_event events[MAX_EVENTS];
+	struct epoll_event input = { .events = EPOLLIN, .data.u32 = TAG_STDIN };
+	int rc = 0;
+
+	// A peer hanging up mid-write must not kill the client
+	signal(SIGPIPE, SIG_IGN);
+
+	loop.listen_sock = listen_sock;
+	loop.discoverable = listen_sock >= 0;
+	loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop.epoll_fd < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+	pthread_mutex_lock(&handoffs.lock);
+	int wake_fd = wake_fd_locked();
+	pthread_mutex_unlock(&handoffs.lock);
+	if (wake_fd < 0 || watch(wake_fd, EPOLLIN, TAG_WAKE) != 0) {
+		close(loop.epoll_fd);
+		return -1;
+	}
+	// A regular file or /dev/null on stdin can't be polled (EPERM): run headless, with no menu
+	if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &input) != 0) {
+		if (errno != EPERM) {
+			perror("epoll_ctl");
+			close(loop.epoll_fd);
+			return -1;
+		}
+		safe_print("No interactive input, serving peers until stopped.\n");
+	}
+	if (loop.discoverable) {
+		if (set_nonblocking(listen_sock) != 0 || watch(listen_sock, EPOLLIN, TAG_LISTEN) != 0 ||
+			(server_sock >= 0 && (watch(server_sock, EPOLLIN, TAG_SERVER) != 0 || start_rotate_timer() != 0))) {
+			if (loop.rotate_fd >= 0) close(loop.rotate_fd);
+			loop.rotate_fd = -1;
+			close(loop.epoll_fd);
+			return -1;
+		}
+	}
+
+	loop.running = 1;
+	show_prompt();
+	while (loop.running) {
+		int n = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
+			rc = -1;
+			break;
+		}
+
+		for (int i = 0; i < n && loop.running; i++) {
+			uint32_t tag = events[i].data.u32;
+			int foreground = loop.foreground;
+
+			if (tag == TAG_WAKE) {
+				on_wake();
+			} else if (tag == TAG_STDIN) {
+				if (on_stdin_readable() != 0) loop.running = 0;
+				continue;
+			} else if (tag == TAG_SERVER) {
+				if (server_sock >= 0) on_server_readable();
+			} else if (tag == TAG_LISTEN) {
+				on_listen_readable();
+			} else if (tag == TAG_ROTATE) {
+				on_rotate();
+			} else {
+				session_service(tag - TAG_SESSION, events[i].events);
+			}
+
+			// Show the prompt again when a question arrived or the foreground changed under the user
+			pthread_mutex_lock(&prompt.lock);
+			int ask = prompt.waiting && !prompt.shown && prompt.answer < 0;
+			pthread_mutex_unlock(&prompt.lock);
+			if (ask || foreground != loop.foreground) show_prompt();
+		}
+	}
+
+	// Nobody is left to answer, refuse whatever asks from now on
+	pthread_mutex_lock(&handoffs.lock);
+	handoffs.stopped = 1;
+	handoff_t *h = handoffs.head;
+	handoffs.head = handoffs.tail = NULL;
+	pthread_mutex_unlock(&handoffs.lock);
+	answer_prompt(0);
+	while (h != NULL) {
+		handoff_t *next = h->next;
+		if (h->chat != NULL) {
+			pqcrypto_context_free(&h->chat->enc_ctx);
+			close(h->chat->sock);
+			free(h->chat);
+		}
+		free(h);
+		h = next;
+	}
+
+	// Hang up on every open session, sending what they still have queued if the socket takes it
+	for (int i = 0; i < EVENT_LOOP_MAX_SESSIONS; i++) {
+		session_t *s = &loop.sessions[i];
+		if (s->state == SESSION_OPEN || s->state == SESSION_CLOSING) {
+			mux_close(&s->chat->mux);
+			chat_flush(s->chat);
+			session_close(i);
+		}
+	}
+	if (loop.rotate_fd >= 0) close(loop.rotate_fd);
+	loop.rotate_fd = -1;
+	close(loop.epoll_fd);
+	loop.epoll_fd = -1;
+	return rc;
+}
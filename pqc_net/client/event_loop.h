@@ -0,0 +1,36 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "handshake.h"
+
+#define EVENT_LOOP_MAX_SESSIONS 8 // peer sessions at once, open or still dialing
+
+// The client runs on one thread: an epoll loop over the routing server connection, the listening
+// socket, a timer rotating our published key, stdin and every peer session. Each session is a small
+// state machine:
+//
+//   DIALING   a dial thread connects and runs the handshake, which waits for the peer's answer
+//   OPEN      keyed, records are read and written as the socket allows
+//   CLOSING   we left with /quit, what is still queued goes out, then the socket closes
+//
+// Inbound connections are keyed by the admission workers (admission.h) and handed over OPEN.
+// Typed lines go to a waiting admission prompt first, then to the foreground session, otherwise to
+// the menu. In a session /switch <user> brings another one forward and /menu goes back to the menu.
+
+// Run until the user exits. listen_sock is the peer listener of a discoverable client, else -1.
+// Without stdin to poll, or once it ends, the loop keeps serving peers. Returns 0, or -1 if the
+// loop could not start or failed.
+int event_loop_run(int listen_sock);
+
+// admission_start() session callback: hand an accepted, keyed session to the loop
+void *event_loop_adopt(void *chat);
+
+// Admission policy that asks the user through the loop, in place of admission_prompt(), which
+// would race the loop for stdin
+int event_loop_prompt(const handshake_request_t *request);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,799 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "handshake.h"
+#include "network.h"
+#include "keypool.h"
+#include "ktls.h"
+#include "utils.h"
+#include "puzzle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#define TRANSCRIPT_HASH_SIZE 32 // SHA-256
+#define CONFIRM_SIZE (TRANSCRIPT_HASH_SIZE + TICKET_MAX_SIZE)
+
+enum { DIAL_FULL, DIAL_RESUME, DIAL_EARLY };
+
+static EVP_MD_CTX *transcript_new() {
+	EVP_MD_CTX *transcript = EVP_MD_CTX_new();
+	if (transcript == NULL || EVP_DigestInit_ex(transcript, EVP_sha256(), NULL) != 1) {
+		fprintf(stderr, "Failed to start the handshake transcript\n");
+		EVP_MD_CTX_free(transcript);
+		return NULL;
+	}
+	return transcript;
+}
+
+// Send header and body as one frame, in one syscall
+static int write_frame_parts(int sock, const char *header, const unsigned char *body, size_t body_len) {
+	size_t header_len = strlen(header);
+	uint32_t net_len = htonl(header_len + body_len);
+	struct iovec iov[3] = {
+		{ &net_len, sizeof(net_len) },
+		{ (void *)header, header_len },
+		{ (void *)body, body_len },
+	};
+
+	if (write_all_iov(sock, iov, body_len > 0 ? 3 : 2) != 0) {
+		perror("write");
+		return -1;
+	}
+	return 0;
+}
+
+// The same, adding both to the transcript
+static int send_message(int sock, EVP_MD_CTX *transcript, const char *header,
+						const unsigned char *body, size_t body_len) {
+	EVP_DigestUpdate(transcript, header, strlen(header));
+	EVP_DigestUpdate(transcript, body, body_len);
+	return write_frame_parts(sock, header, body, body_len);
+}
+
+// Read one message and add it to the transcript. *body points past the first line, which is
+// NUL terminated in place.
+static int read_message(int sock, EVP_MD_CTX *transcript, unsigned char **message,
+						const unsigned char **body, size_t *body_len) {
+	uint32_t len;
+	int rc = read_frame(sock, message, &len, HANDSHAKE_MAX_MESSAGE);
+	if (rc <= 0) {
+		if (rc == 0) fprintf(stderr, "Peer closed the connection during the handshake\n");
+		return -1;
+	}
+	EVP_DigestUpdate(transcript, *message, len);
+
+	unsigned char *newline = memchr(*message, '\n', len);
+	if (newline == NULL) {
+		fprintf(stderr, "Malformed handshake message\n");
+		free(*message);
+		*message = NULL;
+		return -1;
+	}
+	*newline = '\0';
+	*body = newline + 1;
+	*body_len = len - (*body - *message);
+	return 0;
+}
+
+// Request line up to the fields that differ per request, username is left out when NULL
+static void request_header(char *header, size_t header_len, const char *command, const char *username,
+						   int ktls_ciphers) {
+	char cipher_offer[PQCRYPTO_CIPHER_OFFER_SIZE];
+	char kem_list[KEM_OFFER_SIZE];
+
+	pqcrypto_cipher_offer(cipher_offer, sizeof(cipher_offer));
+	kem_offer(kem_list, sizeof(kem_list));
+	if (username == NULL) {
+		snprintf(header, header_len, "%s %s %s %d", command, cipher_offer, kem_list, ktls_ciphers);
+	} else {
+		snprintf(header, header_len, "%s %s %s %s %d", command, username, cipher_offer, kem_list, ktls_ciphers);
+	}
+}
+
+static int send_request(int sock, EVP_MD_CTX *transcript, const char *username, int ktls_ciphers,
+						const keypool_key_t *key) {
+	char header[BUFFER_SIZE];
+	size_t used;
+
+	request_header(header, sizeof(header), "CONNECT_REQUEST", username, ktls_ciphers);
+	used = strlen(header);
+	snprintf(header + used, sizeof(header) - used, " %s\n", kem_name(key->kem));
+	return send_message(sock, transcript, header, key->public_key, key->public_key_len);
+}
+
+static int send_resume(int sock, EVP_MD_CTX *transcript, const char *username, int ktls_ciphers,
+					   const unsigned char *random, const ticket_t *cached) {
+	char header[BUFFER_SIZE];
+	unsigned char body[HANDSHAKE_RANDOM_SIZE + TICKET_MAX_SIZE];
+
+	request_header(header, sizeof(header), "RESUME_REQUEST", username, ktls_ciphers);
+	strncat(header, "\n", sizeof(header) - strlen(header) - 1);
+	memcpy(body, random, HANDSHAKE_RANDOM_SIZE);
+	memcpy(body + HANDSHAKE_RANDOM_SIZE, cached->ticket, cached->ticket_len);
+	return send_message(sock, transcript, header, body, HANDSHAKE_RANDOM_SIZE + cached->ticket_len);
+}
+
+// Hash of the transcript so far, which keeps running
+static int transcript_peek(EVP_MD_CTX *transcript, unsigned char *hash) {
+	EVP_MD_CTX *copy = EVP_MD_CTX_new();
+	unsigned int hash_len;
+	int rc = copy != NULL && EVP_MD_CTX_copy_ex(copy, transcript) == 1 &&
+			 EVP_DigestFinal_ex(copy, hash, &hash_len) == 1 ? 0 : -1;
+	EVP_MD_CTX_free(copy);
+	return rc;
+}
+
+// The early flight: the request with a ciphertext for the peer's published key, then a record under
+// keys from the encapsulated secret holding our name and the hash of the request it belongs to
+static int send_early(int sock, EVP_MD_CTX *transcript, const char *username, int ktls_ciphers,
+					  const unsigned char *random, const directory_entry_t *peer_key, unsigned char *early_secret) {
+	encryption_context_t early_ctx;
+	char header[BUFFER_SIZE], key_id_hex[2 * DIRECTORY_KEY_ID_SIZE + 1];
+	unsigned char key_id[DIRECTORY_KEY_ID_SIZE];
+	unsigned char plaintext[TRANSCRIPT_HASH_SIZE + USERNAME_MAX_LENGTH];
+	unsigned char record[sizeof(plaintext) + PQCRYPTO_RECORD_OVERHEAD];
+	size_t ciphertext_len, record_len, name_len = strlen(username);
+	int rc = -1;
+
+	unsigned char *body = malloc(HANDSHAKE_RANDOM_SIZE + kem_handle(peer_key->kem)->length_ciphertext);
+	if (body == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	memset(&early_ctx, 0, sizeof(early_ctx));
+	memcpy(body, random, HANDSHAKE_RANDOM_SIZE);
+	if (name_len >= USERNAME_MAX_LENGTH ||
+		pqcrypto_encapsulate(&early_ctx, peer_key->kem, peer_key->public_key, peer_key->public_key_len,
+							 body + HANDSHAKE_RANDOM_SIZE, &ciphertext_len) != 0) {
+		goto out;
+	}
+	memcpy(early_secret, early_ctx.aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(&early_ctx, PQCRYPTO_AES_256_GCM, 1) != 0) goto out;
+
+	directory_key_id(peer_key->public_key, peer_key->public_key_len, key_id);
+	hex_encode(key_id, sizeof(key_id), key_id_hex);
+	request_header(header, sizeof(header), "EARLY_REQUEST", NULL, ktls_ciphers);
+	size_t used = strlen(header);
+	snprintf(header + used, sizeof(header) - used, " %s %s\n", kem_name(peer_key->kem), key_id_hex);
+	EVP_DigestUpdate(transcript, header, strlen(header));
+	EVP_DigestUpdate(transcript, body, HANDSHAKE_RANDOM_SIZE + ciphertext_len);
+
+	if (transcript_peek(transcript, plaintext) != 0) goto free_ctx;
+	memcpy(plaintext + TRANSCRIPT_HASH_SIZE, username, name_len);
+	if (pqcrypto_encrypt(&early_ctx, plaintext, TRANSCRIPT_HASH_SIZE + name_len, record, &record_len) != 0) {
+		goto free_ctx;
+	}
+	EVP_DigestUpdate(transcript, record, record_len);
+
+	// Both frames leave in one write, the acceptor has everything it needs from the first packet
+	uint32_t net_request_len = htonl(strlen(header) + HANDSHAKE_RANDOM_SIZE + ciphertext_len);
+	uint32_t net_record_len = htonl(record_len);
+	struct iovec iov[5] = {
+		{ &net_request_len, sizeof(net_request_len) },
+		{ header, strlen(header) },
+		{ body, HANDSHAKE_RANDOM_SIZE + ciphertext_len },
+		{ &net_record_len, sizeof(net_record_len) },
+		{ record, record_len },
+	};
+	if (write_all_iov(sock, iov, 5) != 0) {
+		perror("write");
+		goto free_ctx;
+	}
+	rc = 0;
+
+free_ctx:
+	pqcrypto_context_free(&early_ctx);
+out:
+	OPENSSL_cleanse(early_ctx.aes_key, AES_KEY_SIZE);
+	free(body);
+	return rc;
+}
+
+// Both ends end the handshake on the same transcript hash, the acceptor proves it has the session
+// keys by sealing it in the first record
+static int finish_transcript(EVP_MD_CTX *transcript, unsigned char *hash) {
+	unsigned int hash_len;
+	if (EVP_DigestFinal_ex(transcript, hash, &hash_len) != 1 || hash_len != TRANSCRIPT_HASH_SIZE) {
+		fprintf(stderr, "Failed to hash the handshake transcript\n");
+		return -1;
+	}
+	return 0;
+}
+
+// The peer's IP as text, ip needs INET6_ADDRSTRLEN bytes
+static int peer_host(int sock, char *ip, int *port) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+
+	if (getpeername(sock, (struct sockaddr *)&addr, &addr_len) != 0) {
+		return -1;
+	}
+	if (addr.ss_family == AF_INET) {
+		struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+		inet_ntop(AF_INET, &in->sin_addr, ip, INET6_ADDRSTRLEN);
+		*port = ntohs(in->sin_port);
+	} else if (addr.ss_family == AF_INET6) {
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+		inet_ntop(AF_INET6, &in6->sin6_addr, ip, INET6_ADDRSTRLEN);
+		*port = ntohs(in6->sin6_port);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static int peer_address(int sock, char *peer) {
+	char ip[INET6_ADDRSTRLEN];
+	int port;
+
+	if (peer_host(sock, ip, &port) != 0) return -1;
+	snprintf(peer, TICKET_PEER_SIZE, "%s:%d", ip, port);
+	return 0;
+}
+
+// Microseconds since *mark, which moves on to now
+static double lap_us(struct timespec *mark) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double us = (double)(now.tv_sec - mark->tv_sec) * 1e6 + (double)(now.tv_nsec - mark->tv_nsec) / 1e3;
+	*mark = now;
+	return us;
+}
+
+static double elapsed_us(struct timespec start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+// The acceptor handed out a puzzle and hung up. Solve it, reconnect to the same address in place of
+// sock and send the solution, the request goes again after it on a fresh transcript.
+static int answer_puzzle(int sock, EVP_MD_CTX *transcript, const unsigned char *cookie, size_t cookie_len) {
+	unsigned char solution[PUZZLE_COOKIE_SIZE + PUZZLE_NONCE_SIZE];
+	char ip[INET6_ADDRSTRLEN];
+	int port;
+
+	if (peer_host(sock, ip, &port) != 0 ||
+		puzzle_solve(cookie, cookie_len, solution + PUZZLE_COOKIE_SIZE) != 0) {
+		return -1;
+	}
+	memcpy(solution, cookie, PUZZLE_COOKIE_SIZE);
+
+	// The caller keeps using the same descriptor
+	int fresh = connect_to_peer(ip, port);
+	if (fresh < 0) return -1;
+	if (dup2(fresh, sock) < 0) {
+		perror("dup2");
+		close(fresh);
+		return -1;
+	}
+	close(fresh);
+	if (USE_KTLS) ktls_offer(sock);
+
+	if (EVP_DigestInit_ex(transcript, EVP_sha256(), NULL) != 1 ||
+		write_frame_parts(sock, "SOLUTION\n", solution, sizeof(solution)) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int handshake_dial(int sock, const char *username, const directory_entry_t *peer_key, struct chat_info *chat) {
+	return handshake_dial_timed(sock, username, peer_key, chat, NULL);
+}
+
+int handshake_dial_timed(int sock, const char *username, const directory_entry_t *peer_key, struct chat_info *chat,
+						 handshake_phases_t *phases) {
+	EVP_MD_CTX *transcript = transcript_new();
+	keypool_key_t key = { 0 };
+	ticket_t cached;
+	char peer[TICKET_PEER_SIZE] = "";
+	unsigned char randoms[2 * HANDSHAKE_RANDOM_SIZE];
+	unsigned char early_secret[AES_KEY_SIZE];
+	unsigned char *reply = NULL, *confirm = NULL;
+	const unsigned char *body;
+	size_t body_len;
+	struct timespec start, mark;
+	handshake_phases_t ignored;
+	time_t expires;
+	int share = kem_preferred();
+	int ktls_ciphers = USE_KTLS ? ktls_offer(sock) : 0;
+	int keyed = 0, puzzled = 0, rc = -1;
+
+	if (transcript == NULL) return -1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (phases == NULL) phases = &ignored;
+	memset(phases, 0, sizeof(*phases));
+
+	// Resume with the ticket from our last session with this address if it is still good, else
+	// encapsulate to the key the peer published if there is one
+	int tickets = ticket_lifetime() > 0 && peer_address(sock, peer) == 0;
+	int mode = DIAL_FULL;
+	if (tickets && ticket_lookup(peer, &cached) == 0) {
+		mode = DIAL_RESUME;
+	} else if (peer_key != NULL && kem_handle(peer_key->kem) != NULL) {
+		mode = DIAL_EARLY;
+	}
+
+	// Otherwise the key share goes out with the request, so the acceptor can key the session in its answer
+	for (int attempt = 0; attempt < 2; attempt++) {
+		clock_gettime(CLOCK_MONOTONIC, &mark);
+		if (mode == DIAL_RESUME) {
+			if (RAND_bytes(randoms, HANDSHAKE_RANDOM_SIZE) != 1 ||
+				send_resume(sock, transcript, username, ktls_ciphers, randoms, &cached) != 0) {
+				goto out;
+			}
+		} else if (mode == DIAL_EARLY) {
+			if (RAND_bytes(randoms, HANDSHAKE_RANDOM_SIZE) != 1 ||
+				send_early(sock, transcript, username, ktls_ciphers, randoms, peer_key, early_secret) != 0) {
+				goto out;
+			}
+		} else {
+			if (key.public_key == NULL) {
+				if (keypool_take(share, &key) != 0) goto out;
+				phases->keygen_us += lap_us(&mark);
+			}
+			if (send_request(sock, transcript, username, ktls_ciphers, &key) != 0) goto out;
+		}
+		if (read_message(sock, transcript, &reply, &body, &body_len) != 0) goto out;
+		phases->exchange_us += lap_us(&mark);
+
+		// A busy acceptor wants proof of work before it spends any KEM time on us, once
+		if (!puzzled && strncmp((char *)reply, "PUZZLE ", 7) == 0) {
+			if (mode == DIAL_EARLY) OPENSSL_cleanse(early_secret, sizeof(early_secret));
+			if (answer_puzzle(sock, transcript, body, body_len) != 0) goto out;
+			phases->exchange_us += lap_us(&mark);
+			puzzled = 1;
+			attempt--;
+			free(reply);
+			reply = NULL;
+			continue;
+		}
+		if (attempt > 0 || strncmp((char *)reply, "RETRY ", 6) != 0) break;
+
+		// The acceptor refused the ticket, no longer holds the key we encapsulated to or wants a
+		// stronger KEM than our share, try once more with a share of the one it named
+		share = kem_from_name((char *)reply + 6);
+		if (kem_handle(share) == NULL) {
+			fprintf(stderr, "Peer asked for a KEM we did not offer\n");
+			goto out;
+		}
+		if (mode == DIAL_RESUME) {
+			ticket_forget(peer, 1);
+		} else if (mode == DIAL_FULL) {
+			keypool_release(&key);
+		}
+		mode = DIAL_FULL;
+		free(reply);
+		reply = NULL;
+	}
+
+	if (strcmp((char *)reply, "DENY") == 0) {
+		rc = HANDSHAKE_DENIED;
+		goto out;
+	}
+
+	char cipher_name[64], kem_choice[64];
+	int ktls;
+	if (mode == DIAL_RESUME && sscanf((char *)reply, "RESUMED %63s %d", cipher_name, &ktls) == 2 &&
+		body_len == HANDSHAKE_RANDOM_SIZE) {
+		chat->kem = cached.kem;
+		chat->resumed = 1;
+		expires = cached.expires;
+	} else if (mode != DIAL_RESUME && sscanf((char *)reply, "ACCEPT %63s %63s %d", cipher_name, kem_choice, &ktls) == 3) {
+		chat->kem = kem_from_name(kem_choice);
+		chat->resumed = 0;
+		expires = time(NULL) + ticket_lifetime();
+		if (chat->kem != (mode == DIAL_EARLY ? peer_key->kem : share) ||
+			(mode == DIAL_EARLY && body_len != HANDSHAKE_RANDOM_SIZE)) {
+			fprintf(stderr, "Peer answered with a KEM we did not share\n");
+			goto out;
+		}
+	} else {
+		fprintf(stderr, "Unexpected handshake answer: %s\n", reply);
+		goto out;
+	}
+	chat->cipher = pqcrypto_cipher_from_name(cipher_name);
+	chat->ktls = ktls && chat->cipher >= 0 && ((ktls_ciphers >> chat->cipher) & 1);
+	chat->ktls_rx = chat->ktls ? -1 : 0;
+	chat->initiator = 1;
+	if (chat->cipher < 0 || ktls != chat->ktls) {
+		fprintf(stderr, "Peer answered with choices we did not offer\n");
+		goto out;
+	}
+
+	unsigned char expected[TRANSCRIPT_HASH_SIZE], plaintext[CONFIRM_SIZE + PQCRYPTO_RECORD_OVERHEAD];
+	size_t plaintext_len;
+	uint32_t confirm_len;
+	if (finish_transcript(transcript, expected) != 0) goto out;
+	clock_gettime(CLOCK_MONOTONIC, &mark);
+	if (mode == DIAL_RESUME) {
+		memcpy(randoms + HANDSHAKE_RANDOM_SIZE, body, HANDSHAKE_RANDOM_SIZE);
+		if (pqcrypto_derive_session_secret(&chat->enc_ctx, cached.psk, randoms, sizeof(randoms)) != 0) goto out;
+		// Tickets are used once, the confirmation brings the next one
+		ticket_forget(peer, 0);
+	} else if (mode == DIAL_EARLY) {
+		memcpy(randoms + HANDSHAKE_RANDOM_SIZE, body, HANDSHAKE_RANDOM_SIZE);
+		if (pqcrypto_derive_session_secret(&chat->enc_ctx, early_secret, randoms, sizeof(randoms)) != 0) goto out;
+	} else if (pqcrypto_derive_shared_secret(&chat->enc_ctx, chat->kem, body, body_len, key.secret_key) != 0) {
+		goto out;
+	}
+	if (pqcrypto_context_init(&chat->enc_ctx, chat->cipher, 1) != 0) goto out;
+	keyed = 1;
+	phases->decaps_us = lap_us(&mark);
+
+	// The confirmation record was sent in the same flight as the answer
+	if (read_frame(sock, &confirm, &confirm_len, HANDSHAKE_MAX_MESSAGE) != 1 ||
+		confirm_len > sizeof(plaintext) ||
+		pqcrypto_decrypt(&chat->enc_ctx, confirm, confirm_len, plaintext, &plaintext_len) != 0 ||
+		plaintext_len < TRANSCRIPT_HASH_SIZE || CRYPTO_memcmp(plaintext, expected, TRANSCRIPT_HASH_SIZE) != 0) {
+		fprintf(stderr, "Handshake confirmation failed, the messages were altered in transit\n");
+		goto out;
+	}
+	phases->confirm_us = lap_us(&mark);
+
+	// Keep the new ticket for the next time we dial this address
+	if (tickets && plaintext_len > TRANSCRIPT_HASH_SIZE) {
+		ticket_t fresh;
+		fresh.ticket_len = plaintext_len - TRANSCRIPT_HASH_SIZE;
+		memcpy(fresh.ticket, plaintext + TRANSCRIPT_HASH_SIZE, fresh.ticket_len);
+		fresh.kem = chat->kem;
+		fresh.expires = expires;
+		if (pqcrypto_resumption_psk(&chat->enc_ctx, fresh.psk) == 0) ticket_store(peer, &fresh);
+		OPENSSL_cleanse(&fresh, sizeof(fresh));
+	}
+
+	// Each end tries to hand its sending side to the kernel, the other sees from the first record
+	// whether it did
+	if (chat->ktls) chat->ktls = ktls_start_sending(sock, &chat->enc_ctx, 1);
+	ticket_record_handshake(chat->resumed, elapsed_us(start));
+	rc = 0;
+
+out:
+	if (rc != 0 && keyed) pqcrypto_context_free(&chat->enc_ctx);
+	if (key.public_key != NULL) keypool_release(&key);
+	OPENSSL_cleanse(&cached, sizeof(cached));
+	OPENSSL_cleanse(early_secret, sizeof(early_secret));
+	free(reply);
+	free(confirm);
+	EVP_MD_CTX_free(transcript);
+	return rc;
+}
+
+static int parse_request(handshake_request_t *request, const unsigned char *body, size_t body_len) {
+	char share_name[64];
+	const char *message = (const char *)request->message;
+
+	request->share_kem = -1;
+	request->public_key = NULL;
+	request->public_key_len = 0;
+	request->random = NULL;
+	request->ticket = NULL;
+	request->ticket_len = 0;
+	request->resume = strncmp(message, "RESUME_REQUEST ", 15) == 0;
+	request->early = strncmp(message, "EARLY_REQUEST ", 14) == 0;
+
+	if (request->early) {
+		char key_id_hex[2 * DIRECTORY_KEY_ID_SIZE + 1];
+		// The username arrives encrypted in the record that follows, see read_early()
+		if (sscanf(message, "EARLY_REQUEST %127s %255s %d %63s %16s", request->cipher_offer, request->kem_offer,
+				   &request->ktls_ciphers, share_name, key_id_hex) != 5 ||
+			hex_decode(key_id_hex, strlen(key_id_hex), request->key_id, DIRECTORY_KEY_ID_SIZE) != DIRECTORY_KEY_ID_SIZE ||
+			body_len <= HANDSHAKE_RANDOM_SIZE) {
+			fprintf(stderr, "Malformed early request\n");
+			return -1;
+		}
+		request->username[0] = '\0';
+		request->share_kem = kem_from_name(share_name);
+		request->random = body;
+		request->public_key = body + HANDSHAKE_RANDOM_SIZE;
+		request->public_key_len = body_len - HANDSHAKE_RANDOM_SIZE;
+		return 0;
+	}
+
+	if (request->resume) {
+		if (sscanf(message, "RESUME_REQUEST %49s %127s %255s %d", request->username, request->cipher_offer,
+				   request->kem_offer, &request->ktls_ciphers) != 4 || body_len <= HANDSHAKE_RANDOM_SIZE) {
+			fprintf(stderr, "Malformed resumption request\n");
+			return -1;
+		}
+		request->random = body;
+		request->ticket = body + HANDSHAKE_RANDOM_SIZE;
+		request->ticket_len = body_len - HANDSHAKE_RANDOM_SIZE;
+		return 0;
+	}
+
+	if (sscanf(message, "CONNECT_REQUEST %49s %127s %255s %d %63s", request->username,
+			   request->cipher_offer, request->kem_offer, &request->ktls_ciphers, share_name) != 5) {
+		fprintf(stderr, "Malformed connection request\n");
+		return -1;
+	}
+	request->share_kem = kem_from_name(share_name);
+	request->public_key = body;
+	request->public_key_len = body_len;
+	return 0;
+}
+
+// Read the record that follows an early request and take the username from it. Returns -1 if the
+// ciphertext was for a key we no longer hold or the record doesn't open, the caller falls back to a
+// key share.
+static int read_early(int sock, handshake_request_t *request) {
+	encryption_context_t early_ctx;
+	unsigned char hash[TRANSCRIPT_HASH_SIZE];
+	unsigned char plaintext[TRANSCRIPT_HASH_SIZE + USERNAME_MAX_LENGTH + PQCRYPTO_RECORD_OVERHEAD];
+	unsigned char *record = NULL;
+	uint32_t record_len;
+	size_t plaintext_len;
+	int rc = -1;
+
+	// The record seals the hash of the request before it, so take that before hashing the record
+	if (transcript_peek(request->transcript, hash) != 0 ||
+		read_frame(sock, &record, &record_len, sizeof(plaintext)) <= 0) {
+		free(record);
+		return -1;
+	}
+	EVP_DigestUpdate(request->transcript, record, record_len);
+
+	memset(&early_ctx, 0, sizeof(early_ctx));
+	if (directory_decapsulate(&early_ctx, request->share_kem, request->key_id,
+							  request->public_key, request->public_key_len) != 0) {
+		goto out;
+	}
+	memcpy(request->early_secret, early_ctx.aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(&early_ctx, PQCRYPTO_AES_256_GCM, 0) != 0) goto out;
+	if (pqcrypto_decrypt(&early_ctx, record, record_len, plaintext, &plaintext_len) == 0 &&
+		plaintext_len > TRANSCRIPT_HASH_SIZE && plaintext_len < TRANSCRIPT_HASH_SIZE + USERNAME_MAX_LENGTH &&
+		CRYPTO_memcmp(plaintext, hash, TRANSCRIPT_HASH_SIZE) == 0) {
+		memcpy(request->username, plaintext + TRANSCRIPT_HASH_SIZE, plaintext_len - TRANSCRIPT_HASH_SIZE);
+		request->username[plaintext_len - TRANSCRIPT_HASH_SIZE] = '\0';
+		rc = 0;
+	}
+	pqcrypto_context_free(&early_ctx);
+
+out:
+	OPENSSL_cleanse(early_ctx.aes_key, AES_KEY_SIZE);
+	OPENSSL_cleanse(plaintext, sizeof(plaintext));
+	free(record);
+	return rc;
+}
+
+// Whether the message just read is the solution to a puzzle we handed out to this address
+static int solved_puzzle(int sock, const handshake_request_t *request, const unsigned char *body, size_t body_len) {
+	char ip[INET6_ADDRSTRLEN];
+	int port;
+
+	if (strcmp((char *)request->message, "SOLUTION") != 0) return 0;
+	return body_len == PUZZLE_COOKIE_SIZE + PUZZLE_NONCE_SIZE && peer_host(sock, ip, &port) == 0 &&
+		   puzzle_verify(ip, body, PUZZLE_COOKIE_SIZE, body + PUZZLE_COOKIE_SIZE) == 0;
+}
+
+// Answer with a puzzle instead of doing any KEM work. The connection is closed after it, the dialer
+// comes back with the solution.
+static void demand_work(int sock, int bits) {
+	char ip[INET6_ADDRSTRLEN], header[32];
+	unsigned char cookie[PUZZLE_COOKIE_SIZE];
+	int port;
+
+	if (peer_host(sock, ip, &port) != 0 || puzzle_issue(ip, bits, cookie) != 0) return;
+	snprintf(header, sizeof(header), "PUZZLE %d\n", bits);
+	write_frame_parts(sock, header, cookie, sizeof(cookie));
+}
+
+int handshake_read_request(int sock, int puzzle_bits, handshake_request_t *request) {
+	const unsigned char *body;
+	size_t body_len;
+
+	memset(request, 0, sizeof(*request));
+	request->transcript = transcript_new();
+	if (request->transcript == NULL ||
+		read_message(sock, request->transcript, &request->message, &body, &body_len) != 0) {
+		handshake_request_free(request);
+		return -1;
+	}
+
+	// A dialer coming back with a solution goes ahead of the queue's demands, the request follows it
+	int solved = solved_puzzle(sock, request, body, body_len);
+	if (strcmp((char *)request->message, "SOLUTION") == 0) {
+		free(request->message);
+		request->message = NULL;
+		if (EVP_DigestInit_ex(request->transcript, EVP_sha256(), NULL) != 1 ||
+			read_message(sock, request->transcript, &request->message, &body, &body_len) != 0) {
+			handshake_request_free(request);
+			return -1;
+		}
+	}
+	if (parse_request(request, body, body_len) != 0) {
+		handshake_request_free(request);
+		return -1;
+	}
+	if (puzzle_bits > 0 && !solved) {
+		// Closing with the early record unread would reset the connection and lose the puzzle
+		unsigned char *record = NULL;
+		uint32_t record_len;
+		if (request->early) read_frame(sock, &record, &record_len, HANDSHAKE_MAX_MESSAGE);
+		free(record);
+		demand_work(sock, puzzle_bits);
+		handshake_request_free(request);
+		return HANDSHAKE_PUZZLED;
+	}
+
+	if (request->early && read_early(sock, request) != 0) {
+		// Most likely the dialer resolved a key we have since rotated out, have it send a share
+		int kem = kem_select(request->kem_offer);
+		char header[BUFFER_SIZE];
+
+		request->early = 0;
+		OPENSSL_cleanse(request->early_secret, sizeof(request->early_secret));
+		if (kem < 0) {
+			fprintf(stderr, "Early request offers no KEM we support\n");
+			handshake_deny(sock);
+			handshake_request_free(request);
+			return -1;
+		}
+		snprintf(header, sizeof(header), "RETRY %s\n", kem_name(kem));
+		free(request->message);
+		request->message = NULL;
+		if (send_message(sock, request->transcript, header, NULL, 0) != 0 ||
+			read_message(sock, request->transcript, &request->message, &body, &body_len) != 0 ||
+			parse_request(request, body, body_len) != 0 ||
+			request->resume || request->early) {
+			handshake_request_free(request);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int handshake_accept(int sock, handshake_request_t *request, struct chat_info *chat) {
+	char header[BUFFER_SIZE];
+	const unsigned char *body;
+	size_t body_len;
+	unsigned char psk[TICKET_PSK_SIZE];
+	time_t expires;
+	int kem, rc = -1;
+
+	int cipher = pqcrypto_cipher_select(request->cipher_offer);
+	int resumed = request->resume && ticket_lifetime() > 0 &&
+				  ticket_open(request->ticket, request->ticket_len, psk, &kem, &expires) == 0 &&
+				  kem_cost(kem) != NULL;
+	if (request->early) {
+		// The dialer already encapsulated to our published key, which is for our preferred KEM
+		kem = request->share_kem;
+	} else if (!resumed) {
+		kem = request->resume ? kem_select(request->kem_offer) : kem_accept_share(request->share_kem, request->kem_offer);
+	}
+	if (kem < 0) {
+		fprintf(stderr, "'%s' offers no KEM we support\n", request->username);
+		handshake_deny(sock);
+		return -1;
+	}
+
+	if (!resumed && !request->early && kem != request->share_kem) {
+		// Ask for a share of the KEM we want, the one case that costs a second round trip
+		snprintf(header, sizeof(header), "RETRY %s\n", kem_name(kem));
+		free(request->message);
+		request->message = NULL;
+		if (send_message(sock, request->transcript, header, NULL, 0) != 0 ||
+			read_message(sock, request->transcript, &request->message, &body, &body_len) != 0 ||
+			parse_request(request, body, body_len) != 0) {
+			return -1;
+		}
+		if (request->share_kem != kem) {
+			fprintf(stderr, "Peer retried with the wrong KEM\n");
+			return -1;
+		}
+	}
+
+	unsigned char random[HANDSHAKE_RANDOM_SIZE];
+	unsigned char *ciphertext = NULL;
+	const unsigned char *answer;
+	size_t answer_len;
+	unsigned char hash[TRANSCRIPT_HASH_SIZE];
+	unsigned char plaintext[CONFIRM_SIZE];
+	size_t plaintext_len = TRANSCRIPT_HASH_SIZE, ticket_len;
+	unsigned char confirm[CONFIRM_SIZE + PQCRYPTO_RECORD_OVERHEAD];
+	size_t confirm_len;
+
+	chat->cipher = cipher;
+	chat->kem = kem;
+	chat->resumed = resumed;
+	chat->initiator = 0;
+	chat->ktls = USE_KTLS && ((request->ktls_ciphers >> cipher) & 1) && ((ktls_offer(sock) >> cipher) & 1);
+	chat->ktls_rx = chat->ktls ? -1 : 0;
+
+	if (resumed || request->early) {
+		// The ticket or the early secret stands in for the KEM, both randoms keep the keys fresh
+		unsigned char randoms[2 * HANDSHAKE_RANDOM_SIZE];
+		memcpy(randoms, request->random, HANDSHAKE_RANDOM_SIZE);
+		if (RAND_bytes(random, sizeof(random)) != 1) goto out;
+		memcpy(randoms + HANDSHAKE_RANDOM_SIZE, random, HANDSHAKE_RANDOM_SIZE);
+		if (pqcrypto_derive_session_secret(&chat->enc_ctx, resumed ? psk : request->early_secret,
+										   randoms, sizeof(randoms)) != 0) {
+			goto out;
+		}
+		if (resumed) {
+			snprintf(header, sizeof(header), "RESUMED %s %d\n", pqcrypto_cipher_name(cipher), chat->ktls);
+		} else {
+			snprintf(header, sizeof(header), "ACCEPT %s %s %d\n", pqcrypto_cipher_name(cipher), kem_name(kem), chat->ktls);
+			expires = time(NULL) + ticket_lifetime();
+		}
+		answer = random;
+		answer_len = sizeof(random);
+	} else {
+		ciphertext = malloc(kem_handle(kem)->length_ciphertext);
+		if (ciphertext == NULL) {
+			perror("malloc");
+			goto out;
+		}
+		if (pqcrypto_encapsulate(&chat->enc_ctx, kem, request->public_key, request->public_key_len,
+								 ciphertext, &answer_len) != 0) {
+			goto out;
+		}
+		snprintf(header, sizeof(header), "ACCEPT %s %s %d\n", pqcrypto_cipher_name(cipher), kem_name(kem), chat->ktls);
+		answer = ciphertext;
+		expires = time(NULL) + ticket_lifetime();
+	}
+
+	EVP_DigestUpdate(request->transcript, header, strlen(header));
+	EVP_DigestUpdate(request->transcript, answer, answer_len);
+	if (finish_transcript(request->transcript, hash) != 0 ||
+		pqcrypto_context_init(&chat->enc_ctx, cipher, 0) != 0) {
+		goto out;
+	}
+
+	// The confirmation carries a ticket for the dialer's next connection. A resumed session passes on
+	// the expiry of the ticket it came from, only a KEM exchange starts a new lifetime.
+	memcpy(plaintext, hash, TRANSCRIPT_HASH_SIZE);
+	if (ticket_lifetime() > 0 && pqcrypto_resumption_psk(&chat->enc_ctx, psk) == 0 &&
+		ticket_issue(psk, kem, expires, plaintext + TRANSCRIPT_HASH_SIZE, &ticket_len) == 0) {
+		plaintext_len += ticket_len;
+	}
+	if (pqcrypto_encrypt(&chat->enc_ctx, plaintext, plaintext_len, confirm, &confirm_len) != 0) {
+		pqcrypto_context_free(&chat->enc_ctx);
+		goto out;
+	}
+
+	// The answer and the first record leave together
+	uint32_t net_answer_len = htonl(strlen(header) + answer_len);
+	uint32_t net_confirm_len = htonl(confirm_len);
+	struct iovec iov[5] = {
+		{ &net_answer_len, sizeof(net_answer_len) },
+		{ header, strlen(header) },
+		{ (void *)answer, answer_len },
+		{ &net_confirm_len, sizeof(net_confirm_len) },
+		{ confirm, confirm_len },
+	};
+	if (write_all_iov(sock, iov, 5) != 0) {
+		perror("write");
+		pqcrypto_context_free(&chat->enc_ctx);
+		goto out;
+	}
+
+	if (chat->ktls) chat->ktls = ktls_start_sending(sock, &chat->enc_ctx, 0);
+	rc = 0;
+
+out:
+	OPENSSL_cleanse(psk, sizeof(psk));
+	OPENSSL_cleanse(plaintext, sizeof(plaintext));
+	free(ciphertext);
+	return rc;
+}
+
+int handshake_deny(int sock) {
+	const char *deny = "DENY\n";
+	return write_frame(sock, deny, strlen(deny));
+}
+
+void handshake_request_free(handshake_request_t *request) {
+	OPENSSL_cleanse(request->early_secret, sizeof(request->early_secret));
+	free(request->message);
+	request->message = NULL;
+	EVP_MD_CTX_free(request->transcript);
+	request->transcript = NULL;
+}
@@ -0,0 +1,103 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include "chat.h"
+#include "kem.h"
+#include "ticket.h"
+#include "directory.h"
+#include <openssl/evp.h>
+
+// One round trip connection handshake. Every message is one length-prefixed frame.
+//
+//   dialer:   CONNECT_REQUEST <username> <cipher offer> <kem offer> <ktls ciphers> <share kem>\n
+//             followed by a public key for <share kem>, picked by the dialer's policy
+//         or: RESUME_REQUEST <username> <cipher offer> <kem offer> <ktls ciphers>\n followed by a
+//             random and the ticket the acceptor issued in an earlier session, see ticket.h
+//         or: EARLY_REQUEST <cipher offer> <kem offer> <ktls ciphers> <kem> <key id>\n followed by
+//             a random and a ciphertext for the key the acceptor published in the directory, see
+//             directory.h, and in the same flight an AES-256-GCM record under keys from that secret
+//             holding the username, so the acceptor reads encrypted data from the very first packet
+//   acceptor: ACCEPT <cipher> <kem> <ktls>\n followed by the KEM ciphertext, or by a random when
+//             answering EARLY_REQUEST
+//         or: RESUMED <cipher> <ktls>\n followed by a random, when the ticket is good and unused
+//             Either way the same flight carries a first record under the new session keys holding
+//             a hash of the transcript and a new resumption ticket.
+//         or: RETRY <kem>\n when the share or ticket can't be used, the dialer sends a new request
+//             with a share for that KEM (the only case that takes a second round trip)
+//         or: DENY\n
+//         or: PUZZLE <bits>\n followed by a cookie when the acceptor is busy, see puzzle.h, and
+//             the connection is closed. The dialer reconnects and sends SOLUTION\n followed by the
+//             cookie and a nonce that solves it, then its request again. The transcript starts
+//             after the solution.
+//
+// The session is keyed as soon as ACCEPT or RESUMED arrives and the dialer can send straight away.
+// The kTLS offer rides along, so no separate exchange is needed before the first message either.
+// Either end whose kernel then refuses the keys seals its records in user space, the other end
+// tells which from the first byte it receives (see ktls_start_receiving()).
+// A resumed session skips the KEM: its secret comes from the ticket's PSK and both randoms. An early
+// session skips the key share: its secret comes from the encapsulated secret and both randoms. The
+// early record can be replayed, so it carries nothing but the dialer's name.
+#define HANDSHAKE_MAX_MESSAGE (64 * 1024)
+#define HANDSHAKE_DENIED 1
+#define HANDSHAKE_PUZZLED 2
+#define HANDSHAKE_RANDOM_SIZE 32
+
+// The dialer's request as the acceptor received it
+typedef struct {
+	char username[USERNAME_MAX_LENGTH];
+	char cipher_offer[PQCRYPTO_CIPHER_OFFER_SIZE];
+	char kem_offer[KEM_OFFER_SIZE];
+	int ktls_ciphers;             // ciphers the dialer's kernel can take, bit 1 << cipher
+	int share_kem;                // KEM of the key share or published key, -1 if unknown or none
+	const unsigned char *public_key; // the key share, or the ciphertext of an early request
+	size_t public_key_len;
+	int resume;                   // RESUME_REQUEST, random and ticket are set instead of the share
+	int early;                    // EARLY_REQUEST, random and early_secret are set instead of the share
+	const unsigned char *random;
+	const unsigned char *ticket;
+	size_t ticket_len;
+	unsigned char key_id[DIRECTORY_KEY_ID_SIZE]; // published key an early request encapsulated to
+	unsigned char early_secret[AES_KEY_SIZE];
+	unsigned char *message;       // the frame, public_key, random and ticket point into it
+	EVP_MD_CTX *transcript;       // hash of every handshake message so far
+} handshake_request_t;
+
+// Dial side: send the request and complete the handshake, resuming with a cached ticket for the
+// peer's address when there is one and otherwise encapsulating to peer_key when the peer published
+// one (NULL if not). On success the session secret, cipher, KEM and kTLS choice are set in chat and
+// its encryption context is initialized. Returns 0, HANDSHAKE_DENIED if the peer declined and -1 on
+// error.
+int handshake_dial(int sock, const char *username, const directory_entry_t *peer_key, struct chat_info *chat);
+
+// Where a dial's time went, in microseconds. Phases a resumed or early dial skips stay 0.
+typedef struct {
+	double keygen_us;    // key share taken from the pool, or generated when it had none ready
+	double exchange_us;  // request out until the answer is in, the acceptor's KEM work and any puzzle included
+	double decaps_us;    // session secret derived and the record cipher keyed
+	double confirm_us;   // the acceptor's confirmation record read and checked
+} handshake_phases_t;
+
+// handshake_dial() that also reports its phases
+int handshake_dial_timed(int sock, const char *username, const directory_entry_t *peer_key, struct chat_info *chat,
+						 handshake_phases_t *phases);
+
+// Accept side: read the dialer's request, so the user can be asked about it. With puzzle_bits > 0 a
+// dialer that didn't bring a solution gets a puzzle of that difficulty instead, before any KEM work
+// is done for it, and HANDSHAKE_PUZZLED is returned. An early request for a key we no longer hold
+// is answered with RETRY here, so username is always known on success. Returns 0, HANDSHAKE_PUZZLED
+// or -1.
+int handshake_read_request(int sock, int puzzle_bits, handshake_request_t *request);
+
+// Accept the request and key chat like handshake_dial() does. Returns 0 or -1.
+int handshake_accept(int sock, handshake_request_t *request, struct chat_info *chat);
+
+// Decline the request
+int handshake_deny(int sock);
+
+void handshake_request_free(handshake_request_t *request);
+
+#endif // HANDSHAKE_H
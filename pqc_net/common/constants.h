@@ -8,5 +8,9 @@
 #define USERNAME_MAX_LENGTH 50
 #define BUFFER_SIZE 1024
 #define IP_STR_LEN 16
+#define CONNECT_TIMEOUT_MS 3000
+#define MAX_FRAME_SIZE (64 * 1024 + 64) // 64 KiB payload plus record overhead
+#define DIRECTORY_KEY_MAX 1568 // largest KEM public key the routing server publishes (ML-KEM-1024)
+#define DIRECTORY_LINE_MAX (2 * DIRECTORY_KEY_MAX + 256) // REGISTER or RESOLVED line with a hex key
 
 #endif // CONSTANTS_H
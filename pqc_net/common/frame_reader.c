@@ -0,0 +1,93 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "frame_reader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+int frame_reader_init(frame_reader_t *fr, int sock, size_t max_frame) {
+	memset(fr, 0, sizeof(*fr));
+	fr->sock = sock;
+	fr->max_frame = max_frame;
+
+	// Room for two maximum frames so a full frame normally fits behind a partial one
+	fr->capacity = 2 * (FRAME_HEADER_SIZE + max_frame);
+	fr->buf = malloc(fr->capacity);
+	if (fr->buf == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	return 0;
+}
+
+void frame_reader_free(frame_reader_t *fr) {
+	free(fr->buf);
+	fr->buf = NULL;
+}
+
+int frame_reader_take(frame_reader_t *fr, unsigned char **frame, size_t *frame_len) {
+	size_t buffered = fr->end - fr->start;
+
+	// Hand out a frame as soon as it is completely buffered
+	if (buffered >= FRAME_HEADER_SIZE) {
+		uint32_t net_len;
+		memcpy(&net_len, fr->buf + fr->start, sizeof(net_len));
+		size_t len = ntohl(net_len);
+
+		if (len > fr->max_frame) {
+			fprintf(stderr, "Rejecting %zu byte frame, limit is %zu\n", len, fr->max_frame);
+			return -1;
+		}
+
+		if (buffered >= FRAME_HEADER_SIZE + len) {
+			*frame = fr->buf + fr->start + FRAME_HEADER_SIZE;
+			*frame_len = len;
+			fr->start += FRAME_HEADER_SIZE + len;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+ssize_t frame_reader_fill(frame_reader_t *fr) {
+	size_t buffered = fr->end - fr->start;
+
+	// Keep frames contiguous: wrap the partial frame back to the front once the tail
+	// can no longer hold a maximum-sized one. This moves at most one partial frame.
+	if (fr->start == fr->end) {
+		fr->start = fr->end = 0;
+	} else if (fr->capacity - fr->start < FRAME_HEADER_SIZE + fr->max_frame) {
+		memmove(fr->buf, fr->buf + fr->start, buffered);
+		fr->start = 0;
+		fr->end = buffered;
+	}
+
+	// Pull in whatever the socket has, possibly several frames at once
+	ssize_t bytes_read;
+	do {
+		bytes_read = read(fr->sock, fr->buf + fr->end, fr->capacity - fr->end);
+	} while (bytes_read < 0 && errno == EINTR);
+	if (bytes_read < 0) return -1;
+	if (bytes_read == 0 && fr->end != fr->start) {
+		fprintf(stderr, "Connection closed mid-frame\n");
+		errno = ECONNRESET;
+		return -1;
+	}
+	fr->end += bytes_read;
+	return bytes_read;
+}
+
+int frame_reader_next(frame_reader_t *fr, unsigned char **frame, size_t *frame_len) {
+	while (1) {
+		int rc = frame_reader_take(fr, frame, frame_len);
+		if (rc != 0) return rc;
+
+		ssize_t bytes_read = frame_reader_fill(fr);
+		if (bytes_read <= 0) return (int)bytes_read;
+	}
+}
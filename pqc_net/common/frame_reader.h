@@ -0,0 +1,39 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef FRAME_READER_H
+#define FRAME_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FRAME_HEADER_SIZE 4 // 32-bit big-endian payload length
+
+// Per-session receive buffer that reassembles length-prefixed frames across partial reads
+typedef struct {
+	int sock;
+	unsigned char *buf;
+	size_t capacity;
+	size_t start;     // first byte not yet handed out
+	size_t end;       // one past the last byte read from the socket
+	size_t max_frame; // largest payload accepted from the peer
+} frame_reader_t;
+
+int frame_reader_init(frame_reader_t *fr, int sock, size_t max_frame);
+void frame_reader_free(frame_reader_t *fr);
+
+// Get the next complete frame. Returns 1 and points *frame at the payload inside the reader's
+// buffer (writable, valid until the next call), 0 on orderly shutdown, -1 on error or if the
+// peer announced a frame larger than max_frame.
+int frame_reader_next(frame_reader_t *fr, unsigned char **frame, size_t *frame_len);
+
+// The two halves of frame_reader_next() for non-blocking sockets. frame_reader_take() returns 1
+// with the next buffered frame, 0 if none is complete yet, -1 for an oversized one.
+// frame_reader_fill() does one read: bytes read, 0 on orderly shutdown, -1 with errno set on error
+// (EAGAIN when the socket has nothing).
+int frame_reader_take(frame_reader_t *fr, unsigned char **frame, size_t *frame_len);
+ssize_t frame_reader_fill(frame_reader_t *fr);
+
+#endif // FRAME_READER_H
@@ -0,0 +1,279 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "mux.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+int mux_init(mux_t *mux) {
+	memset(mux, 0, sizeof(*mux));
+	pthread_mutex_init(&mux->lock, NULL);
+	return 0;
+}
+
+void mux_free(mux_t *mux) {
+	for (int i = 0; i < MUX_MAX_STREAMS; i++) {
+		free(mux->streams[i].queue);
+		if (mux->streams[i].file_remaining > 0) {
+			close(mux->streams[i].file_fd);
+		}
+	}
+	pthread_mutex_destroy(&mux->lock);
+}
+
+int mux_open(mux_t *mux, uint16_t stream_id, int priority) {
+	if (stream_id >= MUX_MAX_STREAMS) return -1;
+
+	pthread_mutex_lock(&mux->lock);
+	mux_stream_t *stream = &mux->streams[stream_id];
+	if (stream->queue == NULL) {
+		stream->queue = malloc(MUX_QUEUE_LIMIT);
+		if (stream->queue == NULL) {
+			perror("malloc");
+			pthread_mutex_unlock(&mux->lock);
+			return -1;
+		}
+	}
+	stream->open = 1;
+	stream->priority = priority;
+	stream->queue_head = 0;
+	stream->queue_len = 0;
+	stream->send_window = MUX_INITIAL_WINDOW;
+	stream->recv_window = MUX_INITIAL_WINDOW;
+	stream->recv_unacked = 0;
+	stream->file_fd = -1;
+	stream->file_remaining = 0;
+	pthread_mutex_unlock(&mux->lock);
+	return 0;
+}
+
+// mux_poll_record() drains what is queued, then returns -1
+void mux_close(mux_t *mux) {
+	pthread_mutex_lock(&mux->lock);
+	mux->closed = 1;
+	pthread_mutex_unlock(&mux->lock);
+}
+
+// Copy into the ring up to the wrap point or the free space, whichever comes first. Caller holds
+// the lock, returns how much was taken.
+static size_t queue_bytes(mux_stream_t *stream, const unsigned char *bytes, size_t len) {
+	size_t tail = (stream->queue_head + stream->queue_len) % MUX_QUEUE_LIMIT;
+	size_t room = MUX_QUEUE_LIMIT - stream->queue_len;
+	size_t chunk = MUX_QUEUE_LIMIT - tail;
+	if (chunk > room) chunk = room;
+	if (chunk > len) chunk = len;
+
+	memcpy(stream->queue + tail, bytes, chunk);
+	stream->queue_len += chunk;
+	return chunk;
+}
+
+int mux_try_write(mux_t *mux, uint16_t stream_id, const void *data, size_t len) {
+	if (stream_id >= MUX_MAX_STREAMS) return -1;
+	const unsigned char *bytes = data;
+
+	pthread_mutex_lock(&mux->lock);
+	mux_stream_t *stream = &mux->streams[stream_id];
+	if (mux->closed || !stream->open) {
+		pthread_mutex_unlock(&mux->lock);
+		return -1;
+	}
+	if (MUX_QUEUE_LIMIT - stream->queue_len < len) {
+		pthread_mutex_unlock(&mux->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	while (len > 0) {
+		size_t chunk = queue_bytes(stream, bytes, len);
+		bytes += chunk;
+		len -= chunk;
+	}
+	pthread_mutex_unlock(&mux->lock);
+	return 0;
+}
+
+int mux_write_file(mux_t *mux, uint16_t stream_id, int fd, uint64_t len) {
+	if (stream_id >= MUX_MAX_STREAMS) return -1;
+
+	pthread_mutex_lock(&mux->lock);
+	mux_stream_t *stream = &mux->streams[stream_id];
+	if (mux->closed || !stream->open) {
+		pthread_mutex_unlock(&mux->lock);
+		return -1;
+	}
+	if (stream->file_remaining > 0) {
+		pthread_mutex_unlock(&mux->lock);
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (len == 0) {
+		close(fd);
+	} else {
+		stream->file_fd = fd;
+		stream->file_offset = 0;
+		stream->file_remaining = len;
+	}
+	pthread_mutex_unlock(&mux->lock);
+	return 0;
+}
+
+static void put_header(unsigned char *record, uint16_t stream_id, uint8_t type, uint32_t value) {
+	uint16_t net_id = htons(stream_id);
+	uint32_t net_value = htonl(value);
+	memcpy(record, &net_id, sizeof(net_id));
+	record[2] = type;
+	record[3] = 0;
+	memcpy(record + 4, &net_value, sizeof(net_value));
+}
+
+// Build the next record to send, caller holds the lock. Returns 1 if a record was built. When
+// its body comes from a file, record only holds the mux header and *file says where the body is.
+static int build_record(mux_t *mux, unsigned char *record, size_t *record_len, mux_file_chunk_t *file) {
+	file->len = 0;
+
+	// Window updates first, they unblock the peer
+	for (int i = 0; i < MUX_MAX_STREAMS; i++) {
+		mux_stream_t *stream = &mux->streams[i];
+		if (stream->open && stream->recv_unacked >= MUX_INITIAL_WINDOW / 2) {
+			put_header(record, i, MUX_FRAME_WINDOW_UPDATE, stream->recv_unacked);
+			stream->recv_window += stream->recv_unacked;
+			stream->recv_unacked = 0;
+			*record_len = MUX_HEADER_SIZE;
+			return 1;
+		}
+	}
+
+	// Then the highest-priority stream that can send, round-robin among equals.
+	// Bulk streams only ever get one chunk ahead of a waiting chat message.
+	int best = -1;
+	for (int n = 0; n < MUX_MAX_STREAMS; n++) {
+		int i = (mux->next_stream + n) % MUX_MAX_STREAMS;
+		mux_stream_t *stream = &mux->streams[i];
+		int has_data = stream->queue_len > 0 || stream->file_remaining > 0;
+		if (!stream->open || !has_data || stream->send_window == 0) continue;
+
+		if (best < 0 || stream->priority < mux->streams[best].priority) {
+			best = i;
+		}
+	}
+	if (best < 0) return 0;
+
+	mux_stream_t *stream = &mux->streams[best];
+	mux->next_stream = (best + 1) % MUX_MAX_STREAMS;
+
+	// Queued bytes go first, then the file region
+	if (stream->queue_len == 0) {
+		size_t chunk = MUX_MAX_CHUNK;
+		if (chunk > stream->send_window) chunk = stream->send_window;
+		if (chunk > stream->file_remaining) chunk = stream->file_remaining;
+
+		file->fd = stream->file_fd;
+		file->offset = stream->file_offset;
+		file->len = chunk;
+		stream->file_offset += chunk;
+		stream->file_remaining -= chunk;
+		stream->send_window -= chunk;
+
+		// The sender owns the descriptor from here on
+		file->last = stream->file_remaining == 0;
+		if (file->last) stream->file_fd = -1;
+
+		put_header(record, best, MUX_FRAME_DATA, chunk);
+		*record_len = MUX_HEADER_SIZE;
+		return 1;
+	}
+
+	size_t chunk = stream->queue_len;
+	if (chunk > MUX_MAX_CHUNK) chunk = MUX_MAX_CHUNK;
+	if (chunk > stream->send_window) chunk = stream->send_window;
+
+	// The chunk may straddle the end of the ring
+	size_t first = MUX_QUEUE_LIMIT - stream->queue_head;
+	if (first > chunk) first = chunk;
+	memcpy(record + MUX_HEADER_SIZE, stream->queue + stream->queue_head, first);
+	memcpy(record + MUX_HEADER_SIZE + first, stream->queue, chunk - first);
+
+	stream->queue_head = (stream->queue_head + chunk) % MUX_QUEUE_LIMIT;
+	stream->queue_len -= chunk;
+	stream->send_window -= chunk;
+
+	put_header(record, best, MUX_FRAME_DATA, chunk);
+	*record_len = MUX_HEADER_SIZE + chunk;
+	return 1;
+}
+
+int mux_poll_record(mux_t *mux, unsigned char *record, size_t *record_len, mux_file_chunk_t *file) {
+	pthread_mutex_lock(&mux->lock);
+	int rc = build_record(mux, record, record_len, file) ? 1 : mux->closed ? -1 : 0;
+	pthread_mutex_unlock(&mux->lock);
+	return rc;
+}
+
+int mux_on_record(mux_t *mux, const unsigned char *record, size_t record_len, mux_event_t *event) {
+	if (record_len < MUX_HEADER_SIZE) {
+		fprintf(stderr, "Truncated mux frame\n");
+		return -1;
+	}
+
+	uint16_t net_id;
+	uint32_t net_value;
+	memcpy(&net_id, record, sizeof(net_id));
+	memcpy(&net_value, record + 4, sizeof(net_value));
+	uint16_t stream_id = ntohs(net_id);
+	uint32_t value = ntohl(net_value);
+
+	if (stream_id >= MUX_MAX_STREAMS) {
+		fprintf(stderr, "Mux frame for unknown stream %u\n", stream_id);
+		return -1;
+	}
+
+	event->stream_id = stream_id;
+	event->type = record[2];
+	event->data = record + MUX_HEADER_SIZE;
+	event->len = 0;
+
+	pthread_mutex_lock(&mux->lock);
+	mux_stream_t *stream = &mux->streams[stream_id];
+	int rc = 0;
+
+	if (!stream->open) {
+		fprintf(stderr, "Mux frame for closed stream %u\n", stream_id);
+		rc = -1;
+	} else if (event->type == MUX_FRAME_DATA) {
+		if (value != record_len - MUX_HEADER_SIZE || value > stream->recv_window) {
+			fprintf(stderr, "Peer violated flow control on stream %u\n", stream_id);
+			rc = -1;
+		} else {
+			stream->recv_window -= value;
+			event->len = value;
+		}
+	} else if (event->type == MUX_FRAME_WINDOW_UPDATE) {
+		// The window is a uint32_t, an unbounded update would wrap it
+		if (value > MUX_MAX_WINDOW - stream->send_window) {
+			fprintf(stderr, "Peer overflowed the flow-control window on stream %u\n", stream_id);
+			rc = -1;
+		} else {
+			stream->send_window += value;
+		}
+	} else {
+		fprintf(stderr, "Unknown mux frame type %u\n", event->type);
+		rc = -1;
+	}
+
+	pthread_mutex_unlock(&mux->lock);
+	return rc;
+}
+
+void mux_consumed(mux_t *mux, uint16_t stream_id, size_t len) {
+	if (stream_id >= MUX_MAX_STREAMS || len == 0) return;
+
+	pthread_mutex_lock(&mux->lock);
+	mux->streams[stream_id].recv_unacked += len;
+	pthread_mutex_unlock(&mux->lock);
+}
@@ -0,0 +1,92 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef MUX_H
+#define MUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Logical streams carried over one encrypted peer connection. Every record carries one mux
+// frame: stream id (16 bits), frame type (8), flags (8) and a 32-bit length or window increment.
+#define MUX_MAX_STREAMS 4
+#define MUX_STREAM_CONTROL 0
+#define MUX_STREAM_CHAT 1
+#define MUX_STREAM_FILE 2
+
+#define MUX_HEADER_SIZE 8
+#define MUX_MAX_CHUNK (16 * 1024)          // Largest DATA payload per record
+#define MUX_INITIAL_WINDOW (256 * 1024)    // Per-stream flow-control window
+#define MUX_MAX_WINDOW (16 * 1024 * 1024)  // Largest send window a peer may open, past it is a protocol error
+#define MUX_QUEUE_LIMIT (256 * 1024)       // Per-stream unsent bytes before mux_try_write() refuses
+#define MUX_MAX_RECORD (MUX_HEADER_SIZE + MUX_MAX_CHUNK)
+
+#define MUX_FRAME_DATA 0
+#define MUX_FRAME_WINDOW_UPDATE 1
+
+// Lower value is sent first
+#define MUX_PRIORITY_HIGH 0
+#define MUX_PRIORITY_NORMAL 1
+#define MUX_PRIORITY_BULK 2
+
+typedef struct {
+	int open;
+	int priority;
+	unsigned char *queue;  // Ring buffer of bytes waiting to be sent
+	size_t queue_head;
+	size_t queue_len;
+	uint32_t send_window;  // Bytes the peer will still accept on this stream
+	uint32_t recv_window;  // Bytes we will still accept from the peer
+	uint32_t recv_unacked; // Bytes consumed locally but not yet returned to the peer
+	int file_fd;           // File region sent after the queue drains, see mux_write_file()
+	off_t file_offset;
+	uint64_t file_remaining;
+} mux_stream_t;
+
+typedef struct {
+	mux_stream_t streams[MUX_MAX_STREAMS];
+	int next_stream; // Round-robin position among streams of equal priority
+	int closed;
+	pthread_mutex_t lock;
+} mux_t;
+
+// Part of a file that belongs in the body of the record just built. The sender reads it from
+// fd (or hands it to sendfile()) and closes fd after the chunk marked last.
+typedef struct {
+	int fd;
+	off_t offset;
+	size_t len;
+	int last;
+} mux_file_chunk_t;
+
+// What mux_on_record() found in an incoming record
+typedef struct {
+	uint16_t stream_id;
+	uint8_t type;
+	const unsigned char *data;
+	size_t len;
+} mux_event_t;
+
+int mux_init(mux_t *mux);
+void mux_free(mux_t *mux);
+int mux_open(mux_t *mux, uint16_t stream_id, int priority);
+void mux_close(mux_t *mux);
+
+// Sending side, driven by an event loop and never blocking. mux_try_write() queues all of data
+// or, failing with EAGAIN, none of it. mux_write_file() queues len bytes of fd without copying
+// them and takes ownership of fd, it fails with EBUSY while an earlier file is still going out on
+// the stream. mux_poll_record() returns 1 with a record, 0 when nothing can be sent right now and
+// -1 once the mux is closed and drained.
+int mux_try_write(mux_t *mux, uint16_t stream_id, const void *data, size_t len);
+int mux_write_file(mux_t *mux, uint16_t stream_id, int fd, uint64_t len);
+int mux_poll_record(mux_t *mux, unsigned char *record, size_t *record_len, mux_file_chunk_t *file);
+
+// Receiving side. Data handed out by mux_on_record() must be acknowledged with mux_consumed()
+// once processed so the peer's window for that stream reopens.
+int mux_on_record(mux_t *mux, const unsigned char *record, size_t record_len, mux_event_t *event);
+void mux_consumed(mux_t *mux, uint16_t stream_id, size_t len);
+
+#endif // MUX_H
@@ -6,7 +6,9 @@
 #define NETWORK_H
 
 #include <arpa/inet.h>
+#include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include "constants.h"
 
 typedef struct {
@@ -20,4 +22,26 @@ int connect_to_server(const char *ip, int port);
 int bind_and_listen(int port);
 int connect_to_peer(const char *ip, int port);
 
+// Read one newline-terminated command or answer of at most size - 1 bytes and NUL terminate it, for
+// exchanges where the other end waits for a reply before sending more. Returns its length, 0 on
+// orderly shutdown or -1 on error.
+ssize_t read_line(int sock, char *buffer, size_t size);
+
+// Non-blocking connects bounded by a deadline
+int connect_with_timeout(const char *ip, int port, int timeout_ms);
+int connect_first(const Peer *candidates, int count, int timeout_ms, int *winner);
+
+// Length-prefixed framing for the chat data path
+#define SOCKET_MODE_INTERACTIVE 0 // TCP_NODELAY, every frame goes out immediately
+#define SOCKET_MODE_BULK 1        // TCP_CORK, frames are coalesced into full segments
+
+int set_socket_mode(int sock, int mode);
+int limit_unsent_bytes(int sock, int bytes);
+int set_nonblocking(int sock);
+int write_all_iov(int sock, struct iovec *iov, int iovcnt);
+int write_frame(int sock, const void *payload, uint32_t len);
+
+// Read one whole frame into a malloc'd buffer. Returns 1, 0 on orderly shutdown, -1 on error.
+int read_frame(int sock, unsigned char **payload, uint32_t *len, uint32_t max_len);
+
 #endif // NETWORK_H
@@ -33,3 +33,29 @@ void safe_print(const char *format, ...) {
 	pthread_mutex_unlock(&print_mutex);
 	va_end(args);
 }
+
+void hex_encode(const unsigned char *data, size_t len, char *hex) {
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < len; i++) {
+		hex[2 * i] = digits[data[i] >> 4];
+		hex[2 * i + 1] = digits[data[i] & 0xf];
+	}
+	hex[2 * len] = '\0';
+}
+
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+int hex_decode(const char *hex, size_t hex_len, unsigned char *data, size_t max_len) {
+	if (hex_len % 2 != 0 || hex_len / 2 > max_len) return -1;
+	for (size_t i = 0; i < hex_len / 2; i++) {
+		int high = hex_digit(hex[2 * i]), low = hex_digit(hex[2 * i + 1]);
+		if (high < 0 || low < 0) return -1;
+		data[i] = (unsigned char)(high << 4 | low);
+	}
+	return (int)(hex_len / 2);
+}
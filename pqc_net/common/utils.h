@@ -14,6 +14,11 @@ void safe_fgets(char *buffer, size_t size, FILE *stream);
 void trim_newline(char *str);
 void safe_print(const char *format, ...);
 
+// Binary keys travel in the text protocol as lowercase hex, hex needs 2 * len + 1 bytes
+void hex_encode(const unsigned char *data, size_t len, char *hex);
+// Returns the number of bytes decoded, or -1 if hex is not an even run of hex digits that fits
+int hex_decode(const char *hex, size_t hex_len, unsigned char *data, size_t max_len);
+
 // Declare print_mutex
 extern pthread_mutex_t print_mutex;
 
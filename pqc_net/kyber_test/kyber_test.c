@@ -2,17 +2,34 @@
 // Created by rokas on 24/09/2024.
 //
 
+// Correctness and speed of every KEM enabled in liboqs, on one thread and on several at once.
+// Each round generates a key pair, encapsulates, decapsulates and checks that both secrets and the
+// guard bytes around every buffer are intact. Per operation it reports cycles (rdtsc on x86, else
+// nanoseconds), operations per second over all threads, p50 and p99 latency, and the buffer sizes
+// and peak RSS as the memory footprint.
+//
+//   ./kyber_speed_test [-a name] [-n iterations] [-t 1,2,4] [-j out.json] [-b baseline.json [-r percent]]
+//
+// -a keeps algorithms whose name contains name. -j writes the results as JSON, -b compares them with
+// an earlier -j file and exits with failure when any p50 got more than -r percent (default 10) slower.
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
 #include <oqs/oqs.h>
 
-#if OQS_USE_PTHREADS
-#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+#else
+#define CYCLE_UNIT "ns"
 #endif
 
 #ifdef OQS_ENABLE_TEST_CONSTANT_TIME
@@ -24,6 +41,17 @@
 #define OQS_TEST_CT_DECLASSIFY(addr, len)
 #endif
 
+#define DEFAULT_ITERATIONS 1000
+#define WARMUP_ROUNDS 10
+#define MAX_THREAD_COUNTS 16
+#define MAX_THREADS 256
+#define THREAD_STACK_SIZE (8 * 1024 * 1024) // HQC-256 and Classic McEliece keep big buffers on the stack
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_RESULTS 4096
+
+enum { OP_KEYGEN, OP_ENCAPS, OP_DECAPS, OP_COUNT };
+static const char *op_names[OP_COUNT] = { "keygen", "encaps", "decaps" };
+
 /* Displays hexadecimal strings */
 static void OQS_print_hex_string(const char *label, const uint8_t *str, size_t len) {
 	printf("%-20s (%4zu bytes):  ", label, len);
@@ -38,161 +66,157 @@ typedef struct magic_s {
 	uint8_t val[31];
 } magic_t;
 
-/* Function to perform correctness test and measure performance */
-static OQS_STATUS kem_test_correctness(const char *method_name, int iterations,
-									   double *avg_keygen_time,
-									   double *avg_encaps_time,
-									   double *avg_decaps_time) {
+// One measured operation of one algorithm at one thread count
+typedef struct {
+	char kem[64];
+	int threads;
+	int op;
+	double cycles;       // mean per operation
+	double ops_per_sec;  // all threads together
+	double p50_ns, p99_ns;
+	size_t public_key, secret_key, ciphertext, shared_secret;
+	long rss_kb;         // process peak after the run
+} result_t;
+
+// A thread's share of a run: its samples for every operation
+typedef struct {
+	const char *alg_name;
+	int iterations;
+	uint64_t *cycles[OP_COUNT];
+	double *ns[OP_COUNT];
+	OQS_STATUS rc;
+} worker_t;
 
-	OQS_KEM *kem = NULL;
-	uint8_t *public_key_alloc = NULL;
-	uint8_t *secret_key_alloc = NULL;
-	uint8_t *ciphertext_alloc = NULL;
-	uint8_t *shared_secret_e_alloc = NULL;
-	uint8_t *shared_secret_d_alloc = NULL;
+static inline uint64_t cycles_now() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static double elapsed_ns(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+// Allocate len bytes between two copies of magic, returns the usable part
+static uint8_t *guarded_alloc(size_t len, const magic_t *magic) {
+	uint8_t *alloc = malloc(len + 2 * sizeof(magic_t));
+	if (alloc == NULL) return NULL;
+	memcpy(alloc, magic->val, sizeof(magic_t));
+	memcpy(alloc + sizeof(magic_t) + len, magic->val, sizeof(magic_t));
+	return alloc + sizeof(magic_t);
+}
 
+static bool guard_intact(const uint8_t *buf, size_t len, const magic_t *magic) {
+	return memcmp(buf - sizeof(magic_t), magic->val, sizeof(magic_t)) == 0 &&
+		   memcmp(buf + len, magic->val, sizeof(magic_t)) == 0;
+}
+
+static void guarded_free(uint8_t *buf) {
+	if (buf != NULL) free(buf - sizeof(magic_t));
+}
+
+/* Function to perform correctness test and measure performance */
+static OQS_STATUS kem_test_correctness(worker_t *w) {
+	OQS_KEM *kem = NULL;
 	uint8_t *public_key = NULL;
 	uint8_t *secret_key = NULL;
 	uint8_t *ciphertext = NULL;
 	uint8_t *shared_secret_e = NULL;
 	uint8_t *shared_secret_d = NULL;
-
-	OQS_STATUS rc, ret = OQS_ERROR;
-	int rv;
+	OQS_STATUS ret = OQS_ERROR;
 
 	// Initialize magic numbers for memory checks
 	magic_t magic;
 	OQS_randombytes(magic.val, sizeof(magic_t));
 
 	// Initialize the KEM
-	kem = OQS_KEM_new(method_name);
+	kem = OQS_KEM_new(w->alg_name);
 	if (kem == NULL) {
-		fprintf(stderr, "ERROR: OQS_KEM_new failed\n");
-		goto err;
+		fprintf(stderr, "ERROR: OQS_KEM_new failed for %s\n", w->alg_name);
+		goto cleanup;
 	}
 
-	printf("================================================================================\n");
-	printf("Sample computation for KEM %s\n", kem->method_name);
-	printf("================================================================================\n");
-
-	// Allocate memory using standard malloc
-	public_key_alloc = malloc(kem->length_public_key + 2 * sizeof(magic_t));
-	secret_key_alloc = malloc(kem->length_secret_key + 2 * sizeof(magic_t));
-	ciphertext_alloc = malloc(kem->length_ciphertext + 2 * sizeof(magic_t));
-	shared_secret_e_alloc = malloc(kem->length_shared_secret + 2 * sizeof(magic_t));
-	shared_secret_d_alloc = malloc(kem->length_shared_secret + 2 * sizeof(magic_t));
-
-	if ((public_key_alloc == NULL) || (secret_key_alloc == NULL) ||
-		(ciphertext_alloc == NULL) || (shared_secret_e_alloc == NULL) ||
-		(shared_secret_d_alloc == NULL)) {
+	public_key = guarded_alloc(kem->length_public_key, &magic);
+	secret_key = guarded_alloc(kem->length_secret_key, &magic);
+	ciphertext = guarded_alloc(kem->length_ciphertext, &magic);
+	shared_secret_e = guarded_alloc(kem->length_shared_secret, &magic);
+	shared_secret_d = guarded_alloc(kem->length_shared_secret, &magic);
+	if ((public_key == NULL) || (secret_key == NULL) || (ciphertext == NULL) ||
+		(shared_secret_e == NULL) || (shared_secret_d == NULL)) {
 		fprintf(stderr, "ERROR: malloc failed\n");
-		goto err;
+		goto cleanup;
 	}
 
-	// Set the magic numbers before the allocated memory
-	memcpy(public_key_alloc, magic.val, sizeof(magic_t));
-	memcpy(secret_key_alloc, magic.val, sizeof(magic_t));
-	memcpy(ciphertext_alloc, magic.val, sizeof(magic_t));
-	memcpy(shared_secret_e_alloc, magic.val, sizeof(magic_t));
-	memcpy(shared_secret_d_alloc, magic.val, sizeof(magic_t));
-
-	// Adjust pointers to skip the magic numbers
-	public_key = public_key_alloc + sizeof(magic_t);
-	secret_key = secret_key_alloc + sizeof(magic_t);
-	ciphertext = ciphertext_alloc + sizeof(magic_t);
-	shared_secret_e = shared_secret_e_alloc + sizeof(magic_t);
-	shared_secret_d = shared_secret_d_alloc + sizeof(magic_t);
-
-	// Set the magic numbers after the allocated memory
-	memcpy(public_key + kem->length_public_key, magic.val, sizeof(magic_t));
-	memcpy(secret_key + kem->length_secret_key, magic.val, sizeof(magic_t));
-	memcpy(ciphertext + kem->length_ciphertext, magic.val, sizeof(magic_t));
-	memcpy(shared_secret_e + kem->length_shared_secret, magic.val, sizeof(magic_t));
-	memcpy(shared_secret_d + kem->length_shared_secret, magic.val, sizeof(magic_t));
-
-	// Variables to accumulate total time
-	double total_keygen_time = 0.0;
-	double total_encaps_time = 0.0;
-	double total_decaps_time = 0.0;
-
-	// Iterate for the specified number of iterations
-	for (int i = 0; i < iterations; i++) {
-		struct timespec start, end;
-		double elapsed;
-
-		// Measure Key Generation Time
-		clock_gettime(CLOCK_MONOTONIC, &start);
-		rc = OQS_KEM_keypair(kem, public_key, secret_key);
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		if (rc != OQS_SUCCESS) {
-			fprintf(stderr, "ERROR: OQS_KEM_keypair failed\n");
-			goto err;
+	for (int i = -WARMUP_ROUNDS; i < w->iterations; i++) {
+		struct timespec t[OP_COUNT + 1];
+		uint64_t c[OP_COUNT + 1];
+		OQS_STATUS rc[OP_COUNT];
+
+		clock_gettime(CLOCK_MONOTONIC, &t[0]);
+		c[0] = cycles_now();
+		rc[OP_KEYGEN] = OQS_KEM_keypair(kem, public_key, secret_key);
+		c[1] = cycles_now();
+		clock_gettime(CLOCK_MONOTONIC, &t[1]);
+		OQS_TEST_CT_DECLASSIFY(public_key, kem->length_public_key);
+		rc[OP_ENCAPS] = OQS_KEM_encaps(kem, ciphertext, shared_secret_e, public_key);
+		c[2] = cycles_now();
+		clock_gettime(CLOCK_MONOTONIC, &t[2]);
+		OQS_TEST_CT_DECLASSIFY(ciphertext, kem->length_ciphertext);
+		rc[OP_DECAPS] = OQS_KEM_decaps(kem, shared_secret_d, ciphertext, secret_key);
+		c[3] = cycles_now();
+		clock_gettime(CLOCK_MONOTONIC, &t[3]);
+
+		for (int op = 0; op < OP_COUNT; op++) {
+			if (rc[op] != OQS_SUCCESS) {
+				fprintf(stderr, "ERROR: %s %s failed\n", kem->method_name, op_names[op]);
+				goto cleanup;
+			}
 		}
-		elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3; // µs
-		total_keygen_time += elapsed;
-
-		// Measure Encapsulation Time
-		clock_gettime(CLOCK_MONOTONIC, &start);
-		rc = OQS_KEM_encaps(kem, ciphertext, shared_secret_e, public_key);
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		if (rc != OQS_SUCCESS) {
-			fprintf(stderr, "ERROR: OQS_KEM_encaps failed\n");
-			goto err;
-		}
-		elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3; // µs
-		total_encaps_time += elapsed;
-
-		// Measure Decapsulation Time
-		clock_gettime(CLOCK_MONOTONIC, &start);
-		rc = OQS_KEM_decaps(kem, shared_secret_d, ciphertext, secret_key);
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		if (rc != OQS_SUCCESS) {
-			fprintf(stderr, "ERROR: OQS_KEM_decaps failed\n");
-			goto err;
-		}
-		elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3; // µs
-		total_decaps_time += elapsed;
 
 		// Verify shared secrets are equal
+		OQS_TEST_CT_DECLASSIFY(shared_secret_e, kem->length_shared_secret);
+		OQS_TEST_CT_DECLASSIFY(shared_secret_d, kem->length_shared_secret);
 		if (memcmp(shared_secret_e, shared_secret_d, kem->length_shared_secret) != 0) {
 			fprintf(stderr, "ERROR: shared secrets are not equal on iteration %d\n", i + 1);
 			OQS_print_hex_string("shared_secret_e", shared_secret_e, kem->length_shared_secret);
 			OQS_print_hex_string("shared_secret_d", shared_secret_d, kem->length_shared_secret);
-			goto err;
+			goto cleanup;
 		}
-	}
+		if (i < 0) continue;
 
-	// Calculate average times
-	*avg_keygen_time = total_keygen_time / iterations;
-	*avg_encaps_time = total_encaps_time / iterations;
-	*avg_decaps_time = total_decaps_time / iterations;
+		for (int op = 0; op < OP_COUNT; op++) {
+			w->cycles[op][i] = c[op + 1] - c[op];
+			w->ns[op][i] = elapsed_ns(t[op], t[op + 1]);
+		}
+	}
 
+	// Nothing wrote past its buffer
+	if (!guard_intact(public_key, kem->length_public_key, &magic) ||
+		!guard_intact(secret_key, kem->length_secret_key, &magic) ||
+		!guard_intact(ciphertext, kem->length_ciphertext, &magic) ||
+		!guard_intact(shared_secret_e, kem->length_shared_secret, &magic) ||
+		!guard_intact(shared_secret_d, kem->length_shared_secret, &magic)) {
+		fprintf(stderr, "ERROR: %s wrote outside its buffers\n", kem->method_name);
+		goto cleanup;
+	}
 	ret = OQS_SUCCESS;
-	goto cleanup;
-
-err:
-	ret = OQS_ERROR;
 
 cleanup:
-	if (secret_key_alloc) {
-		free(secret_key_alloc);
-	}
-	if (shared_secret_e_alloc) {
-		free(shared_secret_e_alloc);
-	}
-	if (shared_secret_d_alloc) {
-		free(shared_secret_d_alloc);
-	}
-	if (public_key_alloc) {
-		free(public_key_alloc);
-	}
-	if (ciphertext_alloc) {
-		free(ciphertext_alloc);
+	if (kem != NULL && secret_key != NULL) {
+		OQS_MEM_cleanse(secret_key, kem->length_secret_key);
 	}
+	guarded_free(public_key);
+	guarded_free(secret_key);
+	guarded_free(ciphertext);
+	guarded_free(shared_secret_e);
+	guarded_free(shared_secret_d);
 	if (kem) {
 		OQS_KEM_free(kem);
 	}
-
 	return ret;
 }
 
@@ -205,93 +229,244 @@ static void TEST_KEM_randombytes(uint8_t *random_array, size_t bytes_to_read) {
 }
 #endif
 
-#if OQS_USE_PTHREADS
-struct thread_data {
-	char *alg_name;
-	OQS_STATUS rc;
-};
-
-void *test_wrapper(void *arg) {
-	struct thread_data *td = arg;
-	td->rc = kem_test_correctness(td->alg_name, 1000, NULL, NULL, NULL); // Modify if needed
+static void *test_wrapper(void *arg) {
+	worker_t *w = arg;
+	w->rc = kem_test_correctness(w);
 	return NULL;
 }
-#endif
 
-int main(int argc, char **argv) {
-	// Initialize liboqs
-	OQS_init();
-
-	printf("Testing KEM algorithms using liboqs version %s\n", OQS_version());
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
 
-	// Hardcode the algorithm to Kyber512
-	const char *alg_name = OQS_KEM_alg_kyber_512;
+static long peak_rss_kb() {
+	struct rusage usage;
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
 
-	// Check if Kyber512 is enabled
-	if (!OQS_KEM_alg_is_enabled(alg_name)) {
-		printf("KEM algorithm %s not enabled!\n", alg_name);
-		OQS_destroy();
-		return EXIT_FAILURE;
+// Run iterations rounds of alg_name on each of threads threads and summarize every operation into
+// results[0..OP_COUNT)
+static int run(const char *alg_name, int threads, int iterations, result_t *results) {
+	worker_t workers[MAX_THREADS];
+	pthread_t ids[MAX_THREADS];
+	pthread_attr_t attr;
+	size_t samples = (size_t)threads * iterations;
+	uint64_t *cycles = malloc(samples * OP_COUNT * sizeof(uint64_t));
+	double *ns = malloc(samples * OP_COUNT * sizeof(double));
+	int started = 0, rc = -1;
+
+	if (cycles == NULL || ns == NULL) {
+		fprintf(stderr, "ERROR: malloc failed\n");
+		goto out;
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+	for (int i = 0; i < threads; i++) {
+		workers[i].alg_name = alg_name;
+		workers[i].iterations = iterations;
+		workers[i].rc = OQS_ERROR;
+		for (int op = 0; op < OP_COUNT; op++) {
+			workers[i].cycles[op] = cycles + (op * samples) + (size_t)i * iterations;
+			workers[i].ns[op] = ns + (op * samples) + (size_t)i * iterations;
+		}
+		if (pthread_create(&ids[i], &attr, test_wrapper, &workers[i]) != 0) {
+			fprintf(stderr, "ERROR: Creating pthread\n");
+			break;
+		}
+		started++;
+	}
+	pthread_attr_destroy(&attr);
+	for (int i = 0; i < started; i++) {
+		pthread_join(ids[i], NULL);
+	}
+	if (started < threads) goto out;
+	for (int i = 0; i < threads; i++) {
+		if (workers[i].rc != OQS_SUCCESS) goto out;
 	}
 
-#ifdef OQS_ENABLE_TEST_CONSTANT_TIME
-	OQS_randombytes_custom_algorithm(&TEST_KEM_randombytes);
-#else
-	OQS_randombytes_switch_algorithm("system");
-#endif
+	OQS_KEM *kem = OQS_KEM_new(alg_name);
+	if (kem == NULL) goto out;
+	for (int op = 0; op < OP_COUNT; op++) {
+		result_t *r = &results[op];
+		double *op_ns = ns + op * samples;
+		double total_cycles = 0, total_ns = 0;
+
+		for (size_t i = 0; i < samples; i++) {
+			total_cycles += (double)cycles[op * samples + i];
+			total_ns += op_ns[i];
+		}
+		qsort(op_ns, samples, sizeof(double), compare_double);
+
+		snprintf(r->kem, sizeof(r->kem), "%s", alg_name);
+		r->threads = threads;
+		r->op = op;
+		r->cycles = total_cycles / samples;
+		// Each thread spends total_ns / threads in this operation, in parallel with the others
+		r->ops_per_sec = total_ns > 0 ? samples / (total_ns / threads / 1e9) : 0;
+		r->p50_ns = op_ns[samples / 2];
+		r->p99_ns = op_ns[samples * 99 / 100];
+		r->public_key = kem->length_public_key;
+		r->secret_key = kem->length_secret_key;
+		r->ciphertext = kem->length_ciphertext;
+		r->shared_secret = kem->length_shared_secret;
+		r->rss_kb = peak_rss_kb();
+	}
+	OQS_KEM_free(kem);
+	rc = 0;
 
-	// Number of iterations for performance measurement
-	int iterations = 1000;
+out:
+	free(cycles);
+	free(ns);
+	return rc;
+}
 
-	// Variables to store average times
-	double avg_keygen = 0.0;
-	double avg_encaps = 0.0;
-	double avg_decaps = 0.0;
+static int write_json(const char *path, const result_t *results, int count, int iterations) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	// One result per line, which is also what read_baseline() expects
+	fprintf(f, "{\n  \"liboqs\": \"%s\",\n  \"unit\": \"%s\",\n  \"iterations\": %d,\n  \"results\": [\n",
+			OQS_version(), CYCLE_UNIT, iterations);
+	for (int i = 0; i < count; i++) {
+		const result_t *r = &results[i];
+		fprintf(f, "    {\"kem\": \"%s\", \"threads\": %d, \"op\": \"%s\", \"cycles\": %.0f, \"ops_per_sec\": %.1f, "
+				   "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"public_key\": %zu, \"secret_key\": %zu, "
+				   "\"ciphertext\": %zu, \"shared_secret\": %zu, \"rss_kb\": %ld}%s\n",
+				r->kem, r->threads, op_names[r->op], r->cycles, r->ops_per_sec, r->p50_ns, r->p99_ns,
+				r->public_key, r->secret_key, r->ciphertext, r->shared_secret, r->rss_kb,
+				i + 1 < count ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	return fclose(f) == 0 ? 0 : -1;
+}
 
-	OQS_STATUS rc;
+// Compare p50 latencies with a file from -j. Returns the number of regressions, -1 if unreadable.
+static int compare_baseline(const char *path, const result_t *results, int count, double threshold) {
+	FILE *f = fopen(path, "r");
+	char line[1024];
+	int regressions = 0, compared = 0;
 
-#if OQS_USE_PTHREADS
-#define MAX_LEN_KEM_NAME_ 64
-	// Don't run certain KEMs in threads due to large stack usage
-	char no_thread_kem_patterns[][MAX_LEN_KEM_NAME_]  = {"Classic-McEliece", "HQC-256-"};
-	int test_in_thread = 1;
-	for (size_t i = 0 ; i < sizeof(no_thread_kem_patterns) / sizeof(no_thread_kem_patterns[0]); ++i) {
-		if (strstr(alg_name, no_thread_kem_patterns[i]) != NULL) {
-			test_in_thread = 0;
-			break;
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char kem[64], op[16];
+		int threads;
+		double base_p50;
+		if (sscanf(line, " {\"kem\": \"%63[^\"]\", \"threads\": %d, \"op\": \"%15[^\"]\", \"cycles\": %*f, "
+						 "\"ops_per_sec\": %*f, \"p50_ns\": %lf", kem, &threads, op, &base_p50) != 4) {
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			const result_t *r = &results[i];
+			if (strcmp(r->kem, kem) != 0 || r->threads != threads || strcmp(op_names[r->op], op) != 0) continue;
+			double change = base_p50 > 0 ? (r->p50_ns - base_p50) / base_p50 * 100 : 0;
+			compared++;
+			if (change > threshold) {
+				printf("REGRESSION %s %s on %d threads: p50 %.0f ns, baseline %.0f ns (%+.1f%%)\n",
+					   kem, op, threads, r->p50_ns, base_p50, change);
+				regressions++;
+			}
 		}
 	}
-	if (test_in_thread) {
-		pthread_t thread;
-		struct thread_data td;
-		td.alg_name = (char *)alg_name;  // Cast to non-const
-		int trc = pthread_create(&thread, NULL, test_wrapper, &td);
-		if (trc) {
-			fprintf(stderr, "ERROR: Creating pthread\n");
-			OQS_destroy();
+	fclose(f);
+	printf("Compared %d results with %s, %d slower by more than %.1f%%\n", compared, path, regressions, threshold);
+	return regressions;
+}
+
+// "1,2,4" into counts, defaults to 1 and the number of CPUs
+static int parse_threads(const char *list, int *counts) {
+	int n = 0;
+	if (list == NULL) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		counts[n++] = 1;
+		if (cpus > 1) counts[n++] = cpus > MAX_THREADS ? MAX_THREADS : (int)cpus;
+		return n;
+	}
+	for (const char *p = list; *p != '\0' && n < MAX_THREAD_COUNTS;) {
+		int threads = atoi(p);
+		if (threads < 1 || threads > MAX_THREADS) return -1;
+		counts[n++] = threads;
+		p += strcspn(p, ",");
+		if (*p == ',') p++;
+	}
+	return n;
+}
+
+int main(int argc, char **argv) {
+	const char *filter = NULL, *json_path = NULL, *baseline_path = NULL, *thread_list = NULL;
+	int iterations = DEFAULT_ITERATIONS;
+	double threshold = DEFAULT_THRESHOLD;
+	int thread_counts[MAX_THREAD_COUNTS];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:n:t:j:b:r:")) != -1) {
+		switch (opt) {
+		case 'a': filter = optarg; break;
+		case 'n': iterations = atoi(optarg); break;
+		case 't': thread_list = optarg; break;
+		case 'j': json_path = optarg; break;
+		case 'b': baseline_path = optarg; break;
+		case 'r': threshold = atof(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-a name] [-n iterations] [-t 1,2,4] [-j out.json] "
+							"[-b baseline.json [-r percent]]\n", argv[0]);
 			return EXIT_FAILURE;
 		}
-		pthread_join(thread, NULL);
-		rc = td.rc;
-	} else {
-		rc = kem_test_correctness(alg_name, iterations, &avg_keygen, &avg_encaps, &avg_decaps);
 	}
+	int thread_count_len = parse_threads(thread_list, thread_counts);
+	if (iterations < 1 || thread_count_len <= 0) {
+		fprintf(stderr, "Iterations and thread counts must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	// Initialize liboqs
+	OQS_init();
+
+#ifdef OQS_ENABLE_TEST_CONSTANT_TIME
+	OQS_randombytes_custom_algorithm(&TEST_KEM_randombytes);
 #else
-	rc = kem_test_correctness(alg_name, iterations, &avg_keygen, &avg_encaps, &avg_decaps);
+	OQS_randombytes_switch_algorithm("system");
 #endif
 
-	if (rc != OQS_SUCCESS) {
-		OQS_destroy();
-		return EXIT_FAILURE;
+	printf("Testing KEM algorithms using liboqs version %s, %d iterations per thread\n", OQS_version(), iterations);
+	printf("%-28s %3s %-7s %12s %12s %10s %10s\n", "KEM", "thr", "op", CYCLE_UNIT "/op", "ops/s", "p50 us", "p99 us");
+
+	static result_t results[MAX_RESULTS];
+	int count = 0, failed = 0;
+	for (int a = 0; a < OQS_KEM_alg_count(); a++) {
+		const char *alg_name = OQS_KEM_alg_identifier(a);
+		if (!OQS_KEM_alg_is_enabled(alg_name) || (filter != NULL && strstr(alg_name, filter) == NULL)) continue;
+
+		for (int t = 0; t < thread_count_len && count + OP_COUNT <= MAX_RESULTS; t++) {
+			if (run(alg_name, thread_counts[t], iterations, &results[count]) != 0) {
+				fprintf(stderr, "%s failed on %d threads\n", alg_name, thread_counts[t]);
+				failed++;
+				break;
+			}
+			for (int op = 0; op < OP_COUNT; op++) {
+				const result_t *r = &results[count + op];
+				printf("%-28s %3d %-7s %12.0f %12.0f %10.2f %10.2f\n", r->kem, r->threads, op_names[op],
+					   r->cycles, r->ops_per_sec, r->p50_ns / 1e3, r->p99_ns / 1e3);
+			}
+			count += OP_COUNT;
+		}
+		if (count > 0 && strcmp(results[count - 1].kem, alg_name) == 0) {
+			const result_t *r = &results[count - 1];
+			printf("%-28s public key %zu, secret key %zu, ciphertext %zu, shared secret %zu bytes, peak RSS %ld KB\n",
+				   alg_name, r->public_key, r->secret_key, r->ciphertext, r->shared_secret, r->rss_kb);
+		}
 	}
 
-#if !OQS_USE_PTHREADS
-	printf("Kyber %s Speed Test over %d iterations:\n", alg_name, iterations);
-	printf("Average Key Generation Time: %.2f µs\n", avg_keygen);
-	printf("Average Encapsulation Time: %.2f µs\n", avg_encaps);
-	printf("Average Decapsulation Time: %.2f µs\n", avg_decaps);
-#endif
+	int rc = failed == 0 && count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (count == 0) fprintf(stderr, "No enabled KEM matched\n");
+	if (json_path != NULL && write_json(json_path, results, count, iterations) != 0) rc = EXIT_FAILURE;
+	if (baseline_path != NULL && compare_baseline(baseline_path, results, count, threshold) != 0) rc = EXIT_FAILURE;
 
 	OQS_destroy();
-	return EXIT_SUCCESS;
+	return rc;
 }
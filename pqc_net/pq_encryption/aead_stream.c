@@ -0,0 +1,285 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "aead_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <openssl/rand.h>
+
+// Every stream gets its own key, from the session secret and the stream's salt
+static int stream_init(aead_stream_t *st, const unsigned char *secret,
+					   const unsigned char *salt, int decrypt) {
+	unsigned char ikm[AES_KEY_SIZE + AEAD_STREAM_HEADER_SIZE];
+	unsigned char material[AES_KEY_SIZE + sizeof(st->nonce_prefix)];
+
+	memcpy(ikm, secret, AES_KEY_SIZE);
+	memcpy(ikm + AES_KEY_SIZE, salt, AEAD_STREAM_HEADER_SIZE);
+	int rc = pqcrypto_hkdf(ikm, sizeof(ikm), "aead stream", material, sizeof(material));
+	OQS_MEM_cleanse(ikm, sizeof(ikm));
+	if (rc != 0) return -1;
+
+	memcpy(st->nonce_prefix, material + AES_KEY_SIZE, sizeof(st->nonce_prefix));
+	st->counter = 0;
+	st->decrypt = decrypt;
+	st->finished = 0;
+
+	st->ctx = EVP_CIPHER_CTX_new();
+	if (st->ctx == NULL ||
+		1 != EVP_CipherInit_ex(st->ctx, EVP_aes_256_gcm(), NULL, NULL, NULL, !decrypt) ||
+		1 != EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_SET_IVLEN, AES_GCM_IV_SIZE, NULL) ||
+		1 != EVP_CipherInit_ex(st->ctx, NULL, NULL, material, NULL, !decrypt)) {
+		fprintf(stderr, "Failed to key stream cipher\n");
+		OQS_MEM_cleanse(material, sizeof(material));
+		aead_stream_free(st);
+		return -1;
+	}
+	OQS_MEM_cleanse(material, sizeof(material));
+	return 0;
+}
+
+int aead_stream_init_encrypt(aead_stream_t *st, const unsigned char *secret,
+							 unsigned char header[AEAD_STREAM_HEADER_SIZE]) {
+	if (!RAND_bytes(header, AEAD_STREAM_HEADER_SIZE)) {
+		fprintf(stderr, "Failed to generate stream salt\n");
+		return -1;
+	}
+	return stream_init(st, secret, header, 0);
+}
+
+int aead_stream_init_decrypt(aead_stream_t *st, const unsigned char *secret,
+							 const unsigned char header[AEAD_STREAM_HEADER_SIZE]) {
+	return stream_init(st, secret, header, 1);
+}
+
+void aead_stream_free(aead_stream_t *st) {
+	EVP_CIPHER_CTX_free(st->ctx);
+	st->ctx = NULL;
+}
+
+// nonce = prefix || counter || final flag
+static void chunk_nonce(const aead_stream_t *st, int final, unsigned char *nonce) {
+	size_t n = sizeof(st->nonce_prefix);
+	memcpy(nonce, st->nonce_prefix, n);
+	nonce[n] = (unsigned char)(st->counter >> 24);
+	nonce[n + 1] = (unsigned char)(st->counter >> 16);
+	nonce[n + 2] = (unsigned char)(st->counter >> 8);
+	nonce[n + 3] = (unsigned char)st->counter;
+	nonce[n + 4] = final ? 1 : 0;
+}
+
+static void put_chunk_header(unsigned char *out, uint32_t value) {
+	out[0] = (unsigned char)(value >> 24);
+	out[1] = (unsigned char)(value >> 16);
+	out[2] = (unsigned char)(value >> 8);
+	out[3] = (unsigned char)value;
+}
+
+size_t aead_stream_chunk_len(const unsigned char header[AEAD_STREAM_CHUNK_HEADER_SIZE], int *final) {
+	uint32_t value = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+					 ((uint32_t)header[2] << 8) | header[3];
+	*final = (value & AEAD_STREAM_FINAL) != 0;
+	return value & ~AEAD_STREAM_FINAL;
+}
+
+int aead_stream_push(aead_stream_t *st, const unsigned char *in, size_t in_len, int final,
+					 unsigned char *out, size_t *out_len) {
+	unsigned char nonce[AES_GCM_IV_SIZE];
+	int len;
+
+	if (st->decrypt || st->finished || in_len > AEAD_STREAM_CHUNK_SIZE || st->counter == UINT32_MAX) {
+		fprintf(stderr, "Stream chunk rejected\n");
+		return -1;
+	}
+
+	uint32_t ciphertext_len = in_len + AES_GCM_TAG_SIZE;
+	put_chunk_header(out, ciphertext_len | (final ? AEAD_STREAM_FINAL : 0));
+	chunk_nonce(st, final, nonce);
+
+	unsigned char *ciphertext = out + AEAD_STREAM_CHUNK_HEADER_SIZE;
+	if (1 != EVP_EncryptInit_ex(st->ctx, NULL, NULL, NULL, nonce) ||
+		1 != EVP_EncryptUpdate(st->ctx, NULL, &len, out, AEAD_STREAM_CHUNK_HEADER_SIZE) ||
+		1 != EVP_EncryptUpdate(st->ctx, ciphertext, &len, in, in_len) ||
+		1 != EVP_EncryptFinal_ex(st->ctx, ciphertext + len, &len) ||
+		1 != EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_GET_TAG, AES_GCM_TAG_SIZE, ciphertext + in_len)) {
+		fprintf(stderr, "Stream chunk encryption failed\n");
+		return -1;
+	}
+
+	st->counter++;
+	st->finished = final;
+	*out_len = AEAD_STREAM_CHUNK_HEADER_SIZE + ciphertext_len;
+	return 0;
+}
+
+int aead_stream_pull(aead_stream_t *st, const unsigned char *in, size_t in_len,
+					 unsigned char *out, size_t *out_len) {
+	unsigned char nonce[AES_GCM_IV_SIZE];
+	int final, len;
+
+	if (!st->decrypt || st->finished || in_len < AEAD_STREAM_CHUNK_OVERHEAD) {
+		fprintf(stderr, "Unexpected stream chunk\n");
+		return -1;
+	}
+	size_t ciphertext_len = aead_stream_chunk_len(in, &final);
+	if (ciphertext_len != in_len - AEAD_STREAM_CHUNK_HEADER_SIZE) {
+		fprintf(stderr, "Stream chunk length mismatch\n");
+		return -1;
+	}
+	// out only has room for one chunk's plaintext, whoever framed the input
+	if (ciphertext_len > AEAD_STREAM_CHUNK_SIZE + AES_GCM_TAG_SIZE) {
+		fprintf(stderr, "Stream chunk larger than %d bytes\n", AEAD_STREAM_CHUNK_SIZE);
+		return -1;
+	}
+
+	// A forged final flag or a chunk out of place gives the wrong nonce and fails the tag check
+	size_t plaintext_len = ciphertext_len - AES_GCM_TAG_SIZE;
+	const unsigned char *ciphertext = in + AEAD_STREAM_CHUNK_HEADER_SIZE;
+	chunk_nonce(st, final, nonce);
+
+	if (1 != EVP_DecryptInit_ex(st->ctx, NULL, NULL, NULL, nonce) ||
+		1 != EVP_DecryptUpdate(st->ctx, NULL, &len, in, AEAD_STREAM_CHUNK_HEADER_SIZE) ||
+		1 != EVP_DecryptUpdate(st->ctx, out, &len, ciphertext, plaintext_len) ||
+		1 != EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_SET_TAG, AES_GCM_TAG_SIZE,
+								 (void *)(ciphertext + plaintext_len)) ||
+		EVP_DecryptFinal_ex(st->ctx, out + len, &len) <= 0) {
+		fprintf(stderr, "Stream chunk failed authentication\n");
+		return -1;
+	}
+
+	st->counter++;
+	st->finished = final;
+	*out_len = plaintext_len;
+	return final;
+}
+
+// Read until len bytes or end of file, returns the number read or -1
+static ssize_t read_full(int fd, unsigned char *buf, size_t len) {
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = read(fd, buf + total, len - total);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		if (n == 0) break;
+		total += n;
+	}
+	return total;
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int aead_stream_seal_fd(const unsigned char *secret, int in_fd, int out_fd) {
+	unsigned char header[AEAD_STREAM_HEADER_SIZE];
+	unsigned char *plaintext = malloc(AEAD_STREAM_CHUNK_SIZE);
+	unsigned char *chunk = malloc(AEAD_STREAM_CHUNK_SIZE + AEAD_STREAM_CHUNK_OVERHEAD);
+	aead_stream_t st;
+	int rc = -1;
+
+	if (plaintext == NULL || chunk == NULL) {
+		perror("malloc");
+		goto out_free;
+	}
+	if (aead_stream_init_encrypt(&st, secret, header) != 0) {
+		goto out_free;
+	}
+	if (write_full(out_fd, header, sizeof(header)) != 0) {
+		perror("write");
+		goto out;
+	}
+
+	// A short read means end of input, so the chunk read then is the final one. An input that is
+	// an exact multiple of the chunk size ends with an empty final chunk.
+	for (;;) {
+		ssize_t n = read_full(in_fd, plaintext, AEAD_STREAM_CHUNK_SIZE);
+		if (n < 0) {
+			perror("read");
+			goto out;
+		}
+		int final = n < AEAD_STREAM_CHUNK_SIZE;
+		size_t chunk_len;
+		if (aead_stream_push(&st, plaintext, n, final, chunk, &chunk_len) != 0) {
+			goto out;
+		}
+		if (write_full(out_fd, chunk, chunk_len) != 0) {
+			perror("write");
+			goto out;
+		}
+		if (final) break;
+	}
+	rc = 0;
+
+out:
+	aead_stream_free(&st);
+out_free:
+	if (plaintext != NULL) OQS_MEM_cleanse(plaintext, AEAD_STREAM_CHUNK_SIZE);
+	free(plaintext);
+	free(chunk);
+	return rc;
+}
+
+int aead_stream_open_fd(const unsigned char *secret, int in_fd, int out_fd) {
+	unsigned char header[AEAD_STREAM_HEADER_SIZE];
+	unsigned char *chunk = malloc(AEAD_STREAM_CHUNK_SIZE + AEAD_STREAM_CHUNK_OVERHEAD);
+	unsigned char *plaintext = malloc(AEAD_STREAM_CHUNK_SIZE);
+	aead_stream_t st;
+	int rc = -1;
+
+	if (plaintext == NULL || chunk == NULL) {
+		perror("malloc");
+		goto out_free;
+	}
+	if (read_full(in_fd, header, sizeof(header)) != sizeof(header)) {
+		fprintf(stderr, "Stream header missing\n");
+		goto out_free;
+	}
+	if (aead_stream_init_decrypt(&st, secret, header) != 0) {
+		goto out_free;
+	}
+
+	int done = 0;
+	while (!done) {
+		int final;
+		if (read_full(in_fd, chunk, AEAD_STREAM_CHUNK_HEADER_SIZE) != AEAD_STREAM_CHUNK_HEADER_SIZE) {
+			fprintf(stderr, "Stream truncated\n");
+			goto out;
+		}
+		size_t ciphertext_len = aead_stream_chunk_len(chunk, &final);
+		if (ciphertext_len < AES_GCM_TAG_SIZE || ciphertext_len > AEAD_STREAM_CHUNK_SIZE + AES_GCM_TAG_SIZE ||
+			read_full(in_fd, chunk + AEAD_STREAM_CHUNK_HEADER_SIZE, ciphertext_len) != (ssize_t)ciphertext_len) {
+			fprintf(stderr, "Stream truncated\n");
+			goto out;
+		}
+
+		size_t plaintext_len;
+		done = aead_stream_pull(&st, chunk, AEAD_STREAM_CHUNK_HEADER_SIZE + ciphertext_len,
+								plaintext, &plaintext_len);
+		if (done < 0) {
+			goto out;
+		}
+		if (write_full(out_fd, plaintext, plaintext_len) != 0) {
+			perror("write");
+			goto out;
+		}
+	}
+	rc = 0;
+
+out:
+	aead_stream_free(&st);
+out_free:
+	if (plaintext != NULL) OQS_MEM_cleanse(plaintext, AEAD_STREAM_CHUNK_SIZE);
+	free(plaintext);
+	free(chunk);
+	return rc;
+}
@@ -0,0 +1,65 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef AEAD_STREAM_H
+#define AEAD_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+#include "pq_encryption.h"
+
+// Segmented AEAD (STREAM construction) for payloads too large to hold in memory. The payload is
+// cut into chunks of up to AEAD_STREAM_CHUNK_SIZE bytes, each sealed with its own tag under a
+// nonce built from the chunk counter and a final-chunk flag, so chunks can't be reordered,
+// dropped or cut off at the end without the receiver noticing.
+//
+// Wire format: a AEAD_STREAM_HEADER_SIZE byte random salt, then per chunk a 4-byte big-endian
+// header (top bit = final chunk, rest = ciphertext length) followed by ciphertext and tag.
+
+#define AEAD_STREAM_CHUNK_SIZE (64 * 1024)
+#define AEAD_STREAM_HEADER_SIZE 16
+#define AEAD_STREAM_CHUNK_HEADER_SIZE 4
+#define AEAD_STREAM_CHUNK_OVERHEAD (AEAD_STREAM_CHUNK_HEADER_SIZE + AES_GCM_TAG_SIZE)
+#define AEAD_STREAM_FINAL 0x80000000u
+
+typedef struct {
+	EVP_CIPHER_CTX *ctx;
+	unsigned char nonce_prefix[AES_GCM_IV_SIZE - 5]; // followed by a 32-bit counter and the flag
+	uint32_t counter;
+	int decrypt;
+	int finished;
+} aead_stream_t;
+
+// Start sealing a stream keyed from a session secret, header receives the salt to send first
+int aead_stream_init_encrypt(aead_stream_t *st, const unsigned char *secret,
+							 unsigned char header[AEAD_STREAM_HEADER_SIZE]);
+
+// Start opening a stream from the salt the sender put in front of it
+int aead_stream_init_decrypt(aead_stream_t *st, const unsigned char *secret,
+							 const unsigned char header[AEAD_STREAM_HEADER_SIZE]);
+
+void aead_stream_free(aead_stream_t *st);
+
+// Seal up to AEAD_STREAM_CHUNK_SIZE bytes as the next chunk. out receives
+// in_len + AEAD_STREAM_CHUNK_OVERHEAD bytes. The last chunk must have final set, it may be empty.
+int aead_stream_push(aead_stream_t *st, const unsigned char *in, size_t in_len, int final,
+					 unsigned char *out, size_t *out_len);
+
+// Read the ciphertext length from a chunk header and whether it is the final chunk
+size_t aead_stream_chunk_len(const unsigned char header[AEAD_STREAM_CHUNK_HEADER_SIZE], int *final);
+
+// Open the next chunk, header included. Returns 1 after the final chunk, 0 when more should
+// follow and -1 if the chunk is forged, out of order, arrives after the final one or holds more
+// than AEAD_STREAM_CHUNK_SIZE bytes, which is all out needs room for.
+int aead_stream_pull(aead_stream_t *st, const unsigned char *in, size_t in_len,
+					 unsigned char *out, size_t *out_len);
+
+// Seal everything readable from in_fd and write the stream to out_fd, and the reverse. Memory use
+// is a fixed two chunk buffers whatever the payload size. Opening writes each chunk as soon as it
+// authenticates, so if it fails the output written so far must be discarded.
+int aead_stream_seal_fd(const unsigned char *secret, int in_fd, int out_fd);
+int aead_stream_open_fd(const unsigned char *secret, int in_fd, int out_fd);
+
+#endif // AEAD_STREAM_H
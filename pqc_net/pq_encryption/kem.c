@@ -0,0 +1,227 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "kem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every algorithm the client knows how to negotiate. Times are rough liboqs figures for a recent
+// x86-64 core, kem_bench replaces them with this machine's. Sizes come from the handles.
+static kem_cost_t costs[] = {
+	{ "ML-KEM-512", 1, 0, 12, 14, 16, 0 },
+	{ "ML-KEM-768", 3, 0, 19, 21, 24, 0 },
+	{ "ML-KEM-1024", 5, 0, 28, 30, 34, 0 },
+	{ "Kyber512", 1, 0, 12, 14, 16, 0 },
+	{ "Kyber768", 3, 0, 19, 21, 24, 0 },
+	{ "Kyber1024", 5, 0, 28, 30, 34, 0 },
+	{ "HQC-128", 1, 0, 60, 120, 200, 0 },
+	{ "HQC-192", 3, 0, 170, 340, 560, 0 },
+	{ "HQC-256", 5, 0, 310, 620, 1000, 0 },
+};
+
+#define KEM_COUNT (int)(sizeof(costs) / sizeof(costs[0]))
+#define KEM_LEGACY 3 // Kyber512, all that peers without negotiation speak
+#define KEM_TIME_TOLERANCE 0.05
+
+static OQS_KEM *handles[KEM_COUNT];
+static kem_policy_t policy = KEM_POLICY_FASTEST;
+
+static const char *policy_names[] = { "fastest", "smallest", "strongest" };
+
+int kem_initialize() {
+	int enabled = 0;
+
+	for (int i = 0; i < KEM_COUNT; i++) {
+		handles[i] = OQS_KEM_alg_is_enabled(costs[i].name) ? OQS_KEM_new(costs[i].name) : NULL;
+		if (handles[i] != NULL) {
+			costs[i].wire_bytes = handles[i]->length_public_key + handles[i]->length_ciphertext;
+			enabled++;
+		}
+	}
+	if (enabled == 0) {
+		fprintf(stderr, "No supported KEM is enabled in liboqs\n");
+		return -1;
+	}
+
+	const char *path = getenv("PQC_KEM_COSTS");
+	kem_load_costs(path != NULL ? path : KEM_COSTS_FILE);
+
+	const char *name = getenv("PQC_KEM_POLICY");
+	if (name != NULL) {
+		int p = kem_policy_from_name(name);
+		if (p < 0) {
+			fprintf(stderr, "Unknown KEM policy '%s', using %s\n", name, policy_names[policy]);
+		} else {
+			policy = p;
+		}
+	}
+	return 0;
+}
+
+void kem_cleanup() {
+	for (int i = 0; i < KEM_COUNT; i++) {
+		OQS_KEM_free(handles[i]);
+		handles[i] = NULL;
+	}
+}
+
+int kem_count() {
+	return KEM_COUNT;
+}
+
+const OQS_KEM *kem_handle(int kem) {
+	return kem >= 0 && kem < KEM_COUNT ? handles[kem] : NULL;
+}
+
+const char *kem_name(int kem) {
+	return kem >= 0 && kem < KEM_COUNT ? costs[kem].name : "unknown";
+}
+
+int kem_from_name(const char *name) {
+	for (int i = 0; i < KEM_COUNT; i++) {
+		if (strcmp(name, costs[i].name) == 0) return i;
+	}
+	return -1;
+}
+
+const kem_cost_t *kem_cost(int kem) {
+	return kem >= 0 && kem < KEM_COUNT ? &costs[kem] : NULL;
+}
+
+int kem_load_costs(const char *path) {
+	char line[256], name[64];
+	double keygen, encaps, decaps;
+	int loaded = 0;
+
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		// No table yet, the built-in estimates stand
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%63s %lf %lf %lf", name, &keygen, &encaps, &decaps) != 4) {
+			continue;
+		}
+		int kem = kem_from_name(name);
+		if (kem < 0) continue;
+		costs[kem].keygen_us = keygen;
+		costs[kem].encaps_us = encaps;
+		costs[kem].decaps_us = decaps;
+		costs[kem].measured = 1;
+		loaded++;
+	}
+	fclose(fp);
+	return loaded;
+}
+
+int kem_policy_from_name(const char *name) {
+	for (int i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++) {
+		if (strcmp(name, policy_names[i]) == 0) return i;
+	}
+	return -1;
+}
+
+const char *kem_policy_name(kem_policy_t p) {
+	return p <= KEM_POLICY_STRONGEST ? policy_names[p] : "unknown";
+}
+
+void kem_set_policy(kem_policy_t p) {
+	policy = p;
+}
+
+kem_policy_t kem_get_policy() {
+	return policy;
+}
+
+static double handshake_us(int kem) {
+	return costs[kem].keygen_us + costs[kem].encaps_us + costs[kem].decaps_us;
+}
+
+// Negative when a is the better choice under the policy. The other criteria break ties, then the
+// table order, so both ends agree on the same inputs. Times within KEM_TIME_TOLERANCE of each other
+// count as a tie, measurement noise shouldn't decide between two equally fast algorithms.
+static int compare(int a, int b) {
+	double time = handshake_us(a) - handshake_us(b);
+	double faster = handshake_us(a) < handshake_us(b) ? handshake_us(a) : handshake_us(b);
+	if (time < faster * KEM_TIME_TOLERANCE && time > -faster * KEM_TIME_TOLERANCE) time = 0;
+	double size = (double)costs[a].wire_bytes - (double)costs[b].wire_bytes;
+	double level = (double)costs[b].nist_level - (double)costs[a].nist_level;
+	double order[3];
+
+	switch (policy) {
+	case KEM_POLICY_SMALLEST:
+		order[0] = size, order[1] = time, order[2] = level;
+		break;
+	case KEM_POLICY_STRONGEST:
+		order[0] = level, order[1] = time, order[2] = size;
+		break;
+	default:
+		order[0] = time, order[1] = size, order[2] = level;
+		break;
+	}
+	for (int i = 0; i < 3; i++) {
+		if (order[i] != 0) return order[i] < 0 ? -1 : 1;
+	}
+	return a - b;
+}
+
+int kem_preferred() {
+	int best = -1;
+
+	for (int i = 0; i < KEM_COUNT; i++) {
+		if (handles[i] != NULL && (best < 0 || compare(i, best) < 0)) best = i;
+	}
+	return best;
+}
+
+void kem_offer(char *offer, size_t offer_len) {
+	int order[KEM_COUNT], count = 0;
+	size_t used = 0;
+
+	for (int i = 0; i < KEM_COUNT; i++) {
+		if (handles[i] == NULL) continue;
+		int j = count++;
+		while (j > 0 && compare(i, order[j - 1]) < 0) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	offer[0] = '\0';
+	for (int i = 0; i < count && used < offer_len; i++) {
+		used += snprintf(offer + used, offer_len - used, "%s%s", i ? "," : "", costs[order[i]].name);
+	}
+}
+
+int kem_select(const char *peer_offer) {
+	char offer[KEM_OFFER_SIZE];
+	int best = -1;
+
+	if (peer_offer == NULL || peer_offer[0] == '\0') {
+		return handles[KEM_LEGACY] != NULL ? KEM_LEGACY : -1;
+	}
+
+	strncpy(offer, peer_offer, sizeof(offer) - 1);
+	offer[sizeof(offer) - 1] = '\0';
+
+	char *saveptr;
+	for (char *entry = strtok_r(offer, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr)) {
+		int kem = kem_from_name(entry);
+		if (kem < 0 || handles[kem] == NULL) continue;
+		if (best < 0 || compare(kem, best) < 0) best = kem;
+	}
+	return best;
+}
+
+int kem_accept_share(int share, const char *peer_offer) {
+	int best = kem_select(peer_offer);
+
+	if (share < 0 || handles[share] == NULL || best < 0) {
+		return best;
+	}
+	// The dialer already ranked by its own policy, only security is worth a round trip
+	return costs[best].nist_level > costs[share].nist_level ? best : share;
+}
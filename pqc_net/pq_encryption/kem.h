@@ -0,0 +1,72 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef KEM_H
+#define KEM_H
+
+#include <oqs/oqs.h>
+#include <stddef.h>
+
+#define KEM_OFFER_SIZE 256
+#define KEM_COSTS_FILE "kem_costs.conf" // written by pqc_test/kem_bench, read at startup if present
+
+// How a session's KEM is picked from those both ends support
+typedef enum {
+	KEM_POLICY_FASTEST,   // least keygen + encaps + decaps time, the handshake's CPU latency
+	KEM_POLICY_SMALLEST,  // fewest public key + ciphertext bytes on the wire
+	KEM_POLICY_STRONGEST, // highest NIST security level
+} kem_policy_t;
+
+// Cost of one algorithm on this machine. Times come from the cost table when one was loaded and
+// from built-in estimates otherwise.
+typedef struct {
+	const char *name;     // liboqs algorithm name, also used on the wire
+	int nist_level;
+	size_t wire_bytes;    // public key + ciphertext, what a handshake sends
+	double keygen_us;
+	double encaps_us;
+	double decaps_us;
+	int measured;         // 1 if the times came from the cost table
+} kem_cost_t;
+
+// Create a shared handle for every known algorithm this liboqs has enabled and load the cost table
+// from $PQC_KEM_COSTS or KEM_COSTS_FILE. The policy comes from $PQC_KEM_POLICY, fastest by default.
+// Called by pqcrypto_initialize().
+int kem_initialize();
+void kem_cleanup();
+
+// Number of known algorithms, indexes run from 0 to kem_count() - 1
+int kem_count();
+
+// Shared handle, NULL when this liboqs build lacks the algorithm
+const OQS_KEM *kem_handle(int kem);
+const char *kem_name(int kem);
+int kem_from_name(const char *name);
+const kem_cost_t *kem_cost(int kem);
+
+// Replace the built-in estimates with a table of "name keygen_us encaps_us decaps_us" lines
+int kem_load_costs(const char *path);
+
+int kem_policy_from_name(const char *name);
+const char *kem_policy_name(kem_policy_t policy);
+void kem_set_policy(kem_policy_t policy);
+kem_policy_t kem_get_policy();
+
+// Best enabled algorithm under the local policy, what the key pair pool generates ahead of time
+int kem_preferred();
+
+// Comma separated names of the enabled algorithms, best first under the local policy
+void kem_offer(char *offer, size_t offer_len);
+
+// Pick the session's KEM from the peer's offer: the best algorithm both ends support under the
+// local policy. An empty offer comes from a peer that predates negotiation and means Kyber512.
+// Returns -1 when nothing is shared.
+int kem_select(const char *peer_offer);
+
+// KEM for a session whose dialer already sent a key share for share. The share is used unless the
+// local policy would pick an algorithm with a higher security level, which costs the dialer
+// another round trip with a new share. Returns -1 when nothing is shared.
+int kem_accept_share(int share, const char *peer_offer);
+
+#endif // KEM_H
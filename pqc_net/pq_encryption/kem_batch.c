@@ -0,0 +1,223 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "kem_batch.h"
+#include "kem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+enum { BATCH_KEYPAIR, BATCH_ENCAPSULATE, BATCH_DECAPSULATE };
+
+typedef struct batch_job {
+	int op;
+	int kem;
+	size_t count;
+	size_t chunk;
+	encryption_context_t *enc_ctxs;
+	const unsigned char *const *inputs;   // public keys or ciphertexts
+	const size_t *input_lens;
+	const unsigned char *const *secret_keys;
+	unsigned char *const *outputs;        // public keys or ciphertexts
+	unsigned char *const *output_secrets; // secret keys of new key pairs
+	int *results;
+
+	size_t next;      // first operation nobody has claimed
+	size_t done;
+	int failed;
+	int queued;       // still on the list for workers to claim from
+	struct batch_job *next_job;
+} batch_job_t;
+
+static struct {
+	int running;
+	int threads;
+	pthread_t workers[KEM_BATCH_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t work;       // a batch was queued or the pool is stopping
+	pthread_cond_t finished;   // a batch's last chunk completed
+	batch_job_t *jobs, *last_job;
+} pool = { .threads = 1, .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+		   .finished = PTHREAD_COND_INITIALIZER };
+
+static int run_one(const batch_job_t *job, size_t i) {
+	size_t ciphertext_len;
+
+	switch (job->op) {
+	case BATCH_KEYPAIR:
+		return OQS_KEM_keypair(kem_handle(job->kem), job->outputs[i], job->output_secrets[i]) == OQS_SUCCESS ? 0 : -1;
+	case BATCH_ENCAPSULATE:
+		return pqcrypto_encapsulate(&job->enc_ctxs[i], job->kem, job->inputs[i], job->input_lens[i],
+									job->outputs[i], &ciphertext_len);
+	default:
+		return pqcrypto_derive_shared_secret(&job->enc_ctxs[i], job->kem, job->inputs[i], job->input_lens[i],
+											 job->secret_keys[i]);
+	}
+}
+
+// Caller holds the lock
+static void unqueue(batch_job_t *job) {
+	batch_job_t **link = &pool.jobs, *prev = NULL;
+	while (*link != job) {
+		prev = *link;
+		link = &(*link)->next_job;
+	}
+	*link = job->next_job;
+	if (pool.last_job == job) pool.last_job = prev;
+	job->queued = 0;
+}
+
+// Claim and run chunks of job until none are left. Called and returns with the lock held.
+static void work_on(batch_job_t *job) {
+	while (job->next < job->count) {
+		size_t first = job->next;
+		size_t last = first + job->chunk < job->count ? first + job->chunk : job->count;
+		job->next = last;
+		if (last == job->count && job->queued) unqueue(job);
+		pthread_mutex_unlock(&pool.lock);
+
+		int failed = 0;
+		for (size_t i = first; i < last; i++) {
+			int rc = run_one(job, i);
+			if (job->results != NULL) job->results[i] = rc;
+			failed += rc != 0;
+		}
+
+		pthread_mutex_lock(&pool.lock);
+		job->failed += failed;
+		job->done += last - first;
+		if (job->done == job->count) pthread_cond_broadcast(&pool.finished);
+	}
+}
+
+static void *worker_thread(void *arg) {
+	(void)arg;
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.running) {
+		if (pool.jobs == NULL) {
+			pthread_cond_wait(&pool.work, &pool.lock);
+			continue;
+		}
+		work_on(pool.jobs);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static int run_batch(batch_job_t *job) {
+	if (job->count == 0) return 0;
+	if (kem_handle(job->kem) == NULL) {
+		fprintf(stderr, "KEM %s is not available\n", kem_name(job->kem));
+		for (size_t i = 0; job->results != NULL && i < job->count; i++) job->results[i] = -1;
+		return (int)job->count;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	// Small enough chunks that every thread gets some, large enough to keep each on one algorithm
+	job->chunk = job->count / ((size_t)pool.threads * 4);
+	if (job->chunk < 1) job->chunk = 1;
+	if (job->chunk > KEM_BATCH_CHUNK) job->chunk = KEM_BATCH_CHUNK;
+	if (pool.running && job->count > job->chunk) {
+		job->queued = 1;
+		if (pool.last_job != NULL) {
+			pool.last_job->next_job = job;
+		} else {
+			pool.jobs = job;
+		}
+		pool.last_job = job;
+		pthread_cond_broadcast(&pool.work);
+	}
+	work_on(job);
+	while (job->done < job->count) {
+		pthread_cond_wait(&pool.finished, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return job->failed;
+}
+
+static int default_threads() {
+	const char *value = getenv("PQC_KEM_THREADS");
+	long threads = value != NULL ? atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+	return (int)threads;
+}
+
+int kem_batch_start(int threads) {
+	if (threads <= 0) threads = default_threads();
+	if (threads > KEM_BATCH_MAX_THREADS) threads = KEM_BATCH_MAX_THREADS;
+
+	pthread_mutex_lock(&pool.lock);
+	if (pool.running) {
+		pthread_mutex_unlock(&pool.lock);
+		return 0;
+	}
+	pool.running = 1;
+	pool.threads = 1;
+	for (int i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool.workers[i], NULL, worker_thread, NULL) != 0) {
+			perror("pthread_create");
+			break;
+		}
+		pool.threads++;
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return 0;
+}
+
+void kem_batch_stop() {
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.running) {
+		pthread_mutex_unlock(&pool.lock);
+		return;
+	}
+	pool.running = 0;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	// Batches still queued are finished by the threads that submitted them
+	for (int i = 0; i < pool.threads - 1; i++) {
+		pthread_join(pool.workers[i], NULL);
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.threads = 1;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+int kem_batch_threads() {
+	pthread_mutex_lock(&pool.lock);
+	int threads = pool.threads;
+	pthread_mutex_unlock(&pool.lock);
+	return threads;
+}
+
+int kem_batch_keypair(int kem, size_t count, unsigned char *const *public_keys,
+					  unsigned char *const *secret_keys, int *results) {
+	batch_job_t job = {
+		.op = BATCH_KEYPAIR, .kem = kem, .count = count,
+		.outputs = public_keys, .output_secrets = secret_keys, .results = results,
+	};
+	return run_batch(&job);
+}
+
+int kem_batch_encapsulate(encryption_context_t *enc_ctxs, int kem, size_t count,
+						  const unsigned char *const *public_keys, const size_t *public_key_lens,
+						  unsigned char *const *ciphertexts, int *results) {
+	batch_job_t job = {
+		.op = BATCH_ENCAPSULATE, .kem = kem, .count = count, .enc_ctxs = enc_ctxs,
+		.inputs = public_keys, .input_lens = public_key_lens, .outputs = ciphertexts, .results = results,
+	};
+	return run_batch(&job);
+}
+
+int kem_batch_decapsulate(encryption_context_t *enc_ctxs, int kem, size_t count,
+						  const unsigned char *const *ciphertexts, const size_t *ciphertext_lens,
+						  const unsigned char *const *secret_keys, int *results) {
+	batch_job_t job = {
+		.op = BATCH_DECAPSULATE, .kem = kem, .count = count, .enc_ctxs = enc_ctxs,
+		.inputs = ciphertexts, .input_lens = ciphertext_lens, .secret_keys = secret_keys, .results = results,
+	};
+	return run_batch(&job);
+}
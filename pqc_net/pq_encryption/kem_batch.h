@@ -0,0 +1,49 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef KEM_BATCH_H
+#define KEM_BATCH_H
+
+#include "pq_encryption.h"
+#include <stddef.h>
+
+#define KEM_BATCH_CHUNK 8          // most operations a thread claims at a time
+#define KEM_BATCH_MAX_THREADS 64
+
+// Batched KEM operations for peers that key many sessions at once. A batch is split into chunks of
+// consecutive operations that the pool's threads and the calling thread claim until none are left,
+// so each thread runs one algorithm's code back to back. liboqs has no multi-buffer API, its AVX2
+// code is picked per call, so a batch gains from the threads and from the warm code and tables.
+//
+// Without kem_batch_start() batches run on the calling thread alone. Several threads may submit
+// batches at the same time.
+
+// Start threads - 1 workers, the caller of a batch is the last one. threads <= 0 takes
+// $PQC_KEM_THREADS or the number of CPUs. Call after pqcrypto_initialize().
+int kem_batch_start(int threads);
+
+// Stop the workers, safe to call if they were never started
+void kem_batch_stop();
+
+// Threads a batch runs on, the caller included
+int kem_batch_threads();
+
+// Each call below returns the number of operations that failed and sets results[i] to 0 or -1 for
+// each one unless results is NULL. Buffers are sized by the KEM's handle, see kem_handle().
+
+// Generate count key pairs for kem into public_keys[i] and secret_keys[i]
+int kem_batch_keypair(int kem, size_t count, unsigned char *const *public_keys,
+					  unsigned char *const *secret_keys, int *results);
+
+// pqcrypto_encapsulate() to each public key, the secret goes to enc_ctxs[i]
+int kem_batch_encapsulate(encryption_context_t *enc_ctxs, int kem, size_t count,
+						  const unsigned char *const *public_keys, const size_t *public_key_lens,
+						  unsigned char *const *ciphertexts, int *results);
+
+// pqcrypto_derive_shared_secret() for each ciphertext with the matching secret key
+int kem_batch_decapsulate(encryption_context_t *enc_ctxs, int kem, size_t count,
+						  const unsigned char *const *ciphertexts, const size_t *ciphertext_lens,
+						  const unsigned char *const *secret_keys, int *results);
+
+#endif // KEM_BATCH_H
@@ -0,0 +1,251 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "keypool.h"
+#include "pq_encryption.h"
+#include "kem.h"
+#include "secure_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
+enum { SLOT_FREE, SLOT_READY, SLOT_IN_USE };
+
+// Twice as many slots as ready key pairs, so the refill thread can keep the pool full while
+// handshakes still hold the key pairs they took
+static struct {
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	int kem_id;        // the locally preferred KEM, what handshakes will mostly ask for
+	const OQS_KEM *kem;
+	unsigned char **slots;     // one key pair each, in the secure arena
+	size_t slot_size;
+	int *state;
+	int slot_count;
+	size_t capacity;
+	size_t ready;
+
+	unsigned long hits, misses, refilled;
+	double refill_sec;
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static unsigned char *slot_public_key(int slot) {
+	return pool.slots[slot];
+}
+
+static unsigned char *slot_secret_key(int slot) {
+	return slot_public_key(slot) + pool.kem->length_public_key;
+}
+
+static int find_slot(int state) {
+	for (int i = 0; i < pool.slot_count; i++) {
+		if (pool.state[i] == state) return i;
+	}
+	return -1;
+}
+
+static void *refill_thread(void *arg) {
+	(void)arg;
+
+	// Key generation should only use otherwise idle CPU. On Linux the nice value is per thread.
+	setpriority(PRIO_PROCESS, 0, 19);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.running) {
+		int slot = pool.ready < pool.capacity ? find_slot(SLOT_FREE) : -1;
+		if (slot < 0) {
+			pthread_cond_wait(&pool.cond, &pool.lock);
+			continue;
+		}
+		pool.state[slot] = SLOT_IN_USE;
+		pthread_mutex_unlock(&pool.lock);
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		OQS_STATUS rc = OQS_KEM_keypair(pool.kem, slot_public_key(slot), slot_secret_key(slot));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		pthread_mutex_lock(&pool.lock);
+		if (rc != OQS_SUCCESS) {
+			fprintf(stderr, "Background %s key generation failed\n", pool.kem->method_name);
+			pool.state[slot] = SLOT_FREE;
+			break;
+		}
+		pool.state[slot] = SLOT_READY;
+		pool.ready++;
+		pool.refilled++;
+		pool.refill_sec += (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static void free_slots() {
+	for (int i = 0; pool.slots != NULL && i < pool.slot_count; i++) {
+		secure_free(pool.slots[i], pool.slot_size);
+	}
+	free(pool.slots);
+	pool.slots = NULL;
+	free(pool.state);
+	pool.state = NULL;
+	pool.kem = NULL;
+}
+
+int keypool_start(size_t capacity) {
+	if (pool.running) return 0;
+
+	pool.kem_id = kem_preferred();
+	pool.kem = kem_handle(pool.kem_id);
+	if (pool.kem == NULL) {
+		fprintf(stderr, "No KEM to fill the key pool with\n");
+		return -1;
+	}
+	pool.capacity = capacity;
+	pool.slot_count = (int)capacity * 2;
+	pool.slot_size = pool.kem->length_public_key + pool.kem->length_secret_key;
+
+	pool.slots = calloc(pool.slot_count, sizeof(unsigned char *));
+	pool.state = calloc(pool.slot_count, sizeof(int));
+	if (pool.slots == NULL || pool.state == NULL) {
+		perror("calloc");
+		goto fail;
+	}
+	for (int i = 0; i < pool.slot_count; i++) {
+		pool.slots[i] = secure_alloc(pool.slot_size);
+		if (pool.slots[i] == NULL) goto fail;
+	}
+
+	pool.ready = 0;
+	pool.running = 1;
+	if (pthread_create(&pool.thread, NULL, refill_thread, NULL) != 0) {
+		perror("pthread_create");
+		pool.running = 0;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free_slots();
+	return -1;
+}
+
+void keypool_stop() {
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.running) {
+		pthread_mutex_unlock(&pool.lock);
+		return;
+	}
+	pool.running = 0;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+	pthread_join(pool.thread, NULL);
+	free_slots();
+}
+
+// A KEM the pool doesn't hold was negotiated, generate into a block of its own
+static int take_other(int kem_id, keypool_key_t *key) {
+	const OQS_KEM *kem = kem_handle(kem_id);
+	if (kem == NULL) {
+		fprintf(stderr, "KEM %s is not available\n", kem_name(kem_id));
+		return -1;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.misses++;
+	pthread_mutex_unlock(&pool.lock);
+
+	key->slot = -1;
+	key->public_key_len = kem->length_public_key;
+	key->secret_key_len = kem->length_secret_key;
+	key->public_key = secure_alloc(key->public_key_len + key->secret_key_len);
+	if (key->public_key == NULL) return -1;
+	key->secret_key = key->public_key + key->public_key_len;
+	if (OQS_KEM_keypair(kem, key->public_key, key->secret_key) != OQS_SUCCESS) {
+		fprintf(stderr, "Failed to generate %s key pair\n", kem->method_name);
+		keypool_release(key);
+		return -1;
+	}
+	return 0;
+}
+
+int keypool_take(int kem_id, keypool_key_t *key) {
+	key->kem = kem_id;
+	if (pool.running && kem_id != pool.kem_id) {
+		return take_other(kem_id, key);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.running) {
+		pthread_mutex_unlock(&pool.lock);
+		fprintf(stderr, "Key pool is not running\n");
+		return -1;
+	}
+
+	int slot = find_slot(SLOT_READY);
+	if (slot >= 0) {
+		pool.ready--;
+		pool.hits++;
+	} else {
+		// Nothing ready, generate into a free slot ourselves
+		slot = find_slot(SLOT_FREE);
+		pool.misses++;
+	}
+	if (slot < 0) {
+		pthread_mutex_unlock(&pool.lock);
+		fprintf(stderr, "Key pool exhausted\n");
+		return -1;
+	}
+	int generate = pool.state[slot] == SLOT_FREE;
+	pool.state[slot] = SLOT_IN_USE;
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	key->slot = slot;
+	key->public_key = slot_public_key(slot);
+	key->secret_key = slot_secret_key(slot);
+	key->public_key_len = pool.kem->length_public_key;
+	key->secret_key_len = pool.kem->length_secret_key;
+
+	if (generate && OQS_KEM_keypair(pool.kem, key->public_key, key->secret_key) != OQS_SUCCESS) {
+		fprintf(stderr, "Failed to generate %s key pair\n", pool.kem->method_name);
+		keypool_release(key);
+		return -1;
+	}
+	return 0;
+}
+
+void keypool_release(keypool_key_t *key) {
+	if (key->slot < 0) {
+		secure_free(key->public_key, key->public_key_len + key->secret_key_len);
+		key->public_key = NULL;
+		key->secret_key = NULL;
+		return;
+	}
+
+	OQS_MEM_cleanse(key->public_key, key->public_key_len + key->secret_key_len);
+	pthread_mutex_lock(&pool.lock);
+	pool.state[key->slot] = SLOT_FREE;
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	key->public_key = NULL;
+	key->secret_key = NULL;
+}
+
+void keypool_get_stats(keypool_stats_t *stats) {
+	pthread_mutex_lock(&pool.lock);
+	stats->hits = pool.hits;
+	stats->misses = pool.misses;
+	stats->refilled = pool.refilled;
+	stats->refill_rate = pool.refill_sec > 0 ? pool.refilled / pool.refill_sec : 0;
+	stats->ready = pool.ready;
+	stats->kem = pool.kem != NULL ? pool.kem->method_name : "none";
+	pthread_mutex_unlock(&pool.lock);
+}
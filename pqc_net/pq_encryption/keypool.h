@@ -0,0 +1,48 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef KEYPOOL_H
+#define KEYPOOL_H
+
+#include <stddef.h>
+
+#define KEYPOOL_CAPACITY 8 // ready key pairs kept on hand
+
+// A key pair handed out by the pool. The keys live in the pool's blocks of the secure arena (see
+// secure_arena.h) and must be given back with keypool_release(), which wipes them. Key pairs for a
+// KEM other than the pool's are generated on the spot into a block of their own (slot -1).
+typedef struct {
+	unsigned char *public_key;
+	unsigned char *secret_key;
+	size_t public_key_len;
+	size_t secret_key_len;
+	int kem;
+	int slot;
+} keypool_key_t;
+
+typedef struct {
+	unsigned long hits;      // takes served from a ready key pair
+	unsigned long misses;    // takes that had to generate on the spot
+	unsigned long refilled;  // key pairs generated by the background thread
+	double refill_rate;      // background generation speed in key pairs per second
+	size_t ready;            // key pairs currently waiting
+	const char *kem;         // algorithm the pool generates
+} keypool_stats_t;
+
+// Allocate the pool for the locally preferred KEM and start the background refill thread, call
+// after pqcrypto_initialize()
+int keypool_start(size_t capacity);
+
+// Stop the refill thread and wipe and free the pool, safe to call if it was never started
+void keypool_stop();
+
+// Take a key pair for kem, generating one synchronously if none are ready
+int keypool_take(int kem, keypool_key_t *key);
+
+// Wipe a key pair and hand its slot back to the pool
+void keypool_release(keypool_key_t *key);
+
+void keypool_get_stats(keypool_stats_t *stats);
+
+#endif // KEYPOOL_H
@@ -0,0 +1,221 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "ktls.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/crypto.h>
+
+#if USE_KTLS && defined(__linux__)
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+// Content type of application data, the first byte of every record the kernel sends
+#define TLS_APPLICATION_DATA 0x17
+
+typedef union {
+	struct tls12_crypto_info_aes_gcm_256 aes;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+} crypto_info_t;
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+static int kernel_ciphers;
+
+// Lay out key || salt || iv material for cipher the way the kernel takes it. Returns the length
+// to hand to setsockopt(), 0 for a cipher these headers don't know.
+static socklen_t fill_crypto_info(crypto_info_t *info, int cipher, const unsigned char *material) {
+	memset(info, 0, sizeof(*info));
+	if (cipher == PQCRYPTO_AES_256_GCM) {
+		info->aes.info.version = TLS_1_3_VERSION;
+		info->aes.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(info->aes.key, material, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+		memcpy(info->aes.salt, material + AES_KEY_SIZE, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+		memcpy(info->aes.iv, material + AES_KEY_SIZE + TLS_CIPHER_AES_GCM_256_SALT_SIZE,
+			   TLS_CIPHER_AES_GCM_256_IV_SIZE);
+		return sizeof(info->aes);
+	}
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	if (cipher == PQCRYPTO_CHACHA20_POLY1305) {
+		// ChaCha20-Poly1305 has no salt, the whole 12-byte nonce base is the IV
+		info->chacha.info.version = TLS_1_3_VERSION;
+		info->chacha.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		memcpy(info->chacha.key, material, TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE);
+		memcpy(info->chacha.iv, material + AES_KEY_SIZE, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+		return sizeof(info->chacha);
+	}
+#endif
+	return 0;
+}
+
+// Key and nonce material for one direction, nonce = salt || iv, XORed with the record sequence
+static int install_direction(int sock, int direction, const encryption_context_t *enc_ctx,
+							 const char *label) {
+	unsigned char material[AES_KEY_SIZE + AES_GCM_IV_SIZE];
+	crypto_info_t info;
+	if (pqcrypto_hkdf(enc_ctx->aes_key, AES_KEY_SIZE, label, material, sizeof(material)) != 0) {
+		return -1;
+	}
+
+	socklen_t info_len = fill_crypto_info(&info, enc_ctx->cipher, material);
+	int rc = info_len > 0 ? setsockopt(sock, SOL_TLS, direction, &info, info_len) : -1;
+	if (rc < 0) {
+		perror(direction == TLS_TX ? "setsockopt TLS_TX" : "setsockopt TLS_RX");
+	}
+
+	OPENSSL_cleanse(material, sizeof(material));
+	OPENSSL_cleanse(&info, sizeof(info));
+	return rc;
+}
+
+// A connected loopback pair, the kernel only takes keys on an established connection
+static int loopback_pair(int pair[2]) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addr_len = sizeof(addr);
+
+	pair[0] = pair[1] = -1;
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0) return -1;
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(listener, 1) == 0 &&
+		getsockname(listener, (struct sockaddr *)&addr, &addr_len) == 0 &&
+		(pair[0] = socket(AF_INET, SOCK_STREAM, 0)) >= 0 &&
+		connect(pair[0], (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		pair[1] = accept(listener, NULL, NULL);
+	}
+	close(listener);
+	if (pair[1] < 0) {
+		if (pair[0] >= 0) close(pair[0]);
+		return -1;
+	}
+	return 0;
+}
+
+// Whether this kernel takes cipher's keys both ways, headers that name a cipher don't mean the
+// running kernel has it (or the tls module at all)
+static int kernel_takes_cipher(int cipher) {
+	unsigned char material[AES_KEY_SIZE + AES_GCM_IV_SIZE] = { 0 };
+	crypto_info_t info;
+	int pair[2];
+
+	socklen_t info_len = fill_crypto_info(&info, cipher, material);
+	if (info_len == 0 || loopback_pair(pair) != 0) return 0;
+	int ok = setsockopt(pair[0], IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 &&
+			 setsockopt(pair[1], IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 &&
+			 setsockopt(pair[0], SOL_TLS, TLS_TX, &info, info_len) == 0 &&
+			 setsockopt(pair[1], SOL_TLS, TLS_RX, &info, info_len) == 0;
+	close(pair[0]);
+	close(pair[1]);
+	return ok;
+}
+
+static void probe_kernel(void) {
+	for (int cipher = 0; cipher < PQCRYPTO_CIPHER_COUNT; cipher++) {
+		if (kernel_takes_cipher(cipher)) kernel_ciphers |= 1 << cipher;
+	}
+}
+
+int ktls_probe(void) {
+	pthread_once(&probe_once, probe_kernel);
+	return kernel_ciphers;
+}
+
+int ktls_offer(int sock) {
+	// Attaching the ULP doesn't change what goes on the wire until keys are installed
+	if (ktls_probe() == 0 || setsockopt(sock, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+		return 0;
+	}
+	return kernel_ciphers;
+}
+
+int ktls_start_sending(int sock, const encryption_context_t *enc_ctx, int initiator) {
+	// The peer tells our kernel's records from user-space ones by their first byte
+	if (install_direction(sock, TLS_TX, enc_ctx, initiator ? "ktls initiator" : "ktls responder") != 0) {
+		fprintf(stderr, "Kernel refused the kTLS keys, sealing records in user space\n");
+		return 0;
+	}
+	return 1;
+}
+
+int ktls_start_receiving(int sock, const encryption_context_t *enc_ctx, int initiator) {
+	unsigned char first;
+	ssize_t peeked;
+	do {
+		peeked = recv(sock, &first, 1, MSG_PEEK);
+	} while (peeked < 0 && errno == EINTR);
+	if (peeked < 0) return -1;
+
+	// A user-space record starts with its frame length, whose top byte is always 0
+	if (peeked == 0 || first != TLS_APPLICATION_DATA) return 0;
+	if (install_direction(sock, TLS_RX, enc_ctx, initiator ? "ktls responder" : "ktls initiator") != 0) {
+		fprintf(stderr, "Kernel refused the kTLS keys for records the peer's kernel sealed\n");
+		errno = EPROTO;
+		return -1;
+	}
+	return 1;
+}
+
+int ktls_negotiate(int sock, const encryption_context_t *enc_ctx, int initiator) {
+	unsigned char offer = (ktls_offer(sock) >> enc_ctx->cipher) & 1;
+	unsigned char peer_offer;
+
+	if (write(sock, &offer, 1) != 1 || read(sock, &peer_offer, 1) != 1) {
+		perror("kTLS negotiation");
+		return -1;
+	}
+	if (!offer || !peer_offer) {
+		return 0;
+	}
+	return ktls_start_sending(sock, enc_ctx, initiator);
+}
+
+#else
+
+int ktls_probe(void) {
+	return 0;
+}
+
+int ktls_offer(int sock) {
+	(void)sock;
+	return 0;
+}
+
+int ktls_start_sending(int sock, const encryption_context_t *enc_ctx, int initiator) {
+	(void)sock;
+	(void)enc_ctx;
+	(void)initiator;
+	return 0;
+}
+
+int ktls_start_receiving(int sock, const encryption_context_t *enc_ctx, int initiator) {
+	(void)sock;
+	(void)enc_ctx;
+	(void)initiator;
+	return 0;
+}
+
+int ktls_negotiate(int sock, const encryption_context_t *enc_ctx, int initiator) {
+	(void)enc_ctx;
+	(void)initiator;
+
+	// Still take part in the exchange so a kTLS-capable peer falls back as well
+	unsigned char offer = 0, peer_offer;
+	if (write(sock, &offer, 1) != 1 || read(sock, &peer_offer, 1) != 1) {
+		perror("kTLS negotiation");
+		return -1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,42 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef KTLS_H
+#define KTLS_H
+
+#include <stddef.h>
+#include "pq_encryption.h"
+
+// Set to 0 to always keep the record layer in user space
+#ifndef USE_KTLS
+#define USE_KTLS 1
+#endif
+
+// Ciphers (bit 1 << cipher) this kernel takes TLS keys for, found once by installing throwaway
+// keys on a scratch loopback connection. Call it at startup, ktls_offer() probes on first use.
+int ktls_probe(void);
+
+// Ciphers (bit 1 << cipher) this end could hand to the kernel on sock, 0 if none. Attaches the TLS
+// ULP to sock, so call it once per connection.
+int ktls_offer(int sock);
+
+// Once both ends have agreed to use kTLS, for example in the connection handshake, each hands its
+// sending side to the kernel. Returns 1 when the kernel seals what we send, 0 when it refused the
+// keys and records keep going out sealed in user space.
+int ktls_start_sending(int sock, const encryption_context_t *enc_ctx, int initiator);
+
+// Before the first read of a session that agreed on kTLS: waits for the peer's first record and
+// installs the receive keys if the peer's kernel sealed it. Returns 1 when the kernel opens what we
+// receive, 0 when records arrive sealed in user space and -1 on error, with errno EAGAIN on a
+// non-blocking socket that has nothing yet.
+int ktls_start_receiving(int sock, const encryption_context_t *enc_ctx, int initiator);
+
+// Agree with the peer over sock whether both ends can hand the record layer to the kernel (Linux
+// kTLS, TLS 1.3 record format, with the session's AES-256-GCM or ChaCha20-Poly1305 cipher) and
+// start sending through it if so. Costs a round trip, the connection handshake carries the same
+// offer instead. Returns ktls_start_sending()'s answer, 0 as well when either end can't offer, and
+// -1 if the connection is unusable. The receiving end still calls ktls_start_receiving().
+int ktls_negotiate(int sock, const encryption_context_t *enc_ctx, int initiator);
+
+#endif // KTLS_H
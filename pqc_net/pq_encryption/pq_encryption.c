@@ -3,58 +3,252 @@
 //
 
 #include "pq_encryption.h"  // Must include pq_encryption.h to get OQS declarations
+#include "keypool.h"
+#include "kem.h"
+#include "secure_arena.h"
 #include <openssl/evp.h>
-#include <openssl/rand.h>
+#include <openssl/kdf.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+static const struct {
+	const char *name;
+	const EVP_CIPHER *(*evp)(void);
+} ciphers[PQCRYPTO_CIPHER_COUNT] = {
+	{ "aes-256-gcm", EVP_aes_256_gcm },
+	{ "chacha20-poly1305", EVP_chacha20_poly1305 },
+};
+
+// MB/s of each record cipher on this machine, filled in by rank_ciphers()
+static double cipher_speed[PQCRYPTO_CIPHER_COUNT];
+
+#define RANK_BLOCK 4096
+#define RANK_BLOCKS 256
+
+// 1 if the CPU has AES instructions, 0 if not, -1 if we can't tell
+static int cpu_has_aes() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("aes") ? 1 : 0;
+#elif defined(__aarch64__) && defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_AES) ? 1 : 0;
+#else
+	return -1;
+#endif
+}
+
+// Seal 1 MB with each cipher to see which one this machine runs fastest
+static void rank_ciphers() {
+	unsigned char key[AES_KEY_SIZE] = { 0 }, nonce[AES_GCM_IV_SIZE] = { 0 };
+	unsigned char block[RANK_BLOCK + AES_GCM_TAG_SIZE] = { 0 };
+	int len;
+
+	for (int i = 0; i < PQCRYPTO_CIPHER_COUNT; i++) {
+		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+		struct timespec start, end;
+
+		cipher_speed[i] = 0;
+		if (ctx == NULL || 1 != EVP_EncryptInit_ex(ctx, ciphers[i].evp(), NULL, key, nonce)) {
+			EVP_CIPHER_CTX_free(ctx);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int n = 0; n < RANK_BLOCKS; n++) {
+			EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce);
+			EVP_EncryptUpdate(ctx, block, &len, block, RANK_BLOCK);
+			EVP_EncryptFinal_ex(ctx, block + len, &len);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		EVP_CIPHER_CTX_free(ctx);
+
+		double secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+		cipher_speed[i] = secs > 0 ? (double)RANK_BLOCK * RANK_BLOCKS / secs / 1e6 : 1;
+	}
+
+	// Without AES instructions OpenSSL falls back to table-based AES, which also leaks timing, so
+	// never let a noisy measurement put it ahead of ChaCha20
+	if (cpu_has_aes() == 0 && cipher_speed[PQCRYPTO_AES_256_GCM] >= cipher_speed[PQCRYPTO_CHACHA20_POLY1305]) {
+		cipher_speed[PQCRYPTO_AES_256_GCM] = cipher_speed[PQCRYPTO_CHACHA20_POLY1305] / 2;
+	}
+}
 
 // Initialize the OQS library
 void pqcrypto_initialize() {
 	OQS_init();
+
+	// One shared handle per supported KEM, they hold no per-call state
+	if (kem_initialize() != 0) {
+		fprintf(stderr, "Failed to set up the KEMs\n");
+	}
+
+	rank_ciphers();
+}
+
+const char *pqcrypto_cipher_name(int cipher) {
+	if (cipher == PQCRYPTO_CIPHER_NULL) return "null";
+	return cipher >= 0 && cipher < PQCRYPTO_CIPHER_COUNT ? ciphers[cipher].name : "unknown";
+}
+
+int pqcrypto_cipher_from_name(const char *name) {
+	for (int i = 0; i < PQCRYPTO_CIPHER_COUNT; i++) {
+		if (strcmp(name, ciphers[i].name) == 0) return i;
+	}
+	if (strcmp(name, "null") == 0 && pqcrypto_null_cipher_allowed()) return PQCRYPTO_CIPHER_NULL;
+	return -1;
+}
+
+int pqcrypto_null_cipher_allowed() {
+#if PQCRYPTO_NULL_CIPHER
+	const char *allow = getenv("PQC_ALLOW_NULL_CIPHER");
+	return allow != NULL && strcmp(allow, "1") == 0;
+#else
+	return 0;
+#endif
 }
 
-// Generate Kyber key pair
-int pqcrypto_generate_keypair(unsigned char **public_key, size_t *public_key_len,
+double pqcrypto_cipher_speed(int cipher) {
+	return cipher >= 0 && cipher < PQCRYPTO_CIPHER_COUNT ? cipher_speed[cipher] : 0;
+}
+
+void pqcrypto_cipher_offer(char *offer, size_t offer_len) {
+	int order[PQCRYPTO_CIPHER_COUNT];
+	size_t used = 0;
+
+	for (int i = 0; i < PQCRYPTO_CIPHER_COUNT; i++) {
+		int j = i;
+		while (j > 0 && cipher_speed[order[j - 1]] < cipher_speed[i]) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	offer[0] = '\0';
+	if (pqcrypto_null_cipher_allowed()) {
+		used = snprintf(offer, offer_len, "null:0,");
+	}
+	for (int i = 0; i < PQCRYPTO_CIPHER_COUNT && used < offer_len; i++) {
+		used += snprintf(offer + used, offer_len - used, "%s%s:%.0f", i ? "," : "",
+						 ciphers[order[i]].name, cipher_speed[order[i]]);
+	}
+}
+
+int pqcrypto_cipher_select(const char *peer_offer) {
+	char offer[PQCRYPTO_CIPHER_OFFER_SIZE];
+	int best = PQCRYPTO_AES_256_GCM;
+	double best_speed = -1;
+
+	if (peer_offer == NULL || peer_offer[0] == '\0') {
+		return PQCRYPTO_AES_256_GCM;
+	}
+
+	strncpy(offer, peer_offer, sizeof(offer) - 1);
+	offer[sizeof(offer) - 1] = '\0';
+
+	char *saveptr;
+	for (char *entry = strtok_r(offer, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr)) {
+		char *colon = strchr(entry, ':');
+		double peer_speed = colon ? atof(colon + 1) : 0;
+		if (colon) *colon = '\0';
+
+		int cipher = pqcrypto_cipher_from_name(entry);
+		if (cipher == PQCRYPTO_CIPHER_NULL) return cipher;
+		if (cipher < 0) continue;
+
+		double speed = peer_speed < cipher_speed[cipher] ? peer_speed : cipher_speed[cipher];
+		if (speed > best_speed || (speed == best_speed && cipher < best)) {
+			best = cipher;
+			best_speed = speed;
+		}
+	}
+	return best;
+}
+
+void pqcrypto_cleanup() {
+	keypool_stop();
+	secure_arena_cleanup();
+	kem_cleanup();
+	OQS_destroy();
+}
+
+// Generate a key pair for the given KEM
+int pqcrypto_generate_keypair(int kem_id, unsigned char **public_key, size_t *public_key_len,
 							  unsigned char **secret_key, size_t *secret_key_len) {
-	OQS_KEM *kem = OQS_KEM_new(OQS_KEM_alg_kyber_512);
+	const OQS_KEM *kem = kem_handle(kem_id);
 	if (kem == NULL) {
-		fprintf(stderr, "Failed to create Kyber KEM object\n");
+		fprintf(stderr, "KEM %s is not available\n", kem_name(kem_id));
 		return -1;
 	}
 
-	// Allocate memory for public and secret keys
+	// The secret key goes in locked memory, the public one is sent anyway
 	*public_key = malloc(kem->length_public_key);
-	*secret_key = malloc(kem->length_secret_key);
+	*secret_key = secure_alloc(kem->length_secret_key);
 	if (*public_key == NULL || *secret_key == NULL) {
 		fprintf(stderr, "Failed to allocate memory for key pair\n");
-		OQS_KEM_free(kem);
+		free(*public_key);
+		secure_free(*secret_key, kem->length_secret_key);
 		return -1;
 	}
 
 	// Generate key pair
 	if (OQS_KEM_keypair(kem, *public_key, *secret_key) != OQS_SUCCESS) {
-		fprintf(stderr, "Failed to generate Kyber key pair\n");
+		fprintf(stderr, "Failed to generate %s key pair\n", kem->method_name);
 		free(*public_key);
-		free(*secret_key);
-		OQS_KEM_free(kem);
+		secure_free(*secret_key, kem->length_secret_key);
 		return -1;
 	}
 
 	*public_key_len = kem->length_public_key;
 	*secret_key_len = kem->length_secret_key;
+	return 0;
+}
+
+// Encapsulate a fresh secret to the peer's public key, ciphertext receives the KEM's
+// length_ciphertext bytes for the peer to decapsulate
+int pqcrypto_encapsulate(encryption_context_t *enc_ctx, int kem_id,
+						 const unsigned char *public_key, size_t public_key_len,
+						 unsigned char *ciphertext, size_t *ciphertext_len) {
+	const OQS_KEM *kem = kem_handle(kem_id);
+	if (kem == NULL) {
+		fprintf(stderr, "KEM %s is not available\n", kem_name(kem_id));
+		return -1;
+	}
+	if (public_key_len != kem->length_public_key) {
+		fprintf(stderr, "Unexpected %s public key length %zu\n", kem->method_name, public_key_len);
+		return -1;
+	}
 
-	OQS_KEM_free(kem);
+	unsigned char shared_secret[kem->length_shared_secret];
+
+	if (OQS_KEM_encaps(kem, ciphertext, shared_secret, public_key) != OQS_SUCCESS) {
+		fprintf(stderr, "Failed to encapsulate shared secret\n");
+		return -1;
+	}
+
+	memcpy(enc_ctx->aes_key, shared_secret, AES_KEY_SIZE);
+	OQS_MEM_cleanse(shared_secret, sizeof(shared_secret));
+	enc_ctx->kem = kem;
+	*ciphertext_len = kem->length_ciphertext;
 	return 0;
 }
 
-// Derive shared secret using Kyber KEM
-int pqcrypto_derive_shared_secret(encryption_context_t *enc_ctx,
+// Derive shared secret using the session's KEM
+int pqcrypto_derive_shared_secret(encryption_context_t *enc_ctx, int kem_id,
 								  const unsigned char *ciphertext, size_t ciphertext_len,
 								  const unsigned char *secret_key) {
-	OQS_KEM *kem = OQS_KEM_new(OQS_KEM_alg_kyber_512);
+	const OQS_KEM *kem = kem_handle(kem_id);
 	if (kem == NULL) {
-		fprintf(stderr, "Failed to create Kyber KEM object\n");
+		fprintf(stderr, "KEM %s is not available\n", kem_name(kem_id));
+		return -1;
+	}
+	if (ciphertext_len != kem->length_ciphertext) {
+		fprintf(stderr, "Unexpected KEM ciphertext length %zu\n", ciphertext_len);
 		return -1;
 	}
 
@@ -63,147 +257,531 @@ int pqcrypto_derive_shared_secret(encryption_context_t *enc_ctx,
 	// Decapsulate to derive shared secret
 	if (OQS_KEM_decaps(kem, shared_secret, ciphertext, secret_key) != OQS_SUCCESS) {
 		fprintf(stderr, "Failed to decapsulate shared secret\n");
-		OQS_KEM_free(kem);
 		return -1;
 	}
 
-	// Derive AES key from shared secret
-	// Here, we'll use the first 32 bytes (256 bits) as the AES key
+	// Keep the secret, the per-direction keys are derived from it by pqcrypto_context_init()
 	memcpy(enc_ctx->aes_key, shared_secret, AES_KEY_SIZE);
+	OQS_MEM_cleanse(shared_secret, sizeof(shared_secret));
+	enc_ctx->kem = kem;
+	return 0;
+}
 
-	// Generate random IV
-	if (!RAND_bytes(enc_ctx->iv, AES_GCM_IV_SIZE)) {
-		fprintf(stderr, "Failed to generate random IV\n");
-		OQS_KEM_free(kem);
+int pqcrypto_resumption_psk(const encryption_context_t *enc_ctx, unsigned char *psk) {
+	return pqcrypto_hkdf(enc_ctx->aes_key, AES_KEY_SIZE, "resumption", psk, AES_KEY_SIZE);
+}
+
+int pqcrypto_derive_session_secret(encryption_context_t *enc_ctx, const unsigned char *secret,
+								   const unsigned char *randoms, size_t randoms_len) {
+	unsigned char input[AES_KEY_SIZE + 2 * AES_KEY_SIZE];
+	if (randoms_len > sizeof(input) - AES_KEY_SIZE) {
+		fprintf(stderr, "Too many randoms for the session secret\n");
 		return -1;
 	}
 
-	OQS_KEM_free(kem);
-	return 0;
+	memcpy(input, secret, AES_KEY_SIZE);
+	memcpy(input + AES_KEY_SIZE, randoms, randoms_len);
+	int rc = pqcrypto_hkdf(input, AES_KEY_SIZE + randoms_len, "session secret", enc_ctx->aes_key, AES_KEY_SIZE);
+	OQS_MEM_cleanse(input, sizeof(input));
+	enc_ctx->kem = NULL;
+	return rc;
 }
 
-// Encrypt data using AES-256-GCM
-int pqcrypto_encrypt(const encryption_context_t *enc_ctx,
-					 const unsigned char *plaintext, size_t plaintext_len,
-					 unsigned char *ciphertext, size_t *ciphertext_len) {
-	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-	if (!ctx) {
+// Key a cipher context for dir's key, the key schedule runs once here and records only set a nonce
+static int direction_key(pqcrypto_direction_t *dir, int cipher, int decrypt) {
+	if (cipher == PQCRYPTO_CIPHER_NULL) {
+		dir->ctx = NULL;
+		return 0;
+	}
+	dir->ctx = EVP_CIPHER_CTX_new();
+	if (dir->ctx == NULL) {
 		perror("EVP_CIPHER_CTX_new");
 		return -1;
 	}
 
-	if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL)) {
-		perror("EVP_EncryptInit_ex");
-		EVP_CIPHER_CTX_free(ctx);
+	if (1 != EVP_CipherInit_ex(dir->ctx, ciphers[cipher].evp(), NULL, NULL, NULL, !decrypt) ||
+		1 != EVP_CIPHER_CTX_ctrl(dir->ctx, EVP_CTRL_AEAD_SET_IVLEN, AES_GCM_IV_SIZE, NULL) ||
+		1 != EVP_CipherInit_ex(dir->ctx, NULL, NULL, dir->key, NULL, !decrypt)) {
+		fprintf(stderr, "Failed to key %s context\n", decrypt ? "decryption" : "encryption");
+		EVP_CIPHER_CTX_free(dir->ctx);
+		dir->ctx = NULL;
 		return -1;
 	}
+	return 0;
+}
 
-	if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AES_GCM_IV_SIZE, NULL)) {
-		perror("EVP_CIPHER_CTX_ctrl");
-		EVP_CIPHER_CTX_free(ctx);
+// Expand seed into the epoch's key and IV plus the secret the next epoch is derived from, in one
+// HKDF call so a ratchet step costs a single derivation, and key the epoch's cipher context
+static int direction_init(pqcrypto_direction_t *dir, const unsigned char *seed, const char *label,
+						  int cipher, int decrypt) {
+	unsigned char material[AES_KEY_SIZE + AES_GCM_IV_SIZE + AES_KEY_SIZE];
+	if (pqcrypto_hkdf(seed, AES_KEY_SIZE, label, material, sizeof(material)) != 0) {
 		return -1;
 	}
+	memcpy(dir->key, material, AES_KEY_SIZE);
+	memcpy(dir->iv, material + AES_KEY_SIZE, AES_GCM_IV_SIZE);
+	memcpy(dir->secret, material + AES_KEY_SIZE + AES_GCM_IV_SIZE, AES_KEY_SIZE);
+	OQS_MEM_cleanse(material, sizeof(material));
+	return direction_key(dir, cipher, decrypt);
+}
 
-	if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, enc_ctx->aes_key, enc_ctx->iv)) {
-		perror("EVP_EncryptInit_ex");
-		EVP_CIPHER_CTX_free(ctx);
+static void direction_free(pqcrypto_direction_t *dir) {
+	EVP_CIPHER_CTX_free(dir->ctx);
+	OQS_MEM_cleanse(dir, sizeof(*dir));
+}
+
+// One ratchet step: next gets the epoch after dir's, dir itself is left untouched
+static int direction_next(const pqcrypto_direction_t *dir, int cipher, int decrypt, pqcrypto_direction_t *next) {
+	if (dir->epoch == UINT16_MAX) {
+		fprintf(stderr, "Session ran out of key epochs\n");
+		return -1;
+	}
+	next->epoch = dir->epoch + 1;
+	if (direction_init(next, dir->secret, "ratchet", cipher, decrypt) != 0) {
+		OQS_MEM_cleanse(next, sizeof(*next));
 		return -1;
 	}
+	return 0;
+}
 
-	int len;
+int pqcrypto_context_init(encryption_context_t *enc_ctx, int cipher, int initiator) {
+	if (cipher == PQCRYPTO_CIPHER_NULL && !pqcrypto_null_cipher_allowed()) {
+		fprintf(stderr, "Null record cipher not allowed\n");
+		return -1;
+	}
+	if (cipher < 0 || cipher > PQCRYPTO_CIPHER_NULL) {
+		fprintf(stderr, "Unknown record cipher %d\n", cipher);
+		return -1;
+	}
+	enc_ctx->cipher = cipher;
+	memset(&enc_ctx->send, 0, sizeof(enc_ctx->send));
+	memset(&enc_ctx->recv, 0, sizeof(enc_ctx->recv));
+	memset(&enc_ctx->recv_prev, 0, sizeof(enc_ctx->recv_prev));
+	enc_ctx->send_seq = 0;
+	enc_ctx->send_epoch_records = 0;
+	enc_ctx->send_epoch_bytes = 0;
+	enc_ctx->rekey_records = PQCRYPTO_REKEY_RECORDS;
+	enc_ctx->rekey_bytes = PQCRYPTO_REKEY_BYTES;
+	enc_ctx->recv_highest = 0;
+	enc_ctx->recv_window = 0;
+	pthread_mutex_init(&enc_ctx->replay_lock, NULL);
+
+	// Each side sends under its own key, so both can start their sequence numbers at zero
+	const char *send_label = initiator ? "record initiator" : "record responder";
+	const char *recv_label = initiator ? "record responder" : "record initiator";
+	if (direction_init(&enc_ctx->send, enc_ctx->aes_key, send_label, cipher, 0) != 0 ||
+		direction_init(&enc_ctx->recv, enc_ctx->aes_key, recv_label, cipher, 1) != 0) {
+		pqcrypto_context_free(enc_ctx);
+		return -1;
+	}
+	return 0;
+}
 
-	if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len)) {
-		perror("EVP_EncryptUpdate");
-		EVP_CIPHER_CTX_free(ctx);
+void pqcrypto_context_free(encryption_context_t *enc_ctx) {
+	direction_free(&enc_ctx->send);
+	direction_free(&enc_ctx->recv);
+	direction_free(&enc_ctx->recv_prev);
+	pthread_mutex_destroy(&enc_ctx->replay_lock);
+	OQS_MEM_cleanse(enc_ctx->aes_key, AES_KEY_SIZE);
+}
+
+int pqcrypto_worker_init(const encryption_context_t *enc_ctx, int decrypt, pqcrypto_direction_t *worker) {
+	const pqcrypto_direction_t *dir = decrypt ? &enc_ctx->recv : &enc_ctx->send;
+
+	// The ratchet secret stays with the session, a worker only needs this epoch's key
+	memset(worker, 0, sizeof(*worker));
+	memcpy(worker->key, dir->key, AES_KEY_SIZE);
+	memcpy(worker->iv, dir->iv, AES_GCM_IV_SIZE);
+	worker->epoch = dir->epoch;
+	if (direction_key(worker, enc_ctx->cipher, decrypt) != 0) {
+		OQS_MEM_cleanse(worker, sizeof(*worker));
 		return -1;
 	}
-	*ciphertext_len = len;
+	return 0;
+}
 
-	if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) {
-		perror("EVP_EncryptFinal_ex");
-		EVP_CIPHER_CTX_free(ctx);
+void pqcrypto_worker_free(pqcrypto_direction_t *worker) {
+	direction_free(worker);
+}
+
+int pqcrypto_rekey(encryption_context_t *enc_ctx) {
+	pqcrypto_direction_t next;
+
+	if (direction_next(&enc_ctx->send, enc_ctx->cipher, 0, &next) != 0) {
 		return -1;
 	}
-	*ciphertext_len += len;
+	// The old key and secret are wiped, records sealed before cannot be forged from the new state
+	direction_free(&enc_ctx->send);
+	enc_ctx->send = next;
+	OQS_MEM_cleanse(&next, sizeof(next));
+	enc_ctx->send_epoch_records = 0;
+	enc_ctx->send_epoch_bytes = 0;
+	return 0;
+}
 
-	// Get the tag
-	unsigned char tag[AES_GCM_TAG_SIZE];
-	if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AES_GCM_TAG_SIZE, tag)) {
-		perror("EVP_CIPHER_CTX_ctrl");
-		EVP_CIPHER_CTX_free(ctx);
+// Expand a secret into out_len bytes of key material bound to label (HKDF-SHA256)
+int pqcrypto_hkdf(const unsigned char *secret, size_t secret_len, const char *label,
+				  unsigned char *out, size_t out_len) {
+	EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+	if (pctx == NULL) {
+		fprintf(stderr, "Failed to create HKDF context\n");
 		return -1;
 	}
 
-	// Append the tag to the ciphertext
-	memcpy(ciphertext + *ciphertext_len, tag, AES_GCM_TAG_SIZE);
-	*ciphertext_len += AES_GCM_TAG_SIZE;
+	if (EVP_PKEY_derive_init(pctx) <= 0 ||
+		EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256()) <= 0 ||
+		EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secret_len) <= 0 ||
+		EVP_PKEY_CTX_add1_hkdf_info(pctx, (const unsigned char *)label, strlen(label)) <= 0 ||
+		EVP_PKEY_derive(pctx, out, &out_len) <= 0) {
+		fprintf(stderr, "HKDF derivation failed\n");
+		EVP_PKEY_CTX_free(pctx);
+		return -1;
+	}
 
-	EVP_CIPHER_CTX_free(ctx);
+	EVP_PKEY_CTX_free(pctx);
 	return 0;
 }
 
-// Decrypt data using AES-256-GCM
-int pqcrypto_decrypt(const encryption_context_t *enc_ctx,
-					 const unsigned char *ciphertext, size_t ciphertext_len,
-					 unsigned char *plaintext, size_t *plaintext_len) {
-	if (ciphertext_len < AES_GCM_TAG_SIZE) {
-		fprintf(stderr, "Ciphertext too short\n");
+// Nonce for a record: the direction's IV with the sequence number XORed into its last 8 bytes
+static void record_nonce(const pqcrypto_direction_t *dir, uint64_t seq, unsigned char *nonce) {
+	memcpy(nonce, dir->iv, AES_GCM_IV_SIZE);
+	for (int i = 0; i < PQCRYPTO_SEQ_SIZE; i++) {
+		nonce[AES_GCM_IV_SIZE - 1 - i] ^= (unsigned char)(seq >> (8 * i));
+	}
+}
+
+uint64_t pqcrypto_reserve_seq(encryption_context_t *enc_ctx, uint64_t count) {
+	return __atomic_fetch_add(&enc_ctx->send_seq, count, __ATOMIC_RELAXED);
+}
+
+// Output may alias its input exactly (in place), but must not partially overlap it
+static int partially_overlaps(const unsigned char *in, const unsigned char *out, size_t len) {
+	return in != out && in < out + len && out < in + len;
+}
+
+static void put_header(unsigned char *record, uint16_t epoch, uint64_t seq) {
+	uint64_t header = ((uint64_t)epoch << PQCRYPTO_SEQ_BITS) | seq;
+	for (int i = 0; i < PQCRYPTO_SEQ_SIZE; i++) {
+		record[i] = (unsigned char)(header >> (8 * (PQCRYPTO_SEQ_SIZE - 1 - i)));
+	}
+}
+
+static uint64_t get_header(const unsigned char *record) {
+	uint64_t header = 0;
+	for (int i = 0; i < PQCRYPTO_SEQ_SIZE; i++) {
+		header = (header << 8) | record[i];
+	}
+	return header;
+}
+
+static uint16_t header_epoch(uint64_t header) {
+	return (uint16_t)(header >> PQCRYPTO_SEQ_BITS);
+}
+
+#if PQCRYPTO_NULL_CIPHER
+// Null cipher sealing: the plaintext as it is behind the header, a zero tag after it
+static int copy_iov(const struct iovec *iov, int iovcnt, unsigned char *record, size_t *record_len) {
+	unsigned char *out = record + PQCRYPTO_SEQ_SIZE;
+
+	for (int i = 0; i < iovcnt; i++) {
+		memmove(out, iov[i].iov_base, iov[i].iov_len);
+		out += iov[i].iov_len;
+	}
+	memset(out, 0, AES_GCM_TAG_SIZE);
+	*record_len = out + AES_GCM_TAG_SIZE - record;
+	return 0;
+}
+
+// Null cipher opening: scatter the record body over iov unchecked
+static int uncopy_iov(const unsigned char *in, size_t remaining, const struct iovec *iov, int iovcnt,
+					  size_t *plaintext_len) {
+	*plaintext_len = 0;
+	for (int i = 0; i < iovcnt && remaining > 0; i++) {
+		size_t n = iov[i].iov_len < remaining ? iov[i].iov_len : remaining;
+		memmove(iov[i].iov_base, in, n);
+		in += n;
+		remaining -= n;
+		*plaintext_len += n;
+	}
+	if (remaining > 0) {
+		fprintf(stderr, "Plaintext buffers too small for record\n");
 		return -1;
 	}
+	return 0;
+}
+#endif
+
+// Seal the gathered plaintext into record: header, ciphertext, tag
+static int seal_iov(const pqcrypto_direction_t *dir, uint64_t seq,
+					const struct iovec *iov, int iovcnt,
+					unsigned char *record, size_t *record_len) {
+	EVP_CIPHER_CTX *ctx = dir->ctx;
+	unsigned char nonce[AES_GCM_IV_SIZE];
+	unsigned char *out = record + PQCRYPTO_SEQ_SIZE;
+	int len;
 
-	size_t actual_ciphertext_len = ciphertext_len - AES_GCM_TAG_SIZE;
-	unsigned char tag[AES_GCM_TAG_SIZE];
-	memcpy(tag, ciphertext + actual_ciphertext_len, AES_GCM_TAG_SIZE);
+	if (seq >= PQCRYPTO_SEQ_LIMIT) {
+		fprintf(stderr, "Session ran out of sequence numbers\n");
+		return -1;
+	}
 
-	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-	if (!ctx) {
-		perror("EVP_CIPHER_CTX_new");
+	// The header travels in the clear and is authenticated as associated data
+	put_header(record, dir->epoch, seq);
+#if PQCRYPTO_NULL_CIPHER
+	if (ctx == NULL) return copy_iov(iov, iovcnt, record, record_len);
+#endif
+	record_nonce(dir, seq, nonce);
+
+	if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) ||
+		1 != EVP_EncryptUpdate(ctx, NULL, &len, record, PQCRYPTO_SEQ_SIZE)) {
+		perror("EVP_EncryptInit_ex");
 		return -1;
 	}
 
-	if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL)) {
-		perror("EVP_DecryptInit_ex");
-		EVP_CIPHER_CTX_free(ctx);
+	for (int i = 0; i < iovcnt; i++) {
+		if (partially_overlaps(iov[i].iov_base, out, iov[i].iov_len)) {
+			fprintf(stderr, "Plaintext overlaps the record it is sealed into\n");
+			return -1;
+		}
+		if (1 != EVP_EncryptUpdate(ctx, out, &len, iov[i].iov_base, iov[i].iov_len)) {
+			perror("EVP_EncryptUpdate");
+			return -1;
+		}
+		out += len;
+	}
+
+	if (1 != EVP_EncryptFinal_ex(ctx, out, &len)) {
+		perror("EVP_EncryptFinal_ex");
 		return -1;
 	}
+	out += len;
 
-	if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AES_GCM_IV_SIZE, NULL)) {
+	// The tag goes straight after the ciphertext
+	if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AES_GCM_TAG_SIZE, out)) {
 		perror("EVP_CIPHER_CTX_ctrl");
-		EVP_CIPHER_CTX_free(ctx);
 		return -1;
 	}
 
-	if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, enc_ctx->aes_key, enc_ctx->iv)) {
-		perror("EVP_DecryptInit_ex");
-		EVP_CIPHER_CTX_free(ctx);
+	*record_len = out + AES_GCM_TAG_SIZE - record;
+	return 0;
+}
+
+// Authenticate record and scatter its plaintext over iov
+static int open_iov(const pqcrypto_direction_t *dir,
+					const unsigned char *record, size_t record_len,
+					const struct iovec *iov, int iovcnt, size_t *plaintext_len, uint64_t *seq) {
+	EVP_CIPHER_CTX *ctx = dir->ctx;
+
+	if (record_len < PQCRYPTO_RECORD_OVERHEAD) {
+		fprintf(stderr, "Ciphertext too short\n");
+		return -1;
+	}
+
+	uint64_t header = get_header(record);
+	if (header_epoch(header) != dir->epoch) {
+		fprintf(stderr, "Record from key epoch %u, expected %u\n", header_epoch(header), dir->epoch);
 		return -1;
 	}
+	*seq = header & (PQCRYPTO_SEQ_LIMIT - 1);
+	const unsigned char *in = record + PQCRYPTO_SEQ_SIZE;
+	size_t remaining = record_len - PQCRYPTO_RECORD_OVERHEAD;
+	const unsigned char *tag = in + remaining;
+
+#if PQCRYPTO_NULL_CIPHER
+	if (ctx == NULL) return uncopy_iov(in, remaining, iov, iovcnt, plaintext_len);
+#endif
+
+	unsigned char nonce[AES_GCM_IV_SIZE];
+	record_nonce(dir, *seq, nonce);
 
 	int len;
 
-	if (1 != EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, actual_ciphertext_len)) {
-		perror("EVP_DecryptUpdate");
-		EVP_CIPHER_CTX_free(ctx);
+	if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) ||
+		1 != EVP_DecryptUpdate(ctx, NULL, &len, record, PQCRYPTO_SEQ_SIZE)) {
+		perror("EVP_DecryptInit_ex");
+		return -1;
+	}
+
+	*plaintext_len = 0;
+	for (int i = 0; i < iovcnt && remaining > 0; i++) {
+		size_t n = iov[i].iov_len < remaining ? iov[i].iov_len : remaining;
+		unsigned char *out = iov[i].iov_base;
+		if (partially_overlaps(in, out, n) || (out < tag + AES_GCM_TAG_SIZE && tag < out + n)) {
+			fprintf(stderr, "Plaintext buffer overlaps the record being opened\n");
+			return -1;
+		}
+		if (1 != EVP_DecryptUpdate(ctx, out, &len, in, n)) {
+			perror("EVP_DecryptUpdate");
+			return -1;
+		}
+		in += n;
+		remaining -= n;
+		*plaintext_len += len;
+	}
+	if (remaining > 0) {
+		fprintf(stderr, "Plaintext buffers too small for record\n");
 		return -1;
 	}
-	*plaintext_len = len;
 
 	// Set expected tag value
-	if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AES_GCM_TAG_SIZE, tag)) {
+	if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AES_GCM_TAG_SIZE, (void *)tag)) {
 		perror("EVP_CIPHER_CTX_ctrl");
-		EVP_CIPHER_CTX_free(ctx);
 		return -1;
 	}
 
-	// Finalize decryption
-	int ret = EVP_DecryptFinal_ex(ctx, plaintext + len, &len);
-	if (ret > 0) {
-		*plaintext_len += len;
-		EVP_CIPHER_CTX_free(ctx);
+	// Finalize decryption, the AEAD produces no further output here
+	unsigned char final_block[AES_GCM_TAG_SIZE];
+	if (EVP_DecryptFinal_ex(ctx, final_block, &len) > 0) {
 		return 0;
 	} else {
 		fprintf(stderr, "Decryption failed: authentication tag mismatch\n");
-		EVP_CIPHER_CTX_free(ctx);
 		return -1;
 	}
 }
+
+// Sequence number for the session's next record of plaintext_len bytes, ratcheting the send key
+// first when the current one has reached a rekey limit
+static int next_send_seq(encryption_context_t *enc_ctx, size_t plaintext_len, uint64_t *seq) {
+	if ((enc_ctx->send_epoch_records >= enc_ctx->rekey_records ||
+		 enc_ctx->send_epoch_bytes >= enc_ctx->rekey_bytes) && pqcrypto_rekey(enc_ctx) != 0) {
+		return -1;
+	}
+	enc_ctx->send_epoch_records++;
+	enc_ctx->send_epoch_bytes += plaintext_len;
+	*seq = pqcrypto_reserve_seq(enc_ctx, 1);
+	return 0;
+}
+
+// Encrypt data with the session's AEAD
+int pqcrypto_encrypt(encryption_context_t *enc_ctx,
+					 const unsigned char *plaintext, size_t plaintext_len,
+					 unsigned char *ciphertext, size_t *ciphertext_len) {
+	struct iovec iov = { (void *)plaintext, plaintext_len };
+	return pqcrypto_encrypt_iov(enc_ctx, &iov, 1, ciphertext, ciphertext_len);
+}
+
+int pqcrypto_encrypt_seq(const pqcrypto_direction_t *worker, uint64_t seq,
+						 const unsigned char *plaintext, size_t plaintext_len,
+						 unsigned char *ciphertext, size_t *ciphertext_len) {
+	struct iovec iov = { (void *)plaintext, plaintext_len };
+	return seal_iov(worker, seq, &iov, 1, ciphertext, ciphertext_len);
+}
+
+int pqcrypto_encrypt_inplace(encryption_context_t *enc_ctx, unsigned char *record,
+							 size_t plaintext_len, size_t *record_len) {
+	struct iovec iov = { record + PQCRYPTO_SEQ_SIZE, plaintext_len };
+	return pqcrypto_encrypt_iov(enc_ctx, &iov, 1, record, record_len);
+}
+
+int pqcrypto_encrypt_iov(encryption_context_t *enc_ctx, const struct iovec *iov, int iovcnt,
+						 unsigned char *record, size_t *record_len) {
+	size_t plaintext_len = 0;
+	uint64_t seq;
+
+	for (int i = 0; i < iovcnt; i++) {
+		plaintext_len += iov[i].iov_len;
+	}
+	if (next_send_seq(enc_ctx, plaintext_len, &seq) != 0) {
+		return -1;
+	}
+	return seal_iov(&enc_ctx->send, seq, iov, iovcnt, record, record_len);
+}
+
+// Open a record under whichever receive key its epoch names: the current one, the previous one
+// for stragglers, or the next one, which becomes current once a record authenticates under it.
+// Records that authenticated are then checked against the replay window.
+static int open_record(encryption_context_t *enc_ctx, const unsigned char *record, size_t record_len,
+					   const struct iovec *iov, int iovcnt, size_t *plaintext_len) {
+	uint64_t seq;
+	int rc;
+
+	if (record_len < PQCRYPTO_RECORD_OVERHEAD) {
+		fprintf(stderr, "Ciphertext too short\n");
+		return -1;
+	}
+
+	uint16_t epoch = header_epoch(get_header(record));
+	if (epoch == enc_ctx->recv.epoch) {
+		rc = open_iov(&enc_ctx->recv, record, record_len, iov, iovcnt, plaintext_len, &seq);
+	} else if (enc_ctx->recv_prev.ctx != NULL && epoch == enc_ctx->recv_prev.epoch) {
+		rc = open_iov(&enc_ctx->recv_prev, record, record_len, iov, iovcnt, plaintext_len, &seq);
+	} else if (epoch == enc_ctx->recv.epoch + 1) {
+		pqcrypto_direction_t next;
+		if (direction_next(&enc_ctx->recv, enc_ctx->cipher, 1, &next) != 0) {
+			return -1;
+		}
+		rc = open_iov(&next, record, record_len, iov, iovcnt, plaintext_len, &seq);
+		if (rc != 0) {
+			direction_free(&next);
+			return -1;
+		}
+		// Only an authenticated record moves the receiver on, forged epochs change nothing
+		direction_free(&enc_ctx->recv_prev);
+		enc_ctx->recv_prev = enc_ctx->recv;
+		OQS_MEM_cleanse(enc_ctx->recv_prev.secret, AES_KEY_SIZE);
+		enc_ctx->recv = next;
+		OQS_MEM_cleanse(&next, sizeof(next));
+	} else {
+		fprintf(stderr, "Record from unexpected key epoch %u\n", epoch);
+		return -1;
+	}
+	if (rc != 0) {
+		return -1;
+	}
+
+	if (pqcrypto_replay_check(enc_ctx, seq) != 0) {
+		fprintf(stderr, "Rejected replayed record %llu\n", (unsigned long long)seq);
+		return -1;
+	}
+	return 0;
+}
+
+// Decrypt data with the session's AEAD
+int pqcrypto_decrypt(encryption_context_t *enc_ctx,
+					 const unsigned char *ciphertext, size_t ciphertext_len,
+					 unsigned char *plaintext, size_t *plaintext_len) {
+	size_t capacity = ciphertext_len > PQCRYPTO_RECORD_OVERHEAD ? ciphertext_len - PQCRYPTO_RECORD_OVERHEAD : 0;
+	struct iovec iov = { plaintext, capacity };
+	return open_record(enc_ctx, ciphertext, ciphertext_len, &iov, 1, plaintext_len);
+}
+
+int pqcrypto_decrypt_seq(const pqcrypto_direction_t *worker,
+						 const unsigned char *ciphertext, size_t ciphertext_len,
+						 unsigned char *plaintext, size_t *plaintext_len, uint64_t *seq) {
+	size_t capacity = ciphertext_len > PQCRYPTO_RECORD_OVERHEAD ? ciphertext_len - PQCRYPTO_RECORD_OVERHEAD : 0;
+	struct iovec iov = { plaintext, capacity };
+	return open_iov(worker, ciphertext, ciphertext_len, &iov, 1, plaintext_len, seq);
+}
+
+int pqcrypto_decrypt_inplace(encryption_context_t *enc_ctx, unsigned char *record, size_t record_len,
+							 unsigned char **plaintext, size_t *plaintext_len) {
+	*plaintext = record + PQCRYPTO_SEQ_SIZE;
+	return pqcrypto_decrypt(enc_ctx, record, record_len, *plaintext, plaintext_len);
+}
+
+int pqcrypto_decrypt_iov(encryption_context_t *enc_ctx, const unsigned char *record, size_t record_len,
+						 const struct iovec *iov, int iovcnt, size_t *plaintext_len) {
+	return open_record(enc_ctx, record, record_len, iov, iovcnt, plaintext_len);
+}
+
+// Sliding window over the last PQCRYPTO_REPLAY_WINDOW sequence numbers, O(1) per record
+int pqcrypto_replay_check(encryption_context_t *enc_ctx, uint64_t seq) {
+	int rc = 0;
+
+	pthread_mutex_lock(&enc_ctx->replay_lock);
+	if (enc_ctx->recv_window == 0 || seq > enc_ctx->recv_highest) {
+		// Newest record so far, slide the window forward
+		uint64_t shift = enc_ctx->recv_window == 0 ? 0 : seq - enc_ctx->recv_highest;
+		enc_ctx->recv_window = shift >= PQCRYPTO_REPLAY_WINDOW ? 1 : (enc_ctx->recv_window << shift) | 1;
+		enc_ctx->recv_highest = seq;
+	} else {
+		uint64_t behind = enc_ctx->recv_highest - seq;
+		if (behind >= PQCRYPTO_REPLAY_WINDOW || (enc_ctx->recv_window & (1ULL << behind))) {
+			rc = -1;
+		} else {
+			enc_ctx->recv_window |= 1ULL << behind;
+		}
+	}
+	pthread_mutex_unlock(&enc_ctx->replay_lock);
+	return rc;
+}
@@ -6,39 +6,187 @@
 #define PQ_ENCRYPTION_H
 
 #include <oqs/oqs.h>
+#include <openssl/evp.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #define AES_KEY_SIZE 32        // 256 bits
 #define AES_GCM_IV_SIZE 12     // 96 bits
 #define AES_GCM_TAG_SIZE 16    // 128 bits
 
-// Structure to hold encryption context
+// Record ciphers, both take a 256-bit key and 96-bit nonce and produce a 128-bit tag
+#define PQCRYPTO_AES_256_GCM 0
+#define PQCRYPTO_CHACHA20_POLY1305 1
+#define PQCRYPTO_CIPHER_COUNT 2
+// No encryption at all: records keep their header, sequence numbers and tag room but travel in the
+// clear, unauthenticated. Only there to measure what the record crypto costs: it exists only in
+// builds with PQCRYPTO_NULL_CIPHER=1, the echo benches, is offered and accepted there only while
+// PQC_ALLOW_NULL_CIPHER=1, and never counts among the PQCRYPTO_CIPHER_COUNT.
+#ifndef PQCRYPTO_NULL_CIPHER
+#define PQCRYPTO_NULL_CIPHER 0
+#endif
+#define PQCRYPTO_CIPHER_NULL PQCRYPTO_CIPHER_COUNT
+#define PQCRYPTO_CIPHER_OFFER_SIZE 128
+
+#define PQCRYPTO_SEQ_SIZE 8           // explicit header in front of every record: key epoch, sequence number
+#define PQCRYPTO_EPOCH_BITS 16        // top bits of the header
+#define PQCRYPTO_SEQ_BITS 48          // the rest, sequence numbers run on across epochs
+#define PQCRYPTO_SEQ_LIMIT (1ULL << PQCRYPTO_SEQ_BITS)
+#define PQCRYPTO_REPLAY_WINDOW 64     // how far behind the newest record a late one may arrive
+#define PQCRYPTO_RECORD_OVERHEAD (PQCRYPTO_SEQ_SIZE + AES_GCM_TAG_SIZE)
+
+// Default limits after which the sender ratchets to the next key epoch
+#define PQCRYPTO_REKEY_RECORDS (1ULL << 22)
+#define PQCRYPTO_REKEY_BYTES (1ULL << 32)
+
+// Keys and nonce state for one direction of a session
+typedef struct {
+	unsigned char secret[AES_KEY_SIZE]; // ratchet state, seeds the next epoch's keys
+	unsigned char key[AES_KEY_SIZE];
+	unsigned char iv[AES_GCM_IV_SIZE]; // XORed with the record's sequence number to form its nonce
+	uint16_t epoch;
+	EVP_CIPHER_CTX *ctx;               // keyed once, only the nonce changes per record, NULL for the null cipher
+} pqcrypto_direction_t;
+
+// Structure to hold encryption context. One per session: aes_key is the secret agreed by the KEM,
+// pqcrypto_context_init() derives a key and IV for each direction from it. Every record carries
+// its key epoch and sequence number, so records can be sealed and opened independently and in any
+// order. The sender moves each direction to a fresh key every rekey_records records or rekey_bytes
+// bytes with an HKDF ratchet, the receiver follows when the first record of the new epoch
+// authenticates. Sending and receiving may happen on two different threads.
 typedef struct {
 	unsigned char aes_key[AES_KEY_SIZE];
-	unsigned char iv[AES_GCM_IV_SIZE];
+	pqcrypto_direction_t send;
+	pqcrypto_direction_t recv;
+	pqcrypto_direction_t recv_prev; // previous receive epoch, for records still in flight
+	uint64_t send_seq;        // next sequence number to send
+	uint64_t send_epoch_records; // sealed under the current send key
+	uint64_t send_epoch_bytes;
+	uint64_t rekey_records;   // PQCRYPTO_REKEY_RECORDS unless changed after pqcrypto_context_init()
+	uint64_t rekey_bytes;     // PQCRYPTO_REKEY_BYTES likewise
+	uint64_t recv_highest;    // newest sequence number received
+	uint64_t recv_window;     // bit i set when recv_highest - i has been received
+	pthread_mutex_t replay_lock;
+	int cipher;               // PQCRYPTO_AES_256_GCM, PQCRYPTO_CHACHA20_POLY1305 or PQCRYPTO_CIPHER_NULL
+	const OQS_KEM *kem; // shared, process-wide KEM handle
 } encryption_context_t;
 
-// Initialize the OQS library, only called once
+// Initialize the OQS library and the cached KEM handles (see kem.h) and rank the record ciphers
+// for this CPU, only called once
 void pqcrypto_initialize();
 
-// Generate key pair for Kyber KEM
-int pqcrypto_generate_keypair(unsigned char **public_key, size_t *public_key_len,
+// Release what pqcrypto_initialize() set up
+void pqcrypto_cleanup();
+
+// Generate a key pair for a KEM from kem.h. The secret key is allocated in the secure arena, release
+// it with secure_free(), and the public key with free().
+int pqcrypto_generate_keypair(int kem, unsigned char **public_key, size_t *public_key_len,
 							  unsigned char **secret_key, size_t *secret_key_len);
 
-// Derive shared secret using Kyber KEM
-int pqcrypto_derive_shared_secret(encryption_context_t *enc_ctx,
+// Encapsulate the session secret to the peer's public key with the negotiated KEM
+int pqcrypto_encapsulate(encryption_context_t *enc_ctx, int kem,
+						 const unsigned char *public_key, size_t public_key_len,
+						 unsigned char *ciphertext, size_t *ciphertext_len);
+
+// Derive the session secret using the negotiated KEM
+int pqcrypto_derive_shared_secret(encryption_context_t *enc_ctx, int kem,
 								  const unsigned char *ciphertext, size_t ciphertext_len,
 								  const unsigned char *secret_key);
 
-// Encrypt data using AES-256-GCM
-int pqcrypto_encrypt(const encryption_context_t *enc_ctx,
+// Secret a resumption ticket carries, derived from the session secret so it never touches the wire
+int pqcrypto_resumption_psk(const encryption_context_t *enc_ctx, unsigned char *psk);
+
+// Session secret from a secret both ends already hold, a ticket's PSK or a KEM secret encapsulated
+// before the connection was made, mixed with fresh randoms from both ends so no two sessions share
+// keys. Takes the place of the KEM exchange.
+int pqcrypto_derive_session_secret(encryption_context_t *enc_ctx, const unsigned char *secret,
+								   const unsigned char *randoms, size_t randoms_len);
+
+// Derive the per-direction keys from aes_key and key the cipher contexts for cipher. Both ends must
+// pass the same cipher and opposite values of initiator. pqcrypto_context_free() releases them again.
+int pqcrypto_context_init(encryption_context_t *enc_ctx, int cipher, int initiator);
+void pqcrypto_context_free(encryption_context_t *enc_ctx);
+
+// Copy of enc_ctx's current send or receive key with a cipher context of its own, for a worker
+// thread sealing or opening records in parallel. Workers do not ratchet, the copy stays on the
+// epoch it was made in. Release it with pqcrypto_worker_free().
+int pqcrypto_worker_init(const encryption_context_t *enc_ctx, int decrypt, pqcrypto_direction_t *worker);
+void pqcrypto_worker_free(pqcrypto_direction_t *worker);
+
+// Advance enc_ctx's send direction to the next key epoch now. The encrypt calls do this on their
+// own once a rekey limit is reached.
+int pqcrypto_rekey(encryption_context_t *enc_ctx);
+
+const char *pqcrypto_cipher_name(int cipher);
+int pqcrypto_cipher_from_name(const char *name);
+
+// Record cipher throughput measured at startup, in MB/s
+double pqcrypto_cipher_speed(int cipher);
+
+// 1 while PQC_ALLOW_NULL_CIPHER=1 lets sessions run without record encryption, always 0 unless
+// built with PQCRYPTO_NULL_CIPHER=1
+int pqcrypto_null_cipher_allowed();
+
+// Cipher offer for the handshake: "name:speed" pairs, fastest first, led by the null cipher when
+// it is allowed
+void pqcrypto_cipher_offer(char *offer, size_t offer_len);
+
+// Pick the cipher for a session from the peer's offer. The session runs at the speed of the slower
+// end, so the cipher with the best worse-of-both speed wins. A missing offer means AES-256-GCM. The
+// null cipher wins outright when both ends allow it.
+int pqcrypto_cipher_select(const char *peer_offer);
+
+// Derive labelled key material from a secret with HKDF-SHA256
+int pqcrypto_hkdf(const unsigned char *secret, size_t secret_len, const char *label,
+				  unsigned char *out, size_t out_len);
+
+// Encrypt data with the session cipher as the next record, ciphertext receives
+// plaintext_len + PQCRYPTO_RECORD_OVERHEAD bytes
+int pqcrypto_encrypt(encryption_context_t *enc_ctx,
 					 const unsigned char *plaintext, size_t plaintext_len,
 					 unsigned char *ciphertext, size_t *ciphertext_len);
 
-// Decrypt data using AES-256-GCM
-int pqcrypto_decrypt(const encryption_context_t *enc_ctx,
+// Decrypt and authenticate a record, rejecting replays. plaintext may point at
+// ciphertext + PQCRYPTO_SEQ_SIZE to decrypt in place.
+int pqcrypto_decrypt(encryption_context_t *enc_ctx,
 					 const unsigned char *ciphertext, size_t ciphertext_len,
 					 unsigned char *plaintext, size_t *plaintext_len);
 
+// In-place variants. record holds PQCRYPTO_SEQ_SIZE bytes of headroom followed by the plaintext,
+// with AES_GCM_TAG_SIZE bytes of room after it, and is turned into the record. Opening leaves the
+// plaintext at *plaintext, inside record.
+int pqcrypto_encrypt_inplace(encryption_context_t *enc_ctx, unsigned char *record,
+							 size_t plaintext_len, size_t *record_len);
+int pqcrypto_decrypt_inplace(encryption_context_t *enc_ctx, unsigned char *record, size_t record_len,
+							 unsigned char **plaintext, size_t *plaintext_len);
+
+// Scatter-gather variants: seal plaintext gathered from iov as one record, or open a record and
+// scatter its plaintext over iov. A plaintext buffer may sit exactly where its bytes go in the
+// record (in place) but must not partially overlap it.
+int pqcrypto_encrypt_iov(encryption_context_t *enc_ctx, const struct iovec *iov, int iovcnt,
+						 unsigned char *record, size_t *record_len);
+int pqcrypto_decrypt_iov(encryption_context_t *enc_ctx, const unsigned char *record, size_t record_len,
+						 const struct iovec *iov, int iovcnt, size_t *plaintext_len);
+
+// Reserve count consecutive sequence numbers, returns the first
+uint64_t pqcrypto_reserve_seq(encryption_context_t *enc_ctx, uint64_t count);
+
+// Seal a record with an explicit sequence number under a worker's key
+int pqcrypto_encrypt_seq(const pqcrypto_direction_t *worker, uint64_t seq,
+						 const unsigned char *plaintext, size_t plaintext_len,
+						 unsigned char *ciphertext, size_t *ciphertext_len);
+
+// Open a record sealed in the worker's epoch and report its sequence number. No replay check is
+// done, pass the sequence number to pqcrypto_replay_check() before acting on the record.
+int pqcrypto_decrypt_seq(const pqcrypto_direction_t *worker,
+						 const unsigned char *ciphertext, size_t ciphertext_len,
+						 unsigned char *plaintext, size_t *plaintext_len, uint64_t *seq);
+
+// Accept an authenticated sequence number once, returns -1 for replays and records that fell out
+// of the window
+int pqcrypto_replay_check(encryption_context_t *enc_ctx, uint64_t seq);
+
 #endif // PQ_ENCRYPTION_H
 
@@ -0,0 +1,192 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "puzzle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#define PUZZLE_KEY_SIZE 32
+#define PUZZLE_MAC_SIZE 16
+#define PUZZLE_SALT_SIZE 8
+// Issue time, difficulty and salt, what the MAC covers besides the address
+#define PUZZLE_HEADER_SIZE (9 + PUZZLE_SALT_SIZE)
+
+static unsigned char puzzle_key[PUZZLE_KEY_SIZE];
+static pthread_once_t puzzle_key_once = PTHREAD_ONCE_INIT;
+static int puzzle_key_ready;
+
+static struct {
+	pthread_mutex_t lock;
+	int threshold;   // -1 until read from the environment
+	unsigned char redeemed[PUZZLE_REPLAY_CACHE][PUZZLE_MAC_SIZE];
+	time_t redeemed_at[PUZZLE_REPLAY_CACHE];
+	size_t next_redeemed;
+	unsigned long issued, verified, refused, solved;
+	double solve_us;
+} puzzles = { .lock = PTHREAD_MUTEX_INITIALIZER, .threshold = -1 };
+
+static void puzzle_key_init() {
+	puzzle_key_ready = RAND_bytes(puzzle_key, sizeof(puzzle_key)) == 1;
+}
+
+int puzzle_get_threshold() {
+	pthread_mutex_lock(&puzzles.lock);
+	if (puzzles.threshold < 0) {
+		const char *value = getenv("PQC_PUZZLE_THRESHOLD");
+		puzzles.threshold = value != NULL ? atoi(value) : PUZZLE_THRESHOLD;
+		if (puzzles.threshold < 0) puzzles.threshold = 0;
+	}
+	int threshold = puzzles.threshold;
+	pthread_mutex_unlock(&puzzles.lock);
+	return threshold;
+}
+
+void puzzle_set_threshold(int threshold) {
+	pthread_mutex_lock(&puzzles.lock);
+	puzzles.threshold = threshold > 0 ? threshold : 0;
+	pthread_mutex_unlock(&puzzles.lock);
+}
+
+int puzzle_bits(size_t queued) {
+	int threshold = puzzle_get_threshold();
+	if (threshold == 0 || queued < (size_t)threshold) return 0;
+	size_t bits = PUZZLE_MIN_BITS + (queued - threshold) / 2;
+	return bits > PUZZLE_MAX_BITS ? PUZZLE_MAX_BITS : (int)bits;
+}
+
+static int mac(const char *peer_ip, const unsigned char *header, unsigned char *out) {
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len;
+	unsigned char data[PUZZLE_HEADER_SIZE + 64];
+	size_t peer_len = strlen(peer_ip);
+
+	pthread_once(&puzzle_key_once, puzzle_key_init);
+	if (!puzzle_key_ready || peer_len > sizeof(data) - PUZZLE_HEADER_SIZE) return -1;
+	memcpy(data, header, PUZZLE_HEADER_SIZE);
+	memcpy(data + PUZZLE_HEADER_SIZE, peer_ip, peer_len);
+	if (HMAC(EVP_sha256(), puzzle_key, sizeof(puzzle_key), data, PUZZLE_HEADER_SIZE + peer_len,
+			 digest, &digest_len) == NULL) {
+		return -1;
+	}
+	memcpy(out, digest, PUZZLE_MAC_SIZE);
+	return 0;
+}
+
+// Whether SHA-256(cookie || nonce) starts with bits zero bits
+static int solves(const unsigned char *cookie, const unsigned char *nonce, int bits) {
+	unsigned char input[PUZZLE_COOKIE_SIZE + PUZZLE_NONCE_SIZE], digest[SHA256_DIGEST_LENGTH];
+
+	// The one-shot call, EVP_Digest() fetches the algorithm on every attempt of the solver
+	memcpy(input, cookie, PUZZLE_COOKIE_SIZE);
+	memcpy(input + PUZZLE_COOKIE_SIZE, nonce, PUZZLE_NONCE_SIZE);
+	SHA256(input, sizeof(input), digest);
+	for (int i = 0; i < bits / 8; i++) {
+		if (digest[i] != 0) return 0;
+	}
+	return bits % 8 == 0 || (digest[bits / 8] >> (8 - bits % 8)) == 0;
+}
+
+int puzzle_issue(const char *peer_ip, int bits, unsigned char *cookie) {
+	uint64_t now = (uint64_t)time(NULL);
+
+	for (int i = 0; i < 8; i++) cookie[i] = now >> (56 - 8 * i);
+	cookie[8] = (unsigned char)bits;
+	// Without the salt two cookies for one address in the same second would be the same cookie, and
+	// the second solution would look like a replay
+	if (RAND_bytes(cookie + 9, PUZZLE_SALT_SIZE) != 1 ||
+		mac(peer_ip, cookie, cookie + PUZZLE_HEADER_SIZE) != 0) {
+		fprintf(stderr, "Failed to issue a puzzle\n");
+		return -1;
+	}
+	pthread_mutex_lock(&puzzles.lock);
+	puzzles.issued++;
+	pthread_mutex_unlock(&puzzles.lock);
+	return 0;
+}
+
+int puzzle_solve(const unsigned char *cookie, size_t cookie_len, unsigned char *nonce) {
+	struct timespec start, end;
+	uint64_t counter = 0;
+
+	if (cookie_len != PUZZLE_COOKIE_SIZE || cookie[8] > PUZZLE_MAX_BITS) {
+		fprintf(stderr, "Peer sent a puzzle we won't solve\n");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (int i = 0; i < PUZZLE_NONCE_SIZE; i++) nonce[i] = counter >> (56 - 8 * i);
+		counter++;
+	} while (!solves(cookie, nonce, cookie[8]));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	pthread_mutex_lock(&puzzles.lock);
+	puzzles.solved++;
+	puzzles.solve_us += (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+	pthread_mutex_unlock(&puzzles.lock);
+	return 0;
+}
+
+// Caller holds the lock. Remembers the cookie's MAC, returns -1 if it was redeemed before.
+static int redeem(const unsigned char *tag, time_t now) {
+	for (size_t i = 0; i < PUZZLE_REPLAY_CACHE; i++) {
+		if (now - puzzles.redeemed_at[i] <= PUZZLE_LIFETIME &&
+			memcmp(puzzles.redeemed[i], tag, PUZZLE_MAC_SIZE) == 0) {
+			return -1;
+		}
+	}
+	// The oldest can only be forgotten once it has expired, a cookie can't outlive PUZZLE_LIFETIME.
+	// Until then the solution is refused and the dialer gets a fresh puzzle.
+	if (now - puzzles.redeemed_at[puzzles.next_redeemed] <= PUZZLE_LIFETIME) return -1;
+	memcpy(puzzles.redeemed[puzzles.next_redeemed], tag, PUZZLE_MAC_SIZE);
+	puzzles.redeemed_at[puzzles.next_redeemed] = now;
+	puzzles.next_redeemed = (puzzles.next_redeemed + 1) % PUZZLE_REPLAY_CACHE;
+	return 0;
+}
+
+int puzzle_verify(const char *peer_ip, const unsigned char *cookie, size_t cookie_len, const unsigned char *nonce) {
+	unsigned char expected[PUZZLE_MAC_SIZE];
+	uint64_t issued = 0;
+	time_t now = time(NULL);
+	int rc = -1;
+
+	if (cookie_len == PUZZLE_COOKIE_SIZE) {
+		for (int i = 0; i < 8; i++) issued = issued << 8 | cookie[i];
+		// The MAC first, the hash only for cookies we issued
+		if (mac(peer_ip, cookie, expected) == 0 &&
+			CRYPTO_memcmp(expected, cookie + PUZZLE_HEADER_SIZE, PUZZLE_MAC_SIZE) == 0 &&
+			(time_t)issued <= now && now - (time_t)issued <= PUZZLE_LIFETIME &&
+			solves(cookie, nonce, cookie[8])) {
+			rc = 0;
+		}
+	}
+
+	pthread_mutex_lock(&puzzles.lock);
+	if (rc == 0) rc = redeem(cookie + PUZZLE_HEADER_SIZE, now);
+	if (rc == 0) {
+		puzzles.verified++;
+	} else {
+		puzzles.refused++;
+	}
+	pthread_mutex_unlock(&puzzles.lock);
+	return rc;
+}
+
+void puzzle_get_stats(puzzle_stats_t *stats) {
+	pthread_mutex_lock(&puzzles.lock);
+	stats->issued = puzzles.issued;
+	stats->verified = puzzles.verified;
+	stats->refused = puzzles.refused;
+	stats->solved = puzzles.solved;
+	stats->solve_us = puzzles.solved > 0 ? puzzles.solve_us / puzzles.solved : 0;
+	pthread_mutex_unlock(&puzzles.lock);
+}
@@ -0,0 +1,53 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef PUZZLE_H
+#define PUZZLE_H
+
+#include <stddef.h>
+
+#define PUZZLE_COOKIE_SIZE 33      // issue time, difficulty, a salt and a truncated HMAC
+#define PUZZLE_NONCE_SIZE 8
+#define PUZZLE_LIFETIME 30         // seconds a cookie can be redeemed in
+#define PUZZLE_THRESHOLD 4         // queued handshakes before puzzles are handed out
+#define PUZZLE_MIN_BITS 12         // difficulty at the threshold, about 4k hashes to solve
+#define PUZZLE_MAX_BITS 18         // hardest we hand out, and the hardest a dialer will solve
+#define PUZZLE_REPLAY_CACHE 4096   // redeemed cookies remembered so each works once, more per PUZZLE_LIFETIME are refused
+
+// Stateless client puzzles. Under load the acceptor answers a request with a cookie and closes the
+// connection, without any KEM work. The cookie is an HMAC over the dialer's address, the time, the
+// difficulty and a salt under a process-local key, so nothing is kept for dialers that don't come
+// back.
+// The dialer finds a nonce for which SHA-256(cookie || nonce) starts with that many zero bits and
+// reconnects with the solution ahead of its request. Only redeemed cookies are remembered, to stop
+// one solution from being replayed.
+
+typedef struct {
+	unsigned long issued;     // cookies handed out
+	unsigned long verified;   // solutions accepted
+	unsigned long refused;    // bad, stale, replayed or unsolved cookies
+	unsigned long solved;     // puzzles we solved as a dialer
+	double solve_us;          // average time we took to solve one
+} puzzle_stats_t;
+
+// Difficulty for a request that found queued handshakes ahead of it, 0 for no puzzle. Starts at
+// PUZZLE_MIN_BITS once the threshold is reached and adds a bit per two further queued handshakes.
+int puzzle_bits(size_t queued);
+
+// Queue depth that turns puzzles on, $PQC_PUZZLE_THRESHOLD or PUZZLE_THRESHOLD, 0 turns them off
+int puzzle_get_threshold();
+void puzzle_set_threshold(int threshold);
+
+int puzzle_issue(const char *peer_ip, int bits, unsigned char *cookie);
+
+// Dialer side. Returns -1 for a malformed cookie or one harder than PUZZLE_MAX_BITS.
+int puzzle_solve(const unsigned char *cookie, size_t cookie_len, unsigned char *nonce);
+
+// Returns 0 if cookie is ours, was issued to peer_ip within PUZZLE_LIFETIME, wasn't redeemed before
+// and nonce solves it. Refuses every solution while PUZZLE_REPLAY_CACHE others are still live.
+int puzzle_verify(const char *peer_ip, const unsigned char *cookie, size_t cookie_len, const unsigned char *nonce);
+
+void puzzle_get_stats(puzzle_stats_t *stats);
+
+#endif // PUZZLE_H
@@ -0,0 +1,154 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "secure_arena.h"
+#include <oqs/oqs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CLASS_COUNT 9 // SECURE_ARENA_MIN_BLOCK << 8 == SECURE_ARENA_MAX_BLOCK
+
+// Freed blocks keep the link to the next free block of their size in their first bytes
+typedef struct free_block {
+	struct free_block *next;
+} free_block_t;
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned char *memory;
+	size_t size;
+	size_t used;        // blocks past this were never handed out
+	int locked;
+	int unavailable;    // mapping failed, everything comes from the heap
+	free_block_t *free_blocks[CLASS_COUNT];
+	size_t in_use, high_water;
+	unsigned long allocations, fallbacks;
+} arena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int size_class(size_t len) {
+	int class = 0;
+	while (((size_t)SECURE_ARENA_MIN_BLOCK << class) < len) class++;
+	return class;
+}
+
+// Caller holds the lock
+static int setup() {
+	if (arena.memory != NULL) return 0;
+	if (arena.unavailable) return -1;
+
+	long page = sysconf(_SC_PAGESIZE);
+	size_t size = (SECURE_ARENA_SIZE + page - 1) / page * page;
+	unsigned char *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("mmap (secrets will live on the heap)");
+		arena.unavailable = 1;
+		return -1;
+	}
+	// Keep secrets out of swap and core dumps
+	arena.locked = mlock(memory, size) == 0;
+	if (!arena.locked) {
+		perror("mlock (secure arena will be swappable)");
+	}
+#ifdef MADV_DONTDUMP
+	madvise(memory, size, MADV_DONTDUMP);
+#endif
+	arena.memory = memory;
+	arena.size = size;
+	arena.used = 0;
+	return 0;
+}
+
+static int in_arena(const void *ptr) {
+	const unsigned char *p = ptr;
+	return arena.memory != NULL && p >= arena.memory && p < arena.memory + arena.size;
+}
+
+void *secure_alloc(size_t len) {
+	void *ptr = NULL;
+
+	if (len == 0) len = 1;
+	pthread_mutex_lock(&arena.lock);
+	arena.allocations++;
+	if (len <= SECURE_ARENA_MAX_BLOCK && setup() == 0) {
+		int class = size_class(len);
+		size_t block = (size_t)SECURE_ARENA_MIN_BLOCK << class;
+
+		if (arena.free_blocks[class] != NULL) {
+			ptr = arena.free_blocks[class];
+			arena.free_blocks[class] = arena.free_blocks[class]->next;
+		} else if (arena.used + block <= arena.size) {
+			ptr = arena.memory + arena.used;
+			arena.used += block;
+		}
+		if (ptr != NULL) {
+			arena.in_use += block;
+			if (arena.in_use > arena.high_water) arena.high_water = arena.in_use;
+		}
+	}
+	if (ptr == NULL) arena.fallbacks++;
+	pthread_mutex_unlock(&arena.lock);
+
+	if (ptr == NULL) {
+		ptr = malloc(len);
+		if (ptr == NULL) perror("malloc");
+	}
+	return ptr;
+}
+
+void secure_free(void *ptr, size_t len) {
+	if (ptr == NULL) return;
+	if (len == 0) len = 1;
+	if (!in_arena(ptr)) {
+		OQS_MEM_secure_free(ptr, len);
+		return;
+	}
+
+	int class = size_class(len);
+	size_t block = (size_t)SECURE_ARENA_MIN_BLOCK << class;
+	OQS_MEM_cleanse(ptr, block);
+
+	pthread_mutex_lock(&arena.lock);
+	free_block_t *freed = ptr;
+	freed->next = arena.free_blocks[class];
+	arena.free_blocks[class] = freed;
+	arena.in_use -= block;
+	pthread_mutex_unlock(&arena.lock);
+}
+
+void secure_arena_cleanup() {
+	pthread_mutex_lock(&arena.lock);
+	if (arena.in_use > 0) {
+		// Unmapping would pull the memory out from under whoever still holds a block
+		fprintf(stderr, "Secure arena still has %zu bytes in use, leaving it mapped\n", arena.in_use);
+		pthread_mutex_unlock(&arena.lock);
+		return;
+	}
+	if (arena.memory != NULL) {
+		OQS_MEM_cleanse(arena.memory, arena.used);
+		if (arena.locked) munlock(arena.memory, arena.size);
+		munmap(arena.memory, arena.size);
+	}
+	arena.memory = NULL;
+	arena.size = 0;
+	arena.used = 0;
+	arena.locked = 0;
+	arena.unavailable = 0;
+	memset(arena.free_blocks, 0, sizeof(arena.free_blocks));
+	pthread_mutex_unlock(&arena.lock);
+}
+
+void secure_arena_get_stats(secure_arena_stats_t *stats) {
+	pthread_mutex_lock(&arena.lock);
+	stats->size = arena.size;
+	stats->locked = arena.locked;
+	stats->in_use = arena.in_use;
+	stats->high_water = arena.high_water;
+	stats->allocations = arena.allocations;
+	stats->fallbacks = arena.fallbacks;
+	pthread_mutex_unlock(&arena.lock);
+}
@@ -0,0 +1,41 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef SECURE_ARENA_H
+#define SECURE_ARENA_H
+
+#include <stddef.h>
+
+#define SECURE_ARENA_SIZE (1024 * 1024)   // locked memory reserved for key material
+#define SECURE_ARENA_MIN_BLOCK 64
+#define SECURE_ARENA_MAX_BLOCK (16 * 1024) // fits the largest key of every KEM in kem.h
+
+// Slab arena for secret keys and shared secrets. One region is mapped, locked against swapping and
+// left out of core dumps. Allocations are rounded up to a power of two and freed blocks go on a free
+// list for their size, so the handshake path neither takes the allocator's locks nor leaves key
+// bytes behind in the heap. Blocks are wiped when they are released. Requests the arena can't serve
+// come from the heap and are wiped all the same.
+
+typedef struct {
+	size_t size;              // bytes reserved, 0 before the first allocation
+	int locked;               // 1 if mlock() succeeded
+	size_t in_use;            // bytes in blocks handed out right now
+	size_t high_water;        // most bytes ever in use at once
+	unsigned long allocations;
+	unsigned long fallbacks;  // allocations served from the heap instead
+} secure_arena_stats_t;
+
+// Allocate len bytes of locked memory, NULL if even the heap has none. The arena is set up on the
+// first call.
+void *secure_alloc(size_t len);
+
+// Wipe and release a block from secure_alloc(), len must be what it was allocated with
+void secure_free(void *ptr, size_t len);
+
+// Wipe and unmap the arena. It stays mapped if any block is still in use.
+void secure_arena_cleanup();
+
+void secure_arena_get_stats(secure_arena_stats_t *stats);
+
+#endif // SECURE_ARENA_H
@@ -0,0 +1,262 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#include "ticket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#define TICKET_KEY_SIZE 32
+#define TICKET_NONCE_SIZE 12
+#define TICKET_TAG_SIZE 16
+#define TICKET_BODY_SIZE (8 + 1 + TICKET_PSK_SIZE) // expiry, KEM, PSK
+#define TICKET_SIZE (TICKET_NONCE_SIZE + TICKET_BODY_SIZE + TICKET_TAG_SIZE)
+
+// Tickets are sealed under a key that lives only in this process, restarting invalidates them all
+static unsigned char ticket_key[TICKET_KEY_SIZE];
+static pthread_once_t ticket_key_once = PTHREAD_ONCE_INIT;
+static int ticket_key_ready;
+
+static struct {
+	pthread_mutex_t lock;
+	struct {
+		char peer[TICKET_PEER_SIZE];
+		ticket_t entry;
+	} slots[TICKET_CACHE_SIZE];
+	size_t used;
+
+	// Acceptor side, the tickets redeemed so far by their nonce
+	struct {
+		unsigned char nonce[TICKET_NONCE_SIZE];
+		time_t expires;
+	} redeemed[TICKET_REDEEMED_SIZE];
+	size_t redeemed_used;
+
+	unsigned long lookups, resumed, rejected, issued, accepted, replayed, full;
+	double resume_us, full_us;   // totals, averaged by ticket_get_stats()
+} cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void ticket_key_init() {
+	ticket_key_ready = RAND_bytes(ticket_key, sizeof(ticket_key)) == 1;
+}
+
+int ticket_lifetime() {
+	const char *value = getenv("PQC_TICKET_LIFETIME");
+	if (value == NULL) return TICKET_LIFETIME;
+	int lifetime = atoi(value);
+	return lifetime > 0 ? lifetime : 0;
+}
+
+// AES-256-GCM over the ticket body, the nonce goes in front and the tag behind
+static int seal(const unsigned char *nonce, const unsigned char *body, unsigned char *out, unsigned char *tag) {
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int len, rc = -1;
+
+	if (ctx != NULL &&
+		EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, ticket_key, nonce) == 1 &&
+		EVP_EncryptUpdate(ctx, out, &len, body, TICKET_BODY_SIZE) == 1 &&
+		EVP_EncryptFinal_ex(ctx, out + len, &len) == 1 &&
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TICKET_TAG_SIZE, tag) == 1) {
+		rc = 0;
+	}
+	EVP_CIPHER_CTX_free(ctx);
+	return rc;
+}
+
+static int open_body(const unsigned char *ticket, unsigned char *body) {
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	const unsigned char *sealed = ticket + TICKET_NONCE_SIZE;
+	int len, rc = -1;
+
+	if (ctx != NULL &&
+		EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, ticket_key, ticket) == 1 &&
+		EVP_DecryptUpdate(ctx, body, &len, sealed, TICKET_BODY_SIZE) == 1 &&
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TICKET_TAG_SIZE,
+							(void *)(sealed + TICKET_BODY_SIZE)) == 1 &&
+		EVP_DecryptFinal_ex(ctx, body + len, &len) == 1) {
+		rc = 0;
+	}
+	EVP_CIPHER_CTX_free(ctx);
+	return rc;
+}
+
+int ticket_issue(const unsigned char *psk, int kem, time_t expires, unsigned char *ticket, size_t *ticket_len) {
+	unsigned char body[TICKET_BODY_SIZE];
+	uint64_t expiry = (uint64_t)expires;
+
+	pthread_once(&ticket_key_once, ticket_key_init);
+	if (!ticket_key_ready || RAND_bytes(ticket, TICKET_NONCE_SIZE) != 1) {
+		fprintf(stderr, "Failed to issue a resumption ticket\n");
+		return -1;
+	}
+
+	for (int i = 0; i < 8; i++) body[i] = expiry >> (56 - 8 * i);
+	body[8] = (unsigned char)kem;
+	memcpy(body + 9, psk, TICKET_PSK_SIZE);
+	int rc = seal(ticket, body, ticket + TICKET_NONCE_SIZE, ticket + TICKET_NONCE_SIZE + TICKET_BODY_SIZE);
+	OPENSSL_cleanse(body, sizeof(body));
+	if (rc != 0) {
+		fprintf(stderr, "Failed to seal a resumption ticket\n");
+		return -1;
+	}
+
+	*ticket_len = TICKET_SIZE;
+	pthread_mutex_lock(&cache.lock);
+	cache.issued++;
+	pthread_mutex_unlock(&cache.lock);
+	return 0;
+}
+
+// Caller holds the lock. Marks the ticket with this nonce redeemed, returns -1 if it was before or
+// there is no room until one of the marked tickets expires.
+static int redeem(const unsigned char *nonce, time_t expires, time_t now) {
+	for (size_t i = 0; i < cache.redeemed_used;) {
+		if (cache.redeemed[i].expires <= now) {
+			// Expired tickets are refused anyway, forget them
+			cache.redeemed[i] = cache.redeemed[--cache.redeemed_used];
+			continue;
+		}
+		if (memcmp(cache.redeemed[i].nonce, nonce, TICKET_NONCE_SIZE) == 0) {
+			cache.replayed++;
+			return -1;
+		}
+		i++;
+	}
+	if (cache.redeemed_used == TICKET_REDEEMED_SIZE) return -1;
+	memcpy(cache.redeemed[cache.redeemed_used].nonce, nonce, TICKET_NONCE_SIZE);
+	cache.redeemed[cache.redeemed_used].expires = expires;
+	cache.redeemed_used++;
+	return 0;
+}
+
+int ticket_open(const unsigned char *ticket, size_t ticket_len, unsigned char *psk, int *kem, time_t *expires) {
+	unsigned char body[TICKET_BODY_SIZE];
+	uint64_t expiry = 0;
+	time_t now = time(NULL);
+
+	pthread_once(&ticket_key_once, ticket_key_init);
+	if (!ticket_key_ready || ticket_len != TICKET_SIZE || open_body(ticket, body) != 0) {
+		return -1;
+	}
+	for (int i = 0; i < 8; i++) expiry = expiry << 8 | body[i];
+
+	// Also refuse tickets that outlive our lifetime, it may have been shortened since they were issued
+	if ((time_t)expiry <= now || (time_t)expiry > now + ticket_lifetime()) {
+		OPENSSL_cleanse(body, sizeof(body));
+		return -1;
+	}
+
+	// The nonce is unique per ticket and covered by the tag
+	pthread_mutex_lock(&cache.lock);
+	int rc = redeem(ticket, (time_t)expiry, now);
+	if (rc == 0) cache.accepted++;
+	pthread_mutex_unlock(&cache.lock);
+	if (rc != 0) {
+		OPENSSL_cleanse(body, sizeof(body));
+		return -1;
+	}
+
+	*expires = (time_t)expiry;
+	*kem = body[8];
+	memcpy(psk, body + 9, TICKET_PSK_SIZE);
+	OPENSSL_cleanse(body, sizeof(body));
+	return 0;
+}
+
+static int find_peer(const char *peer) {
+	for (size_t i = 0; i < cache.used; i++) {
+		if (strcmp(cache.slots[i].peer, peer) == 0) return (int)i;
+	}
+	return -1;
+}
+
+// Caller holds the lock
+static void remove_slot(int slot) {
+	OPENSSL_cleanse(&cache.slots[slot], sizeof(cache.slots[slot]));
+	cache.used--;
+	if ((size_t)slot != cache.used) {
+		cache.slots[slot] = cache.slots[cache.used];
+		OPENSSL_cleanse(&cache.slots[cache.used], sizeof(cache.slots[cache.used]));
+	}
+}
+
+int ticket_lookup(const char *peer, ticket_t *entry) {
+	int rc = -1;
+
+	pthread_mutex_lock(&cache.lock);
+	cache.lookups++;
+	int slot = find_peer(peer);
+	if (slot >= 0 && cache.slots[slot].entry.expires <= time(NULL)) {
+		remove_slot(slot);
+	} else if (slot >= 0) {
+		*entry = cache.slots[slot].entry;
+		rc = 0;
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return rc;
+}
+
+int ticket_held(const char *peer) {
+	pthread_mutex_lock(&cache.lock);
+	int slot = find_peer(peer);
+	int held = slot >= 0 && cache.slots[slot].entry.expires > time(NULL);
+	pthread_mutex_unlock(&cache.lock);
+	return held;
+}
+
+void ticket_store(const char *peer, const ticket_t *entry) {
+	pthread_mutex_lock(&cache.lock);
+	int slot = find_peer(peer);
+	if (slot < 0 && cache.used == TICKET_CACHE_SIZE) {
+		// Make room by dropping the ticket closest to expiring
+		slot = 0;
+		for (int i = 1; i < TICKET_CACHE_SIZE; i++) {
+			if (cache.slots[i].entry.expires < cache.slots[slot].entry.expires) slot = i;
+		}
+	} else if (slot < 0) {
+		slot = (int)cache.used++;
+	}
+	snprintf(cache.slots[slot].peer, TICKET_PEER_SIZE, "%s", peer);
+	cache.slots[slot].entry = *entry;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void ticket_forget(const char *peer, int rejected) {
+	pthread_mutex_lock(&cache.lock);
+	int slot = find_peer(peer);
+	if (slot >= 0) remove_slot(slot);
+	if (rejected) cache.rejected++;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void ticket_record_handshake(int resumed, double us) {
+	pthread_mutex_lock(&cache.lock);
+	if (resumed) {
+		cache.resumed++;
+		cache.resume_us += us;
+	} else {
+		cache.full++;
+		cache.full_us += us;
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void ticket_get_stats(ticket_stats_t *stats) {
+	pthread_mutex_lock(&cache.lock);
+	stats->cached = cache.used;
+	stats->lookups = cache.lookups;
+	stats->resumed = cache.resumed;
+	stats->rejected = cache.rejected;
+	stats->issued = cache.issued;
+	stats->accepted = cache.accepted;
+	stats->replayed = cache.replayed;
+	stats->resume_us = cache.resumed > 0 ? cache.resume_us / cache.resumed : 0;
+	stats->full_us = cache.full > 0 ? cache.full_us / cache.full : 0;
+	pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,70 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef TICKET_H
+#define TICKET_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define TICKET_PSK_SIZE 32
+#define TICKET_MAX_SIZE 128
+#define TICKET_PEER_SIZE 64   // "ip:port" of the peer a cached ticket is for
+#define TICKET_CACHE_SIZE 32  // peers we keep a ticket for, the oldest is dropped first
+#define TICKET_LIFETIME 3600  // seconds after the last KEM exchange, $PQC_TICKET_LIFETIME overrides
+#define TICKET_REDEEMED_SIZE 1024 // redeemed tickets the acceptor remembers until they expire
+
+// A resumption ticket as the dialer caches it. The ticket itself is opaque to the dialer: the
+// acceptor sealed the PSK and expiry under a key only it knows, so it can resume the session
+// without keeping any state per peer. It only remembers the tickets it has redeemed, until they
+// expire, so a captured RESUME_REQUEST can't be replayed.
+typedef struct {
+	unsigned char ticket[TICKET_MAX_SIZE];
+	size_t ticket_len;
+	unsigned char psk[TICKET_PSK_SIZE];
+	int kem;          // KEM of the exchange the PSK goes back to
+	time_t expires;   // TICKET_LIFETIME after that exchange, resumed sessions don't extend it
+} ticket_t;
+
+typedef struct {
+	size_t cached;           // tickets held for peers we may dial again
+	unsigned long lookups;   // dials that looked for a ticket
+	unsigned long resumed;   // dials resumed with one
+	unsigned long rejected;  // tickets the peer would not take, those fell back to a full handshake
+	unsigned long issued;    // tickets handed to peers that dialed us
+	unsigned long accepted;  // of those, redeemed to resume a session
+	unsigned long replayed;  // presented again after being redeemed, refused
+	double resume_us;        // average dial handshake time, resumed
+	double full_us;          // and with a KEM exchange
+} ticket_stats_t;
+
+// Seconds a ticket stays valid, 0 when resumption is turned off
+int ticket_lifetime();
+
+// Acceptor side: seal psk, the KEM and the expiry into a ticket of at most TICKET_MAX_SIZE bytes
+int ticket_issue(const unsigned char *psk, int kem, time_t expires, unsigned char *ticket, size_t *ticket_len);
+
+// Open a ticket we issued and mark it redeemed. Returns -1 if it was altered, was issued by another
+// process, expired or was redeemed before, and also while TICKET_REDEEMED_SIZE unexpired tickets
+// are marked, the dialer then falls back to a full handshake.
+int ticket_open(const unsigned char *ticket, size_t ticket_len, unsigned char *psk, int *kem, time_t *expires);
+
+// Dialer side: copy the unexpired ticket held for peer into entry. Returns 0, or -1 if there is none.
+int ticket_lookup(const char *peer, ticket_t *entry);
+
+// Whether an unexpired ticket is held for peer, without counting it as a lookup
+int ticket_held(const char *peer);
+
+// Keep a ticket for peer, replacing the one held before
+void ticket_store(const char *peer, const ticket_t *entry);
+
+// Drop the ticket held for peer, after it was used or the peer refused it
+void ticket_forget(const char *peer, int rejected);
+
+// Count a completed dial handshake and how long it took
+void ticket_record_handshake(int resumed, double us);
+
+void ticket_get_stats(ticket_stats_t *stats);
+
+#endif // TICKET_H
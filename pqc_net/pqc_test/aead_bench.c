@@ -0,0 +1,233 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Record cipher throughput from 16 B to 16 MB messages, for each cipher. Every message is sealed and
+// opened again:
+//
+//   copy     pqcrypto_encrypt() and pqcrypto_decrypt() into separate buffers
+//   inplace  pqcrypto_encrypt_inplace() and pqcrypto_decrypt_inplace()
+//   setup    a fresh cipher context keyed for every message on both ends (EVP_CIPHER_CTX_new and the
+//            key schedule each time), what the per-call path cost before sessions kept keyed contexts
+//   threads  copying on worker contexts, one per thread, all sealing records of the same session
+//
+// Throughput is plaintext GB/s through seal and open together. Where ns/message stays flat as the
+// size shrinks, per-call overhead dominates.
+//
+//   ./aead_bench [threads]
+
+#include "pq_encryption.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <openssl/rand.h>
+
+#define MIN_SIZE 16
+#define MAX_SIZE (16 * 1024 * 1024)
+#define MIN_SECONDS 0.1
+#define MIN_MESSAGES 8
+#define MAX_THREADS 16
+#define DEFAULT_THREADS 4 // each thread holds two MAX_SIZE buffers
+
+enum { MODE_COPY, MODE_INPLACE, MODE_SETUP, MODE_THREADS, MODE_COUNT };
+static const char *mode_names[MODE_COUNT] = { "copy", "inplace", "setup", "threads" };
+
+static unsigned char *plaintext;
+static int thread_count;
+
+typedef struct {
+	encryption_context_t *sender, *receiver;
+	size_t size;
+	long messages;
+	int rc;
+} sealer_args_t;
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int session_pair(int cipher, encryption_context_t *sender, encryption_context_t *receiver) {
+	memset(sender, 0, sizeof(*sender));
+	memset(receiver, 0, sizeof(*receiver));
+	RAND_bytes(sender->aes_key, AES_KEY_SIZE);
+	memcpy(receiver->aes_key, sender->aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(sender, cipher, 1) != 0) return -1;
+	if (pqcrypto_context_init(receiver, cipher, 0) != 0) {
+		pqcrypto_context_free(sender);
+		return -1;
+	}
+	return 0;
+}
+
+// One message through seal and open in the given single-threaded mode
+static int roundtrip(int mode, encryption_context_t *sender, encryption_context_t *receiver, size_t size,
+					 unsigned char *record, unsigned char *opened) {
+	size_t record_len, opened_len;
+	unsigned char *inplace;
+
+	switch (mode) {
+	case MODE_COPY:
+		return pqcrypto_encrypt(sender, plaintext, size, record, &record_len) != 0 ||
+			   pqcrypto_decrypt(receiver, record, record_len, opened, &opened_len) != 0 ? -1 : 0;
+	case MODE_INPLACE:
+		return pqcrypto_encrypt_inplace(sender, record, size, &record_len) != 0 ||
+			   pqcrypto_decrypt_inplace(receiver, record, record_len, &inplace, &opened_len) != 0 ? -1 : 0;
+	default: {
+		pqcrypto_direction_t seal, open;
+		uint64_t seq;
+		int rc = -1;
+		if (pqcrypto_worker_init(sender, 0, &seal) != 0) return -1;
+		if (pqcrypto_worker_init(receiver, 1, &open) == 0) {
+			rc = pqcrypto_encrypt_seq(&seal, pqcrypto_reserve_seq(sender, 1), plaintext, size, record, &record_len) != 0 ||
+				 pqcrypto_decrypt_seq(&open, record, record_len, opened, &opened_len, &seq) != 0 ? -1 : 0;
+			pqcrypto_worker_free(&open);
+		}
+		pqcrypto_worker_free(&seal);
+		return rc;
+	}
+	}
+}
+
+// Seal and open records on worker contexts of the shared session
+static void *sealer(void *arg) {
+	sealer_args_t *sa = arg;
+	unsigned char *record = malloc(sa->size + PQCRYPTO_RECORD_OVERHEAD);
+	unsigned char *opened = malloc(sa->size);
+	pqcrypto_direction_t seal, open;
+	size_t record_len, opened_len;
+	uint64_t seq;
+
+	sa->rc = -1;
+	if (record == NULL || opened == NULL) {
+		perror("malloc");
+		goto out;
+	}
+	if (pqcrypto_worker_init(sa->sender, 0, &seal) != 0) goto out;
+	if (pqcrypto_worker_init(sa->receiver, 1, &open) != 0) {
+		pqcrypto_worker_free(&seal);
+		goto out;
+	}
+	uint64_t first = pqcrypto_reserve_seq(sa->sender, sa->messages);
+	sa->rc = 0;
+	for (long i = 0; i < sa->messages; i++) {
+		if (pqcrypto_encrypt_seq(&seal, first + i, plaintext, sa->size, record, &record_len) != 0 ||
+			pqcrypto_decrypt_seq(&open, record, record_len, opened, &opened_len, &seq) != 0 || seq != first + i) {
+			sa->rc = -1;
+			break;
+		}
+	}
+	pqcrypto_worker_free(&open);
+	pqcrypto_worker_free(&seal);
+
+out:
+	free(record);
+	free(opened);
+	return NULL;
+}
+
+static int run_threads(encryption_context_t *sender, encryption_context_t *receiver, size_t size, long messages) {
+	pthread_t threads[MAX_THREADS];
+	sealer_args_t args[MAX_THREADS];
+	int started = 0, rc = 0;
+
+	for (int i = 0; i < thread_count; i++) {
+		args[i] = (sealer_args_t){ sender, receiver, size, messages, -1 };
+		if (pthread_create(&threads[i], NULL, sealer, &args[i]) != 0) {
+			perror("pthread_create");
+			rc = -1;
+			break;
+		}
+		started++;
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		rc |= args[i].rc;
+	}
+	return rc;
+}
+
+// Messages per second for one cipher, size and mode, or -1 on failure. Single-threaded modes run
+// until MIN_SECONDS have passed, threads run a batch sized from the copy mode's rate.
+static double measure(int cipher, int mode, size_t size, double copy_rate, unsigned char *record, unsigned char *opened) {
+	encryption_context_t sender, receiver;
+	struct timespec start, now;
+	long messages = 0;
+
+	if (session_pair(cipher, &sender, &receiver) != 0) return -1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (mode == MODE_THREADS) {
+		long each = (long)(copy_rate * MIN_SECONDS);
+		if (each < MIN_MESSAGES) each = MIN_MESSAGES;
+		if (run_threads(&sender, &receiver, size, each) != 0) messages = -1;
+		else messages = each * thread_count;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} else {
+		do {
+			if (roundtrip(mode, &sender, &receiver, size, record, opened) != 0) {
+				messages = -1;
+				break;
+			}
+			messages++;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while (messages < MIN_MESSAGES || elapsed_sec(start, now) < MIN_SECONDS);
+	}
+	pqcrypto_context_free(&sender);
+	pqcrypto_context_free(&receiver);
+	return messages < 0 ? -1 : messages / elapsed_sec(start, now);
+}
+
+int main(int argc, char **argv) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	thread_count = argc > 1 ? atoi(argv[1]) : (cpus < DEFAULT_THREADS ? (int)cpus : DEFAULT_THREADS);
+	if (thread_count < 1) thread_count = 1;
+	if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
+
+	pqcrypto_initialize();
+	plaintext = malloc(MAX_SIZE);
+	unsigned char *record = malloc(MAX_SIZE + PQCRYPTO_RECORD_OVERHEAD);
+	unsigned char *opened = malloc(MAX_SIZE);
+	if (plaintext == NULL || record == NULL || opened == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	RAND_bytes(plaintext, MAX_SIZE);
+	// Opening in place leaves the plaintext where the next message is sealed from
+	memcpy(record + PQCRYPTO_SEQ_SIZE, plaintext, MAX_SIZE);
+
+	printf("Seal and open per message, GB/s of plaintext and ns per message, threads mode on %d threads\n",
+		   thread_count);
+	int rc = EXIT_SUCCESS;
+	for (int cipher = 0; cipher < PQCRYPTO_CIPHER_COUNT; cipher++) {
+		printf("\n%-18s %9s", pqcrypto_cipher_name(cipher), "size");
+		for (int mode = 0; mode < MODE_COUNT; mode++) {
+			printf(" %8s GB/s %8s ns", mode_names[mode], "");
+		}
+		printf("\n");
+
+		for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+			double rate[MODE_COUNT] = { 0 };
+			printf("%-18s %9zu", "", size);
+			for (int mode = 0; mode < MODE_COUNT; mode++) {
+				rate[mode] = measure(cipher, mode, size, rate[MODE_COPY], record, opened);
+				if (rate[mode] < 0) {
+					fprintf(stderr, "\n%s %s failed at %zu bytes\n", pqcrypto_cipher_name(cipher), mode_names[mode], size);
+					rc = EXIT_FAILURE;
+					goto out;
+				}
+				printf(" %13.3f %11.0f", rate[mode] * size / 1e9, 1e9 / rate[mode]);
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+out:
+	free(plaintext);
+	free(record);
+	free(opened);
+	pqcrypto_cleanup();
+	return rc;
+}
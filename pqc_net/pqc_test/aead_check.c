@@ -0,0 +1,277 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Correctness checks for the record encryption variants, with each record cipher: in-place and scatter-gather records must
+// match the copying API byte for byte, at any buffer alignment, and overlapping buffers that can't
+// work must be refused rather than produce garbage. The key ratchet must keep both ends in step
+// across epochs, including records that arrive late or out of order around a rekey.
+
+#include "pq_encryption.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/rand.h>
+
+#define MAX_PLAINTEXT 5000
+
+static int checks, failures;
+static int cipher;
+
+static void check(int ok, const char *what, size_t size, size_t offset) {
+	checks++;
+	if (!ok) {
+		failures++;
+		printf("FAILED: %s (%s, size %zu, offset %zu)\n", what, pqcrypto_cipher_name(cipher), size, offset);
+	}
+}
+
+// Fresh pair of session ends sharing one secret
+static int make_session(encryption_context_t *sender, encryption_context_t *receiver) {
+	RAND_bytes(sender->aes_key, AES_KEY_SIZE);
+	memcpy(receiver->aes_key, sender->aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(sender, cipher, 1) != 0 || pqcrypto_context_init(receiver, cipher, 0) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static void free_session(encryption_context_t *sender, encryption_context_t *receiver) {
+	pqcrypto_context_free(sender);
+	pqcrypto_context_free(receiver);
+}
+
+// Every variant must produce the record the copying API would have produced for the same sequence
+// number, so both ends can mix them freely
+static void check_inplace(const unsigned char *plaintext, size_t size, size_t offset) {
+	encryption_context_t sender, receiver;
+	unsigned char copy_record[MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD];
+	unsigned char buffer[MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD + 16];
+	unsigned char *record = buffer + offset, *opened;
+	size_t copy_len, record_len, opened_len;
+
+	if (make_session(&sender, &receiver) != 0) {
+		check(0, "session setup", size, offset);
+		return;
+	}
+
+	// Reference record from the copying API with sequence number 0
+	check(pqcrypto_encrypt(&sender, plaintext, size, copy_record, &copy_len) == 0, "copy encrypt", size, offset);
+	sender.send_seq = 0;
+
+	memcpy(record + PQCRYPTO_SEQ_SIZE, plaintext, size);
+	check(pqcrypto_encrypt_inplace(&sender, record, size, &record_len) == 0, "in-place encrypt", size, offset);
+	check(record_len == copy_len && memcmp(record, copy_record, copy_len) == 0,
+		  "in-place record matches copy record", size, offset);
+
+	check(pqcrypto_decrypt_inplace(&receiver, record, record_len, &opened, &opened_len) == 0,
+		  "in-place decrypt", size, offset);
+	check(opened == record + PQCRYPTO_SEQ_SIZE && opened_len == size && memcmp(opened, plaintext, size) == 0,
+		  "in-place plaintext", size, offset);
+
+	// The same record again is a replay
+	memcpy(record, copy_record, copy_len);
+	check(pqcrypto_decrypt_inplace(&receiver, record, copy_len, &opened, &opened_len) != 0,
+		  "replayed record refused", size, offset);
+
+	free_session(&sender, &receiver);
+}
+
+// Plaintext gathered from odd-sized, oddly aligned pieces, opened by scattering over others
+static void check_iov(const unsigned char *plaintext, size_t size, size_t offset) {
+	encryption_context_t sender, receiver;
+	unsigned char copy_record[MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD];
+	unsigned char buffer[MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD + 16];
+	unsigned char pieces[MAX_PLAINTEXT + 64], scattered[MAX_PLAINTEXT + 64], joined[MAX_PLAINTEXT];
+	unsigned char *record = buffer + offset;
+	size_t copy_len, record_len, opened_len;
+
+	if (make_session(&sender, &receiver) != 0) {
+		check(0, "session setup", size, offset);
+		return;
+	}
+	check(pqcrypto_encrypt(&sender, plaintext, size, copy_record, &copy_len) == 0, "copy encrypt", size, offset);
+	sender.send_seq = 0;
+
+	// Three pieces with gaps between them so none starts on an aligned address
+	size_t a = size / 3, b = size / 2 - a, c = size - a - b;
+	struct iovec gather[3] = {
+		{ pieces + offset + 1, a },
+		{ pieces + offset + a + 7, b },
+		{ pieces + offset + a + b + 20, c },
+	};
+	for (int i = 0, done = 0; i < 3; done += gather[i].iov_len, i++) {
+		memcpy(gather[i].iov_base, plaintext + done, gather[i].iov_len);
+	}
+	check(pqcrypto_encrypt_iov(&sender, gather, 3, record, &record_len) == 0, "gather encrypt", size, offset);
+	check(record_len == copy_len && memcmp(record, copy_record, copy_len) == 0,
+		  "gathered record matches copy record", size, offset);
+
+	// Scatter into pieces split differently from the ones it was gathered from
+	size_t x = size / 4, y = size - x;
+	struct iovec scatter[2] = {
+		{ scattered + offset + 3, x },
+		{ scattered + offset + x + 11, y + 5 }, // more room than needed
+	};
+	check(pqcrypto_decrypt_iov(&receiver, record, record_len, scatter, 2, &opened_len) == 0,
+		  "scatter decrypt", size, offset);
+	memcpy(joined, scatter[0].iov_base, x);
+	memcpy(joined + x, scatter[1].iov_base, y);
+	check(opened_len == size && memcmp(joined, plaintext, size) == 0, "scattered plaintext", size, offset);
+
+	// Not enough room to scatter into
+	sender.send_seq = 1;
+	struct iovec short_scatter = { scattered, size > 0 ? size - 1 : 0 };
+	if (size > 0) {
+		check(pqcrypto_encrypt(&sender, plaintext, size, record, &record_len) == 0, "copy encrypt", size, offset);
+		check(pqcrypto_decrypt_iov(&receiver, record, record_len, &short_scatter, 1, &opened_len) != 0,
+			  "short scatter buffers refused", size, offset);
+	}
+
+	free_session(&sender, &receiver);
+}
+
+// Buffers that overlap without lining up exactly must be refused
+static void check_overlap(const unsigned char *plaintext, size_t size) {
+	encryption_context_t sender, receiver;
+	unsigned char buffer[MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD + 16];
+	size_t record_len, opened_len;
+	uint64_t seq;
+
+	if (size < 2 || make_session(&sender, &receiver) != 0) return;
+
+	// Plaintext at the start of the record, where the sequence number and ciphertext go
+	memcpy(buffer, plaintext, size);
+	check(pqcrypto_encrypt_seq(&sender.send, 0, buffer, size, buffer, &record_len) != 0,
+		  "encrypt into overlapping record refused", size, 0);
+
+	// Output one byte behind the ciphertext
+	check(pqcrypto_encrypt(&sender, plaintext, size, buffer, &record_len) == 0, "copy encrypt", size, 0);
+	check(pqcrypto_decrypt_seq(&receiver.recv, buffer, record_len,
+							   buffer + PQCRYPTO_SEQ_SIZE - 1, &opened_len, &seq) != 0,
+		  "decrypt into shifted buffer refused", size, 0);
+
+	// Output running into the tag
+	struct iovec into_tag = { buffer + PQCRYPTO_SEQ_SIZE + size - 1, size };
+	check(pqcrypto_decrypt_iov(&receiver, buffer, record_len, &into_tag, 1, &opened_len) != 0,
+		  "decrypt over the tag refused", size, 0);
+
+	// A flipped bit anywhere fails authentication
+	buffer[record_len / 2] ^= 0x10;
+	unsigned char out[MAX_PLAINTEXT];
+	check(pqcrypto_decrypt(&receiver, buffer, record_len, out, &opened_len) != 0,
+		  "tampered record refused", size, 0);
+
+	free_session(&sender, &receiver);
+}
+
+#define RATCHET_RECORDS 16
+#define RATCHET_INTERVAL 4
+
+static int opens(encryption_context_t *receiver, unsigned char records[][MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD],
+				 const size_t *record_len, int i, const unsigned char *plaintext, size_t size) {
+	unsigned char out[MAX_PLAINTEXT];
+	size_t opened_len;
+	return pqcrypto_decrypt(receiver, records[i], record_len[i], out, &opened_len) == 0 &&
+		   opened_len == size && memcmp(out, plaintext, size) == 0;
+}
+
+// Records sealed over four epochs, opened out of order around the epoch changes
+static void check_ratchet(const unsigned char *plaintext, size_t size) {
+	static unsigned char records[RATCHET_RECORDS][MAX_PLAINTEXT + PQCRYPTO_RECORD_OVERHEAD];
+	size_t record_len[RATCHET_RECORDS];
+	encryption_context_t sender, receiver;
+
+	if (make_session(&sender, &receiver) != 0) {
+		check(0, "session setup", size, 0);
+		return;
+	}
+	sender.rekey_records = RATCHET_INTERVAL;
+	for (int i = 0; i < RATCHET_RECORDS; i++) {
+		check(pqcrypto_encrypt(&sender, plaintext, size, records[i], &record_len[i]) == 0,
+			  "ratchet encrypt", size, i);
+	}
+	check(sender.send.epoch == RATCHET_RECORDS / RATCHET_INTERVAL - 1, "sender epochs", size, 0);
+
+	check(opens(&receiver, records, record_len, 0, plaintext, size) &&
+		  opens(&receiver, records, record_len, 1, plaintext, size), "epoch 0 records", size, 0);
+	check(opens(&receiver, records, record_len, 4, plaintext, size) && receiver.recv.epoch == 1,
+		  "first record of the next epoch moves the receiver on", size, 0);
+	check(opens(&receiver, records, record_len, 3, plaintext, size), "late record from the previous epoch", size, 0);
+	check(!opens(&receiver, records, record_len, 12, plaintext, size) && receiver.recv.epoch == 1,
+		  "record two epochs ahead refused", size, 0);
+
+	// A forged record claiming the next epoch must not move the receiver
+	records[8][record_len[8] - 1] ^= 0x01;
+	check(!opens(&receiver, records, record_len, 8, plaintext, size) && receiver.recv.epoch == 1,
+		  "forged next-epoch record refused", size, 0);
+	records[8][record_len[8] - 1] ^= 0x01;
+	check(opens(&receiver, records, record_len, 8, plaintext, size) && receiver.recv.epoch == 2,
+		  "genuine next-epoch record", size, 0);
+	check(opens(&receiver, records, record_len, 5, plaintext, size), "straggler one epoch back", size, 0);
+	check(!opens(&receiver, records, record_len, 2, plaintext, size), "record two epochs back refused", size, 0);
+	check(!opens(&receiver, records, record_len, 8, plaintext, size), "replay across epochs refused", size, 0);
+
+	// Workers stay on the epoch they were made in
+	pqcrypto_direction_t worker;
+	unsigned char out[MAX_PLAINTEXT];
+	size_t opened_len;
+	uint64_t seq;
+	check(pqcrypto_worker_init(&receiver, 1, &worker) == 0, "worker init", size, 0);
+	check(pqcrypto_decrypt_seq(&worker, records[9], record_len[9], out, &opened_len, &seq) == 0 && seq == 9,
+		  "worker opens its epoch", size, 0);
+	check(pqcrypto_decrypt_seq(&worker, records[13], record_len[13], out, &opened_len, &seq) != 0,
+		  "worker refuses other epochs", size, 0);
+	pqcrypto_worker_free(&worker);
+
+	for (int i = 9; i < RATCHET_RECORDS; i++) {
+		check(opens(&receiver, records, record_len, i, plaintext, size), "remaining records", size, i);
+	}
+	check(receiver.recv.epoch == sender.send.epoch, "receiver caught up", size, 0);
+	free_session(&sender, &receiver);
+
+	// The byte limit rekeys as well
+	if (size == 0 || make_session(&sender, &receiver) != 0) return;
+	sender.rekey_bytes = 2 * size;
+	for (int i = 0; i < 3; i++) {
+		check(pqcrypto_encrypt(&sender, plaintext, size, records[i], &record_len[i]) == 0 &&
+			  opens(&receiver, records, record_len, i, plaintext, size), "byte limit records", size, i);
+	}
+	check(sender.send.epoch == 1 && receiver.recv.epoch == 1, "byte limit rekey", size, 0);
+	free_session(&sender, &receiver);
+}
+
+int main() {
+	const size_t sizes[] = { 0, 1, 15, 16, 17, 255, 1024, 4099 };
+	unsigned char plaintext[MAX_PLAINTEXT];
+
+	pqcrypto_initialize();
+	RAND_bytes(plaintext, sizeof(plaintext));
+
+	// The refusals below print their reasons, only the summary matters
+	printf("Running record encryption checks, error messages from refused cases are expected\n");
+	fflush(stdout);
+	for (cipher = 0; cipher < PQCRYPTO_CIPHER_COUNT; cipher++) {
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			for (size_t offset = 0; offset < 8; offset++) {
+				check_inplace(plaintext, sizes[i], offset);
+				check_iov(plaintext, sizes[i], offset);
+			}
+			check_overlap(plaintext, sizes[i]);
+			check_ratchet(plaintext, sizes[i]);
+		}
+	}
+
+	// Both ends pick the same cipher, and a peer that offers nothing gets AES-256-GCM
+	char offer[PQCRYPTO_CIPHER_OFFER_SIZE];
+	pqcrypto_cipher_offer(offer, sizeof(offer));
+	check(pqcrypto_cipher_select(offer) == pqcrypto_cipher_select(offer), "cipher selection", 0, 0);
+	check(pqcrypto_cipher_select("") == PQCRYPTO_AES_256_GCM, "default cipher", 0, 0);
+	check(pqcrypto_cipher_select("chacha20-poly1305:1,des:99999") == PQCRYPTO_CHACHA20_POLY1305,
+		  "unknown ciphers ignored", 0, 0);
+	printf("Cipher offer: %s\n", offer);
+
+	printf("%d of %d checks passed\n", checks - failures, checks);
+	pqcrypto_cleanup();
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
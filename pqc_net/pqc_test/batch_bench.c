@@ -0,0 +1,150 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Key generation, encapsulation and decapsulation for every enabled KEM, one call at a time on one
+// thread against batches on the kem_batch pool, in operations per second and per second per core.
+// The batches are checked: every decapsulated secret has to match its encapsulated one.
+//
+//   ./batch_bench [threads]
+
+#include "pq_encryption.h"
+#include "kem.h"
+#include "kem_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BATCH_SIZE 256
+#define MIN_SECONDS 0.3
+
+enum { OP_KEYPAIR, OP_ENCAPSULATE, OP_DECAPSULATE, OP_COUNT };
+static const char *op_names[OP_COUNT] = { "keygen", "encaps", "decaps" };
+
+typedef struct {
+	unsigned char *public_keys[BATCH_SIZE], *secret_keys[BATCH_SIZE], *ciphertexts[BATCH_SIZE];
+	size_t public_key_lens[BATCH_SIZE], ciphertext_lens[BATCH_SIZE];
+	encryption_context_t senders[BATCH_SIZE], receivers[BATCH_SIZE];
+	unsigned char *memory;
+} batch_t;
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int batch_alloc(batch_t *batch, const OQS_KEM *kem) {
+	size_t each = kem->length_public_key + kem->length_secret_key + kem->length_ciphertext;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->memory = malloc(each * BATCH_SIZE);
+	if (batch->memory == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (int i = 0; i < BATCH_SIZE; i++) {
+		batch->public_keys[i] = batch->memory + i * each;
+		batch->secret_keys[i] = batch->public_keys[i] + kem->length_public_key;
+		batch->ciphertexts[i] = batch->secret_keys[i] + kem->length_secret_key;
+		batch->public_key_lens[i] = kem->length_public_key;
+		batch->ciphertext_lens[i] = kem->length_ciphertext;
+	}
+	return 0;
+}
+
+static int run_single(batch_t *batch, int kem, int op, size_t i) {
+	size_t ciphertext_len;
+
+	switch (op) {
+	case OP_KEYPAIR:
+		return OQS_KEM_keypair(kem_handle(kem), batch->public_keys[i], batch->secret_keys[i]) == OQS_SUCCESS ? 0 : -1;
+	case OP_ENCAPSULATE:
+		return pqcrypto_encapsulate(&batch->senders[i], kem, batch->public_keys[i], batch->public_key_lens[i],
+									batch->ciphertexts[i], &ciphertext_len);
+	default:
+		return pqcrypto_derive_shared_secret(&batch->receivers[i], kem, batch->ciphertexts[i],
+											 batch->ciphertext_lens[i], batch->secret_keys[i]);
+	}
+}
+
+static int run_batch(batch_t *batch, int kem, int op) {
+	switch (op) {
+	case OP_KEYPAIR:
+		return kem_batch_keypair(kem, BATCH_SIZE, batch->public_keys, batch->secret_keys, NULL);
+	case OP_ENCAPSULATE:
+		return kem_batch_encapsulate(batch->senders, kem, BATCH_SIZE,
+									 (const unsigned char *const *)batch->public_keys, batch->public_key_lens,
+									 batch->ciphertexts, NULL);
+	default:
+		return kem_batch_decapsulate(batch->receivers, kem, BATCH_SIZE,
+									 (const unsigned char *const *)batch->ciphertexts, batch->ciphertext_lens,
+									 (const unsigned char *const *)batch->secret_keys, NULL);
+	}
+}
+
+// Operations per second, whole batches until MIN_SECONDS have passed. The operations before op
+// have already filled the batch with what op consumes.
+static double measure(batch_t *batch, int kem, int op, int batched) {
+	struct timespec start, now;
+	long ops = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		if (batched) {
+			if (run_batch(batch, kem, op) != 0) return -1;
+		} else {
+			for (size_t i = 0; i < BATCH_SIZE; i++) {
+				if (run_single(batch, kem, op, i) != 0) return -1;
+			}
+		}
+		ops += BATCH_SIZE;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (elapsed_sec(start, now) < MIN_SECONDS);
+	return ops / elapsed_sec(start, now);
+}
+
+static int check(const batch_t *batch) {
+	for (int i = 0; i < BATCH_SIZE; i++) {
+		if (memcmp(batch->senders[i].aes_key, batch->receivers[i].aes_key, AES_KEY_SIZE) != 0) return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int rc = EXIT_SUCCESS;
+
+	pqcrypto_initialize();
+	if (kem_batch_start(argc > 1 ? atoi(argv[1]) : 0) != 0) return EXIT_FAILURE;
+	int threads = kem_batch_threads();
+
+	printf("batches of %d on %d threads, single calls on one\n", BATCH_SIZE, threads);
+	printf("%-22s %-7s %12s %12s %14s %8s\n", "kem", "op", "single/s", "batch/s", "batch/s/core", "speedup");
+	for (int kem = 0; kem < kem_count(); kem++) {
+		const OQS_KEM *handle = kem_handle(kem);
+		batch_t batch;
+		if (handle == NULL) continue;
+		if (batch_alloc(&batch, handle) != 0) return EXIT_FAILURE;
+
+		for (int op = 0; op < OP_COUNT; op++) {
+			double single = measure(&batch, kem, op, 0);
+			double batched = measure(&batch, kem, op, 1);
+			if (single < 0 || batched < 0) {
+				fprintf(stderr, "%s %s failed\n", kem_name(kem), op_names[op]);
+				rc = EXIT_FAILURE;
+				break;
+			}
+			printf("%-22s %-7s %12.0f %12.0f %14.0f %7.2fx\n", kem_name(kem), op_names[op], single, batched,
+				   batched / threads, batched / single);
+		}
+		if (rc == EXIT_SUCCESS && check(&batch) != 0) {
+			fprintf(stderr, "%s batch secrets do not match\n", kem_name(kem));
+			rc = EXIT_FAILURE;
+		}
+		OQS_MEM_cleanse(batch.memory, BATCH_SIZE * (handle->length_public_key + handle->length_secret_key));
+		free(batch.memory);
+	}
+
+	kem_batch_stop();
+	pqcrypto_cleanup();
+	return rc;
+}
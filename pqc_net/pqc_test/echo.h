@@ -0,0 +1,13 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+#ifndef ECHO_H
+#define ECHO_H
+
+// Shared by echo_peer and echo_bench
+#define ECHO_PEER_PORT 6001             // next to test/static_peer's 6000
+#define ECHO_PEER_USERNAME "echo"
+#define ECHO_MAX_MESSAGE (64 * 1024)    // largest message echoed, one record each way
+
+#endif // ECHO_H
@@ -0,0 +1,267 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Encrypted counterpart of test/test_client.c's message metrics, driving a running echo_peer over
+// the real protocol. For each number of concurrent sessions and each message size every session
+// sends a message, waits for it to come back and sends the next, for MEASURE_SECONDS. Reports round
+// trip p50/p99, messages/s and MB/s each way.
+//
+// Everything runs twice, once with the negotiated record cipher and once with the null cipher,
+// whose records are framed the same but not encrypted. The gap between the two is what the record
+// crypto costs. The null run needs echo_peer started with PQC_ALLOW_NULL_CIPHER=1, without it
+// only the first run is shown. Handshakes happen before timing starts.
+//
+//   ./echo_bench [peer ip] [port]
+
+#include "handshake.h"
+#include "ktls.h"
+#include "keypool.h"
+#include "network.h"
+#include "echo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+
+#define MEASURE_SECONDS 0.5
+#define MAX_SAMPLES (1 << 16) // round trips kept per session for the percentiles
+#define SIZE_COUNT 4
+#define LEVEL_COUNT 3
+#define MAX_SESSIONS 16
+
+static const size_t sizes[SIZE_COUNT] = { 16, 256, 4096, ECHO_MAX_MESSAGE };
+static const int levels[LEVEL_COUNT] = { 1, 4, MAX_SESSIONS };
+
+enum { MODE_CIPHER, MODE_NULL, MODE_COUNT };
+
+typedef struct {
+	double p50_us, p99_us;
+	double messages_per_sec;
+	double mb_per_sec;
+} echo_result_t;
+
+typedef struct {
+	struct chat_info chat;
+	size_t size;
+	double *rtt_us;    // MAX_SAMPLES round trips
+	long messages;
+	int rc;
+} session_t;
+
+static unsigned char message[ECHO_MAX_MESSAGE];
+static struct timespec deadline;
+
+static double elapsed_us(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Send one message and read the echo back, sealed unless the kernel does it
+static int roundtrip(session_t *s, unsigned char *record, unsigned char *echo) {
+	struct chat_info *chat = &s->chat;
+	size_t record_len = s->size, echo_len;
+	unsigned char *reply;
+	uint32_t reply_len;
+	int rc = -1;
+
+	if (chat->ktls) memcpy(record, message, s->size);
+	else if (pqcrypto_encrypt(&chat->enc_ctx, message, s->size, record, &record_len) != 0) return -1;
+	if (write_frame(chat->sock, record, record_len) != 0) return -1;
+	if (chat->ktls_rx < 0) chat->ktls_rx = ktls_start_receiving(chat->sock, &chat->enc_ctx, chat->initiator);
+	if (chat->ktls_rx < 0 ||
+		read_frame(chat->sock, &reply, &reply_len, ECHO_MAX_MESSAGE + PQCRYPTO_RECORD_OVERHEAD) != 1) {
+		return -1;
+	}
+	if (chat->ktls_rx) {
+		memcpy(echo, reply, reply_len);
+		echo_len = reply_len;
+		rc = 0;
+	} else {
+		rc = pqcrypto_decrypt(&chat->enc_ctx, reply, reply_len, echo, &echo_len);
+	}
+	free(reply);
+	return rc == 0 && echo_len == s->size && memcmp(echo, message, echo_len) == 0 ? 0 : -1;
+}
+
+static void *pinger(void *arg) {
+	session_t *s = arg;
+	unsigned char *record = malloc(ECHO_MAX_MESSAGE + PQCRYPTO_RECORD_OVERHEAD);
+	unsigned char *echo = malloc(ECHO_MAX_MESSAGE);
+	struct timespec start, end;
+
+	s->messages = 0;
+	s->rc = -1;
+	if (record == NULL || echo == NULL) {
+		perror("malloc");
+		goto out;
+	}
+	s->rc = 0;
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (roundtrip(s, record, echo) != 0) {
+			fprintf(stderr, "Echo of %zu bytes failed\n", s->size);
+			s->rc = -1;
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (s->messages < MAX_SAMPLES) s->rtt_us[s->messages] = elapsed_us(start, end);
+		s->messages++;
+	} while (elapsed_us(end, deadline) > 0);
+
+out:
+	free(record);
+	free(echo);
+	return NULL;
+}
+
+// Every session echoes messages of one size until the deadline
+static int measure(session_t *sessions, int count, size_t size, double *samples, echo_result_t *result) {
+	pthread_t threads[MAX_SESSIONS];
+	struct timespec start, end;
+	size_t kept = 0;
+	long messages = 0;
+	int rc = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	deadline = start;
+	deadline.tv_nsec += (long)(MEASURE_SECONDS * 1e9);
+	deadline.tv_sec += deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+	for (int i = 0; i < count; i++) {
+		sessions[i].size = size;
+		sessions[i].rtt_us = samples + (size_t)i * MAX_SAMPLES;
+		pthread_create(&threads[i], NULL, pinger, &sessions[i]);
+	}
+	for (int i = 0; i < count; i++) {
+		pthread_join(threads[i], NULL);
+		rc |= sessions[i].rc;
+		messages += sessions[i].messages;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (rc != 0 || messages == 0) return -1;
+
+	// Gather every session's samples in front of the first one's
+	for (int i = 0; i < count; i++) {
+		size_t n = sessions[i].messages < MAX_SAMPLES ? (size_t)sessions[i].messages : MAX_SAMPLES;
+		memmove(samples + kept, sessions[i].rtt_us, n * sizeof(double));
+		kept += n;
+	}
+	qsort(samples, kept, sizeof(double), compare_double);
+	double secs = elapsed_us(start, end) / 1e6;
+	result->p50_us = samples[kept / 2];
+	result->p99_us = samples[kept * 99 / 100];
+	result->messages_per_sec = messages / secs;
+	result->mb_per_sec = messages * (double)size / secs / 1e6;
+	return 0;
+}
+
+static void close_sessions(session_t *sessions, int count) {
+	for (int i = 0; i < count; i++) {
+		pqcrypto_context_free(&sessions[i].chat.enc_ctx);
+		close(sessions[i].chat.sock);
+	}
+}
+
+// Dial count sessions, 1 if they all got the cipher the mode asks for, 0 if the peer chose another
+// one, -1 if a dial failed
+static int open_sessions(const char *ip, int port, int mode, session_t *sessions, int count, const char **cipher) {
+	int opened = 0, rc = 1;
+
+	for (; opened < count; opened++) {
+		struct chat_info *chat = &sessions[opened].chat;
+		memset(chat, 0, sizeof(*chat));
+		chat->sock = connect_to_peer(ip, port);
+		if (chat->sock < 0) {
+			rc = -1;
+			break;
+		}
+		if (handshake_dial(chat->sock, "echo_bench", NULL, chat) != 0) {
+			close(chat->sock);
+			rc = -1;
+			break;
+		}
+		*cipher = chat->ktls ? "kernel" : pqcrypto_cipher_name(chat->cipher);
+		if ((mode == MODE_NULL) != (chat->cipher == PQCRYPTO_CIPHER_NULL)) rc = 0;
+	}
+	if (rc != 1) close_sessions(sessions, opened);
+	return rc;
+}
+
+int main(int argc, char **argv) {
+	const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+	int port = argc > 2 ? atoi(argv[2]) : ECHO_PEER_PORT;
+	static echo_result_t results[MODE_COUNT][LEVEL_COUNT][SIZE_COUNT];
+	static session_t sessions[MAX_SESSIONS];
+	const char *cipher = "unknown";
+	int modes = MODE_COUNT;
+
+	pqcrypto_initialize();
+	if (keypool_start(KEYPOOL_CAPACITY) != 0) return EXIT_FAILURE;
+	double *samples = malloc((size_t)MAX_SESSIONS * MAX_SAMPLES * sizeof(double));
+	if (samples == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	RAND_bytes(message, sizeof(message));
+
+	for (int mode = 0; mode < modes; mode++) {
+		if (mode == MODE_NULL) setenv("PQC_ALLOW_NULL_CIPHER", "1", 1);
+		else unsetenv("PQC_ALLOW_NULL_CIPHER");
+
+		for (int level = 0; level < LEVEL_COUNT && mode < modes; level++) {
+			const char *session_cipher = "unknown";
+			int rc = open_sessions(ip, port, mode, sessions, levels[level], &session_cipher);
+			if (rc < 0) {
+				fprintf(stderr, "Could not open %d sessions to %s:%d, is echo_peer running?\n", levels[level], ip, port);
+				return EXIT_FAILURE;
+			}
+			if (rc == 0 && mode == MODE_NULL) {
+				printf("The peer refused the null cipher, start echo_peer with PQC_ALLOW_NULL_CIPHER=1 to "
+					   "measure without record encryption\n");
+				close_sessions(sessions, levels[level]);
+				modes = MODE_NULL;
+				break;
+			}
+			if (mode == MODE_CIPHER) cipher = session_cipher;
+
+			for (int size = 0; size < SIZE_COUNT; size++) {
+				if (measure(sessions, levels[level], sizes[size], samples, &results[mode][level][size]) != 0) {
+					close_sessions(sessions, levels[level]);
+					return EXIT_FAILURE;
+				}
+			}
+			close_sessions(sessions, levels[level]);
+		}
+	}
+
+	printf("Echo round trips to %s:%d, %.1f s per row, MB/s each way\n\n", ip, port, MEASURE_SECONDS);
+	printf("%-8s %8s  %-17s %8s %8s %9s %8s", "sessions", "size", cipher, "p50 us", "p99 us", "msg/s", "MB/s");
+	if (modes == MODE_COUNT) printf("   %-4s %8s %8s %9s %8s %7s", "null", "p50 us", "p99 us", "msg/s", "MB/s", "crypto");
+	printf("\n");
+	for (int level = 0; level < LEVEL_COUNT; level++) {
+		for (int size = 0; size < SIZE_COUNT; size++) {
+			echo_result_t *r = &results[MODE_CIPHER][level][size];
+			printf("%-8d %8zu  %-17s %8.1f %8.1f %9.0f %8.1f", levels[level], sizes[size], "", r->p50_us,
+				   r->p99_us, r->messages_per_sec, r->mb_per_sec);
+			if (modes == MODE_COUNT) {
+				// Share of each message's time that went to sealing and opening
+				echo_result_t *n = &results[MODE_NULL][level][size];
+				printf("   %-4s %8.1f %8.1f %9.0f %8.1f %6.1f%%", "", n->p50_us, n->p99_us, n->messages_per_sec,
+					   n->mb_per_sec, 100.0 * (1 - r->messages_per_sec / n->messages_per_sec));
+			}
+			printf("\n");
+		}
+	}
+
+	free(samples);
+	pqcrypto_cleanup();
+	return EXIT_SUCCESS;
+}
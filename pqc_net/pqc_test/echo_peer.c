@@ -0,0 +1,101 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// test/static_peer.c's echoer speaking the real protocol: connections go through the admission
+// pipeline and the full handshake, then every record that comes in is opened and sealed back to the
+// sender. Records are opened and resealed in the frame they arrived in. Start it with
+// PQC_ALLOW_NULL_CIPHER=1 to let echo_bench measure sessions without record encryption as well.
+//
+//   ./echo_peer [port]
+
+#include "admission.h"
+#include "keypool.h"
+#include "ktls.h"
+#include "network.h"
+#include "echo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static int accept_all(const handshake_request_t *request) {
+	(void)request;
+	return 1;
+}
+
+// Echo records until the dialer hangs up. With kTLS the kernel opens and seals, frames carry plaintext.
+// A kernel that took the keys for only one direction leaves the other to user space.
+static void *echo_session(void *arg) {
+	struct chat_info *chat = arg;
+	unsigned char *record, *sealed = NULL;
+	uint32_t record_len;
+
+	while (1) {
+		if (chat->ktls_rx < 0) chat->ktls_rx = ktls_start_receiving(chat->sock, &chat->enc_ctx, 0);
+		if (chat->ktls_rx < 0 ||
+			read_frame(chat->sock, &record, &record_len, ECHO_MAX_MESSAGE + PQCRYPTO_RECORD_OVERHEAD) != 1) {
+			break;
+		}
+		unsigned char *message = record, *reply = record;
+		size_t message_len = record_len, reply_len = record_len;
+		int rc = 0;
+
+		if (!chat->ktls_rx) {
+			rc = pqcrypto_decrypt_inplace(&chat->enc_ctx, record, record_len, &message, &message_len);
+		}
+		if (rc == 0 && chat->ktls) {
+			reply = message;
+			reply_len = message_len;
+		} else if (rc == 0 && !chat->ktls_rx) {
+			rc = pqcrypto_encrypt_inplace(&chat->enc_ctx, record, message_len, &reply_len);
+		} else if (rc == 0) {
+			if (sealed == NULL) sealed = malloc(ECHO_MAX_MESSAGE + PQCRYPTO_RECORD_OVERHEAD);
+			reply = sealed;
+			rc = sealed == NULL ? -1 : pqcrypto_encrypt(&chat->enc_ctx, message, message_len, reply, &reply_len);
+		}
+		if (rc == 0) rc = write_frame(chat->sock, reply, reply_len);
+		free(record);
+		if (rc != 0) break;
+	}
+
+	free(sealed);
+	pqcrypto_context_free(&chat->enc_ctx);
+	close(chat->sock);
+	free(chat);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int port = argc > 1 ? atoi(argv[1]) : ECHO_PEER_PORT;
+
+	pqcrypto_initialize();
+	if (keypool_start(KEYPOOL_CAPACITY) != 0) return EXIT_FAILURE;
+
+	int listen_sock = bind_and_listen(port);
+	if (listen_sock < 0) {
+		fprintf(stderr, "Failed to bind and listen on port %d.\n", port);
+		return EXIT_FAILURE;
+	}
+	if (admission_start(0, accept_all, ECHO_PEER_USERNAME, echo_session) != 0) {
+		close(listen_sock);
+		return EXIT_FAILURE;
+	}
+	printf("Echo peer listening on port %d%s...\n", port,
+		   pqcrypto_null_cipher_allowed() ? ", null cipher allowed" : "");
+
+	while (1) {
+		int sock = accept(listen_sock, NULL, NULL);
+		if (sock < 0) {
+			perror("accept");
+			continue;
+		}
+		admission_submit(sock);
+	}
+
+	admission_stop();
+	close(listen_sock);
+	pqcrypto_cleanup();
+	return 0;
+}
@@ -0,0 +1,142 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Loopback throughput of the chat record path: encrypt + write_frame() on one side,
+// frame_reader_next() + in-place decrypt on the other.
+
+#include "network.h"
+#include "frame_reader.h"
+#include "pq_encryption.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+
+#define BENCH_PORT 7611
+#define BENCH_BYTES (256UL * 1024 * 1024) // per message size
+
+struct writer_args {
+	int sock;
+	encryption_context_t *enc_ctx;
+	size_t message_size;
+	size_t count;
+	int rc;
+};
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void *writer(void *arg) {
+	struct writer_args *wa = arg;
+	unsigned char *message = malloc(wa->message_size);
+	unsigned char *record = malloc(wa->message_size + PQCRYPTO_RECORD_OVERHEAD);
+	size_t record_len;
+	wa->rc = -1;
+
+	if (message == NULL || record == NULL) {
+		perror("malloc");
+		goto out;
+	}
+	memset(message, 'A', wa->message_size);
+
+	for (size_t i = 0; i < wa->count; i++) {
+		if (pqcrypto_encrypt(wa->enc_ctx, message, wa->message_size, record, &record_len) != 0 ||
+			write_frame(wa->sock, record, record_len) != 0) {
+			fprintf(stderr, "Writer failed at message %zu\n", i);
+			goto out;
+		}
+	}
+	wa->rc = 0;
+
+out:
+	free(message);
+	free(record);
+	shutdown(wa->sock, SHUT_WR);
+	return NULL;
+}
+
+static int run(size_t message_size, int mode) {
+	// Sender and receiver are the two ends of one session
+	encryption_context_t enc_ctx, peer_ctx;
+	RAND_bytes(enc_ctx.aes_key, AES_KEY_SIZE);
+	memcpy(peer_ctx.aes_key, enc_ctx.aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(&enc_ctx, PQCRYPTO_AES_256_GCM, 1) != 0 ||
+		pqcrypto_context_init(&peer_ctx, PQCRYPTO_AES_256_GCM, 0) != 0) {
+		return -1;
+	}
+
+	int listen_sock = bind_and_listen(BENCH_PORT);
+	if (listen_sock < 0) return -1;
+	int tx = connect_to_peer("127.0.0.1", BENCH_PORT);
+	int rx = accept(listen_sock, NULL, NULL);
+	close(listen_sock);
+	if (tx < 0 || rx < 0) {
+		fprintf(stderr, "Loopback connection failed\n");
+		return -1;
+	}
+	set_socket_mode(tx, mode);
+
+	struct writer_args wa = { tx, &enc_ctx, message_size, BENCH_BYTES / message_size, 0 };
+	if (wa.count > 2000000) wa.count = 2000000;
+
+	frame_reader_t reader;
+	if (frame_reader_init(&reader, rx, MAX_FRAME_SIZE) != 0) return -1;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, writer, &wa);
+
+	size_t frames = 0;
+	unsigned char *frame;
+	size_t frame_len, plaintext_len;
+	int rc;
+	while ((rc = frame_reader_next(&reader, &frame, &frame_len)) > 0) {
+		if (pqcrypto_decrypt(&peer_ctx, frame, frame_len, frame + PQCRYPTO_SEQ_SIZE, &plaintext_len) != 0 ||
+			plaintext_len != message_size) {
+			fprintf(stderr, "Bad frame %zu\n", frames);
+			rc = -1;
+			break;
+		}
+		frames++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_join(thread, NULL);
+	frame_reader_free(&reader);
+	close(tx);
+	close(rx);
+	pqcrypto_context_free(&enc_ctx);
+	pqcrypto_context_free(&peer_ctx);
+
+	if (rc < 0 || wa.rc != 0 || frames != wa.count) {
+		fprintf(stderr, "Run failed after %zu of %zu frames\n", frames, wa.count);
+		return -1;
+	}
+
+	double secs = elapsed_sec(start, end);
+	printf("%-8zu %-12s %10zu frames  %12.0f frames/s  %9.2f MB/s\n",
+		   message_size, mode == SOCKET_MODE_BULK ? "bulk" : "interactive", frames,
+		   frames / secs, (double)frames * message_size / secs / 1e6);
+	return 0;
+}
+
+int main() {
+	const size_t sizes[] = { 64, 64 * 1024 };
+	const int modes[] = { SOCKET_MODE_INTERACTIVE, SOCKET_MODE_BULK };
+
+	pqcrypto_initialize();
+	printf("%-8s %-12s %17s  %19s  %14s\n", "size", "mode", "count", "rate", "throughput");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+			if (run(sizes[i], modes[j]) != 0) return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
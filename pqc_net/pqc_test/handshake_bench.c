@@ -0,0 +1,260 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Where connection setup time goes. Dialer threads connect to an acceptor on loopback over and over,
+// run the client's full handshake through the admission pipeline and exchange a first encrypted
+// message, echoed back by the session. Each connection is timed in phases:
+//
+//   connect   TCP connect
+//   keygen    key share from the pool
+//   exchange  request out until the answer is in, the acceptor's encapsulation included
+//   decaps    session secret derived and the cipher keyed
+//   confirm   the acceptor's confirmation record
+//   first     first message sealed, sent, echoed and opened
+//
+// Tickets are off so every handshake runs the KEM.
+//
+//   ./handshake_bench [concurrent dialers] [handshakes per dialer]
+
+#include "admission.h"
+#include "keypool.h"
+#include "ktls.h"
+#include "network.h"
+#include "puzzle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define DEFAULT_DIALERS 4
+#define DEFAULT_HANDSHAKES 250
+#define MAX_DIALERS 64
+#define FIRST_MESSAGE "hello"
+#define HISTOGRAM_BUCKETS 18 // powers of two from 1 us, the last one open ended
+
+enum { PHASE_CONNECT, PHASE_KEYGEN, PHASE_EXCHANGE, PHASE_DECAPS, PHASE_CONFIRM, PHASE_FIRST, PHASE_TOTAL, PHASE_COUNT };
+static const char *phase_names[PHASE_COUNT] = { "connect", "keygen", "exchange", "decaps", "confirm", "first", "total" };
+
+static int listen_sock, port, handshakes;
+static double *samples[PHASE_COUNT]; // [phase][dialer * handshakes + i], microseconds
+
+static double elapsed_us(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int accept_quietly(const handshake_request_t *request) {
+	(void)request;
+	return 1;
+}
+
+// Seal and send one message, or with kTLS hand the kernel the plaintext
+static int send_message(struct chat_info *chat, const unsigned char *message, size_t len) {
+	unsigned char record[BUFFER_SIZE + PQCRYPTO_RECORD_OVERHEAD];
+	size_t record_len;
+
+	if (chat->ktls) return write_frame(chat->sock, message, len);
+	if (len > BUFFER_SIZE || pqcrypto_encrypt(&chat->enc_ctx, message, len, record, &record_len) != 0) return -1;
+	return write_frame(chat->sock, record, record_len);
+}
+
+static int receive_message(struct chat_info *chat, unsigned char *message, size_t *len) {
+	unsigned char *record = NULL;
+	uint32_t record_len;
+	int rc = -1;
+
+	if (chat->ktls_rx < 0) chat->ktls_rx = ktls_start_receiving(chat->sock, &chat->enc_ctx, chat->initiator);
+	if (chat->ktls_rx >= 0 && read_frame(chat->sock, &record, &record_len, BUFFER_SIZE + PQCRYPTO_RECORD_OVERHEAD) == 1) {
+		if (chat->ktls_rx) {
+			memcpy(message, record, record_len);
+			*len = record_len;
+			rc = 0;
+		} else {
+			rc = pqcrypto_decrypt(&chat->enc_ctx, record, record_len, message, len);
+		}
+	}
+	free(record);
+	return rc;
+}
+
+// The acceptor's session: echo the first message and hang up
+static void *echo_session(void *arg) {
+	struct chat_info *chat = arg;
+	unsigned char message[BUFFER_SIZE];
+	size_t len;
+
+	if (receive_message(chat, message, &len) == 0) send_message(chat, message, len);
+	pqcrypto_context_free(&chat->enc_ctx);
+	close(chat->sock);
+	free(chat);
+	return NULL;
+}
+
+static void *listener(void *arg) {
+	(void)arg;
+	while (1) {
+		int sock = accept(listen_sock, NULL, NULL);
+		if (sock < 0) break;
+		admission_submit(sock);
+	}
+	return NULL;
+}
+
+static void *dialer(void *arg) {
+	size_t base = (size_t)(long)arg * handshakes;
+	long failed = 0;
+
+	for (int i = 0; i < handshakes; i++) {
+		struct chat_info chat;
+		handshake_phases_t phases;
+		struct timespec start, connected, keyed, end;
+		unsigned char echo[BUFFER_SIZE];
+		size_t echo_len;
+
+		memset(&chat, 0, sizeof(chat));
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		chat.sock = connect_to_peer("127.0.0.1", port);
+		clock_gettime(CLOCK_MONOTONIC, &connected);
+		if (chat.sock < 0 || handshake_dial_timed(chat.sock, "alice", NULL, &chat, &phases) != 0) {
+			if (chat.sock >= 0) close(chat.sock);
+			failed++;
+			i--;
+			if (failed > handshakes) break;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &keyed);
+		int ok = send_message(&chat, (const unsigned char *)FIRST_MESSAGE, sizeof(FIRST_MESSAGE)) == 0 &&
+				 receive_message(&chat, echo, &echo_len) == 0 && echo_len == sizeof(FIRST_MESSAGE) &&
+				 memcmp(echo, FIRST_MESSAGE, echo_len) == 0;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		pqcrypto_context_free(&chat.enc_ctx);
+		close(chat.sock);
+		if (!ok) {
+			fprintf(stderr, "First message did not come back\n");
+			failed = handshakes + 1;
+			break;
+		}
+
+		size_t at = base + i;
+		samples[PHASE_CONNECT][at] = elapsed_us(start, connected);
+		samples[PHASE_KEYGEN][at] = phases.keygen_us;
+		samples[PHASE_EXCHANGE][at] = phases.exchange_us;
+		samples[PHASE_DECAPS][at] = phases.decaps_us;
+		samples[PHASE_CONFIRM][at] = phases.confirm_us;
+		samples[PHASE_FIRST][at] = elapsed_us(keyed, end);
+		samples[PHASE_TOTAL][at] = elapsed_us(start, end);
+	}
+	return (void *)failed;
+}
+
+static void print_phases(size_t count) {
+	printf("\n%-9s %10s %10s %10s %10s %10s   (us)\n", "phase", "mean", "p50", "p90", "p99", "max");
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		double *s = samples[phase], sum = 0;
+		qsort(s, count, sizeof(double), compare_double);
+		for (size_t i = 0; i < count; i++) sum += s[i];
+		printf("%-9s %10.1f %10.1f %10.1f %10.1f %10.1f\n", phase_names[phase], sum / count,
+			   s[count / 2], s[count * 90 / 100], s[count * 99 / 100], s[count - 1]);
+	}
+
+	// Handshakes per power-of-two bucket, the column is the bucket's upper bound
+	printf("\n%-9s", "<= us");
+	for (int b = 0; b < HISTOGRAM_BUCKETS - 1; b++) {
+		if (b < 10) printf(" %6d", 1 << b);
+		else printf(" %5dk", (1 << b) / 1000);
+	}
+	printf(" %6s\n", "more");
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		size_t buckets[HISTOGRAM_BUCKETS] = { 0 };
+		for (size_t i = 0; i < count; i++) {
+			int b = 0;
+			while (b < HISTOGRAM_BUCKETS - 1 && samples[phase][i] > (double)(1 << b)) b++;
+			buckets[b]++;
+		}
+		printf("%-9s", phase_names[phase]);
+		for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+			if (buckets[b] > 0) printf(" %6zu", buckets[b]);
+			else printf(" %6s", ".");
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	int dialers = argc > 1 ? atoi(argv[1]) : DEFAULT_DIALERS;
+	handshakes = argc > 2 ? atoi(argv[2]) : DEFAULT_HANDSHAKES;
+	if (dialers < 1 || dialers > MAX_DIALERS || handshakes < 1) {
+		fprintf(stderr, "Usage: %s [concurrent dialers, up to %d] [handshakes per dialer]\n", argv[0], MAX_DIALERS);
+		return EXIT_FAILURE;
+	}
+	size_t count = (size_t)dialers * handshakes;
+
+	// Full handshakes every time, and no puzzles when the dialers pile up
+	setenv("PQC_TICKET_LIFETIME", "0", 1);
+	puzzle_set_threshold(0);
+	pqcrypto_initialize();
+	if (keypool_start(KEYPOOL_CAPACITY) != 0) return EXIT_FAILURE;
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		samples[phase] = calloc(count, sizeof(double));
+		if (samples[phase] == NULL) {
+			perror("calloc");
+			return EXIT_FAILURE;
+		}
+	}
+
+	listen_sock = bind_and_listen(0);
+	if (listen_sock < 0) return EXIT_FAILURE;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	getsockname(listen_sock, (struct sockaddr *)&addr, &addr_len);
+	port = ntohs(addr.sin_port);
+
+	pthread_t thread, threads[MAX_DIALERS];
+	if (admission_start(0, accept_quietly, "bob", echo_session) != 0 ||
+		pthread_create(&thread, NULL, listener, NULL) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < dialers; i++) {
+		pthread_create(&threads[i], NULL, dialer, (void *)i);
+	}
+	long failed = 0;
+	for (int i = 0; i < dialers; i++) {
+		void *result;
+		pthread_join(threads[i], &result);
+		failed += (long)result;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	admission_stats_t admission;
+	keypool_stats_t pool;
+	admission_get_stats(&admission);
+	keypool_get_stats(&pool);
+	printf("%zu handshakes with %s from %d dialers to %d handshake workers, %.0f handshakes/s, %ld retried\n",
+		   count, pool.kem, dialers, admission.workers, count / (elapsed_us(start, end) / 1e6), failed);
+	printf("Key pool %lu hits, %lu misses. Acceptor waits %.0f us for a worker, %.0f us to be keyed, "
+		   "%.0f us of crypto each\n", pool.hits, pool.misses, admission.read_wait_us, admission.accept_wait_us,
+		   admission.crypto_us);
+	print_phases(count);
+
+	shutdown(listen_sock, SHUT_RDWR);
+	close(listen_sock);
+	pthread_join(thread, NULL);
+	admission_stop();
+	keypool_stop();
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		free(samples[phase]);
+	}
+	pqcrypto_cleanup();
+	return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
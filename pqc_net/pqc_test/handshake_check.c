@@ -0,0 +1,188 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Checks for the acceptor's defences. Connections that open and then send nothing must not hold the
+// handshake workers: once they time out a real dialer gets through again. A solved puzzle works
+// once, also after more than PUZZLE_REPLAY_CACHE others were redeemed, and so does a resumption
+// ticket.
+
+#include "admission.h"
+#include "keypool.h"
+#include "network.h"
+#include "puzzle.h"
+#include "ticket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define CHECK_WORKERS 2
+#define CHECK_TIMEOUT "1" // $PQC_HANDSHAKE_TIMEOUT for the run, seconds
+
+static int checks, failures;
+static int listen_sock, port;
+
+static void check(int ok, const char *what) {
+	checks++;
+	if (!ok) {
+		failures++;
+		printf("FAILED: %s\n", what);
+	}
+}
+
+static double since_s(struct timespec start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int accept_quietly(const handshake_request_t *request) {
+	(void)request;
+	return 1;
+}
+
+static void *end_session(void *arg) {
+	struct chat_info *chat = arg;
+	pqcrypto_context_free(&chat->enc_ctx);
+	close(chat->sock);
+	free(chat);
+	return NULL;
+}
+
+static void *listener(void *arg) {
+	(void)arg;
+	while (1) {
+		int sock = accept(listen_sock, NULL, NULL);
+		if (sock < 0) break;
+		admission_submit(sock);
+	}
+	return NULL;
+}
+
+// Dial until a handshake succeeds or seconds pass, the queue refuses us while it is full
+static int dial_within(double seconds) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (since_s(start) < seconds) {
+		struct chat_info chat;
+		memset(&chat, 0, sizeof(chat));
+		int sock = connect_to_peer("127.0.0.1", port);
+		int rc = sock < 0 ? -1 : handshake_dial(sock, "alice", NULL, &chat);
+		if (sock >= 0) close(sock);
+		if (rc == 0) {
+			pqcrypto_context_free(&chat.enc_ctx);
+			return 0;
+		}
+		usleep(100000);
+	}
+	return -1;
+}
+
+// Fill the queue with connections that never send their request
+static void check_idle_connections() {
+	int idle[ADMISSION_QUEUE_SIZE];
+	admission_stats_t before, after;
+
+	admission_get_stats(&before);
+	for (int i = 0; i < ADMISSION_QUEUE_SIZE; i++) {
+		idle[i] = connect_to_peer("127.0.0.1", port);
+		// One at a time, a full listen backlog would hold the rest back for a SYN retry
+		do {
+			usleep(1000);
+			admission_get_stats(&after);
+		} while (after.admitted - before.admitted <= (unsigned long)i);
+	}
+	admission_get_stats(&after);
+	check(after.queued == ADMISSION_QUEUE_SIZE, "idle connections fill the queue");
+
+	check(dial_within(3 * atoi(CHECK_TIMEOUT) + 2) == 0, "dialer gets through once idle connections time out");
+	admission_get_stats(&after);
+	check(after.timed_out - before.timed_out == ADMISSION_QUEUE_SIZE, "every idle connection timed out");
+	for (int i = 0; i < ADMISSION_QUEUE_SIZE; i++) {
+		if (idle[i] >= 0) close(idle[i]);
+	}
+}
+
+// Cookies are issued at difficulty 1 here, solving them is not what is being checked
+static void check_puzzle_replay() {
+	unsigned char first[PUZZLE_COOKIE_SIZE], first_nonce[PUZZLE_NONCE_SIZE];
+	unsigned char cookie[PUZZLE_COOKIE_SIZE], nonce[PUZZLE_NONCE_SIZE];
+	int redeemed = 0;
+
+	for (int i = 0; i <= PUZZLE_REPLAY_CACHE; i++) {
+		if (puzzle_issue("192.0.2.1", 1, cookie) != 0 || puzzle_solve(cookie, sizeof(cookie), nonce) != 0) {
+			check(0, "puzzle issued and solved");
+			return;
+		}
+		if (i == 0) {
+			memcpy(first, cookie, sizeof(first));
+			memcpy(first_nonce, nonce, sizeof(first_nonce));
+		}
+		if (puzzle_verify("192.0.2.1", cookie, sizeof(cookie), nonce) == 0) redeemed++;
+		if (i == 0) {
+			check(puzzle_verify("192.0.2.1", first, sizeof(first), first_nonce) != 0, "solution replayed at once");
+		}
+	}
+	check(redeemed == PUZZLE_REPLAY_CACHE, "solutions redeemed up to the replay cache, the one past it refused");
+	check(puzzle_verify("192.0.2.1", first, sizeof(first), first_nonce) != 0,
+		  "solution replayed after the replay cache filled");
+	check(puzzle_verify("192.0.2.2", cookie, sizeof(cookie), nonce) != 0, "solution from another address");
+}
+
+static void check_ticket_replay() {
+	unsigned char psk[TICKET_PSK_SIZE] = { 1 }, opened[TICKET_PSK_SIZE];
+	unsigned char ticket[TICKET_MAX_SIZE];
+	size_t ticket_len;
+	ticket_stats_t before, after;
+	time_t expires;
+	int kem;
+
+	ticket_get_stats(&before);
+	if (ticket_issue(psk, 0, time(NULL) + 60, ticket, &ticket_len) != 0) {
+		check(0, "ticket issued");
+		return;
+	}
+	check(ticket_open(ticket, ticket_len, opened, &kem, &expires) == 0 && memcmp(opened, psk, sizeof(psk)) == 0,
+		  "ticket redeemed");
+	check(ticket_open(ticket, ticket_len, opened, &kem, &expires) != 0, "ticket replayed");
+	ticket_get_stats(&after);
+	check(after.accepted - before.accepted == 1 && after.replayed - before.replayed == 1, "ticket replay counted");
+}
+
+int main() {
+	setenv("PQC_HANDSHAKE_TIMEOUT", CHECK_TIMEOUT, 1);
+	pqcrypto_initialize();
+	if (keypool_start(KEYPOOL_CAPACITY) != 0) return EXIT_FAILURE;
+
+	listen_sock = bind_and_listen(0);
+	if (listen_sock < 0) return EXIT_FAILURE;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	getsockname(listen_sock, (struct sockaddr *)&addr, &addr_len);
+	port = ntohs(addr.sin_port);
+
+	pthread_t thread;
+	if (admission_start(CHECK_WORKERS, accept_quietly, "bob", end_session) != 0 ||
+		pthread_create(&thread, NULL, listener, NULL) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("Running handshake defence checks, error messages from refused cases are expected\n");
+	check_idle_connections();
+	check_puzzle_replay();
+	check_ticket_replay();
+
+	shutdown(listen_sock, SHUT_RDWR);
+	close(listen_sock);
+	pthread_join(thread, NULL);
+	admission_stop();
+	keypool_stop();
+	pqcrypto_cleanup();
+
+	printf("%d of %d checks passed\n", checks - failures, checks);
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,145 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Per-algorithm cost of every KEM the handshake can negotiate, measured on this machine, and what
+// each selection policy would pick from it. With a path argument the costs are also written as a
+// table the client loads at startup (see KEM_COSTS_FILE in kem.h):
+//
+//   ./kem_bench kem_costs.conf
+
+#include "pq_encryption.h"
+#include "kem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_ITERATIONS 20
+#define MIN_SECONDS 0.2
+
+typedef struct {
+	double keygen_us, encaps_us, decaps_us;
+} timing_t;
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Full handshakes until both MIN_ITERATIONS and MIN_SECONDS are reached, each step timed apart
+static int measure(const OQS_KEM *kem, timing_t *t) {
+	unsigned char *public_key = malloc(kem->length_public_key);
+	unsigned char *secret_key = malloc(kem->length_secret_key);
+	unsigned char *ciphertext = malloc(kem->length_ciphertext);
+	unsigned char *secret_a = malloc(kem->length_shared_secret);
+	unsigned char *secret_b = malloc(kem->length_shared_secret);
+	double keygen = 0, encaps = 0, decaps = 0;
+	int n, rc = -1;
+
+	if (!public_key || !secret_key || !ciphertext || !secret_a || !secret_b) {
+		perror("malloc");
+		goto out;
+	}
+
+	for (n = 0; n < MIN_ITERATIONS || keygen + encaps + decaps < MIN_SECONDS; n++) {
+		struct timespec t0, t1, t2, t3;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		OQS_STATUS s1 = OQS_KEM_keypair(kem, public_key, secret_key);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		OQS_STATUS s2 = OQS_KEM_encaps(kem, ciphertext, secret_a, public_key);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		OQS_STATUS s3 = OQS_KEM_decaps(kem, secret_b, ciphertext, secret_key);
+		clock_gettime(CLOCK_MONOTONIC, &t3);
+
+		if (s1 != OQS_SUCCESS || s2 != OQS_SUCCESS || s3 != OQS_SUCCESS ||
+			memcmp(secret_a, secret_b, kem->length_shared_secret) != 0) {
+			fprintf(stderr, "%s handshake failed\n", kem->method_name);
+			goto out;
+		}
+		keygen += elapsed_sec(t0, t1);
+		encaps += elapsed_sec(t1, t2);
+		decaps += elapsed_sec(t2, t3);
+	}
+
+	t->keygen_us = keygen * 1e6 / n;
+	t->encaps_us = encaps * 1e6 / n;
+	t->decaps_us = decaps * 1e6 / n;
+	rc = 0;
+
+out:
+	free(public_key);
+	free(secret_key);
+	free(ciphertext);
+	free(secret_a);
+	free(secret_b);
+	return rc;
+}
+
+int main(int argc, char **argv) {
+	timing_t timings[kem_count()];
+	int measured[kem_count()];
+	FILE *table = NULL;
+
+	pqcrypto_initialize();
+
+	printf("%-12s %5s %7s %7s %8s %10s %10s %10s %10s\n", "kem", "level", "pk", "ct", "wire",
+		   "keygen us", "encaps us", "decaps us", "total us");
+	for (int i = 0; i < kem_count(); i++) {
+		const OQS_KEM *kem = kem_handle(i);
+		measured[i] = 0;
+		if (kem == NULL) {
+			printf("%-12s not enabled in this liboqs\n", kem_name(i));
+			continue;
+		}
+		if (measure(kem, &timings[i]) != 0) {
+			pqcrypto_cleanup();
+			return EXIT_FAILURE;
+		}
+		measured[i] = 1;
+		printf("%-12s %5d %7zu %7zu %8zu %10.1f %10.1f %10.1f %10.1f\n", kem_name(i),
+			   kem->claimed_nist_level, kem->length_public_key, kem->length_ciphertext,
+			   kem->length_public_key + kem->length_ciphertext, timings[i].keygen_us,
+			   timings[i].encaps_us, timings[i].decaps_us,
+			   timings[i].keygen_us + timings[i].encaps_us + timings[i].decaps_us);
+	}
+
+	if (argc > 1) {
+		table = fopen(argv[1], "w");
+		if (table == NULL) {
+			perror("fopen");
+			pqcrypto_cleanup();
+			return EXIT_FAILURE;
+		}
+		fprintf(table, "# KEM costs measured by kem_bench: name keygen_us encaps_us decaps_us\n");
+		for (int i = 0; i < kem_count(); i++) {
+			if (!measured[i]) continue;
+			fprintf(table, "%s %.1f %.1f %.1f\n", kem_name(i), timings[i].keygen_us,
+					timings[i].encaps_us, timings[i].decaps_us);
+		}
+		fclose(table);
+		printf("\nCost table written to %s\n", argv[1]);
+		if (kem_load_costs(argv[1]) <= 0) {
+			fprintf(stderr, "Failed to read the cost table back\n");
+			pqcrypto_cleanup();
+			return EXIT_FAILURE;
+		}
+	}
+
+	// What each policy picks with these costs, and that a peer running the same policy agrees
+	printf("\n%-10s %-12s %s\n", "policy", "preferred", "offer");
+	for (int p = KEM_POLICY_FASTEST; p <= KEM_POLICY_STRONGEST; p++) {
+		char offer[KEM_OFFER_SIZE];
+		kem_set_policy(p);
+		kem_offer(offer, sizeof(offer));
+		int preferred = kem_preferred();
+		if (kem_select(offer) != preferred) {
+			fprintf(stderr, "Selection disagrees with the %s offer\n", kem_policy_name(p));
+			pqcrypto_cleanup();
+			return EXIT_FAILURE;
+		}
+		printf("%-10s %-12s %s\n", kem_policy_name(p), kem_name(preferred), offer);
+	}
+
+	pqcrypto_cleanup();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Loopback throughput of the user-space AES-GCM record path against kernel TLS offload,
+// with and without sendfile() from disk.
+
+#include "network.h"
+#include "frame_reader.h"
+#include "pq_encryption.h"
+#include "ktls.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <openssl/rand.h>
+
+#define BENCH_PORT 7612
+#define RECORD_SIZE (16 * 1024)
+#define TOTAL_BYTES (512UL * 1024 * 1024)
+#define BENCH_FILE "ktls_bench.tmp"
+
+enum mode { MODE_USERSPACE, MODE_KTLS, MODE_KTLS_SENDFILE };
+static const char *mode_names[] = { "user-space AES-GCM", "kTLS write", "kTLS sendfile" };
+
+struct receiver_args {
+	int sock;
+	encryption_context_t *enc_ctx;
+	enum mode mode;
+	int ktls;
+	size_t bytes;
+	int rc;
+};
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void *receiver(void *arg) {
+	struct receiver_args *ra = arg;
+	frame_reader_t reader;
+	unsigned char *frame;
+	size_t frame_len, plaintext_len;
+	int rc;
+
+	ra->rc = -1;
+	if (ra->mode != MODE_USERSPACE) {
+		// Only the sender's records are timed, so what comes back in this direction doesn't matter
+		if (ktls_negotiate(ra->sock, ra->enc_ctx, 0) < 0) return NULL;
+		ra->ktls = ktls_start_receiving(ra->sock, ra->enc_ctx, 0);
+		if (ra->ktls != 1) return NULL;
+	}
+	if (frame_reader_init(&reader, ra->sock, MAX_FRAME_SIZE) != 0) return NULL;
+
+	while ((rc = frame_reader_next(&reader, &frame, &frame_len)) > 0) {
+		plaintext_len = frame_len;
+		if (ra->mode == MODE_USERSPACE &&
+			pqcrypto_decrypt(ra->enc_ctx, frame, frame_len, frame + PQCRYPTO_SEQ_SIZE, &plaintext_len) != 0) {
+			break;
+		}
+		ra->bytes += plaintext_len;
+	}
+	frame_reader_free(&reader);
+	ra->rc = rc;
+	return NULL;
+}
+
+// Send a frame whose header is in memory and whose body the kernel reads straight from the file
+static int sendfile_frame(int sock, const void *header, size_t header_len, int fd, off_t offset, size_t len) {
+	// MSG_MORE keeps the header in the same TLS record as the start of the body
+	const char *bytes = header;
+	while (header_len > 0) {
+		ssize_t sent = send(sock, bytes, header_len, MSG_MORE | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		bytes += sent;
+		header_len -= sent;
+	}
+
+	while (len > 0) {
+		ssize_t sent = sendfile(sock, fd, &offset, len);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (sent == 0) {
+			fprintf(stderr, "File shrank during transfer\n");
+			return -1;
+		}
+		len -= sent;
+	}
+	return 0;
+}
+
+static int send_all(int sock, enum mode mode, encryption_context_t *enc_ctx, int file_fd) {
+	unsigned char *record = malloc(RECORD_SIZE);
+	unsigned char *ciphertext = malloc(RECORD_SIZE + PQCRYPTO_RECORD_OVERHEAD);
+	size_t ciphertext_len;
+	int rc = 0;
+
+	memset(record, 'A', RECORD_SIZE);
+	for (size_t sent = 0; sent < TOTAL_BYTES && rc == 0; sent += RECORD_SIZE) {
+		if (mode == MODE_USERSPACE) {
+			rc = pqcrypto_encrypt(enc_ctx, record, RECORD_SIZE, ciphertext, &ciphertext_len);
+			if (rc == 0) rc = write_frame(sock, ciphertext, ciphertext_len);
+		} else if (mode == MODE_KTLS) {
+			rc = write_frame(sock, record, RECORD_SIZE);
+		} else {
+			uint32_t net_len = htonl(RECORD_SIZE);
+			rc = sendfile_frame(sock, &net_len, sizeof(net_len), file_fd, sent, RECORD_SIZE);
+		}
+	}
+
+	free(record);
+	free(ciphertext);
+	return rc;
+}
+
+static int run(enum mode mode, int file_fd) {
+	// Sender and receiver are the two ends of one session
+	encryption_context_t enc_ctx, peer_ctx;
+	RAND_bytes(enc_ctx.aes_key, AES_KEY_SIZE);
+	memcpy(peer_ctx.aes_key, enc_ctx.aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(&enc_ctx, PQCRYPTO_AES_256_GCM, 1) != 0 ||
+		pqcrypto_context_init(&peer_ctx, PQCRYPTO_AES_256_GCM, 0) != 0) {
+		return -1;
+	}
+
+	int listen_sock = bind_and_listen(BENCH_PORT);
+	if (listen_sock < 0) return -1;
+	int tx = connect_to_peer("127.0.0.1", BENCH_PORT);
+	int rx = accept(listen_sock, NULL, NULL);
+	close(listen_sock);
+	if (tx < 0 || rx < 0) {
+		fprintf(stderr, "Loopback connection failed\n");
+		return -1;
+	}
+	set_socket_mode(tx, SOCKET_MODE_BULK);
+
+	struct receiver_args ra = { rx, &peer_ctx, mode, 0, 0, 0 };
+	pthread_t thread;
+	pthread_create(&thread, NULL, receiver, &ra);
+
+	if (mode != MODE_USERSPACE && ktls_negotiate(tx, &enc_ctx, 1) != 1) {
+		// The receiver waits for the first record to see how it was sealed
+		shutdown(tx, SHUT_WR);
+		pthread_join(thread, NULL);
+		close(tx);
+		close(rx);
+		pqcrypto_context_free(&enc_ctx);
+		pqcrypto_context_free(&peer_ctx);
+		printf("%-20s unavailable on this kernel, user-space path would be used\n", mode_names[mode]);
+		return 0;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int rc = send_all(tx, mode, &enc_ctx, file_fd);
+	shutdown(tx, SHUT_WR);
+	pthread_join(thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(tx);
+	close(rx);
+	pqcrypto_context_free(&enc_ctx);
+	pqcrypto_context_free(&peer_ctx);
+
+	if (rc != 0 || ra.rc != 0 || ra.bytes != TOTAL_BYTES) {
+		fprintf(stderr, "%s run failed after %zu bytes\n", mode_names[mode], ra.bytes);
+		return -1;
+	}
+
+	double secs = elapsed_sec(start, end);
+	printf("%-20s %8.2f MB/s\n", mode_names[mode], TOTAL_BYTES / secs / 1e6);
+	return 0;
+}
+
+int main() {
+	pqcrypto_initialize();
+
+	// Source file for the sendfile run
+	int file_fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (file_fd < 0 || ftruncate(file_fd, TOTAL_BYTES) != 0) {
+		perror(BENCH_FILE);
+		return EXIT_FAILURE;
+	}
+	unlink(BENCH_FILE);
+
+	printf("%zu MB over loopback in %d byte records\n", TOTAL_BYTES >> 20, RECORD_SIZE);
+	int rc = 0;
+	for (int mode = MODE_USERSPACE; mode <= MODE_KTLS_SENDFILE && rc == 0; mode++) {
+		rc = run(mode, file_fd);
+	}
+
+	close(file_fd);
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
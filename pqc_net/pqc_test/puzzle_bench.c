@@ -0,0 +1,200 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Handshake latency of a legitimate dialer while other connections flood the acceptor with
+// connection requests, each costing it an encapsulation. Runs without a flood, under the flood with
+// puzzles off, and under the flood with puzzles handed out from PUZZLE_THRESHOLD queued handshakes.
+// The flooders never solve a puzzle, they drop the connection and come back.
+
+#include "admission.h"
+#include "keypool.h"
+#include "network.h"
+#include "puzzle.h"
+#include "secure_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define BENCH_DIALS 50
+#define FLOOD_THREADS 16
+#define BENCH_WORKERS 2
+
+static int listen_sock, port;
+static volatile int flooding;
+static unsigned char *flood_request;
+static size_t flood_request_len;
+
+static double elapsed_us(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int accept_quietly(const handshake_request_t *request) {
+	(void)request;
+	return 1;
+}
+
+static void *end_session(void *arg) {
+	struct chat_info *chat = arg;
+	pqcrypto_context_free(&chat->enc_ctx);
+	close(chat->sock);
+	free(chat);
+	return NULL;
+}
+
+static void *listener(void *arg) {
+	(void)arg;
+	while (1) {
+		int sock = accept(listen_sock, NULL, NULL);
+		if (sock < 0) break;
+		admission_submit(sock);
+	}
+	return NULL;
+}
+
+// A connection request with a fixed key share: free for the flooder, an encapsulation for us
+static int build_flood_request() {
+	char header[BUFFER_SIZE], ciphers[PQCRYPTO_CIPHER_OFFER_SIZE], kems[KEM_OFFER_SIZE];
+	unsigned char *public_key, *secret_key;
+	size_t public_key_len, secret_key_len;
+	int kem = kem_preferred();
+
+	if (pqcrypto_generate_keypair(kem, &public_key, &public_key_len, &secret_key, &secret_key_len) != 0) {
+		return -1;
+	}
+	pqcrypto_cipher_offer(ciphers, sizeof(ciphers));
+	kem_offer(kems, sizeof(kems));
+	snprintf(header, sizeof(header), "CONNECT_REQUEST mallory %s %s 0 %s\n", ciphers, kems, kem_name(kem));
+
+	flood_request_len = strlen(header) + public_key_len;
+	flood_request = malloc(flood_request_len);
+	if (flood_request == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	memcpy(flood_request, header, strlen(header));
+	memcpy(flood_request + strlen(header), public_key, public_key_len);
+	secure_free(secret_key, secret_key_len);
+	free(public_key);
+	return 0;
+}
+
+static void *flooder(void *arg) {
+	(void)arg;
+	while (flooding) {
+		int sock = connect_to_peer("127.0.0.1", port);
+		if (sock < 0) continue;
+		unsigned char *reply = NULL;
+		uint32_t reply_len;
+		if (write_frame(sock, flood_request, flood_request_len) == 0) {
+			read_frame(sock, &reply, &reply_len, HANDSHAKE_MAX_MESSAGE);
+		}
+		free(reply);
+		close(sock);
+	}
+	return NULL;
+}
+
+static int run(const char *name, int flood, int threshold) {
+	double latency[BENCH_DIALS];
+	int done = 0;
+	pthread_t threads[FLOOD_THREADS];
+	admission_stats_t before, after;
+	puzzle_stats_t puzzles_before, puzzles_after;
+
+	puzzle_set_threshold(threshold);
+	admission_get_stats(&before);
+	puzzle_get_stats(&puzzles_before);
+	flooding = flood;
+	for (int i = 0; flood && i < FLOOD_THREADS; i++) {
+		pthread_create(&threads[i], NULL, flooder, NULL);
+	}
+	usleep(flood ? 200000 : 0); // let the queue fill
+
+	struct timespec run_start, run_end;
+	clock_gettime(CLOCK_MONOTONIC, &run_start);
+	for (int i = 0; i < BENCH_DIALS; i++) {
+		struct chat_info chat;
+		struct timespec start, end;
+
+		memset(&chat, 0, sizeof(chat));
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		int sock = connect_to_peer("127.0.0.1", port);
+		int rc = sock < 0 ? -1 : handshake_dial(sock, "alice", NULL, &chat);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (rc == 0) {
+			latency[done++] = elapsed_us(start, end);
+			pqcrypto_context_free(&chat.enc_ctx);
+		}
+		if (sock >= 0) close(sock);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &run_end);
+
+	flooding = 0;
+	for (int i = 0; flood && i < FLOOD_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	admission_get_stats(&after);
+	puzzle_get_stats(&puzzles_after);
+
+	double secs = elapsed_us(run_start, run_end) / 1e6;
+	qsort(latency, done, sizeof(double), compare_double);
+	printf("%-16s %4d/%-4d %10.2f %10.2f %10.2f %14.0f %10lu %10lu\n", name, done, BENCH_DIALS,
+		   done > 0 ? latency[done / 2] / 1e3 : 0.0,
+		   done > 0 ? latency[done * 95 / 100] / 1e3 : 0.0,
+		   done > 0 ? latency[done - 1] / 1e3 : 0.0,
+		   (after.accepted - before.accepted - done) / secs,
+		   puzzles_after.issued - puzzles_before.issued,
+		   after.dropped - before.dropped);
+	return done > 0 ? 0 : -1;
+}
+
+int main() {
+	// Full handshakes every time, resumption would hide the KEM cost being measured
+	setenv("PQC_TICKET_LIFETIME", "0", 1);
+	// Every flood connection that gives up on a puzzle is an error line otherwise
+	freopen("/dev/null", "w", stderr);
+	pqcrypto_initialize();
+	if (keypool_start(KEYPOOL_CAPACITY) != 0 || build_flood_request() != 0) return EXIT_FAILURE;
+
+	listen_sock = bind_and_listen(0);
+	if (listen_sock < 0) return EXIT_FAILURE;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	getsockname(listen_sock, (struct sockaddr *)&addr, &addr_len);
+	port = ntohs(addr.sin_port);
+
+	pthread_t thread;
+	if (admission_start(BENCH_WORKERS, accept_quietly, "bob", end_session) != 0 ||
+		pthread_create(&thread, NULL, listener, NULL) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("%d dials, %d flooding threads, %d handshake workers, queue of %d\n",
+		   BENCH_DIALS, FLOOD_THREADS, BENCH_WORKERS, ADMISSION_QUEUE_SIZE);
+	printf("%-16s %9s %10s %10s %10s %14s %10s %10s\n", "run", "dials", "p50 ms", "p95 ms", "max ms",
+		   "flood KEMs/s", "puzzles", "refused");
+	int rc = run("idle", 0, 0) | run("flood", 1, 0) | run("flood+puzzles", 1, PUZZLE_THRESHOLD);
+
+	puzzle_stats_t puzzles;
+	puzzle_get_stats(&puzzles);
+	printf("legitimate dialer solved %lu puzzles in %.2f ms each\n", puzzles.solved, puzzles.solve_us / 1e3);
+
+	shutdown(listen_sock, SHUT_RDWR);
+	close(listen_sock);
+	pthread_join(thread, NULL);
+	admission_stop();
+	keypool_stop();
+	free(flood_request);
+	pqcrypto_cleanup();
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,360 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Small-message cost of pqcrypto_encrypt()/pqcrypto_decrypt() with a pre-keyed session against
+// the previous per-call path, which built and keyed a fresh EVP_CIPHER_CTX for every message.
+// Also compares keypair generation with a cached OQS_KEM handle against OQS_KEM_new() per call,
+// and against taking a ready key pair from the background pool. Bulk records are sealed on up to
+// BULK_THREADS cores at once, and the symmetric ratchet is timed per step and under traffic.
+
+#include "pq_encryption.h"
+#include "keypool.h"
+#include "kem.h"
+#include "secure_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define MESSAGES 200000
+#define KEYPAIRS 2000
+#define KEYPOOL_SAMPLES 200
+#define BULK_RECORD (16 * 1024)
+#define BULK_SLOT (BULK_RECORD + PQCRYPTO_RECORD_OVERHEAD)
+#define BULK_RECORDS 16384
+#define BULK_THREADS 4
+#define REKEYS 10000
+#define REKEY_INTERVAL 1024
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// What every call used to do before sessions held keyed contexts
+static int per_call_encrypt(const encryption_context_t *enc_ctx,
+							const unsigned char *plaintext, size_t plaintext_len,
+							unsigned char *ciphertext, size_t *ciphertext_len) {
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int len, rc = -1;
+
+	if (ctx &&
+		1 == EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) &&
+		1 == EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AES_GCM_IV_SIZE, NULL) &&
+		1 == EVP_EncryptInit_ex(ctx, NULL, NULL, enc_ctx->send.key, enc_ctx->send.iv) &&
+		1 == EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len)) {
+		*ciphertext_len = len;
+		if (1 == EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) {
+			*ciphertext_len += len;
+			if (1 == EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AES_GCM_TAG_SIZE,
+										 ciphertext + *ciphertext_len)) {
+				*ciphertext_len += AES_GCM_TAG_SIZE;
+				rc = 0;
+			}
+		}
+	}
+	EVP_CIPHER_CTX_free(ctx);
+	return rc;
+}
+
+static int bench_messages(encryption_context_t *enc_ctx, encryption_context_t *peer_ctx, size_t size) {
+	unsigned char plaintext[1024], ciphertext[1024 + PQCRYPTO_RECORD_OVERHEAD], decrypted[1024];
+	size_t ciphertext_len, decrypted_len;
+	struct timespec start, end;
+	double per_call, session, session_roundtrip;
+
+	memset(plaintext, 'A', size);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MESSAGES; i++) {
+		if (per_call_encrypt(enc_ctx, plaintext, size, ciphertext, &ciphertext_len) != 0) return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	per_call = elapsed_sec(start, end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MESSAGES; i++) {
+		if (pqcrypto_encrypt(enc_ctx, plaintext, size, ciphertext, &ciphertext_len) != 0) return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	session = elapsed_sec(start, end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MESSAGES; i++) {
+		if (pqcrypto_encrypt(enc_ctx, plaintext, size, ciphertext, &ciphertext_len) != 0 ||
+			pqcrypto_decrypt(peer_ctx, ciphertext, ciphertext_len, decrypted, &decrypted_len) != 0) {
+			return -1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	session_roundtrip = elapsed_sec(start, end);
+
+	printf("%-6zu %12.0f %12.0f %8.2fx %12.0f\n", size,
+		   MESSAGES / per_call, MESSAGES / session, per_call / session, MESSAGES / session_roundtrip);
+	return 0;
+}
+
+struct sealer_args {
+	encryption_context_t *enc_ctx;
+	unsigned char *records;
+	size_t count;
+	int rc;
+};
+
+// Seal a batch of bulk records on a worker's own cipher context
+static void *sealer(void *arg) {
+	struct sealer_args *sa = arg;
+	unsigned char plaintext[BULK_RECORD];
+	size_t record_len;
+	pqcrypto_direction_t worker;
+
+	sa->rc = -1;
+	if (pqcrypto_worker_init(sa->enc_ctx, 0, &worker) != 0) return NULL;
+	memset(plaintext, 'B', sizeof(plaintext));
+
+	uint64_t seq = pqcrypto_reserve_seq(sa->enc_ctx, sa->count);
+	for (size_t i = 0; i < sa->count; i++) {
+		if (pqcrypto_encrypt_seq(&worker, seq + i, plaintext, sizeof(plaintext),
+								 sa->records + i * BULK_SLOT, &record_len) != 0) {
+			pqcrypto_worker_free(&worker);
+			return NULL;
+		}
+	}
+	pqcrypto_worker_free(&worker);
+	sa->rc = 0;
+	return NULL;
+}
+
+// Bulk records carry their own sequence numbers, so they can be sealed on several cores at once
+// and still open on the other side in whatever order they arrive
+static int bench_parallel(encryption_context_t *enc_ctx, encryption_context_t *peer_ctx) {
+	unsigned char *records = malloc((size_t)BULK_RECORDS * BULK_SLOT);
+	unsigned char plaintext[BULK_RECORD];
+	struct timespec start, end;
+	double single = 0;
+	int rc = -1;
+
+	if (records == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	// Warm up untimed so the first run isn't charged for page faults and cold caches
+	struct sealer_args warm_up = { enc_ctx, records, BULK_RECORDS, 0 };
+	sealer(&warm_up);
+
+	printf("\n%-8s %12s\n", "threads", "seal MB/s");
+	for (int threads = 1; threads <= BULK_THREADS; threads *= 2) {
+		pthread_t tids[BULK_THREADS];
+		struct sealer_args args[BULK_THREADS];
+		size_t per_thread = BULK_RECORDS / threads;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int t = 0; t < threads; t++) {
+			args[t] = (struct sealer_args){ enc_ctx, records + t * per_thread * BULK_SLOT, per_thread, 0 };
+			pthread_create(&tids[t], NULL, sealer, &args[t]);
+		}
+		for (int t = 0; t < threads; t++) {
+			pthread_join(tids[t], NULL);
+			if (args[t].rc != 0) goto out;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double secs = elapsed_sec(start, end);
+		if (threads == 1) single = secs;
+		printf("%-8d %12.2f %8.2fx\n", threads, (double)BULK_RECORDS * BULK_RECORD / secs / 1e6,
+			   single / secs);
+	}
+
+	// Open the last batch newest first, every record is still inside the replay window
+	for (int i = 0; i < PQCRYPTO_REPLAY_WINDOW; i++) {
+		size_t plaintext_len;
+		unsigned char *record = records + (size_t)(PQCRYPTO_REPLAY_WINDOW - 1 - i) * BULK_SLOT;
+		if (pqcrypto_decrypt(peer_ctx, record, BULK_RECORD + PQCRYPTO_RECORD_OVERHEAD,
+							 plaintext, &plaintext_len) != 0) {
+			goto out;
+		}
+	}
+	// A second copy of any of them must be refused
+	size_t plaintext_len;
+	if (pqcrypto_decrypt(peer_ctx, records, BULK_RECORD + PQCRYPTO_RECORD_OVERHEAD,
+						 plaintext, &plaintext_len) == 0) {
+		fprintf(stderr, "Replayed record was accepted\n");
+		goto out;
+	}
+	printf("%d records opened newest first, replayed record refused\n", PQCRYPTO_REPLAY_WINDOW);
+	rc = 0;
+
+out:
+	free(records);
+	return rc;
+}
+
+static int rekey_pair(encryption_context_t *a, encryption_context_t *b) {
+	RAND_bytes(a->aes_key, AES_KEY_SIZE);
+	memcpy(b->aes_key, a->aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(a, PQCRYPTO_AES_256_GCM, 1) != 0) return -1;
+	if (pqcrypto_context_init(b, PQCRYPTO_AES_256_GCM, 0) != 0) {
+		pqcrypto_context_free(a);
+		return -1;
+	}
+	return 0;
+}
+
+// Round trips of 1 KB records, with the pair's rekey limits as set
+static int rekey_traffic(encryption_context_t *a, encryption_context_t *b, double *rate) {
+	unsigned char plaintext[1024], ciphertext[1024 + PQCRYPTO_RECORD_OVERHEAD], decrypted[1024];
+	size_t ciphertext_len, decrypted_len;
+	struct timespec start, end;
+
+	memset(plaintext, 'R', sizeof(plaintext));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < MESSAGES; i++) {
+		if (pqcrypto_encrypt(a, plaintext, sizeof(plaintext), ciphertext, &ciphertext_len) != 0 ||
+			pqcrypto_decrypt(b, ciphertext, ciphertext_len, decrypted, &decrypted_len) != 0) {
+			return -1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*rate = MESSAGES / elapsed_sec(start, end);
+	return 0;
+}
+
+// Cost of one ratchet step, and what rekeying every REKEY_INTERVAL records does to a session
+static int bench_rekey() {
+	encryption_context_t a, b;
+	struct timespec start, end;
+	double fixed, ratcheting;
+
+	if (rekey_pair(&a, &b) != 0) return -1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < REKEYS; i++) {
+		if (pqcrypto_rekey(&a) != 0) return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double step = elapsed_sec(start, end);
+	pqcrypto_context_free(&a);
+	pqcrypto_context_free(&b);
+
+	if (rekey_pair(&a, &b) != 0) return -1;
+	int rc = rekey_traffic(&a, &b, &fixed);
+	pqcrypto_context_free(&a);
+	pqcrypto_context_free(&b);
+	if (rc != 0) return -1;
+
+	if (rekey_pair(&a, &b) != 0) return -1;
+	a.rekey_records = REKEY_INTERVAL;
+	rc = rekey_traffic(&a, &b, &ratcheting);
+	unsigned epochs = a.send.epoch;
+	int followed = b.recv.epoch == a.send.epoch;
+	pqcrypto_context_free(&a);
+	pqcrypto_context_free(&b);
+	if (rc != 0 || !followed) return -1;
+
+	printf("\nRekey: %.2f us per ratchet step\n", step * 1e6 / REKEYS);
+	printf("1 KB enc+dec/s: %.0f with one key, %.0f rekeying every %d records (%u epochs)\n",
+		   fixed, ratcheting, REKEY_INTERVAL, epochs);
+	return 0;
+}
+
+static int bench_keypairs() {
+	struct timespec start, end;
+	unsigned char *public_key, *secret_key;
+	size_t public_key_len, secret_key_len;
+	int kem_id = kem_preferred();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < KEYPAIRS; i++) {
+		OQS_KEM *kem = OQS_KEM_new(kem_name(kem_id));
+		if (kem == NULL) return -1;
+		public_key = malloc(kem->length_public_key);
+		secret_key = malloc(kem->length_secret_key);
+		OQS_STATUS rc = OQS_KEM_keypair(kem, public_key, secret_key);
+		free(public_key);
+		free(secret_key);
+		OQS_KEM_free(kem);
+		if (rc != OQS_SUCCESS) return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double per_call = elapsed_sec(start, end);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < KEYPAIRS; i++) {
+		if (pqcrypto_generate_keypair(kem_id, &public_key, &public_key_len, &secret_key, &secret_key_len) != 0) {
+			return -1;
+		}
+		free(public_key);
+		secure_free(secret_key, secret_key_len);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double cached = elapsed_sec(start, end);
+
+	printf("\n%s keypair generation: %.2f us with OQS_KEM_new per call, %.2f us with the cached handle\n",
+		   kem_name(kem_id), per_call * 1e6 / KEYPAIRS, cached * 1e6 / KEYPAIRS);
+
+	// A handshake takes one key pair from a warm pool, then the pool refills while the session runs
+	keypool_key_t key;
+	double taken = 0;
+	if (keypool_start(KEYPOOL_CAPACITY) != 0) return -1;
+	for (int i = 0; i < KEYPOOL_SAMPLES; i++) {
+		keypool_stats_t stats;
+		do {
+			usleep(1000);
+			keypool_get_stats(&stats);
+		} while (stats.ready < KEYPOOL_CAPACITY);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (keypool_take(kem_id, &key) != 0) return -1;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		taken += elapsed_sec(start, end);
+		keypool_release(&key);
+	}
+
+	keypool_stats_t stats;
+	keypool_get_stats(&stats);
+	printf("Keypair from the pool: %.0f ns per take (%lu hits, %lu misses, refill %.0f key pairs/s)\n",
+		   taken * 1e9 / KEYPOOL_SAMPLES, stats.hits, stats.misses, stats.refill_rate);
+	return 0;
+}
+
+int main() {
+	const size_t sizes[] = { 16, 64, 256, 1024 };
+	encryption_context_t enc_ctx, peer_ctx;
+
+	pqcrypto_initialize();
+	RAND_bytes(enc_ctx.aes_key, AES_KEY_SIZE);
+	memcpy(peer_ctx.aes_key, enc_ctx.aes_key, AES_KEY_SIZE);
+	if (pqcrypto_context_init(&enc_ctx, PQCRYPTO_AES_256_GCM, 1) != 0 ||
+		pqcrypto_context_init(&peer_ctx, PQCRYPTO_AES_256_GCM, 0) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("%-6s %12s %12s %9s %12s\n", "size", "per-call/s", "session/s", "speedup", "enc+dec/s");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench_messages(&enc_ctx, &peer_ctx, sizes[i]) != 0) {
+			fprintf(stderr, "Benchmark failed at %zu bytes\n", sizes[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bench_parallel(&enc_ctx, &peer_ctx) != 0) {
+		fprintf(stderr, "Parallel benchmark failed\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_rekey() != 0) {
+		fprintf(stderr, "Rekey benchmark failed\n");
+		return EXIT_FAILURE;
+	}
+	if (bench_keypairs() != 0) {
+		fprintf(stderr, "Keypair benchmark failed\n");
+		return EXIT_FAILURE;
+	}
+
+	pqcrypto_context_free(&enc_ctx);
+	pqcrypto_context_free(&peer_ctx);
+	pqcrypto_cleanup();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+//
+// Created by rokas on 19/10/2026.
+//
+
+// Seals and opens a multi-gigabyte payload through pipes with the streaming AEAD API and reports
+// throughput and peak memory, then checks that tampered and truncated streams are refused.
+
+#include "aead_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <openssl/rand.h>
+
+#define PAYLOAD_BYTES (2ULL * 1024 * 1024 * 1024)
+#define SOURCE_BLOCK (1024 * 1024)
+#define SMALL_PAYLOAD (3 * AEAD_STREAM_CHUNK_SIZE + 100)
+
+struct pump_args {
+	int fd;
+	const unsigned char *secret;
+	int rc;
+};
+
+static double elapsed_sec(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static long peak_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// Produce the payload without holding it anywhere
+static void *source(void *arg) {
+	struct pump_args *pa = arg;
+	unsigned char *block = malloc(SOURCE_BLOCK);
+	pa->rc = -1;
+	if (block != NULL) {
+		memset(block, 'S', SOURCE_BLOCK);
+		unsigned long long sent = 0;
+		while (sent < PAYLOAD_BYTES && write(pa->fd, block, SOURCE_BLOCK) == SOURCE_BLOCK) {
+			sent += SOURCE_BLOCK;
+		}
+		pa->rc = sent == PAYLOAD_BYTES ? 0 : -1;
+	}
+	free(block);
+	close(pa->fd);
+	return NULL;
+}
+
+static void *opener(void *arg) {
+	struct pump_args *pa = arg;
+	int sink = open("/dev/null", O_WRONLY);
+	pa->rc = aead_stream_open_fd(pa->secret, pa->fd, sink);
+	close(sink);
+	close(pa->fd);
+	return NULL;
+}
+
+static int bench_stream(const unsigned char *secret) {
+	int plain[2], sealed[2];
+	if (pipe(plain) != 0 || pipe(sealed) != 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	struct pump_args src = { plain[1], secret, 0 }, dst = { sealed[0], secret, 0 };
+	pthread_t src_thread, dst_thread;
+	long rss_before = peak_rss_kb();
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_create(&src_thread, NULL, source, &src);
+	pthread_create(&dst_thread, NULL, opener, &dst);
+	int rc = aead_stream_seal_fd(secret, plain[0], sealed[1]);
+	close(plain[0]);
+	close(sealed[1]);
+	pthread_join(src_thread, NULL);
+	pthread_join(dst_thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (rc != 0 || src.rc != 0 || dst.rc != 0) {
+		fprintf(stderr, "Stream run failed\n");
+		return -1;
+	}
+
+	double secs = elapsed_sec(start, end);
+	printf("%llu MB sealed and opened in %.2f s, %.2f MB/s, peak RSS grew by %ld KB\n",
+		   PAYLOAD_BYTES >> 20, secs, PAYLOAD_BYTES / secs / 1e6, peak_rss_kb() - rss_before);
+	return 0;
+}
+
+// Seal a small payload into a temporary file, damage it with damage() and try to open it again
+static int open_damaged(const unsigned char *secret, void (*damage)(int fd, off_t len)) {
+	unsigned char payload[SMALL_PAYLOAD];
+	FILE *in_file = tmpfile(), *sealed_file = tmpfile();
+	if (in_file == NULL || sealed_file == NULL) {
+		perror("tmpfile");
+		return -1;
+	}
+	int in = fileno(in_file), sealed = fileno(sealed_file);
+	int sink = open("/dev/null", O_WRONLY);
+
+	RAND_bytes(payload, sizeof(payload));
+	if (write(in, payload, sizeof(payload)) != sizeof(payload)) return -1;
+	lseek(in, 0, SEEK_SET);
+	if (aead_stream_seal_fd(secret, in, sealed) != 0) return -1;
+
+	off_t len = lseek(sealed, 0, SEEK_END);
+	if (damage != NULL) damage(sealed, len);
+	lseek(sealed, 0, SEEK_SET);
+	int rc = aead_stream_open_fd(secret, sealed, sink);
+
+	fclose(in_file);
+	fclose(sealed_file);
+	close(sink);
+	return rc;
+}
+
+static void flip_byte(int fd, off_t len) {
+	unsigned char c;
+	pread(fd, &c, 1, len / 2);
+	c ^= 0x01;
+	pwrite(fd, &c, 1, len / 2);
+}
+
+// Drop the final chunk, leaving a stream that ends cleanly on a chunk boundary
+static void drop_final_chunk(int fd, off_t len) {
+	ftruncate(fd, len - (SMALL_PAYLOAD % AEAD_STREAM_CHUNK_SIZE) - AEAD_STREAM_CHUNK_OVERHEAD);
+}
+
+int main() {
+	unsigned char secret[AES_KEY_SIZE];
+	RAND_bytes(secret, sizeof(secret));
+
+	if (bench_stream(secret) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("Checking damaged streams, two failures are expected:\n");
+	fflush(stdout);
+	if (open_damaged(secret, NULL) != 0 ||
+		open_damaged(secret, flip_byte) == 0 ||
+		open_damaged(secret, drop_final_chunk) == 0) {
+		fprintf(stderr, "Stream integrity check failed\n");
+		return EXIT_FAILURE;
+	}
+	printf("Intact stream opened, tampered and truncated streams refused\n");
+	return EXIT_SUCCESS;
+}
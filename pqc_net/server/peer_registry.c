@@ -11,12 +11,14 @@ struct Peer peer_list[MAX_PEERS];
 int peer_count = 0;
 pthread_mutex_t peer_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void add_peer(const char *username, const char *ip, int port) {
+void add_peer(const char *username, const char *ip, int port, const char *kem, const char *public_key) {
     pthread_mutex_lock(&peer_list_mutex);
     if (peer_count < MAX_PEERS) {
         strcpy(peer_list[peer_count].username, username);
         strcpy(peer_list[peer_count].ip, ip);
 		peer_list[peer_count].port = port;
+        snprintf(peer_list[peer_count].kem, sizeof(peer_list[peer_count].kem), "%s", kem);
+        snprintf(peer_list[peer_count].public_key, sizeof(peer_list[peer_count].public_key), "%s", public_key);
         peer_count++;
     }
     pthread_mutex_unlock(&peer_list_mutex);
@@ -35,6 +37,22 @@ void remove_peer(const char *username) {
     pthread_mutex_unlock(&peer_list_mutex);
 }
 
+int update_peer_key(const char *username, const char *kem, const char *public_key) {
+    int rc = -1;
+
+    pthread_mutex_lock(&peer_list_mutex);
+    for (int i = 0; i < peer_count; i++) {
+        if (strcmp(peer_list[i].username, username) == 0) {
+            snprintf(peer_list[i].kem, sizeof(peer_list[i].kem), "%s", kem);
+            snprintf(peer_list[i].public_key, sizeof(peer_list[i].public_key), "%s", public_key);
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&peer_list_mutex);
+    return rc;
+}
+
 int username_exists(const char *username) {
     pthread_mutex_lock(&peer_list_mutex);
     for (int i = 0; i < peer_count; i++) {
@@ -60,3 +78,18 @@ void get_peer_list(char *buffer, size_t size) {
     }
     pthread_mutex_unlock(&peer_list_mutex);
 }
+
+int resolve_peer(const char *username, struct Peer *peer) {
+    int rc = -1;
+
+    pthread_mutex_lock(&peer_list_mutex);
+    for (int i = 0; i < peer_count; i++) {
+        if (strcmp(peer_list[i].username, username) == 0) {
+            *peer = peer_list[i];
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&peer_list_mutex);
+    return rc;
+}
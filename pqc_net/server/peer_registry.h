@@ -7,6 +7,7 @@
 
 #include <pthread.h>
 #include <arpa/inet.h>
+#include "constants.h"
 
 #ifndef INET_ADDRSTRLEN
 #define INET_ADDRSTRLEN 16
@@ -18,15 +19,22 @@ struct Peer {
 	char username[50];
 	char ip[INET_ADDRSTRLEN];
 	int port;
+	char kem[32];                                  // KEM of the published key, empty if none
+	char public_key[2 * DIRECTORY_KEY_MAX + 1];    // hex, so dialers can encapsulate before connecting
 };
 
 extern struct Peer peer_list[MAX_PEERS];
 extern int peer_count;
 extern pthread_mutex_t peer_list_mutex;
 
-void add_peer(const char *username, const char *ip, int port);
+void add_peer(const char *username, const char *ip, int port, const char *kem, const char *public_key);
 void remove_peer(const char *username);
+// Replace a registered peer's published key, returns 0 or -1 if nobody has that username
+int update_peer_key(const char *username, const char *kem, const char *public_key);
 int username_exists(const char *username);
 void get_peer_list(char *buffer, size_t size);
 
+// Copy a registered peer's entry, returns 0 or -1 if nobody has that username
+int resolve_peer(const char *username, struct Peer *peer);
+
 #endif // PEER_REGISTRY_H
@@ -36,10 +36,11 @@ void *command_handler(void *arg) {
 				pthread_mutex_lock(&peer_list_mutex);
 				safe_print("Discoverable peers:\n");
 				for (int i = 0; i < peer_count; i++) {
-					safe_print("%s %s %d\n",
+					safe_print("%s %s %d %s\n",
 							   peer_list[i].username,
 							   peer_list[i].ip,
-							   peer_list[i].port);
+							   peer_list[i].port,
+							   peer_list[i].kem);
 				}
 				pthread_mutex_unlock(&peer_list_mutex);
 			} else {
@@ -75,10 +76,48 @@ void remove_client_socket(int client_sock) {
 	pthread_mutex_unlock(&client_mutex);
 }
 
+// Answer RESOLVE <username> with the peer's address and, if it published one, its KEM public key
+static void send_resolved(int client_sock, const char *request) {
+	char name[USERNAME_MAX_LENGTH];
+	char response[DIRECTORY_LINE_MAX];
+	struct Peer peer;
+
+	if (sscanf(request + 8, "%49s", name) != 1 || resolve_peer(name, &peer) != 0) {
+		snprintf(response, sizeof(response), "UNKNOWN_PEER\n");
+	} else if (peer.kem[0] != '\0') {
+		snprintf(response, sizeof(response), "RESOLVED %s %s %d %s %s\n", peer.username, peer.ip, peer.port,
+				 peer.kem, peer.public_key);
+	} else {
+		snprintf(response, sizeof(response), "RESOLVED %s %s %d\n", peer.username, peer.ip, peer.port);
+	}
+	write(client_sock, response, strlen(response));
+}
+
+// The KEM name and key that may follow the port in REGISTER, kem receives up to 31 characters. Both
+// are left empty unless the key is hex that fits.
+static void parse_published_key(const char *fields, char *kem, char *public_key, size_t key_size) {
+	int offset = 0;
+
+	kem[0] = '\0';
+	public_key[0] = '\0';
+	if (sscanf(fields, "%31s %n", kem, &offset) != 1 || offset == 0) {
+		kem[0] = '\0';
+		return;
+	}
+	size_t len = strcspn(fields + offset, " \r\n");
+	if (len == 0 || len % 2 != 0 || len >= key_size ||
+		strspn(fields + offset, "0123456789abcdefABCDEF") < len) {
+		kem[0] = '\0';
+		return;
+	}
+	memcpy(public_key, fields + offset, len);
+	public_key[len] = '\0';
+}
+
 void *handle_client(void *arg) {
 	int client_sock = *(int *)arg;
 	free(arg);
-	char buffer[BUFFER_SIZE];
+	char buffer[DIRECTORY_LINE_MAX]; // REGISTER may carry a hex public key
 	ssize_t bytes_read;
 
 	struct sockaddr_in client_addr;
@@ -100,19 +139,23 @@ void *handle_client(void *arg) {
 	// Registration loop
 	while (!registered) {
 		// Read initial request from client
-		bytes_read = read(client_sock, buffer, sizeof(buffer) - 1);
+		bytes_read = read_line(client_sock, buffer, sizeof(buffer));
 		if (bytes_read <= 0) {
 			safe_print("\n[%s] disconnected during registration.\n", client_ip);
 			remove_client_socket(client_sock);
 			close(client_sock);
 			pthread_exit(NULL);
 		}
-		buffer[bytes_read] = '\0';
 
-		if (strncmp(buffer, "REGISTER", 8) == 0) {
-			// Client wants to become discoverable
-			int peer_port;
-			sscanf(buffer + 9, "%s %d", username, &peer_port);
+		if (strncmp(buffer, "RESOLVE ", 8) == 0) {
+			// Dialers look up a peer's key before connecting, they don't have to register
+			send_resolved(client_sock, buffer);
+		} else if (strncmp(buffer, "REGISTER", 8) == 0) {
+			// Client wants to become discoverable, optionally publishing a KEM public key
+			int peer_port, offset = 0;
+			char kem[32], public_key[2 * DIRECTORY_KEY_MAX + 1];
+			sscanf(buffer + 9, "%49s %d%n", username, &peer_port, &offset);
+			parse_published_key(offset > 0 ? buffer + 9 + offset : "", kem, public_key, sizeof(public_key));
 
 			if (username_exists(username)) {
 				// Username is taken
@@ -121,9 +164,9 @@ void *handle_client(void *arg) {
 				safe_print("\n[%s] attempted to register with taken username '%s'.\n", client_ip, username);
 			} else {
 				// Username is available
-				add_peer(username, client_ip, peer_port);
+				add_peer(username, client_ip, peer_port, kem, public_key);
 
-				safe_print("[%s] [%s] registered.\n", client_ip, username);
+				safe_print("[%s] [%s] registered%s%s.\n", client_ip, username, kem[0] ? " with a key for " : "", kem);
 
 				// Send list of discoverable peers to client
 				pthread_mutex_lock(&peer_list_mutex);
@@ -165,11 +208,25 @@ void *handle_client(void *arg) {
 		}
 	}
 
-	// Main loop to handle further client requests
-	while ((bytes_read = read(client_sock, buffer, sizeof(buffer) - 1)) > 0) {
-		buffer[bytes_read] = '\0';
-
-		if (strncmp(buffer, "GET_PEER_LIST", 13) == 0) {
+	// Main loop to handle further client requests, a whole line at a time as a REGISTER with a key spans segments
+	while ((bytes_read = read_line(client_sock, buffer, sizeof(buffer))) > 0) {
+		if (strncmp(buffer, "RESOLVE ", 8) == 0) {
+			send_resolved(client_sock, buffer);
+		} else if (strncmp(buffer, "REGISTER", 8) == 0) {
+			// Registering again publishes a rotated key, and lists the client again if a dialer reported it gone
+			int peer_port, offset = 0;
+			char again[USERNAME_MAX_LENGTH], kem[32], public_key[2 * DIRECTORY_KEY_MAX + 1];
+			if (sscanf(buffer + 9, "%49s %d%n", again, &peer_port, &offset) != 2 || strcmp(again, username) != 0) {
+				char response[] = "INVALID_COMMAND\n";
+				write(client_sock, response, strlen(response));
+				continue;
+			}
+			parse_published_key(buffer + 9 + offset, kem, public_key, sizeof(public_key));
+			if (update_peer_key(username, kem, public_key) != 0) {
+				add_peer(username, client_ip, peer_port, kem, public_key);
+			}
+			safe_print("[%s] [%s] registered again%s%s.\n", client_ip, username, kem[0] ? " with a key for " : "", kem);
+		} else if (strncmp(buffer, "GET_PEER_LIST", 13) == 0) {
 			// Send the updated peer list to the client
 			pthread_mutex_lock(&peer_list_mutex);
 			char peer_list_str[BUFFER_SIZE];